@@ -12,6 +12,7 @@
 #include "../Share/StdUtils.hpp"
 #include "../Share/TimeUtils.hpp"
 #include "../Share/ModuleHelper.hpp"
+#include "../Share/CpuHelper.hpp"
 
 #include "../Includes/WTSDataDef.hpp"
 #include "../Includes/WTSContractInfo.hpp"
@@ -20,23 +21,32 @@
 #include "../Includes/WTSVersion.h"
 
 #include <boost/filesystem.hpp>
+#include <algorithm>
+#include <functional>
+#include <stddef.h>
 
 // By Wesley @ 2022.01.05
 #include "../Share/fmtlib.h"
+// 日志统一走异步管道，格式化在后台线程完成
 template<typename... Args>
-inline void write_log(IParserSpi* sink, WTSLogLevel ll, const char* format, const Args&... args)
+inline void write_log(QdpAsyncLogger& logger, WTSLogLevel ll, const char* format, const Args&... args)
 {
-    if (sink == NULL)
-        return;
-
-    static thread_local char buffer[512] = { 0 };
-    fmtutil::format_to(buffer, format, args...);
+    logger.log(QLC_GENERAL, ll, format, args...);
+}
 
-    sink->handleParserLog(ll, buffer);
+template<typename... Args>
+inline void write_log(QdpAsyncLogger& logger, QdpLogCategory cat, WTSLogLevel ll, const char* format, const Args&... args)
+{
+    logger.log(cat, ll, format, args...);
 }
 
+// 进程内所有QDP行情通道共用一份希腊值存储，多个解析器同时写由存储自己加锁
+static QdpGreeksStore g_greeksStore;
+
 extern "C"
 {
+    // 回放解析器把本文件一起编译，由它自己导出创建函数
+#ifndef QDP_REPLAY_PARSER
     EXPORT_FLAG IParserApi* createParser()
     {
         ParserQDP* parser = new ParserQDP();
@@ -51,22 +61,13 @@ extern "C"
             parser = NULL;
         }
     }
-};
+#endif
 
-uint32_t ParserQDP::strToTime(const char* strTime)
-{
-    std::string str;
-    const char *pos = strTime;
-    while(strlen(pos) > 0)
+    EXPORT_FLAG QdpGreeksStore* getGreeksStore()
     {
-        if(pos[0] != ':')
-        {
-            str.append(pos, 1);
-        }
-        pos++;
+        return &g_greeksStore;
     }
-    return strtoul(str.c_str(), NULL, 10);
-}
+};
 
 inline double ParserQDP::checkValid(double val)
 {
@@ -102,14 +103,71 @@ inline double ParserQDP::checkValid(double val)
 // }
 
 ParserQDP::ParserQDP()
-    : m_pUserAPI(NULL)
-    , m_iRequestID(0)
-    , m_uTradingDate(0)
+    : m_uTradingDate(0)
     , m_loginState(LS_NOTLOGIN)
+    , m_pUserAPI(NULL)
+    , m_uSubBatch(500)
+    , m_uSubInterval(0)
+    , m_iLastSubTime(0)
+    , m_bUniverse(false)
+    , m_bUniverseCache(true)
+    , m_bUniverseError(false)
+    , m_iRequestID(0)
     , m_sink(NULL)
     , m_pBaseDataMgr(NULL)
     , m_hInstQDP(NULL)
     , m_funcCreator(NULL)
+    , m_uSlotsPerCode(4)
+    , m_uTickCount(0)
+    , m_uTickAllocs(0)
+    , m_uLastAllocs(0)
+    , m_bStopped(false)
+    , m_bMultiCast(false)
+    , m_bMultiNoLogin(false)
+    , m_uMultiLevel(0)
+    , m_uMultiTradingDay(0)
+    , m_bUserFreedom(false)
+    , m_bShmMode(false)
+    , m_bShmNoLogin(false)
+    , m_iShmTopic(0)
+    , m_iShmCore(-1)
+    , m_uShmInterval(0)
+    , m_uShmTradingDay(0)
+    , m_uShmVersion(0)
+    , m_uShmPolled(0)
+    , m_bShmRunning(false)
+    , m_bMBLBook(false)
+    , m_bMBLPublish(false)
+    , m_bOrderQueue(false)
+    , m_bGreeks(false)
+    , m_uStateGate(SG_OFF)
+    , m_uGatedTicks(0)
+    , m_uStateChanges(0)
+    , m_bSeqCheck(false)
+    , m_bSeqRefill(false)
+    , m_bSeqGaps(false)
+    , m_uRefillBatch(20)
+    , m_uRefillCooldown(5)
+    , m_bWarmStart(false)
+    , m_uWarmBatch(100)
+    , m_uWarmTotal(0)
+    , m_bArbByPacket(false)
+    , m_uArbReport(60)
+    , m_pFeedMutex(NULL)
+    , m_pPipeline(NULL)
+    , m_bPipeSpin(false)
+    , m_bPipeBlock(true)
+    , m_iPipeCore(-1)
+    , m_uPipeReport(60)
+    , m_uPipeDropped(0)
+    , m_uPipeStalls(0)
+    , m_bPipeRunning(false)
+    , m_pConflator(NULL)
+    , m_uConflateCnt(0)
+    , m_bJournal(false)
+    , m_uJournalFlush(1000)
+    , m_bLatency(false)
+    , m_bLatencyPerCode(false)
 {
 }
 
@@ -118,8 +176,14 @@ ParserQDP::~ParserQDP()
     release();
 }
 
-bool ParserQDP::init(WTSVariant* config)
+bool ParserQDP::initOptions(WTSVariant* config)
 {
+    m_logger.configure(config->get("logctrl"));
+    m_logger.start([this](WTSLogLevel ll, const char* message) {
+        if (m_sink)
+            m_sink->handleParserLog(ll, message);
+    }, config->has("logqueue") ? config->getUInt32("logqueue") : QdpAsyncLogger::DEFAULT_QUEUE);
+
     m_strFrontAddr = config->getCString("front");
     m_strBroker = config->getCString("broker");
     m_strUserID = config->getCString("user");
@@ -131,6 +195,219 @@ bool ParserQDP::init(WTSVariant* config)
 
     m_strFlowDir = StrUtil::standardisePath(m_strFlowDir);
 
+    // 订阅分批，合约很多的时候可以配置每批数量和批次间隔
+    WTSVariant* cfgSub = config->get("subscribe");
+    if (cfgSub != NULL)
+    {
+        if (cfgSub->has("batch"))
+            m_uSubBatch = std::max(cfgSub->getUInt32("batch"), (uint32_t)1);
+        m_uSubInterval = cfgSub->getUInt32("interval");
+    }
+
+    // 组播行情配置
+    WTSVariant* cfgMulti = config->get("multicast");
+    if (cfgMulti != NULL && cfgMulti->getBoolean("active"))
+    {
+        m_bMultiCast = true;
+        m_bMultiNoLogin = cfgMulti->getBoolean("nologin");
+        m_uMultiLevel = cfgMulti->getUInt32("level");
+        m_uMultiTradingDay = cfgMulti->getUInt32("tradingday");
+
+        WTSVariant* cfgAddrs = cfgMulti->get("addrs");
+        if (cfgAddrs != NULL && cfgAddrs->isArray())
+        {
+            for (uint32_t i = 0; i < cfgAddrs->size(); i++)
+                m_ayMultiAddrs.emplace_back(cfgAddrs->get(i)->asCString());
+        }
+
+        // 配置了报文布局才自己解析原始报文，布局不完整的话仍然交给API解析
+        WTSVariant* cfgRaw = cfgMulti->get("rawdecode");
+        if (cfgRaw != NULL)
+        {
+            m_bUserFreedom = m_multiDecoder.init(cfgRaw);
+            if (!m_bUserFreedom)
+                write_log(m_logger, LL_ERROR, "[ParserQDP] Invalid raw multicast layout: {}, falling back to API decoding", m_multiDecoder.lastError());
+        }
+    }
+
+    // 共享内存行情配置，和行情网关部署在同一台机器上时使用
+    WTSVariant* cfgShm = config->get("shm");
+    if (cfgShm != NULL && cfgShm->getBoolean("active"))
+    {
+        m_bShmMode = true;
+        m_bShmNoLogin = cfgShm->getBoolean("nologin");
+        m_strShmIP = cfgShm->getCString("ip");
+        m_iShmTopic = cfgShm->getInt32("topic");
+        m_iShmCore = cfgShm->has("core") ? cfgShm->getInt32("core") : -1;
+        m_uShmInterval = cfgShm->getUInt32("interval");
+        m_uShmTradingDay = cfgShm->getUInt32("tradingday");
+
+        // 轮询线程和API回调线程都会处理行情
+        m_pFeedMutex = &m_mtxFeed;
+    }
+
+    // 分价行情合成盘口，publish为true时每个报文结束把有变化的盘口推给下游
+    WTSVariant* cfgMBL = config->get("mbl");
+    if (cfgMBL != NULL && cfgMBL->getBoolean("active"))
+    {
+        m_bMBLBook = true;
+        m_bMBLPublish = cfgMBL->getBoolean("publish");
+    }
+
+    // 最优价委托队列，需要柜台推送十笔委托行情
+    m_bOrderQueue = config->getBoolean("orderqueue");
+
+    // 期权希腊值，chaincap是每条期权链最多容纳的合约数
+    WTSVariant* cfgGreeks = config->get("greeks");
+    if (cfgGreeks != NULL && cfgGreeks->getBoolean("active"))
+    {
+        m_bGreeks = true;
+        if (cfgGreeks->has("chaincap"))
+            g_greeksStore.setChainCapacity(cfgGreeks->getUInt32("chaincap"));
+    }
+
+    // 合约交易状态过滤，"stategate": "tag|drop"，不配置则不跟踪
+    const char* stateGate = config->getCString("stategate");
+    if (strcmp(stateGate, "tag") == 0)
+        m_uStateGate = SG_TAG;
+    else if (strcmp(stateGate, "drop") == 0)
+        m_uStateGate = SG_DROP;
+
+    // 包序号去重，refill为true时通道出现缺口会查询快照补齐
+    // 缺口按整个通道的PacketNo算，单播会话只收订阅的合约，通道序号本来就不连续，
+    // 所以缺口统计默认只在组播下打开，确认单播线路收的是全通道（全市场订阅）时用gaps打开
+    WTSVariant* cfgSeq = config->get("seqcheck");
+    if (cfgSeq != NULL && cfgSeq->getBoolean("active"))
+    {
+        m_bSeqCheck = true;
+        m_bSeqGaps = cfgSeq->has("gaps") ? cfgSeq->getBoolean("gaps") : m_bMultiCast;
+        m_bSeqRefill = cfgSeq->getBoolean("refill") && m_bSeqGaps;
+        if (cfgSeq->getBoolean("refill") && !m_bSeqGaps)
+            write_log(m_logger, LL_WARN, "[ParserQDP] Packet gaps not tracked on partial channels, refill disabled, set seqcheck.gaps to enable it");
+        if (cfgSeq->has("batch"))
+            m_uRefillBatch = std::max(cfgSeq->getUInt32("batch"), (uint32_t)1);
+        if (cfgSeq->has("cooldown"))
+            m_uRefillCooldown = cfgSeq->getUInt32("cooldown");
+    }
+
+    // 全市场订阅，"universe": {"active": true, "patterns": "SHFE.*,DCE.m*", "cache": true}
+    WTSVariant* cfgUniverse = config->get("universe");
+    if (cfgUniverse != NULL && cfgUniverse->getBoolean("active"))
+    {
+        m_bUniverse = m_universe.init(cfgUniverse->getCString("patterns"));
+        if (!m_bUniverse)
+            write_log(m_logger, LL_ERROR, "[ParserQDP] No valid universe pattern in {}", cfgUniverse->getCString("patterns"));
+        if (cfgUniverse->has("cache"))
+            m_bUniverseCache = cfgUniverse->getBoolean("cache");
+        m_strUniverseFile = StrUtil::printf("%s/%s/%s/universe.txt", m_strFlowDir.c_str(), m_strBroker.c_str(), m_strUserID.c_str());
+    }
+
+    // 登录后预热，按批查询已订阅合约的快照，查回来的tick带TF_SNAPSHOT标记
+    WTSVariant* cfgWarm = config->get("warmstart");
+    if (cfgWarm != NULL && cfgWarm->getBoolean("active"))
+    {
+        m_bWarmStart = true;
+        if (cfgWarm->has("batch"))
+            m_uWarmBatch = std::max(cfgWarm->getUInt32("batch"), (uint32_t)1);
+    }
+
+    // 流水线模式，下游处理慢的时候不会堵住API的接收线程
+    // "pipeline": {"active": true, "size": 65536, "core": 5, "policy": "spin|backoff", "full": "block|drop", "report": 60}
+    WTSVariant* cfgPipe = config->get("pipeline");
+    if (cfgPipe != NULL && cfgPipe->getBoolean("active") && m_pPipeline == NULL)
+    {
+        uint32_t uSize = cfgPipe->has("size") ? cfgPipe->getUInt32("size") : 65536;
+        m_pPipeline = new PipelineRing(uSize);
+        m_bPipeSpin = (strcmp(cfgPipe->getCString("policy"), "spin") == 0);
+        m_bPipeBlock = (strcmp(cfgPipe->getCString("full"), "drop") != 0);
+        m_iPipeCore = cfgPipe->has("core") ? cfgPipe->getInt32("core") : -1;
+        if (cfgPipe->has("report"))
+            m_uPipeReport = cfgPipe->getUInt32("report");
+
+        // "conflate": true时行情按合约合并，只推最新的一笔，委托队列仍走队列
+        if (cfgPipe->getBoolean("conflate"))
+        {
+            uint32_t uSlots = cfgPipe->has("slots") ? cfgPipe->getUInt32("slots") : 8192;
+            m_pConflator = new Conflator(std::max(uSlots, (uint32_t)64));
+            m_ayConflated.resize(m_pConflator->capacity(), NULL);
+        }
+    }
+
+    // 原始行情日志，"journal": {"active": true, "path": "./qdpjournal/", "size": 2048, "flush": 1000}，size单位MB
+    WTSVariant* cfgJournal = config->get("journal");
+    if (cfgJournal != NULL && cfgJournal->getBoolean("active"))
+    {
+        m_bJournal = true;
+        std::string folder = cfgJournal->getCString("path");
+        if (folder.empty())
+            folder = "./qdpjournal/";
+        uint64_t uSize = cfgJournal->has("size") ? cfgJournal->getUInt32("size") : 2048;
+        m_journal.init(folder, uSize << 20);
+        if (cfgJournal->has("flush"))
+            m_uJournalFlush = std::max(cfgJournal->getUInt32("flush"), (uint32_t)100);
+    }
+
+    // 行情链路延迟统计，"latency": {"active": true, "percontract": false, "export": "file|shm", "path": "./qdplatency/", "interval": 10, "capacity": 4096}
+    // interval单位秒，capacity是共享内存里能放的记录数
+    WTSVariant* cfgLatency = config->get("latency");
+    if (cfgLatency != NULL && cfgLatency->getBoolean("active"))
+    {
+        std::string folder = cfgLatency->getCString("path");
+        if (folder.empty())
+            folder = "./qdplatency/";
+        uint32_t uInterval = cfgLatency->has("interval") ? std::max(cfgLatency->getUInt32("interval"), (uint32_t)1) : 10;
+        if (!m_latency.init(cfgLatency->getCString("export"), folder, cfgLatency->getUInt32("capacity"), uInterval * 1000))
+            write_log(m_logger, LL_ERROR, "[ParserQDP] Failed to open latency export under {}", folder);
+
+        m_bLatency = true;
+        m_bLatencyPerCode = cfgLatency->getBoolean("percontract");
+    }
+
+    // 每个合约预留的tick槽位数，下游持有tick越久需要的槽位越多
+    if (config->has("tickslots"))
+        m_uSlotsPerCode = std::max(config->getUInt32("tickslots"), (uint32_t)1);
+
+    // 多线路仲裁，"arbitrate": {"key": "packet|time", "sharedseq": false, "report": 60}
+    // 回放带备用线路的日志时按同样的规则重新仲裁
+    WTSVariant* cfgArb = config->get("arbitrate");
+    if (cfgArb != NULL)
+    {
+        //各线路是独立的会话，PacketNo各自编号，不能互相比较；
+        //只有确认所有线路转发的是同一个行情源（sharedseq为true）时才按包序号仲裁
+        if (strcmp(cfgArb->getCString("key"), "packet") == 0)
+        {
+            m_bArbByPacket = cfgArb->getBoolean("sharedseq");
+            if (!m_bArbByPacket)
+                write_log(m_logger, LL_WARN, "[ParserQDP] Arbitrating by packet no requires sharedseq=true, falling back to time and volume");
+        }
+        if (cfgArb->has("report"))
+            m_uArbReport = cfgArb->getUInt32("report");
+    }
+
+    return true;
+}
+
+void ParserQDP::startWorkers()
+{
+    if (m_pPipeline)
+        startPipeline();
+
+    // 日历缓存先同步刷新一次，之后交给后台线程定时刷新
+    m_dateResolver.refresh();
+    if (m_thrdHouseKeeper == NULL)
+    {
+        m_bStopped = false;
+        m_thrdHouseKeeper.reset(new StdThread([this]() {
+            houseKeeping();
+        }));
+    }
+}
+
+bool ParserQDP::init(WTSVariant* config)
+{
+    if (!initOptions(config))
+        return false;
+
     // 加载QDP动态库
     std::string module = config->getCString("qdpmodule");
     if (module.empty())
@@ -142,7 +419,7 @@ bool ParserQDP::init(WTSVariant* config)
     if (m_hInstQDP == NULL)
     {
         if (m_sink)
-            write_log(m_sink, LL_ERROR, "[ParserQDP] Failed to load QDP library: {}", dllpath);
+            write_log(m_logger, LL_ERROR, "[ParserQDP] Failed to load QDP library: {}", dllpath);
         return false;
     }
 
@@ -161,7 +438,7 @@ bool ParserQDP::init(WTSVariant* config)
     if (m_funcCreator == NULL)
     {
         if (m_sink)
-            write_log(m_sink, LL_ERROR, "[ParserQDP] Failed to get creator function: {}", creatorName);
+            write_log(m_logger, LL_ERROR, "[ParserQDP] Failed to get creator function: {}", creatorName);
         return false;
     }
 
@@ -176,16 +453,66 @@ bool ParserQDP::init(WTSVariant* config)
     if (m_pUserAPI == NULL)
     {
         if (m_sink)
-            write_log(m_sink, LL_ERROR, "[ParserQDP] Failed to create QDP API instance");
+            write_log(m_logger, LL_ERROR, "[ParserQDP] Failed to create QDP API instance");
         return false;
     }
 
     // 注册回调接口
     m_pUserAPI->RegisterSpi(this);
-    m_pUserAPI->RegisterFront((char*)m_strFrontAddr.c_str());
+    if (!m_strFrontAddr.empty())
+        m_pUserAPI->RegisterFront((char*)m_strFrontAddr.c_str());
+
+    // 备用线路，每条线路独立的API实例，快照行情按合约仲裁，谁先到推谁
+    WTSVariant* cfgFeeds = config->get("feeds");
+    if (cfgFeeds != NULL && cfgFeeds->isArray() && cfgFeeds->size() > 0)
+    {
+        for (uint32_t i = 0; i < cfgFeeds->size(); i++)
+        {
+            //线路编号按建成功的顺序连续分配，仲裁统计直接按编号下标
+            QdpFeedSession* feed = new QdpFeedSession(this, (uint32_t)m_ayFeeds.size() + 1);
+            if (!feed->init(cfgFeeds->get(i), m_strFlowDir))
+            {
+                write_log(m_logger, LL_ERROR, "[ParserQDP] Failed to create QDP API instance of feed {}", feed->name());
+                delete feed;
+                continue;
+            }
+            m_ayFeeds.emplace_back(feed);
+        }
+
+        //一条备用线路都没建起来就不用仲裁
+        if (!m_ayFeeds.empty())
+        {
+            m_ayFeedStats.resize(m_ayFeeds.size() + 1);
+            memset(m_ayFeedStats.data(), 0, sizeof(FeedStat) * m_ayFeedStats.size());
+        }
+        m_pFeedMutex = &m_mtxFeed;
+        write_log(m_logger, LL_INFO, "[ParserQDP] {} backup feeds created, arbitrating by {}", m_ayFeeds.size(), m_bArbByPacket ? "packet no" : "time and volume");
+    }
+
+    if (m_bMultiCast)
+    {
+        // 组播地址格式: topic,multi://本地ip@组播地址:组播端口#组播发送源ip
+        m_pUserAPI->SetMultiCast(true);
+        for (const std::string& addr : m_ayMultiAddrs)
+        {
+            m_pUserAPI->RegTopicMultiAddr((char*)addr.c_str());
+            write_log(m_logger, LL_INFO, "[ParserQDP] Multicast address registered: {}", addr);
+        }
+
+        if (m_uMultiLevel > 0)
+            m_pUserAPI->SetMultiLevel(m_uMultiLevel);
+
+        if (m_bUserFreedom)
+        {
+            m_pUserAPI->SetUserFreedom(true);
+            write_log(m_logger, LL_INFO, "[ParserQDP] Raw multicast packets will be decoded by parser");
+        }
+    }
+
+    startWorkers();
 
     if (m_sink)
-        write_log(m_sink, LL_INFO, "[ParserQDP] QDP parser initialized successfully");
+        write_log(m_logger, LL_INFO, "[ParserQDP] QDP parser initialized successfully");
 
     return true;
 }
@@ -193,12 +520,90 @@ bool ParserQDP::init(WTSVariant* config)
 void ParserQDP::release()
 {
     disconnect();
+
+    m_bStopped = true;
+    if (m_thrdHouseKeeper)
+    {
+        m_thrdHouseKeeper->join();
+        m_thrdHouseKeeper.reset();
+    }
+
+    if (m_bUserFreedom)
+    {
+        write_log(m_logger, LL_INFO, "[ParserQDP] Raw multicast decoder: {} records decoded, {} records of unknown instruments, {} packets not matching the record size",
+            m_multiDecoder.records(), m_multiDecoder.unknown(), m_multiDecoder.truncated());
+    }
+
+    if (m_bSeqCheck)
+        reportSequence();
+
+    if (m_bJournal)
+    {
+        write_log(m_logger, LL_INFO, "[ParserQDP] Raw journal: {} records appended, {} of {} bytes used, {} records dropped",
+            m_journal.appended(), m_journal.used(), m_journal.capacity(), m_journal.dropped());
+        m_journal.close();
+    }
+
+    // 回调线程都停了，把队列里剩下的推完再停消费线程
+    if (m_pPipeline)
+    {
+        stopPipeline();
+        reportPipeline();
+        delete m_pPipeline;
+        m_pPipeline = NULL;
+        if (m_pConflator)
+        {
+            delete m_pConflator;
+            m_pConflator = NULL;
+        }
+    }
+
+    // 流水线推完以后再导出最后一段
+    if (m_bLatency)
+    {
+        m_latency.dump();
+        reportLatency();
+    }
+
+    if (!m_ayFeeds.empty())
+    {
+        reportFeeds();
+        for (QdpFeedSession* feed : m_ayFeeds)
+            delete feed;
+        m_ayFeeds.clear();
+    }
+
+    if (m_uStateGate != SG_OFF)
+    {
+        write_log(m_logger, LL_INFO, "[ParserQDP] {} trading state changes, {} ticks dropped by state gate",
+            m_uStateChanges, m_uGatedTicks);
+    }
+
+    if (!m_mapContracts.empty())
+    {
+        reportTickPool();
+        for (auto& item : m_mapContracts)
+        {
+            ContractEntry* entry = item.second;
+            for (WTSTickData* tick : entry->_slots)
+                tick->release();
+            for (WTSOrdQueData* ordQue : entry->_que_slots)
+                ordQue->release();
+            if (entry->_book)
+                delete entry->_book;
+            delete entry;
+        }
+        m_mapContracts.clear();
+        m_ayContracts.clear();
+    }
     
     if (m_hInstQDP)
     {
         DLLHelper::free_library(m_hInstQDP);
         m_hInstQDP = NULL;
     }
+
+    m_logger.stop();
 }
 
 bool ParserQDP::connect()
@@ -206,6 +611,15 @@ bool ParserQDP::connect()
     if(m_pUserAPI)
     {
         m_pUserAPI->Init();
+        for (QdpFeedSession* feed : m_ayFeeds)
+            feed->connect();
+
+        // 登录不了行情前置的时候，直接激活组播收行情
+        if (m_bMultiCast && m_bMultiNoLogin)
+            activateMultiCast();
+        else if (m_bShmMode && m_bShmNoLogin)
+            activateShm();
+
         return true;
     }
     return false;
@@ -213,11 +627,29 @@ bool ParserQDP::connect()
 
 bool ParserQDP::disconnect()
 {
-    if(m_pUserAPI)
+    // 轮询线程要用API实例，先停线程再释放API
+    stopShmPolling();
+
+    for (QdpFeedSession* feed : m_ayFeeds)
+        feed->release();
+
+    // 定时线程会用API实例发补查请求，先在锁里摘下来
+    CQdFtdcMduserApi* api = NULL;
     {
-        m_pUserAPI->RegisterSpi(NULL);
-        m_pUserAPI->Release();
+        SpinLock lock(m_mtxApi);
+        api = m_pUserAPI;
         m_pUserAPI = NULL;
+        for (ContractEntry* entry : m_ayRefills)
+            entry->_refill_pending = false;
+        m_ayRefills.clear();
+        m_ayWarmCodes.clear();
+        m_universe.cancelQuery();
+    }
+
+    if(api)
+    {
+        api->RegisterSpi(NULL);
+        api->Release();
     }
     
     m_loginState = LS_NOTLOGIN;
@@ -238,69 +670,33 @@ void ParserQDP::registerSpi(IParserSpi* listener)
 
 void ParserQDP::subscribe(const CodeSet &vecSymbols)
 {
-    if(m_uTradingDate == 0)
-    {
-        m_filterSubs = vecSymbols;
-    }
-    else
-    {
-        m_filterSubs = vecSymbols;
-        
-        if (vecSymbols.empty())
-            return;
+    for (QdpFeedSession* feed : m_ayFeeds)
+        feed->subscribe(vecSymbols);
 
-        char ** subscribe = new char*[vecSymbols.size()];
-        int nCount = 0;
-        for (auto& code : vecSymbols)
-        {
-            std::size_t pos = code.find('.');
-            if (pos != std::string::npos)
-                subscribe[nCount++] = (char*)code.c_str() + pos + 1;
-            else
-                subscribe[nCount++] = (char*)code.c_str();
-        }
+    // 只登记增量，没登录之前等登录以后统一订阅
+    uint32_t cnt = m_subRegistry.add(vecSymbols);
+    if (cnt == 0 || m_uTradingDate == 0)
+        return;
 
-        if(m_pUserAPI && nCount > 0)
-        {
-            int iResult = m_pUserAPI->SubMarketData(subscribe, nCount);
-            if(iResult != 0)
-            {
-                if (m_sink)
-                    write_log(m_sink, LL_ERROR, "[ParserQDP] Sending md subscribe request failed: {}", iResult);
-            }
-            else
-            {
-                if (m_sink)
-                    write_log(m_sink, LL_INFO, "[ParserQDP] Market data of {} contracts subscribed in total", nCount);
-            }
-        }
-        delete[] subscribe;
-    }
+    if (m_bShmMode)
+        addShmCodes(vecSymbols);
+    else
+        flushSubscriptions();
 }
 
 void ParserQDP::unsubscribe(const CodeSet &vecSymbols)
 {
-    if (!vecSymbols.empty() && m_pUserAPI)
-    {
-        char ** unsubscribe = new char*[vecSymbols.size()];
-        int nCount = 0;
-        for (auto& code : vecSymbols)
-        {
-            std::size_t pos = code.find('.');
-            if (pos != std::string::npos)
-                unsubscribe[nCount++] = (char*)code.c_str() + pos + 1;
-            else
-                unsubscribe[nCount++] = (char*)code.c_str();
-        }
+    for (QdpFeedSession* feed : m_ayFeeds)
+        feed->unsubscribe(vecSymbols);
 
-        int iResult = m_pUserAPI->UnSubMarketData(unsubscribe, nCount);
-        if(iResult != 0)
-        {
-            if (m_sink)
-                write_log(m_sink, LL_ERROR, "[ParserQDP] Sending md unsubscribe request failed: {}", iResult);
-        }
-        delete[] unsubscribe;
-    }
+    uint32_t cnt = m_subRegistry.remove(vecSymbols);
+    if (cnt == 0 || m_uTradingDate == 0)
+        return;
+
+    if (m_bShmMode)
+        removeShmCodes(vecSymbols);
+    else
+        flushSubscriptions();
 }
 
 // QDP回调函数实现
@@ -308,7 +704,7 @@ void ParserQDP::OnFrontConnected()
 {
     if(m_sink)
     {
-        write_log(m_sink, LL_INFO, "[ParserQDP] Market data server connected");
+        write_log(m_logger, LL_INFO, "[ParserQDP] Market data server connected");
         m_sink->handleEvent(WPE_Connect, 0);
     }
 
@@ -319,16 +715,22 @@ void ParserQDP::OnFrontDisconnected(int nReason)
 {
     if(m_sink)
     {
-        write_log(m_sink, LL_ERROR, "[ParserQDP] Market data server disconnected: {}", nReason);
+        write_log(m_logger, LL_ERROR, "[ParserQDP] Market data server disconnected: {}", nReason);
         m_sink->handleEvent(WPE_Close, 0);
     }
     m_loginState = LS_NOTLOGIN;
+
+    // 断线期间的分价增量收不到了，盘口等重连以后从头建
+    resetBooks();
+
+    // 查询中途断开的话剩下的回报不会再来了，不清掉重新登录后就不会再查
+    m_universe.cancelQuery();
 }
 
 void ParserQDP::OnHeartBeatWarning(int nTimeLapse)
 {
     if(m_sink)
-        write_log(m_sink, LL_INFO, "[ParserQDP] Heartbeating, elapse: {}", nTimeLapse);
+        write_log(m_logger, LL_INFO, "[ParserQDP] Heartbeating, elapse: {}", nTimeLapse);
 }
 
 void ParserQDP::OnRspError(CQdFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
@@ -336,7 +738,7 @@ void ParserQDP::OnRspError(CQdFtdcRspInfoField *pRspInfo, int nRequestID, bool b
     if(pRspInfo && pRspInfo->ErrorID != 0)
     {
         if(m_sink)
-            write_log(m_sink, LL_ERROR, "[ParserQDP] Error response: ErrorID={}, ErrorMsg={}", 
+            write_log(m_logger, LL_ERROR, "[ParserQDP] Error response: ErrorID={}, ErrorMsg={}", 
                      pRspInfo->ErrorID, pRspInfo->ErrorMsg);
     }
 }
@@ -345,15 +747,19 @@ void ParserQDP::OnRspUserLogin(CQdFtdcRspUserLoginField *pRspUserLogin, CQdFtdcR
 {
     if(bIsLast && !IsErrorRspInfo(pRspInfo))
     {
-        m_uTradingDate = strtoul(pRspUserLogin->TradingDay, NULL, 10);
+        setTradingDate(QdpFieldDecoder::decodeDate(pRspUserLogin->TradingDay));
         m_loginState = LS_LOGINED;
         
         if(m_sink)
         {
-            write_log(m_sink, LL_INFO, "[ParserQDP] User login successfully, trading day: {}", m_uTradingDate);
+            write_log(m_logger, LL_INFO, "[ParserQDP] User login successfully, trading day: {}", m_uTradingDate);
             m_sink->handleEvent(WPE_Login, 0);
         }
 
+        reportTickPool();
+        if (m_bSeqCheck)
+            reportSequence();
+
         // 订阅行情数据
         SubscribeMarketData();
     }
@@ -366,7 +772,7 @@ void ParserQDP::OnRspUserLogout(CQdFtdcRspUserLogoutField *pRspUserLogout, CQdFt
         m_loginState = LS_NOTLOGIN;
         if(m_sink)
         {
-            write_log(m_sink, LL_INFO, "[ParserQDP] User logout successfully");
+            write_log(m_logger, LL_INFO, "[ParserQDP] User logout successfully");
             m_sink->handleEvent(WPE_Logout, 0);
         }
     }
@@ -378,7 +784,7 @@ void ParserQDP::OnRspSubMarketData(CQdFtdcSpecificInstrumentField *pSpecificInst
     {
         if(pSpecificInstrument && m_sink)
         {
-            write_log(m_sink, LL_INFO, "[ParserQDP] Subscribe market data successfully: {}", pSpecificInstrument->InstrumentID);
+            write_log(m_logger, QLC_SUBSCRIBE, LL_INFO, "[ParserQDP] Subscribe market data successfully: {}", pSpecificInstrument->InstrumentID);
         }
     }
 }
@@ -389,131 +795,884 @@ void ParserQDP::OnRspUnSubMarketData(CQdFtdcSpecificInstrumentField *pSpecificIn
     {
         if(pSpecificInstrument && m_sink)
         {
-            write_log(m_sink, LL_INFO, "[ParserQDP] Unsubscribe market data successfully: {}", pSpecificInstrument->InstrumentID);
+            write_log(m_logger, QLC_SUBSCRIBE, LL_INFO, "[ParserQDP] Unsubscribe market data successfully: {}", pSpecificInstrument->InstrumentID);
         }
     }
 }
 
 void ParserQDP::OnRtnDepthMarketData(CQdFtdcDepthMarketDataField *pDepthMarketData)
 {
-    if(m_pBaseDataMgr == NULL || pDepthMarketData == NULL)
-        return;
+    processDepthData(pDepthMarketData);
+}
 
-    // 处理时间
-    uint32_t actDate = strtoul(pDepthMarketData->TradingDay, NULL, 10);
-    uint32_t actTime = strToTime(pDepthMarketData->UpdateTime) * 1000 + pDepthMarketData->UpdateMillisec;
-    uint32_t actHour = actTime / 10000000;
+void ParserQDP::OnRtnMultiDepthMarketData(CQdFtdcDepthMarketDataField *pDepthMarketData)
+{
+    // 多播行情数据，处理逻辑与单播相同
+    processDepthData(pDepthMarketData);
+}
 
-    if (actDate == 0)
-        actDate = m_uTradingDate;
+void ParserQDP::OnRtnShfeMultiMarketData(CQdFtdcDepthMarketDataField *pMarketData)
+{
+    // 上期所组播行情，已经由API解析好，处理逻辑与单播相同
+    processDepthData(pMarketData);
+}
 
-	if (actDate == m_uTradingDate && actHour >= 20)
-	{
-		//这样的时间是有问题,因为夜盘时发生日期不可能等于交易日
-		//这就需要手动设置一下
-		uint32_t curDate, curTime;
-		TimeUtils::getDateTime(curDate, curTime);
-		uint32_t curHour = curTime / 10000000;
-
-		//早上启动以后,会收到昨晚12点以前收盘的行情,这个时候可能会有发生日期=交易日的情况出现
-		//这笔数据直接丢掉
-		if (curHour >= 3 && curHour < 9)
-			return;
-
-		actDate = curDate;
-
-		if (actHour == 23 && curHour == 0)
-		{
-			//行情时间慢于系统时间
-			actDate = TimeUtils::getNextDate(curDate, -1);
-		}
-		else if (actHour == 0 && curHour == 23)
-		{
-			//系统时间慢于行情时间
-			actDate = TimeUtils::getNextDate(curDate, 1);
-		}
-	}
+void ParserQDP::OnRtnShfeMultiLevel(CQdFtdcShfeMultiLevelField *pShfeMultiLevel)
+{
+    if (pShfeMultiLevel)
+        write_log(m_logger, LL_INFO, "[ParserQDP] Multicast level of topic {} changed to {}", pShfeMultiLevel->TopicID, pShfeMultiLevel->Level);
+}
 
-	
-    WTSContractInfo* contract = m_pBaseDataMgr->getContract(pDepthMarketData->InstrumentID, pDepthMarketData->ExchangeID);
-    if (contract == NULL)
+void ParserQDP::OnMultiHeartbeat(char *CurrTime, char *MultiCastIP)
+{
+    write_log(m_logger, LL_DEBUG, "[ParserQDP] Multicast heartbeating, time: {}, source: {}", CurrTime, MultiCastIP);
+}
+
+void ParserQDP::OnRtnShfeMultiParameters(CQdFtdcShfeMultiParametersField *pShfeMultiParameters)
+{
+    if (pShfeMultiParameters == NULL || m_pBaseDataMgr == NULL)
         return;
 
-    WTSCommodityInfo* pCommInfo = contract->getCommInfo();
+    FeedLock lock(m_pFeedMutex);
+    // 组播参数里没有交易所，按合约代码在全部交易所里查
+    m_multiDecoder.addParameters(pShfeMultiParameters);
+    resolveContract(pShfeMultiParameters->InstrumentID, "", pShfeMultiParameters->InstrumentNo);
+}
 
-    WTSTickData* tick = WTSTickData::create(pDepthMarketData->InstrumentID);
-    tick->setContractInfo(contract);
-    WTSTickStruct& quote = tick->getTickStruct();
-    strcpy(quote.exchg, pCommInfo->getExchg());
-    
-    quote.action_date = actDate;
-    quote.action_time = actTime;
-    quote.trading_date = m_uTradingDate;
-    
-    // 基础行情数据
-    quote.price = checkValid(pDepthMarketData->LastPrice);
-    quote.open = checkValid(pDepthMarketData->OpenPrice);
-    quote.high = checkValid(pDepthMarketData->HighestPrice);
-    quote.low = checkValid(pDepthMarketData->LowestPrice);
-    quote.total_volume = pDepthMarketData->Volume;
-	if (pDepthMarketData->SettlementPrice != DBL_MAX)
-		quote.settle_price = checkValid(pDepthMarketData->SettlementPrice);
-	if (strcmp(quote.exchg, "CZCE") == 0)
-	{
-		quote.total_turnover = pDepthMarketData->Turnover * pCommInfo->getVolScale();
-	}
-	else
-	{
-		if (pDepthMarketData->Turnover != DBL_MAX)
-			quote.total_turnover = pDepthMarketData->Turnover;
-	}
-	quote.open_interest = (uint32_t)pDepthMarketData->OpenInterest;
+void ParserQDP::OnMutiData(char *data, int len)
+{
+    if (!m_bUserFreedom || m_pBaseDataMgr == NULL || data == NULL)
+        return;
 
-    quote.upper_limit = checkValid(pDepthMarketData->UpperLimitPrice);
-    quote.lower_limit = checkValid(pDepthMarketData->LowerLimitPrice);
+    FeedLock lock(m_pFeedMutex);
+    RawTickHandler handler;
+    handler._parser = this;
+    handler._entry = NULL;
+    handler._tick = NULL;
+    handler._params = NULL;
+    handler._recv = m_bLatency ? m_latency.now() : 0;
+    m_multiDecoder.decode(data, len, handler);
+}
 
-    quote.pre_close = checkValid(pDepthMarketData->PreClosePrice);
-    quote.pre_settle = checkValid(pDepthMarketData->PreSettlementPrice);
-    quote.pre_interest = (uint32_t)pDepthMarketData->PreOpenInterest;
+WTSTickStruct* ParserQDP::RawTickHandler::acquire(uint32_t instNo, const QdpMultiDecoder::MultiParams& params)
+{
+    ContractEntry* entry = _parser->resolveContract(params._code, "", (int)instNo);
+    if (entry->_contract == NULL)
+        return NULL;
+
+    _entry = entry;
+    _tick = _parser->allocTick(entry);
+    _params = &params;
+
+    //布局不一定解全所有字段，复用的tick上不能留着上一笔的值，合约代码和交易所不动
+    WTSTickStruct& quote = _tick->getTickStruct();
+    memset(&quote.price, 0, sizeof(WTSTickStruct) - offsetof(WTSTickStruct, price));
+    return &quote;
+}
 
-    // 五档行情
-    quote.ask_prices[0] = checkValid(pDepthMarketData->AskPrice1);
-    quote.ask_prices[1] = checkValid(pDepthMarketData->AskPrice2);
-    quote.ask_prices[2] = checkValid(pDepthMarketData->AskPrice3);
-    quote.ask_prices[3] = checkValid(pDepthMarketData->AskPrice4);
-    quote.ask_prices[4] = checkValid(pDepthMarketData->AskPrice5);
+void ParserQDP::RawTickHandler::commit(uint32_t instNo, WTSTickStruct& quote, uint32_t updateTime, uint32_t millisec)
+{
+    uint32_t actTime = updateTime * 1000 + millisec;
+    uint32_t actDate = 0;
+    if (!_parser->m_dateResolver.resolve(_params->_trading_date, 0, actTime / 10000000, actDate))
+    {
+        _tick->release();
+        return;
+    }
 
-    quote.bid_prices[0] = checkValid(pDepthMarketData->BidPrice1);
-    quote.bid_prices[1] = checkValid(pDepthMarketData->BidPrice2);
-    quote.bid_prices[2] = checkValid(pDepthMarketData->BidPrice3);
-    quote.bid_prices[3] = checkValid(pDepthMarketData->BidPrice4);
-    quote.bid_prices[4] = checkValid(pDepthMarketData->BidPrice5);
+    quote.action_date = actDate;
+    quote.action_time = actTime;
+    quote.trading_date = _parser->m_uTradingDate;
+    quote.reserve_ = _parser->makeTickFlags(_entry, 0);
+    if (_recv != 0)
+        _parser->m_latency.recordExchange(_entry->_latency, _recv, actTime);
+    _parser->dispatchTick(_entry, _tick, _recv);
+}
 
-    quote.ask_qty[0] = pDepthMarketData->AskVolume1;
-    quote.ask_qty[1] = pDepthMarketData->AskVolume2;
-    quote.ask_qty[2] = pDepthMarketData->AskVolume3;
-    quote.ask_qty[3] = pDepthMarketData->AskVolume4;
-    quote.ask_qty[4] = pDepthMarketData->AskVolume5;
+void ParserQDP::OnRtnMBLMarketData(CQdFtdcMBLMarketDataField *pMBLMarketData)
+{
+    if (m_bJournal && pMBLMarketData != NULL)
+        m_journal.append(JRT_MBL, 0, 0, pMBLMarketData, sizeof(CQdFtdcMBLMarketDataField));
 
-    quote.bid_qty[0] = pDepthMarketData->BidVolume1;
-    quote.bid_qty[1] = pDepthMarketData->BidVolume2;
-    quote.bid_qty[2] = pDepthMarketData->BidVolume3;
-    quote.bid_qty[3] = pDepthMarketData->BidVolume4;
-    quote.bid_qty[4] = pDepthMarketData->BidVolume5;
+    if (!m_bMBLBook || m_pBaseDataMgr == NULL || pMBLMarketData == NULL)
+        return;
 
-    write_log(m_sink, LL_INFO, "[ParserQDP] code:{}, bid_price:{}, ask_price:{}",
-		quote.code, quote.bid_prices[0], quote.ask_prices[0]);
+    FeedLock lock(m_pFeedMutex);
+    ContractEntry* entry = resolveContract(pMBLMarketData->InstrumentID, "", 0);
+    if (entry->_contract == NULL)
+        return;
 
-    if(m_sink)
-        m_sink->handleQuote(tick, 1);
+    MBLBook* book = entry->_book;
+    if (book == NULL)
+    {
+        book = new MBLBook();
+        book->_ladder.init(entry->_comm_info->getPriceTick());
+        book->_has_snapshot = false;
+        book->_dirty = false;
+        entry->_book = book;
+    }
 
-    tick->release();
+    uint32_t updateTime = QdpFieldDecoder::decodeTime(pMBLMarketData->UpdateTime) * 1000 + pMBLMarketData->UpdateMillisec;
+    book->_ladder.apply(pMBLMarketData->Direction == QD_FTDC_D_Buy, pMBLMarketData->Price,
+        (uint32_t)std::max(pMBLMarketData->Volume, 0), updateTime);
+
+    if (m_bMBLPublish && !book->_dirty)
+    {
+        book->_dirty = true;
+        m_ayDirtyBooks.emplace_back(entry);
+    }
 }
 
-void ParserQDP::OnRtnMultiDepthMarketData(CQdFtdcDepthMarketDataField *pDepthMarketData)
+void ParserQDP::OnPackageEnd(int nTopicID, int nSequenceNo)
 {
-    // 多播行情数据，处理逻辑与单播相同
-    OnRtnDepthMarketData(pDepthMarketData);
+    // 一个报文里的分价增量都应用完了再推盘口，避免推出半截的盘口
+    FeedLock lock(m_pFeedMutex);
+    if (!m_ayDirtyBooks.empty())
+        publishBooks();
+}
+
+void ParserQDP::publishBooks()
+{
+    for (ContractEntry* entry : m_ayDirtyBooks)
+    {
+        MBLBook* book = entry->_book;
+        book->_dirty = false;
+
+        //还没有收到过快照的合约没有成交数据，先不推
+        if (!book->_has_snapshot)
+            continue;
+
+        WTSTickData* tick = allocTick(entry);
+        WTSTickStruct& quote = tick->getTickStruct();
+        memcpy(&quote, &book->_snapshot, sizeof(WTSTickStruct));
+        book->_ladder.fillTop(quote, 10);
+        if (book->_ladder.updateTime() > quote.action_time)
+            quote.action_time = book->_ladder.updateTime();
+        //快照可能是查询回来的，盘口是推送合成的，标记按当前状态重算
+        quote.reserve_ = makeTickFlags(entry, 0);
+
+        dispatchTick(entry, tick);
+    }
+
+    m_ayDirtyBooks.clear();
+}
+
+void ParserQDP::resetBooks()
+{
+    if (!m_bMBLBook)
+        return;
+
+    FeedLock lock(m_pFeedMutex);
+    for (auto& item : m_mapContracts)
+    {
+        MBLBook* book = item.second->_book;
+        if (book == NULL)
+            continue;
+
+        book->_ladder.reset();
+        book->_has_snapshot = false;
+        book->_dirty = false;
+    }
+    m_ayDirtyBooks.clear();
+}
+
+uint32_t ParserQDP::makeTickFlags(ContractEntry* entry, uint32_t tickFlags)
+{
+    if (m_uStateGate == SG_TAG && entry->_status != 0)
+    {
+        tickFlags |= (uint32_t)(uint8_t)entry->_status << TF_STATE_SHIFT;
+        if (entry->_status != QD_FTDC_IS_Continous)
+            tickFlags |= TF_NON_CONTINUOUS;
+    }
+    return tickFlags;
+}
+
+void ParserQDP::processDepthData(CQdFtdcDepthMarketDataField *pDepthMarketData, uint32_t feedIdx /* = 0 */, uint32_t tickFlags /* = 0 */)
+{
+    if(m_pBaseDataMgr == NULL || pDepthMarketData == NULL)
+        return;
+
+    // 延迟从进入回调算起
+    uint64_t recvTsc = m_bLatency ? m_latency.now() : 0;
+
+    // 原样记下来，放在去重和仲裁之前，备用线路的到达时间也留着
+    if (m_bJournal)
+        m_journal.append(JRT_DEPTH, (uint16_t)feedIdx, (uint16_t)tickFlags, pDepthMarketData, sizeof(CQdFtdcDepthMarketDataField));
+
+    FeedLock lock(m_pFeedMutex);
+
+    ContractEntry* entry = resolveContract(pDepthMarketData);
+    if (entry->_contract == NULL)
+        return;
+
+    // 交易状态先于其他处理，收盘、停牌、集合竞价的行情不用再转换
+    if (m_uStateGate != SG_OFF)
+    {
+        char status = updateState(entry, pDepthMarketData->InstrumentStatus);
+        if (m_uStateGate == SG_DROP && status != 0 && status != QD_FTDC_IS_Continous)
+        {
+            m_uGatedTicks++;
+            return;
+        }
+    }
+
+    // 处理时间
+    uint32_t actTime = QdpFieldDecoder::decodeTime(pDepthMarketData->UpdateTime) * 1000 + pDepthMarketData->UpdateMillisec;
+    uint32_t actHour = actTime / 10000000;
+
+    // 发生日期由缓存的日历解析，夜盘不再每笔都读系统时间
+    uint32_t calDate = 0;
+    QdpFieldDecoder::parseDate(pDepthMarketData->CalendarDate, calDate);
+    uint32_t actDate = 0;
+    if (!m_dateResolver.resolve(QdpFieldDecoder::decodeDate(pDepthMarketData->TradingDay), calDate, actHour, actDate))
+        return;
+
+    // 有线路统计说明有多条线路（实盘的备用线路或者回放日志里的备用线路），要仲裁
+    if (!m_ayFeedStats.empty() && !arbitrate(entry, feedIdx, pDepthMarketData, actDate, actTime))
+        return;
+
+    if (m_bSeqCheck && !checkSequence(entry, pDepthMarketData, actTime, tickFlags))
+        return;
+
+    // 查询回来的快照不是实时的，不计交易所延迟
+    if (recvTsc != 0 && (tickFlags & TF_SNAPSHOT) == 0)
+        m_latency.recordExchange(entry->_latency, recvTsc, actTime);
+
+    WTSTickData* tick = allocTick(entry);
+    WTSTickStruct& quote = tick->getTickStruct();
+    
+    quote.action_date = actDate;
+    quote.action_time = actTime;
+    quote.trading_date = m_uTradingDate;
+    quote.reserve_ = makeTickFlags(entry, tickFlags);
+    
+    // 基础行情数据
+    quote.price = checkValid(pDepthMarketData->LastPrice);
+    quote.open = checkValid(pDepthMarketData->OpenPrice);
+    quote.high = checkValid(pDepthMarketData->HighestPrice);
+    quote.low = checkValid(pDepthMarketData->LowestPrice);
+    quote.total_volume = pDepthMarketData->Volume;
+	// tick对象会被复用，无效值也要显式覆盖
+	quote.settle_price = checkValid(pDepthMarketData->SettlementPrice);
+	if (entry->_flags & CF_TURNOVER_SCALE)
+	{
+		quote.total_turnover = pDepthMarketData->Turnover * entry->_vol_scale;
+	}
+	else
+	{
+		quote.total_turnover = checkValid(pDepthMarketData->Turnover);
+	}
+	quote.open_interest = (uint32_t)pDepthMarketData->OpenInterest;
+
+    quote.upper_limit = checkValid(pDepthMarketData->UpperLimitPrice);
+    quote.lower_limit = checkValid(pDepthMarketData->LowerLimitPrice);
+
+    quote.pre_close = checkValid(pDepthMarketData->PreClosePrice);
+    quote.pre_settle = checkValid(pDepthMarketData->PreSettlementPrice);
+    quote.pre_interest = (uint32_t)pDepthMarketData->PreOpenInterest;
+
+    // 五档行情
+    quote.ask_prices[0] = checkValid(pDepthMarketData->AskPrice1);
+    quote.ask_prices[1] = checkValid(pDepthMarketData->AskPrice2);
+    quote.ask_prices[2] = checkValid(pDepthMarketData->AskPrice3);
+    quote.ask_prices[3] = checkValid(pDepthMarketData->AskPrice4);
+    quote.ask_prices[4] = checkValid(pDepthMarketData->AskPrice5);
+
+    quote.bid_prices[0] = checkValid(pDepthMarketData->BidPrice1);
+    quote.bid_prices[1] = checkValid(pDepthMarketData->BidPrice2);
+    quote.bid_prices[2] = checkValid(pDepthMarketData->BidPrice3);
+    quote.bid_prices[3] = checkValid(pDepthMarketData->BidPrice4);
+    quote.bid_prices[4] = checkValid(pDepthMarketData->BidPrice5);
+
+    quote.ask_qty[0] = pDepthMarketData->AskVolume1;
+    quote.ask_qty[1] = pDepthMarketData->AskVolume2;
+    quote.ask_qty[2] = pDepthMarketData->AskVolume3;
+    quote.ask_qty[3] = pDepthMarketData->AskVolume4;
+    quote.ask_qty[4] = pDepthMarketData->AskVolume5;
+
+    quote.bid_qty[0] = pDepthMarketData->BidVolume1;
+    quote.bid_qty[1] = pDepthMarketData->BidVolume2;
+    quote.bid_qty[2] = pDepthMarketData->BidVolume3;
+    quote.bid_qty[3] = pDepthMarketData->BidVolume4;
+    quote.bid_qty[4] = pDepthMarketData->BidVolume5;
+
+    // 快照只有五档，后面五档用分价盘口补齐
+    MBLBook* book = entry->_book;
+    if (book != NULL)
+    {
+        book->_ladder.ensureRange(quote.lower_limit, quote.upper_limit);
+        book->_ladder.fillBeyond(quote, 5, 10);
+        if (m_bMBLPublish)
+        {
+            memcpy(&book->_snapshot, &quote, sizeof(WTSTickStruct));
+            book->_has_snapshot = true;
+        }
+    }
+
+    dispatchTick(entry, tick, recvTsc);
+}
+
+void ParserQDP::OnRtnTenEntrust(CQdFtdcMDTenDepthMarketDataField *pMDTenDepthMarketData)
+{
+    if (m_bJournal && pMDTenDepthMarketData != NULL)
+        m_journal.append(JRT_TEN_ENTRUST, 0, 0, pMDTenDepthMarketData, sizeof(CQdFtdcMDTenDepthMarketDataField));
+
+    if (!m_bOrderQueue || m_pBaseDataMgr == NULL || pMDTenDepthMarketData == NULL)
+        return;
+
+    FeedLock lock(m_pFeedMutex);
+    ContractEntry* entry = resolveContract(pMDTenDepthMarketData->InstrumentID, pMDTenDepthMarketData->ExchangeID, 0);
+    if (entry->_contract == NULL)
+        return;
+
+    uint32_t actTime = QdpFieldDecoder::decodeTime(pMDTenDepthMarketData->UpdateTime) * 1000 + pMDTenDepthMarketData->UpdateMillisec;
+    uint32_t actDate = 0;
+    if (entry->_last_date != 0 && entry->_last_time == actTime)
+    {
+        //和最近一笔快照是同一时刻的，直接沿用快照的发生日期
+        actDate = entry->_last_date;
+    }
+    else if (!m_dateResolver.resolve(0, 0, actTime / 10000000, actDate))
+    {
+        return;
+    }
+
+    const int bidQtys[10] = {
+        pMDTenDepthMarketData->BestBuyOrderQtyOne, pMDTenDepthMarketData->BestBuyOrderQtyTwo,
+        pMDTenDepthMarketData->BestBuyOrderQtyThree, pMDTenDepthMarketData->BestBuyOrderQtyFour,
+        pMDTenDepthMarketData->BestBuyOrderQtyFive, pMDTenDepthMarketData->BestBuyOrderQtySix,
+        pMDTenDepthMarketData->BestBuyOrderQtySeven, pMDTenDepthMarketData->BestBuyOrderQtyEight,
+        pMDTenDepthMarketData->BestBuyOrderQtyNine, pMDTenDepthMarketData->BestBuyOrderQtyTen
+    };
+    const int askQtys[10] = {
+        pMDTenDepthMarketData->BestSellOrderQtyOne, pMDTenDepthMarketData->BestSellOrderQtyTwo,
+        pMDTenDepthMarketData->BestSellOrderQtyThree, pMDTenDepthMarketData->BestSellOrderQtyFour,
+        pMDTenDepthMarketData->BestSellOrderQtyFive, pMDTenDepthMarketData->BestSellOrderQtySix,
+        pMDTenDepthMarketData->BestSellOrderQtySeven, pMDTenDepthMarketData->BestSellOrderQtyEight,
+        pMDTenDepthMarketData->BestSellOrderQtyNine, pMDTenDepthMarketData->BestSellOrderQtyTen
+    };
+
+    dispatchOrderQueue(entry, BDT_Buy, checkValid(pMDTenDepthMarketData->BestBuyOrderPrice), bidQtys, actDate, actTime);
+    dispatchOrderQueue(entry, BDT_Sell, checkValid(pMDTenDepthMarketData->BestSellOrderPrice), askQtys, actDate, actTime);
+}
+
+void ParserQDP::OnRspQryDepthMarketData(CQdFtdcDepthMarketDataField *pDepthMarketData, CQdFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
+{
+    // 补查和预热回来的快照和推送的行情一样处理，序号没有前进的会被去重
+    if (!IsErrorRspInfo(pRspInfo) && pDepthMarketData != NULL)
+        processDepthData(pDepthMarketData, 0, TF_SNAPSHOT);
+}
+
+bool ParserQDP::checkSequence(ContractEntry* entry, const CQdFtdcDepthMarketDataField* pData, uint32_t actTime, uint32_t tickFlags)
+{
+    //没有包序号的按时间和成交量去重
+    if (pData->PacketNo == 0)
+        return !(entry->_last_time == actTime && entry->_last_volume == (double)pData->Volume);
+
+    //补查回来的快照只去重，不然快照自己又会触发缺口和新一轮补查
+    bool gapCheck = m_bSeqGaps && (tickFlags & TF_SNAPSHOT) == 0;
+    QdpSeqTracker::SeqCheck ret = m_seqTracker.check(entry->_seq, pData->DataCenterID, pData->PacketNo, gapCheck);
+    if (ret == QdpSeqTracker::SC_DUPLICATE)
+        return false;
+
+    if (ret == QdpSeqTracker::SC_GAP)
+        onSequenceGap(entry->_seq._channel);
+
+    return true;
+}
+
+void ParserQDP::onSequenceGap(int32_t channel)
+{
+    const QdpSeqTracker::ChannelStat& stat = m_seqTracker.channel(channel);
+    write_log(m_logger, LL_WARN, "[ParserQDP] Packet gap on channel {}: {} - {}, {} gaps in total",
+        channel, stat._last_gap_from, stat._last_gap_to, stat._gaps);
+
+    if (!m_bSeqRefill)
+        return;
+
+    if (channel >= (int32_t)m_ayRefillTimes.size())
+        m_ayRefillTimes.resize(channel + 1, 0);
+
+    int64_t now = stat._last_gap_time;
+    if (now - m_ayRefillTimes[channel] < (int64_t)m_uRefillCooldown * 1000)
+        return;
+    m_ayRefillTimes[channel] = now;
+
+    //不知道缺的包里有哪些合约，该通道上收到过行情的合约都补查一遍
+    uint32_t cnt = 0;
+    SpinLock lock(m_mtxApi);
+    for (auto& item : m_mapContracts)
+    {
+        ContractEntry* entry = item.second;
+        if (entry->_contract == NULL || entry->_refill_pending || entry->_seq._channel != channel)
+            continue;
+
+        entry->_refill_pending = true;
+        m_ayRefills.emplace_back(entry);
+        cnt++;
+    }
+
+    write_log(m_logger, LL_INFO, "[ParserQDP] {} contracts of channel {} queued for snapshot refill", cnt, channel);
+}
+
+void ParserQDP::sendRefills()
+{
+    SpinLock lock(m_mtxApi);
+    if (m_ayRefills.empty() || m_pUserAPI == NULL || m_loginState != LS_LOGINED)
+        return;
+
+    uint32_t cnt = 0;
+    while (!m_ayRefills.empty() && cnt < m_uRefillBatch)
+    {
+        ContractEntry* entry = m_ayRefills.back();
+
+        CQdFtdcQryMarketDataField req;
+        memset(&req, 0, sizeof(req));
+        wt_strcpy(req.ExchangeID, entry->_exchg);
+        wt_strcpy(req.InstrumentID, entry->_code);
+        int iResult = m_pUserAPI->ReqQryDepthMarketData(&req, ++m_iRequestID);
+        if (iResult != 0)
+        {
+            //流控了就留在队列里下一轮再发，和预热查询一样
+            write_log(m_logger, LL_WARN, "[ParserQDP] Sending snapshot refill request of {} failed: {}, retry later", entry->_code, iResult);
+            return;
+        }
+
+        m_ayRefills.pop_back();
+        entry->_refill_pending = false;
+        cnt++;
+    }
+}
+
+void ParserQDP::sendWarmStart()
+{
+    SpinLock lock(m_mtxApi);
+    if (m_ayWarmCodes.empty() || m_pUserAPI == NULL || m_loginState != LS_LOGINED)
+        return;
+
+    uint32_t cnt = 0;
+    while (!m_ayWarmCodes.empty() && cnt < m_uWarmBatch)
+    {
+        const std::string& code = m_ayWarmCodes.back();
+        CQdFtdcQryMarketDataField req;
+        memset(&req, 0, sizeof(req));
+        WTSContractInfo* ct = (m_pBaseDataMgr != NULL) ? m_pBaseDataMgr->getContract(code.c_str()) : NULL;
+        if (ct != NULL)
+            wt_strcpy(req.ExchangeID, ct->getExchg());
+        wt_strcpy(req.InstrumentID, code.c_str());
+        int iResult = m_pUserAPI->ReqQryDepthMarketData(&req, ++m_iRequestID);
+        if (iResult != 0)
+        {
+            //流控了就留到下一轮再发
+            write_log(m_logger, LL_WARN, "[ParserQDP] Sending warm-start query of {} failed: {}, retry later", code, iResult);
+            return;
+        }
+
+        m_ayWarmCodes.pop_back();
+        cnt++;
+    }
+
+    if (m_ayWarmCodes.empty())
+        write_log(m_logger, LL_INFO, "[ParserQDP] Warm-start queries of {} contracts all sent", m_uWarmTotal);
+}
+
+bool ParserQDP::arbitrate(ContractEntry* entry, uint32_t feedIdx, const CQdFtdcDepthMarketDataField* pData, uint32_t actDate, uint32_t actTime)
+{
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    FeedStat& stat = m_ayFeedStats[feedIdx];
+
+    //比较这笔行情和上一笔胜出行情的先后，0为同一笔，>0为更新，<0为更旧
+    int32_t cmp = 0;
+    if (m_bArbByPacket)
+    {
+        //包序号大幅回退说明换日重新编号了，当作新行情
+        static const int32_t RESET_WINDOW = 100000;
+        if (pData->PacketNo > entry->_arb_packet || pData->PacketNo + RESET_WINDOW < entry->_arb_packet)
+            cmp = 1;
+        else if (pData->PacketNo < entry->_arb_packet)
+            cmp = -1;
+    }
+    else
+    {
+        uint64_t curKey = ((uint64_t)actDate << 32) | actTime;
+        uint64_t lastKey = ((uint64_t)entry->_arb_date << 32) | entry->_arb_time;
+        double volume = (double)pData->Volume;
+        if (curKey != lastKey)
+            cmp = (curKey > lastKey) ? 1 : -1;
+        else if (volume != entry->_arb_volume)
+            cmp = (volume > entry->_arb_volume) ? 1 : -1;
+    }
+
+    if (cmp > 0)
+    {
+        entry->_arb_date = actDate;
+        entry->_arb_time = actTime;
+        entry->_arb_volume = (double)pData->Volume;
+        entry->_arb_packet = pData->PacketNo;
+        entry->_arb_recv = now;
+        stat._wins++;
+        return true;
+    }
+
+    if (cmp == 0)
+    {
+        uint64_t lag = (uint64_t)(now - entry->_arb_recv);
+        stat._losses++;
+        stat._lag_sum += lag;
+        if (lag > stat._lag_max)
+            stat._lag_max = lag;
+    }
+    else
+    {
+        stat._stale++;
+    }
+
+    return false;
+}
+
+void ParserQDP::reportFeeds()
+{
+    for (std::size_t i = 0; i < m_ayFeedStats.size(); i++)
+    {
+        const FeedStat& stat = m_ayFeedStats[i];
+        uint64_t total = stat._wins + stat._losses;
+        write_log(m_logger, LL_INFO, "[ParserQDP] Feed {}: won {} of {} updates ({:.2f}%), avg lag {} us, max lag {} us when behind, {} stale updates",
+            (i == 0) ? "primary" : m_ayFeeds[i - 1]->name(), stat._wins, total,
+            (total == 0) ? 0.0 : stat._wins * 100.0 / total,
+            (stat._losses == 0) ? 0 : stat._lag_sum / stat._losses / 1000, stat._lag_max / 1000, stat._stale);
+    }
+}
+
+void ParserQDP::reportSequence()
+{
+    for (uint32_t i = 0; i < m_seqTracker.channelCount(); i++)
+    {
+        const QdpSeqTracker::ChannelStat& stat = m_seqTracker.channel(i);
+        if (stat._packets == 0 && stat._duplicates == 0)
+            continue;
+
+        write_log(m_logger, LL_INFO, "[ParserQDP] Channel {}: {} packets, {} duplicates dropped, {} gaps with {} packets missing, {} resets",
+            i, stat._packets, stat._duplicates, stat._gaps, stat._missing, stat._resets);
+    }
+}
+
+void ParserQDP::OnRtnQmdInstrumentStatu(CQdFtdcQmdInstrumentStateField *pQmdInstrumentState)
+{
+    if (m_uStateGate == SG_OFF || m_pBaseDataMgr == NULL || pQmdInstrumentState == NULL)
+        return;
+
+    FeedLock lock(m_pFeedMutex);
+    ContractEntry* entry = resolveContract(pQmdInstrumentState->InstrumentID, pQmdInstrumentState->ExchangeID, 0);
+    updateState(entry, pQmdInstrumentState->InstrumentStatus);
+}
+
+char ParserQDP::updateState(ContractEntry* entry, char status)
+{
+    if (status == 0 || status == entry->_status)
+        return entry->_status;
+
+    //开收盘时所有合约会一起切换，逐个合约的日志只在调试级别输出
+    m_uStateChanges++;
+    write_log(m_logger, LL_DEBUG, "[ParserQDP] Trading state of {}.{} changed: {} -> {}",
+        entry->_exchg, entry->_code, entry->_status == 0 ? '-' : entry->_status, status);
+    entry->_status = status;
+    return status;
+}
+
+void ParserQDP::OnRtnOptionIndexData(CQdFtdcOptionIndexDataField *pOptionIndexData)
+{
+    if (!m_bGreeks || m_pBaseDataMgr == NULL || pOptionIndexData == NULL)
+        return;
+
+    FeedLock lock(m_pFeedMutex);
+    ContractEntry* entry = resolveContract(pOptionIndexData->InstrumentID, pOptionIndexData->ExchangeID, 0);
+    if (entry->_contract == NULL)
+        return;
+
+    if (entry->_greeks_row == -1 && !locateGreeksRow(entry))
+        entry->_greeks_row = -2;
+
+    if (entry->_greeks_row < 0)
+        return;
+
+    QdpGreeksChain* chain = entry->_greeks_chain;
+    uint32_t row = (uint32_t)entry->_greeks_row;
+    chain->beginWrite();
+    chain->set(row, GC_UNDERLYING_PRICE, checkValid(pOptionIndexData->UnderlyingLastPrice));
+    chain->set(row, GC_LAST_PRICE, checkValid(pOptionIndexData->LastPrice));
+    chain->set(row, GC_REMAIN_DAYS, checkValid(pOptionIndexData->RemainDay));
+    chain->set(row, GC_THEORY_VOL, checkValid(pOptionIndexData->TheoryVol));
+    chain->set(row, GC_BID_VOL, checkValid(pOptionIndexData->BidVol));
+    chain->set(row, GC_ASK_VOL, checkValid(pOptionIndexData->AskVol));
+    chain->set(row, GC_MID_VOL, checkValid(pOptionIndexData->MidVol));
+    chain->set(row, GC_LAST_VOL, checkValid(pOptionIndexData->LastVol));
+    chain->set(row, GC_DELTA, checkValid(pOptionIndexData->Delta));
+    chain->set(row, GC_GAMMA, checkValid(pOptionIndexData->Gamma));
+    chain->set(row, GC_VEGA, checkValid(pOptionIndexData->Vega));
+    chain->set(row, GC_THETA, checkValid(pOptionIndexData->Theta));
+    chain->set(row, GC_RHO, checkValid(pOptionIndexData->Rho));
+    chain->setUpdateTime(row, QdpFieldDecoder::decodeTime(pOptionIndexData->UpdateTime) * 1000 + pOptionIndexData->UpdateMillisec);
+    chain->endWrite();
+}
+
+bool ParserQDP::locateGreeksRow(ContractEntry* entry)
+{
+    WTSContractCategory cat = entry->_comm_info->getCategory();
+    if (cat != CC_FutOption && cat != CC_ETFOption && cat != CC_SpotOption)
+        return false;
+
+    //期权代码里从后往前找认购认沽标记：m2501-C-3000、SR501C5000、au2502C600
+    const char* code = entry->_code;
+    int32_t len = (int32_t)strlen(code);
+    int32_t pos = -1;
+    for (int32_t i = len - 2; i > 0; i--)
+    {
+        char c = code[i];
+        if ((c == 'C' || c == 'P') && (isdigit(code[i - 1]) || code[i - 1] == '-') && (isdigit(code[i + 1]) || code[i + 1] == '-'))
+        {
+            pos = i;
+            break;
+        }
+    }
+
+    if (pos < 0)
+        return false;
+
+    std::string underlying(code, code[pos - 1] == '-' ? pos - 1 : pos);
+    const char* strStrike = code + pos + 1;
+    if (*strStrike == '-')
+        strStrike++;
+
+    QdpGreeksChain* chain = g_greeksStore.getChain(underlying.c_str(), entry->_contract->getExpireDate());
+    if (chain == NULL)
+    {
+        write_log(m_logger, LL_WARN, "[ParserQDP] Too many option chains, greeks of {} dropped", code);
+        return false;
+    }
+
+    int32_t row = chain->addRow(code, atof(strStrike), code[pos] == 'C');
+    if (row < 0)
+    {
+        write_log(m_logger, LL_WARN, "[ParserQDP] Option chain {}@{} is full, greeks of {} dropped", underlying, chain->expiry(), code);
+        return false;
+    }
+
+    entry->_greeks_chain = chain;
+    entry->_greeks_row = row;
+    return true;
+}
+
+void ParserQDP::dispatchOrderQueue(ContractEntry* entry, WTSBSDirectType side, double price, const int* qtys, uint32_t actDate, uint32_t actTime)
+{
+    if (price == 0 || qtys[0] <= 0)
+        return;
+
+    WTSOrdQueData* ordQue = allocOrdQue(entry);
+
+    WTSOrdQueStruct& ordQueStruct = ordQue->getOrdQueStruct();
+    ordQueStruct.trading_date = m_uTradingDate;
+    ordQueStruct.action_date = actDate;
+    ordQueStruct.action_time = actTime;
+    ordQueStruct.side = side;
+    ordQueStruct.price = price;
+
+    //队列里的委托是连续的，遇到0就说明后面没有了
+    uint32_t qsize = 0;
+    while (qsize < 10 && qtys[qsize] > 0)
+    {
+        ordQueStruct.volumes[qsize] = (uint32_t)qtys[qsize];
+        qsize++;
+    }
+    //复用的对象上可能还留着上一笔更长的队列
+    memset(ordQueStruct.volumes + qsize, 0, sizeof(ordQueStruct.volumes) - sizeof(uint32_t) * qsize);
+    ordQueStruct.qsize = qsize;
+    ordQueStruct.order_items = qsize;
+
+    deliver(ordQue, PK_ORDQUE);
+}
+
+void ParserQDP::dispatchTick(ContractEntry* entry, WTSTickData* tick, uint64_t recvTsc /* = 0 */)
+{
+    WTSTickStruct& quote = tick->getTickStruct();
+    entry->_last_date = quote.action_date;
+    entry->_last_time = quote.action_time;
+    entry->_last_volume = quote.total_volume;
+
+    write_log(m_logger, QLC_TICK, LL_INFO, "[ParserQDP] code:{}, bid_price:{}, ask_price:{}",
+		quote.code, quote.bid_prices[0], quote.ask_prices[0]);
+
+    if (entry->_conflate_idx >= 0)
+    {
+        //消费线程还没取走的上一笔直接作废，延迟按最新一笔算
+        if (recvTsc != 0)
+            entry->_conflate_recv.store(recvTsc, std::memory_order_relaxed);
+        WTSObject* old = m_pConflator->publish((uint32_t)entry->_conflate_idx, tick);
+        if (old != NULL)
+            old->release();
+        return;
+    }
+
+    deliver(tick, PK_TICK, entry, recvTsc);
+}
+
+void ParserQDP::deliver(WTSObject* data, uint32_t kind, ContractEntry* entry /* = NULL */, uint64_t recvTsc /* = 0 */)
+{
+    PipelineItem item;
+    item._data = data;
+    item._kind = kind;
+    item._recv = recvTsc;
+    item._entry = entry;
+
+    if (m_pPipeline == NULL)
+    {
+        deliverNow(item);
+        return;
+    }
+
+    if (m_pPipeline->push(item))
+        return;
+
+    if (!m_bPipeBlock)
+    {
+        m_uPipeDropped.fetch_add(1, std::memory_order_relaxed);
+        data->release();
+        return;
+    }
+
+    //队列满了就等消费线程腾出位置，不丢数据
+    m_uPipeStalls.fetch_add(1, std::memory_order_relaxed);
+    while (!m_pPipeline->push(item))
+        std::this_thread::yield();
+}
+
+void ParserQDP::deliverNow(const PipelineItem& item)
+{
+    if (m_sink)
+    {
+        if (item._kind == PK_TICK && item._recv != 0)
+        {
+            uint64_t sinkTsc = m_latency.now();
+            m_sink->handleQuote((WTSTickData*)item._data, 1);
+            m_latency.recordSink(item._entry->_latency, item._recv, sinkTsc, m_latency.now());
+        }
+        else if (item._kind == PK_TICK)
+            m_sink->handleQuote((WTSTickData*)item._data, 1);
+        else
+            m_sink->handleOrderQueue((WTSOrdQueData*)item._data);
+    }
+
+    item._data->release();
+}
+
+void ParserQDP::startPipeline()
+{
+    if (m_thrdPipeline != NULL)
+        return;
+
+    m_bPipeRunning = true;
+    m_thrdPipeline.reset(new StdThread([this]() {
+        if (m_iPipeCore >= 0 && !CpuHelper::bind_core((uint32_t)m_iPipeCore))
+            write_log(m_logger, LL_WARN, "[ParserQDP] Binding pipeline thread to core {} failed", m_iPipeCore);
+
+        PipelineItem item;
+        uint32_t idle = 0;
+        for (;;)
+        {
+            if (m_pPipeline->pop(item))
+            {
+                idle = 0;
+                deliverNow(item);
+                if (m_pConflator == NULL)
+                    continue;
+            }
+
+            if (m_pConflator != NULL && drainConflated() > 0)
+            {
+                idle = 0;
+                continue;
+            }
+
+            if (!m_bPipeRunning)
+            {
+                while (m_pPipeline->pop(item))
+                    deliverNow(item);
+                if (m_pConflator != NULL)
+                    drainConflated();
+                break;
+            }
+
+            if (m_bPipeSpin)
+                continue;
+
+            //先空转一会，再让出时间片，最后才休眠
+            idle++;
+            if (idle < 128)
+                continue;
+            else if (idle < 1024)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }));
+
+    write_log(m_logger, LL_INFO, "[ParserQDP] Pipeline started, capacity: {}, policy: {}", m_pPipeline->capacity(), m_bPipeSpin ? "spin" : "backoff");
+}
+
+uint32_t ParserQDP::drainConflated()
+{
+    return m_pConflator->drain([this](uint32_t idx, WTSObject* data) {
+        PipelineItem item;
+        item._data = data;
+        item._kind = PK_TICK;
+        item._entry = m_ayConflated[idx];
+        item._recv = m_bLatency ? item._entry->_conflate_recv.load(std::memory_order_relaxed) : 0;
+        deliverNow(item);
+    });
+}
+
+void ParserQDP::stopPipeline()
+{
+    m_bPipeRunning = false;
+    if (m_thrdPipeline)
+    {
+        m_thrdPipeline->join();
+        m_thrdPipeline.reset();
+    }
+}
+
+void ParserQDP::reportPipeline()
+{
+    write_log(m_logger, LL_INFO, "[ParserQDP] Pipeline depth: {}, high water: {}, capacity: {}, {} pushed, {} dropped, {} stalls",
+        m_pPipeline->size(), m_pPipeline->highWater(), m_pPipeline->capacity(), m_pPipeline->pushed(),
+        m_uPipeDropped.load(std::memory_order_relaxed), m_uPipeStalls.load(std::memory_order_relaxed));
+
+    if (m_pConflator == NULL)
+        return;
+
+    //合并得最多的几个合约单独列出来
+    const uint32_t TOP_CNT = 5;
+    std::vector<std::pair<uint64_t, uint32_t>> tops;
+    uint64_t total = 0;
+    uint32_t cnt = m_uConflateCnt.load(std::memory_order_acquire);
+    for (uint32_t idx = 0; idx < cnt; idx++)
+    {
+        uint64_t coalesced = m_pConflator->coalesced(idx);
+        total += coalesced;
+        if (coalesced > 0)
+            tops.emplace_back(coalesced, idx);
+    }
+
+    std::size_t topCnt = std::min(tops.size(), (std::size_t)TOP_CNT);
+    std::partial_sort(tops.begin(), tops.begin() + topCnt, tops.end(), std::greater<std::pair<uint64_t, uint32_t>>());
+    std::string detail;
+    for (std::size_t i = 0; i < topCnt; i++)
+    {
+        const ContractEntry* entry = m_ayConflated[tops[i].second];
+        detail += fmt::format("{}{}.{}:{}", (i > 0) ? ", " : "", entry->_exchg, entry->_code, tops[i].first);
+    }
+
+    write_log(m_logger, LL_INFO, "[ParserQDP] Conflation: {} of {} slots used, {} updates coalesced{}{}",
+        cnt, m_pConflator->capacity(), total, detail.empty() ? "" : ", top: ", detail);
 }
 
 void ParserQDP::ReqUserLogin()
@@ -534,43 +1693,648 @@ void ParserQDP::ReqUserLogin()
     {
         m_loginState = LS_NOTLOGIN;
         if(m_sink)
-            write_log(m_sink, LL_ERROR, "[ParserQDP] Sending login request failed: {}", iResult);
+            write_log(m_logger, LL_ERROR, "[ParserQDP] Sending login request failed: {}", iResult);
     }
 }
 
 void ParserQDP::SubscribeMarketData()
 {
-    if(m_filterSubs.empty())
+    // 共享内存模式不走网络订阅，把合约加入轮询列表即可
+    if (m_bShmMode)
+    {
+        discoverUniverse();
+        addShmCodes(m_subRegistry.snapshot());
+        startShmPolling();
+        return;
+    }
+
+    // 柜台那边的订阅随连接一起没了，登记表里的全部重新订阅
+    m_subRegistry.replay();
+    write_log(m_logger, LL_INFO, "[ParserQDP] Replaying subscriptions of {} contracts", m_subRegistry.size());
+
+    if (m_bWarmStart)
+    {
+        SpinLock lock(m_mtxApi);
+        m_ayWarmCodes.clear();
+        for (const std::string& code : m_subRegistry.snapshot())
+            m_ayWarmCodes.emplace_back(code);
+        m_uWarmTotal = (uint32_t)m_ayWarmCodes.size();
+    }
+
+    // 有缓存的话发现的合约直接并进这一轮订阅，否则等查询回报再增量订阅
+    discoverUniverse();
+    flushSubscriptions();
+
+    //第一批马上发，剩下的交给定时线程
+    sendWarmStart();
+}
+
+void ParserQDP::discoverUniverse()
+{
+    if (!m_bUniverse || m_universe.querying())
         return;
 
-    char ** subscribe = new char*[m_filterSubs.size()];
-    int nCount = 0;
-    for(auto& code : m_filterSubs)
+    if (m_bUniverseCache && m_universe.loadCache(m_strUniverseFile, m_uTradingDate))
     {
-        std::size_t pos = code.find('.');
-        if (pos != std::string::npos)
-            subscribe[nCount++] = (char*)code.c_str() + pos + 1;
+        write_log(m_logger, LL_INFO, "[ParserQDP] {} instruments of trading day {} loaded from universe cache {}",
+            m_universe.size(), m_uTradingDate, m_strUniverseFile);
+        applyUniverse();
+        return;
+    }
+
+    SpinLock lock(m_mtxApi);
+    if (m_pUserAPI == NULL || m_loginState != LS_LOGINED)
+    {
+        write_log(m_logger, LL_WARN, "[ParserQDP] Universe of trading day {} not cached and not logined, discovery skipped", m_uTradingDate);
+        return;
+    }
+
+    m_universe.beginQuery(m_uTradingDate);
+    m_bUniverseError = false;
+    for (const std::string& exchg : m_universe.exchanges())
+    {
+        CQdFtdcMarketDataExchangeIDField req;
+        memset(&req, 0, sizeof(req));
+        wt_strcpy(req.ExchangeID, exchg.c_str());
+
+        int reqID = ++m_iRequestID;
+        m_universe.addRequest(reqID, exchg);
+        int iResult = m_pUserAPI->ReqQryInstrumentList(&req, reqID);
+        if (iResult != 0)
+        {
+            write_log(m_logger, LL_ERROR, "[ParserQDP] Sending instrument list query of {} failed: {}", exchg, iResult);
+            m_bUniverseError = true;
+            m_universe.onInstrument(reqID, NULL, true);
+        }
+        else
+        {
+            write_log(m_logger, LL_INFO, "[ParserQDP] Querying instrument list of {}", exchg);
+        }
+    }
+}
+
+void ParserQDP::OnRspQryInstrumentList(CQdFtdcSpecificInstrumentField *pSpecificInstrument, CQdFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
+{
+    const char* code = NULL;
+    if (IsErrorRspInfo(pRspInfo))
+        m_bUniverseError = true;
+    else if (pSpecificInstrument != NULL)
+        code = pSpecificInstrument->InstrumentID;
+
+    if (!m_universe.onInstrument(nRequestID, code, bIsLast))
+        return;
+
+    // 有交易所没查全就不写缓存，下次启动重新查
+    if (m_bUniverseCache && !m_bUniverseError)
+        m_universe.saveCache(m_strUniverseFile);
+
+    applyUniverse();
+}
+
+void ParserQDP::applyUniverse()
+{
+    if (m_pBaseDataMgr == NULL)
+        return;
+
+    CodeSet codes;
+    uint32_t unknown = m_universe.filter(m_pBaseDataMgr, codes);
+    write_log(m_logger, LL_INFO, "[ParserQDP] Universe discovered: {} instruments listed, {} unknown in base data, {} matched",
+        m_universe.size(), unknown, codes.size());
+    if (codes.empty())
+        return;
+
+    //新发现的合约也要预热，重新登录时已经订阅过的由重订流程预热
+    if (m_bWarmStart)
+    {
+        CodeSet subscribed = m_subRegistry.snapshot();
+        SpinLock lock(m_mtxApi);
+        for (const std::string& fullCode : codes)
+        {
+            std::string code = fullCode.substr(fullCode.find('.') + 1);
+            if (subscribed.find(code) != subscribed.end())
+                continue;
+
+            //重订流程的预热可能还没发完，累加到总数上
+            m_ayWarmCodes.emplace_back(code);
+            m_uWarmTotal++;
+        }
+    }
+
+    // 增量订阅，按subscribe的批次和间隔分批发送
+    subscribe(codes);
+}
+
+void ParserQDP::flushSubscriptions()
+{
+    // 回调线程和定时线程都会调过来，API实例的摘除也在这把锁里
+    SpinLock lock(m_mtxApi);
+    if (m_pUserAPI == NULL || m_loginState != LS_LOGINED)
+        return;
+
+    std::vector<std::string> batch;
+    std::vector<char*> codes;
+    bool isSub = true;
+    for (;;)
+    {
+        //限速的时候每个间隔只发一批，剩下的交给定时线程
+        if (m_uSubInterval > 0)
+        {
+            int64_t now = TimeUtils::getLocalTimeNow();
+            if (now - m_iLastSubTime < (int64_t)m_uSubInterval)
+                return;
+            m_iLastSubTime = now;
+        }
+
+        if (!m_subRegistry.nextBatch(batch, isSub, m_uSubBatch))
+            return;
+
+        codes.clear();
+        for (const std::string& code : batch)
+        {
+            codes.emplace_back((char*)code.c_str());
+            if (isSub)
+                write_log(m_logger, QLC_SUBSCRIBE, LL_INFO, "[ParserQDP] code:{} ready to sub", code);
+        }
+
+        int iResult = isSub ? m_pUserAPI->SubMarketData(codes.data(), (int)codes.size())
+            : m_pUserAPI->UnSubMarketData(codes.data(), (int)codes.size());
+        if (iResult != 0)
+        {
+            write_log(m_logger, LL_ERROR, "[ParserQDP] Sending md {} request of {} contracts failed: {}",
+                isSub ? "subscribe" : "unsubscribe", codes.size(), iResult);
+            m_subRegistry.restore(batch, isSub);
+            return;
+        }
+
+        write_log(m_logger, LL_INFO, "[ParserQDP] Market data of {} contracts {}, {} contracts subscribed in total",
+            codes.size(), isSub ? "subscribed" : "unsubscribed", m_subRegistry.size());
+    }
+}
+
+ParserQDP::ContractEntry* ParserQDP::resolveContract(const CQdFtdcDepthMarketDataField* pData)
+{
+    return resolveContract(pData->InstrumentID, pData->ExchangeID, pData->InstrumentNo);
+}
+
+ParserQDP::ContractEntry* ParserQDP::resolveContract(const char* code, const char* exchg, int instNo)
+{
+    //InstrumentNo是柜台分配的合约序号，命中的话只需要一次下标访问
+    //序号可能在换日后被重新分配，所以还要比对一下合约代码
+    uint32_t idx = (uint32_t)instNo;
+    if (idx < m_ayContracts.size())
+    {
+        ContractEntry* entry = m_ayContracts[idx];
+        if (entry != NULL && strcmp(entry->_code, code) == 0)
+            return entry;
+    }
+
+    ContractEntry* entry = NULL;
+    auto it = m_mapContracts.find(code);
+    if (it != m_mapContracts.end())
+    {
+        entry = it->second;
+    }
+    else
+    {
+        //基础数据里没有的合约也缓存下来，避免每笔行情都去查一次
+        entry = new ContractEntry();
+        wt_strcpy(entry->_code, code);
+        entry->_contract = m_pBaseDataMgr->getContract(code, exchg);
+        entry->_comm_info = NULL;
+        entry->_vol_scale = 1;
+        entry->_flags = 0;
+        entry->_book = NULL;
+        entry->_last_date = 0;
+        entry->_last_time = 0;
+        entry->_greeks_chain = NULL;
+        entry->_greeks_row = -1;
+        entry->_last_volume = 0;
+        entry->_refill_pending = false;
+        entry->_arb_date = 0;
+        entry->_arb_time = 0;
+        entry->_arb_volume = 0;
+        entry->_arb_packet = 0;
+        entry->_arb_recv = 0;
+        entry->_status = 0;
+        entry->_conflate_idx = -1;
+        entry->_conflate_recv.store(0, std::memory_order_relaxed);
+        entry->_latency = NULL;
+        if (entry->_contract != NULL)
+        {
+            entry->_comm_info = entry->_contract->getCommInfo();
+            wt_strcpy(entry->_exchg, entry->_comm_info->getExchg());
+            entry->_vol_scale = entry->_comm_info->getVolScale();
+            if (strcmp(entry->_exchg, "CZCE") == 0)
+                entry->_flags |= CF_TURNOVER_SCALE;
+
+            if (m_bLatencyPerCode)
+                entry->_latency = m_latency.addScope(fmt::format("{}.{}", entry->_exchg, entry->_code));
+
+            //槽位用完了的合约照常走队列
+            uint32_t slot = m_uConflateCnt.load(std::memory_order_relaxed);
+            if (m_pConflator != NULL && slot < m_pConflator->capacity())
+            {
+                entry->_conflate_idx = (int32_t)slot;
+                m_ayConflated[slot] = entry;
+                m_uConflateCnt.store(slot + 1, std::memory_order_release);
+            }
+        }
         else
-            subscribe[nCount++] = (char*)code.c_str();
-        write_log(m_sink, LL_INFO, "[ParserQDP] code:{} ready to sub", code);
+        {
+            wt_strcpy(entry->_exchg, exchg);
+        }
+        m_mapContracts[code] = entry;
+    }
+
+    //合约序号过大的就不建下标了，只走哈希表
+    static const uint32_t MAX_INSTRUMENT_NO = 1 << 20;
+    if (instNo > 0 && idx < MAX_INSTRUMENT_NO)
+    {
+        if (idx >= m_ayContracts.size())
+            m_ayContracts.resize(idx + 1, NULL);
+        m_ayContracts[idx] = entry;
     }
 
-    if(m_pUserAPI && nCount > 0)
+    return entry;
+}
+
+uint32_t ParserQDP::inferTradingDay(uint32_t cfgDate)
+{
+    // 没有登录就拿不到交易日，优先用配置的交易日
+    // 否则按自然日推算：20点以后算下一个工作日，节假日需要在配置里指定
+    uint32_t tradingDay = cfgDate;
+    if (tradingDay == 0)
     {
-        int iResult = m_pUserAPI->SubMarketData(subscribe, nCount);
-        if(iResult != 0)
+        uint32_t curDate, curTime;
+        TimeUtils::getDateTime(curDate, curTime);
+        tradingDay = curDate;
+        if (curTime / 10000000 >= 20)
         {
-            if(m_sink)
-                write_log(m_sink, LL_ERROR, "[ParserQDP] Sending md subscribe request failed: {}", iResult);
+            tradingDay = TimeUtils::getNextDate(tradingDay);
+            while (TimeUtils::getWeekDay(tradingDay) == 0 || TimeUtils::getWeekDay(tradingDay) == 6)
+                tradingDay = TimeUtils::getNextDate(tradingDay);
         }
+    }
+
+    return tradingDay;
+}
+
+void ParserQDP::setTradingDate(uint32_t tradingDay)
+{
+    // 上一个交易日留下的价位不能带到新的交易日
+    if (m_uTradingDate != 0 && m_uTradingDate != tradingDay)
+        resetBooks();
+
+    m_uTradingDate = tradingDay;
+    m_dateResolver.setTradingDate(tradingDay);
+
+    if (m_bJournal && m_journal.tradingDate() != tradingDay)
+    {
+        if (m_journal.rotate(tradingDay))
+            write_log(m_logger, LL_INFO, "[ParserQDP] Raw journal switched to {}", m_journal.filename(tradingDay));
         else
+            write_log(m_logger, LL_ERROR, "[ParserQDP] Opening raw journal {} failed", m_journal.filename(tradingDay));
+    }
+}
+
+void ParserQDP::activateMultiCast()
+{
+    uint32_t tradingDay = inferTradingDay(m_uMultiTradingDay);
+    setTradingDate(tradingDay);
+
+    std::string strDate = fmt::format("{}", tradingDay);
+    m_pUserAPI->ActiveMultiMarketData((char*)strDate.c_str());
+    m_loginState = LS_LOGINED;
+
+    write_log(m_logger, LL_INFO, "[ParserQDP] Multicast market data activated without login, trading day: {}", tradingDay);
+    if (m_sink)
+        m_sink->handleEvent(WPE_Login, 0);
+}
+
+void ParserQDP::activateShm()
+{
+    uint32_t tradingDay = inferTradingDay(m_uShmTradingDay);
+    setTradingDate(tradingDay);
+    m_loginState = LS_LOGINED;
+
+    write_log(m_logger, LL_INFO, "[ParserQDP] Shared memory market data activated without login, trading day: {}", tradingDay);
+    if (m_sink)
+        m_sink->handleEvent(WPE_Login, 0);
+
+    SubscribeMarketData();
+}
+
+void ParserQDP::addShmCodes(const CodeSet& codes)
+{
+    SpinLock lock(m_mtxShm);
+    for (auto& code : codes)
+    {
+        std::size_t pos = code.find('.');
+        const char* stdCode = (pos != std::string::npos) ? code.c_str() + pos + 1 : code.c_str();
+
+        bool bFound = false;
+        for (const ShmSlot& slot : m_ayShmSlots)
+        {
+            if (strcmp(slot._req.InstrumentID, stdCode) == 0)
+            {
+                bFound = true;
+                break;
+            }
+        }
+
+        if (bFound)
+            continue;
+
+        ShmSlot slot;
+        memset(&slot, 0, sizeof(slot));
+        wt_strcpy(slot._req.InstrumentID, stdCode);
+        wt_strcpy(slot._req.IPAddress, m_strShmIP.c_str());
+        slot._req.TopicID = m_iShmTopic;
+        slot._last_packet = -1;
+        m_ayShmSlots.emplace_back(slot);
+    }
+    m_uShmVersion++;
+
+    write_log(m_logger, LL_INFO, "[ParserQDP] {} contracts in shared memory polling list", m_ayShmSlots.size());
+}
+
+void ParserQDP::removeShmCodes(const CodeSet& codes)
+{
+    SpinLock lock(m_mtxShm);
+    for (auto& code : codes)
+    {
+        std::size_t pos = code.find('.');
+        const char* stdCode = (pos != std::string::npos) ? code.c_str() + pos + 1 : code.c_str();
+        for (auto it = m_ayShmSlots.begin(); it != m_ayShmSlots.end(); it++)
+        {
+            if (strcmp(it->_req.InstrumentID, stdCode) == 0)
+            {
+                m_ayShmSlots.erase(it);
+                break;
+            }
+        }
+    }
+    m_uShmVersion++;
+}
+
+void ParserQDP::startShmPolling()
+{
+    if (m_thrdShm != NULL)
+        return;
+
+    m_bShmRunning = true;
+    m_thrdShm.reset(new StdThread([this]() {
+        if (m_iShmCore >= 0)
+        {
+            if (CpuHelper::bind_core((uint32_t)m_iShmCore))
+                write_log(m_logger, LL_INFO, "[ParserQDP] Shared memory polling thread bound to core {}", m_iShmCore);
+            else
+                write_log(m_logger, LL_WARN, "[ParserQDP] Binding shared memory polling thread to core {} failed", m_iShmCore);
+        }
+
+        while (m_bShmRunning)
+        {
+            if (sweepShm() != 0)
+                continue;
+
+            if (m_uShmInterval > 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(m_uShmInterval));
+            else
+                std::this_thread::yield();
+        }
+    }));
+
+    write_log(m_logger, LL_INFO, "[ParserQDP] Shared memory polling started");
+}
+
+void ParserQDP::stopShmPolling()
+{
+    m_bShmRunning = false;
+    if (m_thrdShm)
+    {
+        m_thrdShm->join();
+        m_thrdShm.reset();
+    }
+}
+
+uint32_t ParserQDP::sweepShm()
+{
+    if (m_pUserAPI == NULL)
+        return 0;
+
+    // 合约列表有变化时在锁里拷一份，轮询和推送都不持有m_mtxShm，不会卡住订阅
+    uint32_t version = m_uShmVersion.load(std::memory_order_acquire);
+    if (version != m_uShmPolled)
+    {
+        std::vector<ShmSlot> slots;
+        {
+            SpinLock lock(m_mtxShm);
+            slots = m_ayShmSlots;
+            version = m_uShmVersion.load(std::memory_order_relaxed);
+        }
+
+        // 原有合约的去重状态沿用
+        wt_hashmap<std::string, const ShmSlot*> polled;
+        for (const ShmSlot& slot : m_ayShmPolling)
+            polled[slot._req.InstrumentID] = &slot;
+
+        for (ShmSlot& slot : slots)
+        {
+            auto it = polled.find(slot._req.InstrumentID);
+            if (it == polled.end())
+                continue;
+
+            slot._last_packet = it->second->_last_packet;
+            slot._last_time = it->second->_last_time;
+            slot._last_volume = it->second->_last_volume;
+        }
+
+        m_ayShmPolling.swap(slots);
+        m_uShmPolled = version;
+    }
+
+    uint32_t cnt = 0;
+    CQdFtdcDepthMarketDataField data;
+    for (ShmSlot& slot : m_ayShmPolling)
+    {
+        memset(&data, 0, sizeof(data));
+        m_pUserAPI->ShmMarketData(&slot._req, &data);
+        if (data.InstrumentID[0] == '\0')
+            continue;
+
+        //有包序号的按包序号判断，没有的按时间和成交量判断
+        uint32_t updateTime = QdpFieldDecoder::decodeTime(data.UpdateTime) * 1000 + data.UpdateMillisec;
+        if (data.PacketNo != 0)
+        {
+            if (data.PacketNo == slot._last_packet)
+                continue;
+        }
+        else if (updateTime == slot._last_time && data.Volume == slot._last_volume)
+        {
+            continue;
+        }
+
+        slot._last_packet = data.PacketNo;
+        slot._last_time = updateTime;
+        slot._last_volume = data.Volume;
+
+        processDepthData(&data);
+        cnt++;
+    }
+
+    return cnt;
+}
+
+void ParserQDP::houseKeeping()
+{
+    int64_t lastReport = TimeUtils::getLocalTimeNow();
+    int64_t lastPipeReport = lastReport;
+    int64_t lastFlush = lastReport;
+    int64_t lastCalibrate = lastReport;
+    int64_t lastLatency = lastReport;
+    while (!m_bStopped)
+    {
+        //TSC和系统时钟每秒对一次，导出按配置的间隔
+        if (m_bLatency)
+        {
+            int64_t now = TimeUtils::getLocalTimeNow();
+            if (now - lastCalibrate >= 1000)
+            {
+                m_latency.calibrate();
+                lastCalibrate = now;
+            }
+
+            if (m_latency.mode() != QdpLatencyMonitor::EM_NONE && now - lastLatency >= (int64_t)m_latency.interval())
+            {
+                m_latency.dump();
+                lastLatency = now;
+            }
+        }
+
+        //msync可能很慢，只在这里做
+        if (m_bJournal)
+        {
+            int64_t now = TimeUtils::getLocalTimeNow();
+            if (now - lastFlush >= (int64_t)m_uJournalFlush)
+            {
+                m_journal.flush();
+                lastFlush = now;
+            }
+        }
+
+        if (m_pPipeline != NULL && m_uPipeReport > 0)
+        {
+            int64_t now = TimeUtils::getLocalTimeNow();
+            if (now - lastPipeReport >= (int64_t)m_uPipeReport * 1000)
+            {
+                reportPipeline();
+                lastPipeReport = now;
+            }
+        }
+
+        if (!m_ayFeeds.empty() && m_uArbReport > 0)
+        {
+            int64_t now = TimeUtils::getLocalTimeNow();
+            if (now - lastReport >= (int64_t)m_uArbReport * 1000)
+            {
+                reportFeeds();
+                lastReport = now;
+            }
+        }
+
+        m_dateResolver.refresh();
+        if (m_bSeqRefill)
+            sendRefills();
+        if (m_uSubInterval > 0)
+            flushSubscriptions();
+        if (m_bWarmStart)
+            sendWarmStart();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+void ParserQDP::reportLatency()
+{
+    QdpLatencyScope& global = m_latency.global();
+    for (uint32_t i = 0; i < LS_COUNT; i++)
+    {
+        QdpLatencySummary summary;
+        global._histos[i].summarize(summary, false);
+        if (summary._count == 0)
+            continue;
+
+        write_log(m_logger, LL_INFO, "[ParserQDP] Latency {}: {} samples, mean {}ns, p50 {}ns, p99 {}ns, p99.9 {}ns, max {}ns",
+            LATENCY_STAGE_NAMES[i], summary._count, summary._sum / summary._count, summary._p50, summary._p99, summary._p999, summary._max);
+    }
+
+    if (m_latency.skewed() > 0)
+        write_log(m_logger, LL_INFO, "[ParserQDP] Latency: {} ticks stamped earlier than exchange time, local clock may be behind", m_latency.skewed());
+}
+
+WTSTickData* ParserQDP::allocTick(ContractEntry* entry)
+{
+    m_uTickCount++;
+
+    TickSlots& slots = entry->_slots;
+    for (WTSTickData* tick : slots)
+    {
+        //只剩池子自己持有引用，说明下游已经用完，可以直接复用
+        if (tick->isSingleRefs())
+        {
+            tick->retain();
+            return tick;
+        }
+    }
+
+    //槽位都被下游占着，只能新分配一个
+    m_uTickAllocs++;
+    WTSTickData* tick = WTSTickData::create(entry->_code);
+    tick->setContractInfo(entry->_contract);
+    wt_strcpy(tick->getTickStruct().exchg, entry->_exchg);
+
+    if (slots.size() < m_uSlotsPerCode)
+    {
+        tick->retain();
+        slots.emplace_back(tick);
+    }
+
+    return tick;
+}
+
+WTSOrdQueData* ParserQDP::allocOrdQue(ContractEntry* entry)
+{
+    OrdQueSlots& slots = entry->_que_slots;
+    for (WTSOrdQueData* ordQue : slots)
+    {
+        if (ordQue->isSingleRefs())
         {
-            if(m_sink)
-                write_log(m_sink, LL_INFO, "[ParserQDP] Market data of {} contracts subscribed in total", nCount);
+            ordQue->retain();
+            return ordQue;
         }
     }
-    delete[] subscribe;
-    m_filterSubs.clear();
+
+    WTSOrdQueData* ordQue = WTSOrdQueData::create(entry->_code);
+    ordQue->setContractInfo(entry->_contract);
+    wt_strcpy(ordQue->getOrdQueStruct().exchg, entry->_exchg);
+
+    if (slots.size() < m_uSlotsPerCode)
+    {
+        ordQue->retain();
+        slots.emplace_back(ordQue);
+    }
+
+    return ordQue;
+}
+
+void ParserQDP::reportTickPool()
+{
+    std::size_t slotCnt = 0;
+    for (auto& item : m_mapContracts)
+        slotCnt += item.second->_slots.size();
+
+    write_log(m_logger, LL_INFO, "[ParserQDP] Tick pool: {} ticks, {} slots of {} contracts, {} allocations in total, {} since last report",
+        m_uTickCount, slotCnt, m_mapContracts.size(), m_uTickAllocs, m_uTickAllocs - m_uLastAllocs);
+    m_uLastAllocs = m_uTickAllocs;
 }
 
 bool ParserQDP::IsErrorRspInfo(CQdFtdcRspInfoField *pRspInfo)
@@ -578,7 +2342,7 @@ bool ParserQDP::IsErrorRspInfo(CQdFtdcRspInfoField *pRspInfo)
     if(pRspInfo && pRspInfo->ErrorID != 0)
     {
         if(m_sink)
-            write_log(m_sink, LL_ERROR, "[ParserQDP] Error response: ErrorID={}, ErrorMsg={}", 
+            write_log(m_logger, LL_ERROR, "[ParserQDP] Error response: ErrorID={}, ErrorMsg={}", 
                      pRspInfo->ErrorID, pRspInfo->ErrorMsg);
         return true;
     }
@@ -11,16 +11,41 @@
 #include "../Includes/IParserApi.h"
 #include "../Share/DLLHelper.hpp"
 #include "../API/QDP7.0.0/QdFtdcMdApi.h"
+#include "../Includes/FasterDefs.h"
+#include "../QDPShare/QdpAsyncLogger.hpp"
+#include "../QDPShare/QdpFieldDecoder.hpp"
+#include "../QDPShare/QdpGreeksStore.hpp"
+#include "../QDPShare/QdpSpscRing.hpp"
+#include "../QDPShare/QdpConflator.hpp"
+#include "../QDPShare/QdpJournal.hpp"
+#include "../QDPShare/QdpLatency.hpp"
+#include "../Share/StdUtils.hpp"
+#include "../Share/SpinMutex.hpp"
+#include "QdpDateResolver.hpp"
+#include "QdpMultiDecoder.hpp"
+#include "QdpPriceLadder.hpp"
+#include "QdpSeqTracker.hpp"
+#include "QdpFeedSession.h"
+#include "QdpSubRegistry.hpp"
+#include "QdpUniverse.hpp"
+#include <atomic>
 #include <map>
+#include <vector>
 
 NS_WTP_BEGIN
+class WTSObject;
 class WTSTickData;
+class WTSContractInfo;
+class WTSCommodityInfo;
 NS_WTP_END
 
 USING_NS_WTP;
 
 class ParserQDP : public IParserApi, public CQdFtdcMduserSpi
 {
+    friend class QdpFeedSession;
+    friend class ParserQDPReplay;
+
 public:
     ParserQDP();
     virtual ~ParserQDP();
@@ -33,6 +58,14 @@ public:
         LS_LOGINED
     };
 
+    // 推给下游的tick在WTSTickStruct::reserve_里带的标记
+    enum TickFlag
+    {
+        TF_SNAPSHOT = 0x01,     //查询回来的快照，不是推送的变化
+        TF_NON_CONTINUOUS = 0x02,   //合约不在连续竞价状态，集合竞价、停牌、收盘等
+        TF_STATE_SHIFT = 8,     //打标记模式下8~15位是合约交易状态（QD_FTDC_IS_xxx）
+    };
+
 // IParserApi 接口
 public:
     virtual bool init(WTSVariant* config) override;
@@ -73,17 +106,208 @@ public:
 
 	virtual void OnRtnMultiDepthMarketData(CQdFtdcDepthMarketDataField *pDepthMarketData) override;
 
+	virtual void OnRtnShfeMultiMarketData(CQdFtdcDepthMarketDataField *pMarketData) override;
+
+	virtual void OnRtnShfeMultiLevel(CQdFtdcShfeMultiLevelField *pShfeMultiLevel) override;
+
+	virtual void OnMultiHeartbeat(char *CurrTime, char *MultiCastIP) override;
+
+	virtual void OnMutiData(char *data, int len) override;
+
+	virtual void OnRtnShfeMultiParameters(CQdFtdcShfeMultiParametersField *pShfeMultiParameters) override;
+
+	virtual void OnRtnMBLMarketData(CQdFtdcMBLMarketDataField *pMBLMarketData) override;
+
+	virtual void OnPackageEnd(int nTopicID, int nSequenceNo) override;
+
+	virtual void OnRtnTenEntrust(CQdFtdcMDTenDepthMarketDataField *pMDTenDepthMarketData) override;
+
+	virtual void OnRtnOptionIndexData(CQdFtdcOptionIndexDataField *pOptionIndexData) override;
+
+	virtual void OnRspQryDepthMarketData(CQdFtdcDepthMarketDataField *pDepthMarketData, CQdFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) override;
+
+	virtual void OnRtnQmdInstrumentStatu(CQdFtdcQmdInstrumentStateField *pQmdInstrumentState) override;
+
+	virtual void OnRspQryInstrumentList(CQdFtdcSpecificInstrumentField *pSpecificInstrument, CQdFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) override;
+
 private:
     /// 发送登录请求
     void ReqUserLogin();
-    /// 订阅行情
+    /// 登录以后重新订阅全部合约
     void SubscribeMarketData();
+    /// 按批次发送待订阅、待退订的合约
+    void flushSubscriptions();
+    /// 按模式发现全市场合约，有当天的缓存就直接用缓存
+    void discoverUniverse();
+    /// 过滤发现的合约并订阅
+    void applyUniverse();
+    /// 行情转换，单播、组播共用，feedIdx是收到行情的线路，0为主线路
+    /// tickFlags是TickFlag的组合，写进tick的reserve_
+    void processDepthData(CQdFtdcDepthMarketDataField *pDepthMarketData, uint32_t feedIdx = 0, uint32_t tickFlags = 0);
+    /// 不登录直接激活组播行情
+    void activateMultiCast();
+    /// 读取行情处理相关的配置，不涉及API实例，回放解析器共用
+    bool initOptions(WTSVariant* config);
+    /// 启动流水线消费线程和定时线程
+    void startWorkers();
+    /// 没有登录时推算交易日
+    uint32_t inferTradingDay(uint32_t cfgDate);
+    /// 切换交易日，日期推算和原始行情日志跟着换
+    void setTradingDate(uint32_t tradingDay);
+    /// 不登录直接开始轮询共享内存行情
+    void activateShm();
+    /// 共享内存轮询的合约增减
+    void addShmCodes(const CodeSet& codes);
+    void removeShmCodes(const CodeSet& codes);
+    /// 启动、停止共享内存轮询线程
+    void startShmPolling();
+    void stopShmPolling();
+    /// 扫描一遍共享内存，返回有变化的合约数
+    uint32_t sweepShm();
+    /// 把有变化的分价盘口作为行情推出去
+    void publishBooks();
+    /// 清空全部分价盘口，断线和换日时调用
+    void resetBooks();
     /// 检查错误信息
     bool IsErrorRspInfo(CQdFtdcRspInfoField *pRspInfo);
-    /// 时间字符串转换
-    uint32_t strToTime(const char* strTime);
     /// 检查数据有效性
     inline double checkValid(double val);
+    typedef std::vector<WTSTickData*> TickSlots;
+    typedef std::vector<WTSOrdQueData*> OrdQueSlots;
+
+    // 交易所相关的处理标记
+    enum ContractFlag
+    {
+        CF_TURNOVER_SCALE = 0x01,   //成交额需要乘以合约乘数（郑商所）
+    };
+
+    // 分价行情合成的全档盘口
+    typedef struct _MBLBook
+    {
+        QdpPriceLadder      _ladder;
+        WTSTickStruct       _snapshot;      //最近一笔快照行情，发布盘口时沿用其中的成交数据
+        bool                _has_snapshot;
+        bool                _dirty;
+    } MBLBook;
+
+    // 合约解析缓存，行情回调里按InstrumentNo直接下标定位
+    typedef struct _ContractEntry
+    {
+        char                _code[MAX_INSTRUMENT_LENGTH];
+        char                _exchg[MAX_EXCHANGE_LENGTH];
+        WTSContractInfo*    _contract;
+        WTSCommodityInfo*   _comm_info;
+        double              _vol_scale;
+        uint32_t            _flags;
+        // tick对象池，每个合约若干个槽位，引用计数回落到1时复用
+        TickSlots           _slots;
+        // 委托队列对象池，买卖两边共用，复用规则和tick池一样
+        OrdQueSlots         _que_slots;
+        // 开启分价行情以后才创建
+        MBLBook*            _book;
+        // 最近一笔推出去的快照的发生日期和时间，委托队列按时间对齐
+        uint32_t            _last_date;
+        uint32_t            _last_time;
+        // 期权合约在希腊值存储里的位置，行号-1表示还没定位，-2表示不是期权或者放不下
+        QdpGreeksChain*     _greeks_chain;
+        int32_t             _greeks_row;
+        // 包序号去重
+        QdpSeqTracker::SeqState _seq;
+        double              _last_volume;
+        bool                _refill_pending;
+        // 多线路仲裁，最近一笔胜出行情的键和收到的时间
+        uint32_t            _arb_date;
+        uint32_t            _arb_time;
+        double              _arb_volume;
+        int32_t             _arb_packet;
+        int64_t             _arb_recv;
+        // 合约交易状态，0表示还没收到过
+        char                _status;
+        // 合并推送的槽位，-1表示不合并
+        int32_t             _conflate_idx;
+        // 合并槽位里最新一笔的收到时间，消费线程取走时算延迟
+        std::atomic<uint64_t>   _conflate_recv;
+        // 合约的延迟统计，没有开按合约统计时为NULL
+        QdpLatencyScope*    _latency;
+    } ContractEntry;
+
+    /// 解析行情对应的合约缓存
+    ContractEntry* resolveContract(const CQdFtdcDepthMarketDataField* pData);
+    ContractEntry* resolveContract(const char* code, const char* exchg, int instNo);
+    /// 把填好的tick推给下游并释放，recvTsc是回调收到的时戳，0表示不统计延迟
+    void dispatchTick(ContractEntry* entry, WTSTickData* tick, uint64_t recvTsc = 0);
+    /// 更新合约交易状态，status为0时保持原状态，返回更新后的状态
+    char updateState(ContractEntry* entry, char status);
+    /// 检查包序号，返回false表示是重复行情
+    bool checkSequence(ContractEntry* entry, const CQdFtdcDepthMarketDataField* pData, uint32_t actTime, uint32_t tickFlags);
+    /// 通道出现缺口以后把该通道的合约加入补查队列
+    void onSequenceGap(int32_t channel);
+    /// 发送一批补查请求，由定时线程调用
+    void sendRefills();
+    /// 分批发送登录后的预热快照查询
+    void sendWarmStart();
+    /// 输出各通道的序号统计
+    void reportSequence();
+    /// 多线路仲裁，返回false表示别的线路已经推过这笔行情
+    bool arbitrate(ContractEntry* entry, uint32_t feedIdx, const CQdFtdcDepthMarketDataField* pData, uint32_t actDate, uint32_t actTime);
+    /// 输出各线路的仲裁统计
+    void reportFeeds();
+
+    // 推给下游的数据类型
+    enum PipelineKind
+    {
+        PK_TICK = 0,
+        PK_ORDQUE
+    };
+
+    typedef struct _PipelineItem
+    {
+        WTSObject*  _data;
+        uint32_t    _kind;
+        uint64_t    _recv;      //回调收到的时戳，0表示不统计延迟
+        ContractEntry*  _entry;
+    } PipelineItem;
+    typedef QdpSpscRing<PipelineItem> PipelineRing;
+    typedef QdpConflator<WTSObject> Conflator;
+
+    /// 推给下游，开了流水线就入队由消费线程回调，否则直接回调，data的引用由这里接管
+    void deliver(WTSObject* data, uint32_t kind, ContractEntry* entry = NULL, uint64_t recvTsc = 0);
+    void deliverNow(const PipelineItem& item);
+    /// 消费线程取走合并槽位里的最新行情，返回推送的笔数
+    uint32_t drainConflated();
+    /// 流水线消费线程
+    void startPipeline();
+    void stopPipeline();
+    void reportPipeline();
+    /// 定位期权合约所在的期权链和行
+    bool locateGreeksRow(ContractEntry* entry);
+    /// 推送一个方向的最优价委托队列
+    void dispatchOrderQueue(ContractEntry* entry, WTSBSDirectType side, double price, const int* qtys, uint32_t actDate, uint32_t actTime);
+    /// 写进reserve_的完整标记，打标记模式下带上合约交易状态
+    uint32_t makeTickFlags(ContractEntry* entry, uint32_t tickFlags);
+    /// 从tick池中取一个已绑定合约的tick对象
+    WTSTickData* allocTick(ContractEntry* entry);
+    /// 从委托队列池中取一个已绑定合约的委托队列对象
+    WTSOrdQueData* allocOrdQue(ContractEntry* entry);
+    /// 输出tick池的分配统计
+    void reportTickPool();
+    /// 输出启动以来的全局延迟统计
+    void reportLatency();
+    /// 后台定时任务
+    void houseKeeping();
+
+    // 组播原始报文解码的回调对象，把记录直接解到tick槽位里
+    struct RawTickHandler
+    {
+        ParserQDP*      _parser;
+        ContractEntry*  _entry;
+        WTSTickData*    _tick;
+        const QdpMultiDecoder::MultiParams* _params;
+        uint64_t        _recv;
+
+        WTSTickStruct* acquire(uint32_t instNo, const QdpMultiDecoder::MultiParams& params);
+        void commit(uint32_t instNo, WTSTickStruct& quote, uint32_t updateTime, uint32_t millisec);
+    };
 
 private:
     uint32_t            m_uTradingDate;
@@ -96,7 +320,18 @@ private:
     std::string         m_strPassword;
     std::string         m_strFlowDir;
 
-    CodeSet             m_filterSubs;
+    // 订阅登记表，订阅、退订按增量分批发送，重新登录后全部重订
+    QdpSubRegistry      m_subRegistry;
+    uint32_t            m_uSubBatch;        //每次SubMarketData的合约数
+    uint32_t            m_uSubInterval;     //两批之间的间隔，单位毫秒，0为不限速
+    int64_t             m_iLastSubTime;
+
+    // 按交易所和品种模式订阅全市场
+    bool                m_bUniverse;
+    bool                m_bUniverseCache;
+    bool                m_bUniverseError;   //本次查询有出错的交易所，不写缓存
+    std::string         m_strUniverseFile;
+    QdpUniverse         m_universe;
 
     int                 m_iRequestID;
 
@@ -106,6 +341,148 @@ private:
     DllHandle           m_hInstQDP;
     typedef CQdFtdcMduserApi* (*QDPCreator)(const char*);
     QDPCreator          m_funcCreator;
+
+    // InstrumentNo下标索引，未命中时按合约代码查哈希表
+    std::vector<ContractEntry*>             m_ayContracts;
+    wt_hashmap<std::string, ContractEntry*> m_mapContracts;
+
+    uint32_t            m_uSlotsPerCode;
+    uint64_t            m_uTickCount;
+    uint64_t            m_uTickAllocs;
+    uint64_t            m_uLastAllocs;
+
+    QdpAsyncLogger      m_logger;
+
+    QdpDateResolver     m_dateResolver;
+    std::atomic<bool>   m_bStopped;
+    StdThreadPtr        m_thrdHouseKeeper;
+
+    // 组播行情
+    bool                m_bMultiCast;
+    bool                m_bMultiNoLogin;
+    uint32_t            m_uMultiLevel;
+    uint32_t            m_uMultiTradingDay;
+    std::vector<std::string>    m_ayMultiAddrs;
+
+    // 自行解析上期所组播原始报文
+    bool                m_bUserFreedom;
+    QdpMultiDecoder     m_multiDecoder;
+
+    // 共享内存行情，轮询线程逐个合约取最新快照
+    typedef struct _ShmSlot
+    {
+        CQdFtdcShmDepthMarketDataField  _req;
+        int                             _last_packet;
+        uint32_t                        _last_time;
+        int                             _last_volume;
+    } ShmSlot;
+
+    bool                m_bShmMode;
+    bool                m_bShmNoLogin;
+    std::string         m_strShmIP;
+    int                 m_iShmTopic;
+    int32_t             m_iShmCore;
+    uint32_t            m_uShmInterval;     //空转时的休眠微秒数，0表示只让出时间片
+    uint32_t            m_uShmTradingDay;
+    std::vector<ShmSlot>    m_ayShmSlots;   //订阅线程增减，由m_mtxShm保护
+    SpinMutex           m_mtxShm;
+    std::atomic<uint32_t>   m_uShmVersion;  //m_ayShmSlots每变一次加1
+    std::vector<ShmSlot>    m_ayShmPolling; //轮询线程自己的副本，带去重状态，不加锁
+    uint32_t            m_uShmPolled;       //副本对应的版本
+    std::atomic<bool>   m_bShmRunning;
+    StdThreadPtr        m_thrdShm;
+
+    // 分价行情盘口
+    bool                m_bMBLBook;
+    bool                m_bMBLPublish;
+    std::vector<ContractEntry*> m_ayDirtyBooks;
+
+    // 最优价前十笔委托队列
+    bool                m_bOrderQueue;
+
+    // 交易所计算的期权希腊值
+    bool                m_bGreeks;
+
+    // 按合约交易状态过滤行情
+    enum StateGate
+    {
+        SG_OFF = 0,     //不跟踪交易状态
+        SG_TAG,         //照常推送，tick上打交易状态标记
+        SG_DROP         //非连续竞价状态的行情在转换前丢掉
+    };
+    uint32_t            m_uStateGate;
+    uint64_t            m_uGatedTicks;
+    uint64_t            m_uStateChanges;
+
+    // 包序号跟踪和缺口补查
+    bool                m_bSeqCheck;
+    bool                m_bSeqRefill;
+    bool                m_bSeqGaps;         //统计通道缺口，只有收全通道行情的线路（组播）才有意义
+    uint32_t            m_uRefillBatch;     //每轮定时任务最多发出的补查请求数
+    uint32_t            m_uRefillCooldown;  //同一通道两次补查的最小间隔，单位秒
+    QdpSeqTracker       m_seqTracker;
+    std::vector<int64_t>        m_ayRefillTimes;
+    std::vector<ContractEntry*> m_ayRefills;
+    SpinMutex           m_mtxApi;           //保护m_pUserAPI，定时线程要用API发请求
+
+    // 登录后查一遍快照预热，不活跃的合约也能马上有盘口
+    bool                m_bWarmStart;
+    uint32_t            m_uWarmBatch;       //每轮定时任务最多发出的预热查询数
+    std::vector<std::string>    m_ayWarmCodes;  //待查询的合约，由m_mtxApi保护
+    uint32_t            m_uWarmTotal;
+
+    // 多线路仲裁，0号线路是自己，备用线路从1开始
+    typedef struct _FeedStat
+    {
+        uint64_t    _wins;      //率先送达的次数
+        uint64_t    _losses;    //晚于其他线路送达的次数
+        uint64_t    _stale;     //比已推出的行情还旧的次数
+        uint64_t    _lag_sum;   //落后时的延迟累计，纳秒
+        uint64_t    _lag_max;
+    } FeedStat;
+
+    // 开了备用线路或者共享内存轮询时才加锁，这时候有多个线程往合约缓存和流水线里写
+    class FeedLock
+    {
+    public:
+        FeedLock(SpinMutex* mtx) :_mtx(mtx) { if (_mtx) _mtx->lock(); }
+        ~FeedLock() { if (_mtx) _mtx->unlock(); }
+    private:
+        SpinMutex*  _mtx;
+    };
+
+    std::vector<QdpFeedSession*>    m_ayFeeds;
+    std::vector<FeedStat>           m_ayFeedStats;
+    bool                m_bArbByPacket;     //按PacketNo仲裁，只有各线路共用同一套包序号时才开，否则按行情时间和成交量
+    uint32_t            m_uArbReport;       //仲裁统计的输出间隔，单位秒
+    SpinMutex           m_mtxFeed;
+    SpinMutex*          m_pFeedMutex;
+
+    // 回调线程和下游之间的流水线，回调线程只入队，消费线程调用IParserSpi
+    PipelineRing*       m_pPipeline;
+    bool                m_bPipeSpin;        //消费线程空转策略，true为忙等，否则逐级退让
+    bool                m_bPipeBlock;       //队列满时回调线程等待，否则丢弃
+    int32_t             m_iPipeCore;
+    uint32_t            m_uPipeReport;      //队列统计的输出间隔，单位秒
+    std::atomic<uint64_t>   m_uPipeDropped;     //多条线路的回调线程都会写，统计用，relaxed即可
+    std::atomic<uint64_t>   m_uPipeStalls;
+    std::atomic<bool>   m_bPipeRunning;
+    StdThreadPtr        m_thrdPipeline;
+
+    // 合并推送，每个合约只保留最新一笔，消费线程按自己的节奏取
+    Conflator*          m_pConflator;
+    std::vector<ContractEntry*> m_ayConflated;  //按槽位下标，容量一次分配好
+    std::atomic<uint32_t>       m_uConflateCnt;
+
+    // 原始行情日志，按交易日一个映射文件，定时线程落盘
+    bool                m_bJournal;
+    uint32_t            m_uJournalFlush;    //落盘间隔，单位毫秒
+    QdpJournalWriter    m_journal;
+
+    // 行情链路的延迟统计，按间隔导出到文件或者共享内存
+    bool                m_bLatency;
+    bool                m_bLatencyPerCode;  //每个合约单独统计，合约多的时候占内存较多
+    QdpLatencyMonitor   m_latency;
 };
 
 // 导出函数
@@ -113,4 +490,6 @@ extern "C"
 {
     EXPORT_FLAG IParserApi* createParser();
     EXPORT_FLAG void deleteParser(IParserApi* &parser);
+    // 期权希腊值存储，同一进程里的策略通过这个接口读取
+    EXPORT_FLAG QdpGreeksStore* getGreeksStore();
 };
\ No newline at end of file
@@ -0,0 +1,121 @@
+/*!
+ * \file QdpDateResolver.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 行情发生日期的解析缓存
+ *
+ * 夜盘行情的TradingDay是下一个交易日，需要换算成自然日
+ * 原来每笔夜盘行情都要读一次系统时间再做日历计算，这里改成由定时线程刷新日历缓存，
+ * 行情线程只做几次整数比较
+ */
+#pragma once
+#include "../Share/TimeUtils.hpp"
+
+#include <atomic>
+#include <stdint.h>
+
+class QdpDateResolver
+{
+public:
+	QdpDateResolver()
+		: _trading_date(0)
+		, _cur_state(0)
+		, _prev_date(0)
+		, _manual(false)
+	{
+	}
+
+public:
+	inline void setTradingDate(uint32_t uDate) { _trading_date = uDate; }
+
+	inline uint32_t getTradingDate() const { return _trading_date; }
+
+	/*
+	 *	改由调用方提供当前时间，回放的时候按录制时的时间推算
+	 */
+	inline void setManual(bool bManual) { _manual = bManual; }
+
+	/*
+	 *	刷新日历缓存，由定时线程调用，日期没变的时候不做日历计算
+	 */
+	void refresh()
+	{
+		if (_manual)
+			return;
+
+		uint32_t curDate, curTime;
+		TimeUtils::getDateTime(curDate, curTime);
+		refreshAt(curDate, curTime);
+	}
+
+	/*
+	 *	按指定的当前时间刷新，curTime为HHMMSSmmm
+	 */
+	void refreshAt(uint32_t curDate, uint32_t curTime)
+	{
+		uint32_t curHour = curTime / 10000000;
+
+		uint64_t oldState = _cur_state.load(std::memory_order_relaxed);
+		if ((uint32_t)oldState != curDate)
+			_prev_date.store(TimeUtils::getNextDate(curDate, -1), std::memory_order_relaxed);
+
+		_cur_state.store(((uint64_t)curHour << 32) | curDate, std::memory_order_release);
+	}
+
+	/*
+	 *	计算行情的发生日期
+	 *	feedDate	行情里的TradingDay
+	 *	calDate		行情里的CalendarDate，没有填为0
+	 *	actHour		行情时间的小时数
+	 *	actDate		[out]发生日期
+	 *	返回false表示这是一笔过期行情，应该丢弃
+	 */
+	inline bool resolve(uint32_t feedDate, uint32_t calDate, uint32_t actHour, uint32_t& actDate) const
+	{
+		actDate = (feedDate == 0) ? _trading_date : feedDate;
+
+		if (actDate == _trading_date && actHour >= 20)
+		{
+			//这样的时间是有问题,因为夜盘时发生日期不可能等于交易日
+			uint64_t state = _cur_state.load(std::memory_order_acquire);
+			uint32_t curDate = (uint32_t)state;
+			uint32_t curHour = (uint32_t)(state >> 32);
+
+			//早上启动以后,会收到昨晚12点以前收盘的行情,这个时候可能会有发生日期=交易日的情况出现
+			//这笔数据直接丢掉
+			if (curHour >= 3 && curHour < 9)
+				return false;
+
+			if (calDate != 0)
+			{
+				//柜台给了自然日就直接用
+				actDate = calDate;
+			}
+			else if (actHour == 23 && curHour == 0)
+			{
+				//行情时间慢于系统时间
+				actDate = _prev_date.load(std::memory_order_relaxed);
+			}
+			else
+			{
+				actDate = curDate;
+			}
+		}
+		else if (calDate != 0)
+		{
+			//过了零点的夜盘，TradingDay仍是下一个交易日，有自然日的话以自然日为准
+			actDate = calDate;
+		}
+
+		return true;
+	}
+
+private:
+	uint32_t				_trading_date;
+	std::atomic<uint64_t>	_cur_state;		//高32位是当前小时，低32位是当前日期
+	std::atomic<uint32_t>	_prev_date;
+	bool					_manual;
+};
@@ -0,0 +1,208 @@
+﻿/*!
+ * \file QdpFeedSession.cpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ * 
+ * \brief QDP备用行情线路实现
+ */
+#include "QdpFeedSession.h"
+#include "ParserQDP.h"
+#include "../Share/StrUtil.hpp"
+#include "../Share/StdUtils.hpp"
+#include "../Includes/WTSVariant.hpp"
+#include "../Share/fmtlib.h"
+
+#include <boost/filesystem.hpp>
+
+QdpFeedSession::QdpFeedSession(ParserQDP* parser, uint32_t feedIdx)
+    : m_pParser(parser)
+    , m_uFeedIdx(feedIdx)
+    , m_pUserAPI(NULL)
+    , m_bMultiCast(false)
+    , m_uMultiLevel(0)
+    , m_bLogined(false)
+    , m_iRequestID(0)
+{
+}
+
+QdpFeedSession::~QdpFeedSession()
+{
+    release();
+}
+
+bool QdpFeedSession::init(WTSVariant* config, const std::string& flowDir)
+{
+    m_strName = config->getCString("name");
+    if (m_strName.empty())
+        m_strName = fmt::format("feed{}", m_uFeedIdx);
+
+    m_strFrontAddr = config->getCString("front");
+
+    WTSVariant* cfgMulti = config->get("multicast");
+    if (cfgMulti != NULL && cfgMulti->getBoolean("active"))
+    {
+        m_bMultiCast = true;
+        m_uMultiLevel = cfgMulti->getUInt32("level");
+
+        WTSVariant* cfgAddrs = cfgMulti->get("addrs");
+        if (cfgAddrs != NULL && cfgAddrs->isArray())
+        {
+            for (uint32_t i = 0; i < cfgAddrs->size(); i++)
+                m_ayMultiAddrs.emplace_back(cfgAddrs->get(i)->asCString());
+        }
+    }
+
+    // 每条线路的流文件必须分开，不然API之间会互相覆盖
+    std::string path = StrUtil::printf("%s/%s/%s/%s/", flowDir.c_str(), m_pParser->m_strBroker.c_str(), m_pParser->m_strUserID.c_str(), m_strName.c_str());
+    if (!StdFile::exists(path.c_str()))
+        boost::filesystem::create_directories(boost::filesystem::path(path));
+
+    m_pUserAPI = m_pParser->m_funcCreator(path.c_str());
+    if (m_pUserAPI == NULL)
+        return false;
+
+    m_pUserAPI->RegisterSpi(this);
+    if (!m_strFrontAddr.empty())
+        m_pUserAPI->RegisterFront((char*)m_strFrontAddr.c_str());
+
+    if (m_bMultiCast)
+    {
+        m_pUserAPI->SetMultiCast(true);
+        for (const std::string& addr : m_ayMultiAddrs)
+            m_pUserAPI->RegTopicMultiAddr((char*)addr.c_str());
+
+        if (m_uMultiLevel > 0)
+            m_pUserAPI->SetMultiLevel(m_uMultiLevel);
+    }
+
+    return true;
+}
+
+void QdpFeedSession::connect()
+{
+    if (m_pUserAPI)
+        m_pUserAPI->Init();
+}
+
+void QdpFeedSession::release()
+{
+    if (m_pUserAPI)
+    {
+        m_pUserAPI->RegisterSpi(NULL);
+        m_pUserAPI->Release();
+        m_pUserAPI = NULL;
+    }
+    m_bLogined = false;
+}
+
+void QdpFeedSession::subscribe(const CodeSet& codes)
+{
+    for (auto& code : codes)
+        m_setCodes.insert(code);
+
+    if (m_bLogined)
+        doSubscribe(codes);
+}
+
+void QdpFeedSession::unsubscribe(const CodeSet& codes)
+{
+    std::vector<char*> unsubscribe;
+    unsubscribe.reserve(codes.size());
+    for (auto& code : codes)
+    {
+        m_setCodes.erase(code);
+
+        std::size_t pos = code.find('.');
+        if (pos != std::string::npos)
+            unsubscribe.emplace_back((char*)code.c_str() + pos + 1);
+        else
+            unsubscribe.emplace_back((char*)code.c_str());
+    }
+
+    if (m_bLogined && m_pUserAPI && !unsubscribe.empty())
+        m_pUserAPI->UnSubMarketData(unsubscribe.data(), (int)unsubscribe.size());
+}
+
+void QdpFeedSession::doSubscribe(const CodeSet& codes)
+{
+    if (m_pUserAPI == NULL || codes.empty())
+        return;
+
+    std::vector<char*> subscribe;
+    subscribe.reserve(codes.size());
+    for (auto& code : codes)
+    {
+        std::size_t pos = code.find('.');
+        if (pos != std::string::npos)
+            subscribe.emplace_back((char*)code.c_str() + pos + 1);
+        else
+            subscribe.emplace_back((char*)code.c_str());
+    }
+
+    int iResult = m_pUserAPI->SubMarketData(subscribe.data(), (int)subscribe.size());
+    if (iResult != 0)
+        m_pParser->m_logger.log(QLC_GENERAL, LL_ERROR, "[ParserQDP] Feed {} sending md subscribe request failed: {}", m_strName, iResult);
+    else
+        m_pParser->m_logger.log(QLC_GENERAL, LL_INFO, "[ParserQDP] Feed {} subscribed market data of {} contracts", m_strName, subscribe.size());
+}
+
+void QdpFeedSession::OnFrontConnected()
+{
+    m_pParser->m_logger.log(QLC_GENERAL, LL_INFO, "[ParserQDP] Feed {} connected", m_strName);
+
+    CQdFtdcReqUserLoginField req;
+    memset(&req, 0, sizeof(req));
+    wt_strcpy(req.BrokerID, m_pParser->m_strBroker.c_str());
+    wt_strcpy(req.UserID, m_pParser->m_strUserID.c_str());
+    wt_strcpy(req.Password, m_pParser->m_strPassword.c_str());
+    strcpy(req.UserProductInfo, "WT");
+
+    int iResult = m_pUserAPI->ReqUserLogin(&req, ++m_iRequestID);
+    if (iResult != 0)
+        m_pParser->m_logger.log(QLC_GENERAL, LL_ERROR, "[ParserQDP] Feed {} sending login request failed: {}", m_strName, iResult);
+}
+
+void QdpFeedSession::OnFrontDisconnected(int nReason)
+{
+    m_bLogined = false;
+    m_pParser->m_logger.log(QLC_GENERAL, LL_ERROR, "[ParserQDP] Feed {} disconnected: {}", m_strName, nReason);
+}
+
+void QdpFeedSession::OnRspUserLogin(CQdFtdcRspUserLoginField *pRspUserLogin, CQdFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
+{
+    if (pRspInfo && pRspInfo->ErrorID != 0)
+    {
+        m_pParser->m_logger.log(QLC_GENERAL, LL_ERROR, "[ParserQDP] Feed {} login failed: ErrorID={}, ErrorMsg={}", m_strName, pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+        return;
+    }
+
+    if (!bIsLast)
+        return;
+
+    m_bLogined = true;
+    m_pParser->m_logger.log(QLC_GENERAL, LL_INFO, "[ParserQDP] Feed {} login successfully, trading day: {}", m_strName, pRspUserLogin->TradingDay);
+    doSubscribe(m_setCodes);
+}
+
+void QdpFeedSession::OnRspError(CQdFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
+{
+    if (pRspInfo && pRspInfo->ErrorID != 0)
+        m_pParser->m_logger.log(QLC_GENERAL, LL_ERROR, "[ParserQDP] Feed {} error response: ErrorID={}, ErrorMsg={}", m_strName, pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+}
+
+void QdpFeedSession::OnRtnDepthMarketData(CQdFtdcDepthMarketDataField *pDepthMarketData)
+{
+    m_pParser->processDepthData(pDepthMarketData, m_uFeedIdx);
+}
+
+void QdpFeedSession::OnRtnMultiDepthMarketData(CQdFtdcDepthMarketDataField *pDepthMarketData)
+{
+    m_pParser->processDepthData(pDepthMarketData, m_uFeedIdx);
+}
+
+void QdpFeedSession::OnRtnShfeMultiMarketData(CQdFtdcDepthMarketDataField *pMarketData)
+{
+    m_pParser->processDepthData(pMarketData, m_uFeedIdx);
+}
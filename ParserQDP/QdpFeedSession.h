@@ -0,0 +1,85 @@
+﻿/*!
+ * \file QdpFeedSession.h
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ * 
+ * \brief QDP备用行情线路
+ *
+ * 多线路仲裁模式下，除了ParserQDP自己的主线路，每条备用线路一个会话，
+ * 各自有独立的API实例、流文件目录和前置（或者组播源），收到的快照行情都交给ParserQDP仲裁
+ */
+#pragma once
+#include "../Includes/IParserApi.h"
+#include "../API/QDP7.0.0/QdFtdcMdApi.h"
+
+#include <string>
+#include <vector>
+
+NS_WTP_BEGIN
+class WTSVariant;
+NS_WTP_END
+
+USING_NS_WTP;
+
+class ParserQDP;
+
+class QdpFeedSession : public CQdFtdcMduserSpi
+{
+public:
+    QdpFeedSession(ParserQDP* parser, uint32_t feedIdx);
+    virtual ~QdpFeedSession();
+
+public:
+    /// 读取线路配置并创建API实例
+    bool init(WTSVariant* config, const std::string& flowDir);
+
+    void connect();
+
+    void release();
+
+    /// 订阅合约，没登录之前先记下来，登录以后一起订阅
+    void subscribe(const CodeSet& codes);
+
+    void unsubscribe(const CodeSet& codes);
+
+    inline uint32_t feedIdx() const { return m_uFeedIdx; }
+
+    inline const char* name() const { return m_strName.c_str(); }
+
+// CQdFtdcMduserSpi 接口
+public:
+    virtual void OnFrontConnected() override;
+
+    virtual void OnFrontDisconnected(int nReason) override;
+
+    virtual void OnRspUserLogin(CQdFtdcRspUserLoginField *pRspUserLogin, CQdFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) override;
+
+    virtual void OnRspError(CQdFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) override;
+
+    virtual void OnRtnDepthMarketData(CQdFtdcDepthMarketDataField *pDepthMarketData) override;
+
+    virtual void OnRtnMultiDepthMarketData(CQdFtdcDepthMarketDataField *pDepthMarketData) override;
+
+    virtual void OnRtnShfeMultiMarketData(CQdFtdcDepthMarketDataField *pMarketData) override;
+
+private:
+    void doSubscribe(const CodeSet& codes);
+
+private:
+    ParserQDP*          m_pParser;
+    uint32_t            m_uFeedIdx;
+    std::string         m_strName;
+
+    CQdFtdcMduserApi*   m_pUserAPI;
+    std::string         m_strFrontAddr;
+
+    bool                m_bMultiCast;
+    uint32_t            m_uMultiLevel;
+    std::vector<std::string>    m_ayMultiAddrs;
+
+    bool                m_bLogined;
+    int                 m_iRequestID;
+    CodeSet             m_setCodes;
+};
@@ -0,0 +1,557 @@
+/*!
+ * \file QdpMultiDecoder.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 上期所组播原始报文解码器
+ *
+ * 开启SetUserFreedom以后，API不再解析组播报文，而是通过OnMutiData把原始报文交给用户
+ * 解码器直接把报文字段写进tick槽位的WTSTickStruct，不再构造中间的CQdFtdcDepthMarketDataField
+ * 价格以OnRtnShfeMultiParameters推送的CodecPrice为基准、PriceTick为单位编码，按InstrumentNo索引
+ *
+ * 报文布局（包头长度、记录长度、每个字段的偏移和类型）由配置给出，需要对照柜台提供的组播报文规范填写：
+ * "rawdecode": {
+ *     "header": 16, "record": 96, "bigendian": false,
+ *     "fields": {
+ *         "instrument_no": {"offset": 0, "type": "u32"},
+ *         "update_time": {"offset": 4, "type": "hhmmss"},
+ *         "last_price": {"offset": 12, "type": "tick32"}, ...
+ *     }
+ * }
+ * 布局写错时解出来的行情看上去仍然像样，所以初始化时严格检查：字段必须给出偏移，类型必须认识，
+ * 不能超出记录长度，字段之间不能重叠，有问题的布局整个拒绝，原因见lastError
+ */
+#pragma once
+#include "../Includes/WTSStruct.h"
+#include "../Includes/WTSVariant.hpp"
+#include "../API/QDP7.0.0/QdFtdcUserApiStruct.h"
+#include "../QDPShare/QdpFieldDecoder.hpp"
+
+#include <vector>
+#include <string>
+#include <string.h>
+#include <stdio.h>
+
+USING_NS_WTP;
+
+class QdpMultiDecoder
+{
+public:
+	// 字段编码类型
+	typedef enum tagFieldType
+	{
+		MFT_INT32 = 0,	//有符号32位整数
+		MFT_UINT32,		//无符号32位整数
+		MFT_INT64,		//有符号64位整数
+		MFT_DOUBLE,		//双精度浮点
+		MFT_TICK32,		//相对CodecPrice的价位数，有符号32位整数
+		MFT_HHMMSS,		//整数形式的时间HHMMSS
+		MFT_TIMESTR		//8字节的HH:MM:SS
+	} FieldType;
+
+	// 字段写入的目标
+	typedef enum tagFieldTarget
+	{
+		MFD_INSTRUMENT_NO = 0,
+		MFD_UPDATE_TIME,
+		MFD_UPDATE_MILLISEC,
+		MFD_LAST_PRICE,
+		MFD_OPEN_PRICE,
+		MFD_HIGHEST_PRICE,
+		MFD_LOWEST_PRICE,
+		MFD_VOLUME,
+		MFD_TURNOVER,
+		MFD_OPEN_INTEREST,
+		MFD_BID_PRICE1,
+		MFD_BID_VOLUME1 = MFD_BID_PRICE1 + 5,
+		MFD_ASK_PRICE1 = MFD_BID_VOLUME1 + 5,
+		MFD_ASK_VOLUME1 = MFD_ASK_PRICE1 + 5,
+		MFD_COUNT = MFD_ASK_VOLUME1 + 5
+	} FieldTarget;
+
+	typedef struct _FieldSpec
+	{
+		uint32_t	_offset;
+		FieldType	_type;
+		FieldTarget	_target;
+	} FieldSpec;
+
+	// 组播静态参数，按InstrumentNo索引
+	typedef struct _MultiParams
+	{
+		char		_code[MAX_INSTRUMENT_LENGTH];
+		uint32_t	_trading_date;
+		double		_codec_price;
+		double		_price_tick;
+		double		_pre_settle;
+		double		_pre_close;
+		double		_pre_interest;
+		double		_upper_limit;
+		double		_lower_limit;
+	} MultiParams;
+
+public:
+	QdpMultiDecoder()
+		: _header_size(0)
+		, _record_size(0)
+		, _big_endian(false)
+		, _instno_spec(NULL)
+		, _records(0)
+		, _unknown(0)
+		, _truncated(0)
+	{
+	}
+
+	~QdpMultiDecoder()
+	{
+		for (MultiParams* params : _params)
+		{
+			if (params)
+				delete params;
+		}
+	}
+
+public:
+	bool init(WTSVariant* cfg)
+	{
+		if (cfg == NULL)
+			return fail("rawdecode config missing");
+
+		if (!setLayout(cfg->getUInt32("header"), cfg->getUInt32("record"), cfg->getBoolean("bigendian")))
+			return false;
+
+		WTSVariant* cfgFields = cfg->get("fields");
+		if (cfgFields == NULL)
+			return fail("no fields configured");
+
+		for (uint32_t i = 0; i < MFD_COUNT; i++)
+		{
+			WTSVariant* cfgItem = cfgFields->get(fieldName((FieldTarget)i));
+			if (cfgItem == NULL)
+				continue;
+
+			if (!cfgItem->has("offset"))
+				return fail(std::string("field ") + fieldName((FieldTarget)i) + " has no offset");
+
+			if (!addField((FieldTarget)i, cfgItem->getUInt32("offset"), cfgItem->getCString("type")))
+				return false;
+		}
+
+		return finish();
+	}
+
+	/*
+	 *	不经过配置直接设置布局，init内部也是按这三步走的
+	 *	setLayout -> addField（每个字段一次） -> finish
+	 */
+	bool setLayout(uint32_t headerSize, uint32_t recordSize, bool bigEndian)
+	{
+		_header_size = headerSize;
+		_record_size = recordSize;
+		_big_endian = bigEndian;
+		_fields.clear();
+		_instno_spec = NULL;
+		if (_record_size == 0)
+			return fail("record size is 0");
+
+		return true;
+	}
+
+	/*
+	 *	typeName为空时按i32处理
+	 */
+	bool addField(FieldTarget target, uint32_t offset, const char* typeName)
+	{
+		FieldSpec spec;
+		spec._offset = offset;
+		spec._target = target;
+		if (!parseType(typeName, spec._type))
+			return fail(std::string("field ") + fieldName(target) + " has unknown type " + typeName);
+
+		uint32_t size = typeSize(spec._type);
+		if ((uint64_t)offset + size > _record_size)
+			return fail(std::string("field ") + fieldName(target) + " at offset " + std::to_string(offset) + " runs past the record size " + std::to_string(_record_size));
+
+		for (const FieldSpec& other : _fields)
+		{
+			if (other._target == target)
+				return fail(std::string("field ") + fieldName(target) + " configured twice");
+
+			if (offset < other._offset + typeSize(other._type) && other._offset < offset + size)
+				return fail(std::string("field ") + fieldName(target) + " overlaps " + fieldName(other._target));
+		}
+
+		_fields.emplace_back(spec);
+		return true;
+	}
+
+	bool finish()
+	{
+		//合约序号是必须的，单独拎出来先读
+		_instno_spec = NULL;
+		for (FieldSpec& spec : _fields)
+		{
+			if (spec._target == MFD_INSTRUMENT_NO)
+				_instno_spec = &spec;
+		}
+
+		if (_instno_spec == NULL)
+			return fail("field instrument_no is required");
+
+		if (_instno_spec->_type == MFT_DOUBLE || _instno_spec->_type == MFT_TICK32 || _instno_spec->_type == MFT_TIMESTR)
+			return fail("field instrument_no must be an integer");
+
+		return true;
+	}
+
+	inline const std::string& lastError() const { return _error; }
+	inline uint32_t headerSize() const { return _header_size; }
+	inline uint32_t recordSize() const { return _record_size; }
+
+	static const char* fieldName(FieldTarget target)
+	{
+		static const char* FIELD_NAMES[MFD_COUNT] = {
+			"instrument_no", "update_time", "update_millisec", "last_price",
+			"open_price", "highest_price", "lowest_price", "volume", "turnover", "open_interest",
+			"bid_price1", "bid_price2", "bid_price3", "bid_price4", "bid_price5",
+			"bid_volume1", "bid_volume2", "bid_volume3", "bid_volume4", "bid_volume5",
+			"ask_price1", "ask_price2", "ask_price3", "ask_price4", "ask_price5",
+			"ask_volume1", "ask_volume2", "ask_volume3", "ask_volume4", "ask_volume5"
+		};
+		return FIELD_NAMES[target];
+	}
+
+	/*
+	 *	登记组播静态参数
+	 */
+	void addParameters(const CQdFtdcShfeMultiParametersField* pParams)
+	{
+		if (pParams->InstrumentNo <= 0)
+			return;
+
+		uint32_t idx = (uint32_t)pParams->InstrumentNo;
+		if (idx >= _params.size())
+			_params.resize(idx + 1, NULL);
+
+		MultiParams* params = _params[idx];
+		if (params == NULL)
+		{
+			params = new MultiParams();
+			_params[idx] = params;
+		}
+
+		strncpy(params->_code, pParams->InstrumentID, MAX_INSTRUMENT_LENGTH - 1);
+		params->_code[MAX_INSTRUMENT_LENGTH - 1] = '\0';
+		params->_trading_date = QdpFieldDecoder::decodeDate(pParams->TradingDay);
+		params->_codec_price = pParams->CodecPrice;
+		params->_price_tick = pParams->PriceTick;
+		params->_pre_settle = pParams->PreSettlementPrice;
+		params->_pre_close = pParams->PreClosePrice;
+		params->_pre_interest = pParams->PreOpenInterest;
+		params->_upper_limit = pParams->UpperLimitPrice;
+		params->_lower_limit = pParams->LowerLimitPrice;
+	}
+
+	inline const MultiParams* getParams(uint32_t instNo) const
+	{
+		return (instNo < _params.size()) ? _params[instNo] : NULL;
+	}
+
+	/*
+	 *	解码一个组播报文
+	 *	handler需要实现两个方法：
+	 *	WTSTickStruct* acquire(uint32_t instNo, const MultiParams& params)	取一个tick槽位，返回NULL跳过该记录
+	 *	void commit(uint32_t instNo, WTSTickStruct& quote, uint32_t updateTime, uint32_t millisec)	记录解码完成
+	 *	返回解出的记录数
+	 */
+	template<typename Handler>
+	uint32_t decode(const char* data, int len, Handler& handler)
+	{
+		if (_instno_spec == NULL || len <= (int)_header_size)
+			return 0;
+
+		//末尾不够一条记录的部分不解，说明报文长度和配置的布局对不上
+		if ((len - _header_size) % _record_size != 0)
+			_truncated++;
+
+		uint32_t cnt = 0;
+		const char* end = data + len;
+		for (const char* rec = data + _header_size; rec + _record_size <= end; rec += _record_size)
+		{
+			uint32_t instNo = (uint32_t)readInt(rec + _instno_spec->_offset, _instno_spec->_type);
+			const MultiParams* params = getParams(instNo);
+			if (params == NULL)
+			{
+				_unknown++;
+				continue;
+			}
+
+			WTSTickStruct* quote = handler.acquire(instNo, *params);
+			if (quote == NULL)
+				continue;
+
+			quote->pre_settle = params->_pre_settle;
+			quote->pre_close = params->_pre_close;
+			quote->pre_interest = params->_pre_interest;
+			quote->upper_limit = params->_upper_limit;
+			quote->lower_limit = params->_lower_limit;
+
+			uint32_t updateTime = 0;
+			uint32_t millisec = 0;
+			for (const FieldSpec& spec : _fields)
+			{
+				const char* p = rec + spec._offset;
+				switch (spec._target)
+				{
+				case MFD_INSTRUMENT_NO:
+					break;
+				case MFD_UPDATE_TIME:
+					updateTime = (spec._type == MFT_TIMESTR) ? QdpFieldDecoder::decodeTime(p) : (uint32_t)readInt(p, spec._type);
+					break;
+				case MFD_UPDATE_MILLISEC:
+					millisec = (uint32_t)readInt(p, spec._type);
+					break;
+				case MFD_LAST_PRICE: quote->price = readPrice(p, spec._type, *params); break;
+				case MFD_OPEN_PRICE: quote->open = readPrice(p, spec._type, *params); break;
+				case MFD_HIGHEST_PRICE: quote->high = readPrice(p, spec._type, *params); break;
+				case MFD_LOWEST_PRICE: quote->low = readPrice(p, spec._type, *params); break;
+				case MFD_VOLUME: quote->total_volume = readNumber(p, spec._type); break;
+				case MFD_TURNOVER: quote->total_turnover = readNumber(p, spec._type); break;
+				case MFD_OPEN_INTEREST: quote->open_interest = readNumber(p, spec._type); break;
+				default:
+					{
+						uint32_t level = (spec._target - MFD_BID_PRICE1) % 5;
+						if (spec._target < MFD_BID_VOLUME1)
+							quote->bid_prices[level] = readPrice(p, spec._type, *params);
+						else if (spec._target < MFD_ASK_PRICE1)
+							quote->bid_qty[level] = readNumber(p, spec._type);
+						else if (spec._target < MFD_ASK_VOLUME1)
+							quote->ask_prices[level] = readPrice(p, spec._type, *params);
+						else
+							quote->ask_qty[level] = readNumber(p, spec._type);
+					}
+					break;
+				}
+			}
+
+			handler.commit(instNo, *quote, updateTime, millisec);
+			cnt++;
+		}
+
+		_records += cnt;
+		return cnt;
+	}
+
+	/*
+	 *	按布局把一条行情写成报文记录，是decode的逆过程，用于测试和生成模拟报文
+	 *	rec至少要有recordSize()个字节，布局里没有的字段不写
+	 */
+	void encode(char* rec, uint32_t instNo, const WTSTickStruct& quote, uint32_t updateTime, uint32_t millisec, const MultiParams& params) const
+	{
+		for (const FieldSpec& spec : _fields)
+		{
+			char* p = rec + spec._offset;
+			switch (spec._target)
+			{
+			case MFD_INSTRUMENT_NO: writeInt(p, spec._type, instNo); break;
+			case MFD_UPDATE_TIME:
+				if (spec._type == MFT_TIMESTR)
+				{
+					char buf[16];
+					snprintf(buf, sizeof(buf), "%02u:%02u:%02u", updateTime / 10000, updateTime / 100 % 100, updateTime % 100);
+					memcpy(p, buf, 8);
+				}
+				else
+				{
+					writeInt(p, spec._type, updateTime);
+				}
+				break;
+			case MFD_UPDATE_MILLISEC: writeInt(p, spec._type, millisec); break;
+			case MFD_LAST_PRICE: writePrice(p, spec._type, quote.price, params); break;
+			case MFD_OPEN_PRICE: writePrice(p, spec._type, quote.open, params); break;
+			case MFD_HIGHEST_PRICE: writePrice(p, spec._type, quote.high, params); break;
+			case MFD_LOWEST_PRICE: writePrice(p, spec._type, quote.low, params); break;
+			case MFD_VOLUME: writeNumber(p, spec._type, quote.total_volume); break;
+			case MFD_TURNOVER: writeNumber(p, spec._type, quote.total_turnover); break;
+			case MFD_OPEN_INTEREST: writeNumber(p, spec._type, quote.open_interest); break;
+			default:
+				{
+					uint32_t level = (spec._target - MFD_BID_PRICE1) % 5;
+					if (spec._target < MFD_BID_VOLUME1)
+						writePrice(p, spec._type, quote.bid_prices[level], params);
+					else if (spec._target < MFD_ASK_PRICE1)
+						writeNumber(p, spec._type, quote.bid_qty[level]);
+					else if (spec._target < MFD_ASK_VOLUME1)
+						writePrice(p, spec._type, quote.ask_prices[level], params);
+					else
+						writeNumber(p, spec._type, quote.ask_qty[level]);
+				}
+				break;
+			}
+		}
+	}
+
+	inline uint64_t records() const { return _records; }
+	inline uint64_t unknown() const { return _unknown; }
+	inline uint64_t truncated() const { return _truncated; }
+
+private:
+	inline bool fail(const std::string& error)
+	{
+		_error = error;
+		return false;
+	}
+
+	static bool parseType(const char* name, FieldType& ft)
+	{
+		if (name == NULL || name[0] == '\0' || strcmp(name, "i32") == 0) ft = MFT_INT32;
+		else if (strcmp(name, "u32") == 0) ft = MFT_UINT32;
+		else if (strcmp(name, "i64") == 0) ft = MFT_INT64;
+		else if (strcmp(name, "f64") == 0) ft = MFT_DOUBLE;
+		else if (strcmp(name, "tick32") == 0) ft = MFT_TICK32;
+		else if (strcmp(name, "hhmmss") == 0) ft = MFT_HHMMSS;
+		else if (strcmp(name, "timestr") == 0) ft = MFT_TIMESTR;
+		else return false;
+		return true;
+	}
+
+	static uint32_t typeSize(FieldType ft)
+	{
+		switch (ft)
+		{
+		case MFT_INT64:
+		case MFT_DOUBLE:
+		case MFT_TIMESTR:
+			return 8;
+		default:
+			return 4;
+		}
+	}
+
+	inline uint32_t load32(const char* p) const
+	{
+		uint32_t v;
+		memcpy(&v, p, 4);
+		if (_big_endian)
+			v = ((v & 0xFF) << 24) | ((v & 0xFF00) << 8) | ((v >> 8) & 0xFF00) | (v >> 24);
+		return v;
+	}
+
+	inline uint64_t load64(const char* p) const
+	{
+		uint64_t v;
+		memcpy(&v, p, 8);
+		if (_big_endian)
+		{
+			uint64_t r = 0;
+			for (int i = 0; i < 8; i++)
+				r = (r << 8) | ((v >> (i * 8)) & 0xFF);
+			v = r;
+		}
+		return v;
+	}
+
+	inline void store32(char* p, uint32_t v) const
+	{
+		if (_big_endian)
+			v = ((v & 0xFF) << 24) | ((v & 0xFF00) << 8) | ((v >> 8) & 0xFF00) | (v >> 24);
+		memcpy(p, &v, 4);
+	}
+
+	inline void store64(char* p, uint64_t v) const
+	{
+		if (_big_endian)
+		{
+			uint64_t r = 0;
+			for (int i = 0; i < 8; i++)
+				r = (r << 8) | ((v >> (i * 8)) & 0xFF);
+			v = r;
+		}
+		memcpy(p, &v, 8);
+	}
+
+	inline void writeNumber(char* p, FieldType ft, double v) const
+	{
+		switch (ft)
+		{
+		case MFT_DOUBLE:
+			{
+				uint64_t u;
+				memcpy(&u, &v, 8);
+				store64(p, u);
+			}
+			break;
+		case MFT_INT64: store64(p, (uint64_t)(int64_t)v); break;
+		case MFT_UINT32: store32(p, (uint32_t)v); break;
+		default: store32(p, (uint32_t)(int32_t)v); break;
+		}
+	}
+
+	inline void writeInt(char* p, FieldType ft, int64_t v) const
+	{
+		writeNumber(p, ft, (double)v);
+	}
+
+	inline void writePrice(char* p, FieldType ft, double price, const MultiParams& params) const
+	{
+		if (ft == MFT_TICK32)
+		{
+			double ticks = (price - params._codec_price) / params._price_tick;
+			store32(p, (uint32_t)(int32_t)(ticks < 0 ? ticks - 0.5 : ticks + 0.5));
+			return;
+		}
+		writeNumber(p, ft, price);
+	}
+
+	inline int64_t readInt(const char* p, FieldType ft) const
+	{
+		switch (ft)
+		{
+		case MFT_UINT32: return load32(p);
+		case MFT_INT64: return (int64_t)load64(p);
+		case MFT_DOUBLE:
+			{
+				uint64_t u = load64(p);
+				double d;
+				memcpy(&d, &u, 8);
+				return (int64_t)d;
+			}
+		default: return (int32_t)load32(p);
+		}
+	}
+
+	inline double readNumber(const char* p, FieldType ft) const
+	{
+		if (ft == MFT_DOUBLE)
+		{
+			uint64_t u = load64(p);
+			double d;
+			memcpy(&d, &u, 8);
+			return d;
+		}
+		return (double)readInt(p, ft);
+	}
+
+	inline double readPrice(const char* p, FieldType ft, const MultiParams& params) const
+	{
+		if (ft == MFT_TICK32)
+			return params._codec_price + (int32_t)load32(p) * params._price_tick;
+		return readNumber(p, ft);
+	}
+
+private:
+	uint32_t					_header_size;
+	uint32_t					_record_size;
+	bool						_big_endian;
+	std::vector<FieldSpec>		_fields;
+	const FieldSpec*			_instno_spec;
+	std::vector<MultiParams*>	_params;
+
+	std::string					_error;
+
+	uint64_t					_records;
+	uint64_t					_unknown;
+	uint64_t					_truncated;
+};
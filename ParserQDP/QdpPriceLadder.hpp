@@ -0,0 +1,357 @@
+/*!
+ * \file QdpPriceLadder.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 分价行情的价位阶梯
+ *
+ * 以基准价为0点，按最小变动价位把价格换算成整数下标，每个方向一个连续的数量数组
+ * 分价行情的增量更新只是一次下标写入，另外用位图记录有量的价位，
+ * 最优价被撤空以后按64位字扫描找下一个有量价位
+ */
+#pragma once
+#include "../Includes/WTSStruct.h"
+
+#include <vector>
+#include <initializer_list>
+#include <math.h>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+USING_NS_WTP;
+
+class QdpPriceLadder
+{
+private:
+	static inline int32_t highest_bit(uint64_t v)
+	{
+#ifdef _MSC_VER
+		unsigned long idx;
+		_BitScanReverse64(&idx, v);
+		return (int32_t)idx;
+#else
+		return 63 - __builtin_clzll(v);
+#endif
+	}
+
+	static inline int32_t lowest_bit(uint64_t v)
+	{
+#ifdef _MSC_VER
+		unsigned long idx;
+		_BitScanForward64(&idx, v);
+		return (int32_t)idx;
+#else
+		return __builtin_ctzll(v);
+#endif
+	}
+
+	typedef struct _LadderSide
+	{
+		std::vector<uint32_t>	_qty;
+		std::vector<uint64_t>	_bits;
+		int32_t					_best;
+
+		_LadderSide() :_best(-1) {}
+
+		inline void set(int32_t idx, uint32_t qty)
+		{
+			_qty[idx] = qty;
+			if (qty > 0)
+				_bits[idx >> 6] |= (1ULL << (idx & 63));
+			else
+				_bits[idx >> 6] &= ~(1ULL << (idx & 63));
+		}
+
+		/*
+		 *	下标小于from的最高有量价位，没有返回-1
+		 */
+		inline int32_t prev(int32_t from) const
+		{
+			if (from <= 0)
+				return -1;
+
+			int32_t word = (from - 1) >> 6;
+			uint32_t bit = (uint32_t)((from - 1) & 63);
+			uint64_t mask = (bit == 63) ? _bits[word] : (_bits[word] & ((1ULL << (bit + 1)) - 1));
+			for (;;)
+			{
+				if (mask)
+					return (word << 6) + highest_bit(mask);
+				if (--word < 0)
+					return -1;
+				mask = _bits[word];
+			}
+		}
+
+		/*
+		 *	下标大于from的最低有量价位，没有返回-1
+		 */
+		inline int32_t next(int32_t from) const
+		{
+			int32_t start = from + 1;
+			int32_t words = (int32_t)_bits.size();
+			int32_t word = start >> 6;
+			if (word >= words)
+				return -1;
+
+			uint64_t mask = _bits[word] & (~0ULL << (start & 63));
+			for (;;)
+			{
+				if (mask)
+					return (word << 6) + lowest_bit(mask);
+				if (++word >= words)
+					return -1;
+				mask = _bits[word];
+			}
+		}
+	} LadderSide;
+
+public:
+	QdpPriceLadder()
+		: _tick(0)
+		, _base(0)
+		, _size(0)
+		, _update_time(0)
+	{
+	}
+
+	inline bool ready() const { return _size > 0; }
+
+	inline uint32_t updateTime() const { return _update_time; }
+
+	inline uint32_t size() const { return _size; }
+
+	/*
+	 *	priceTick	最小变动价位
+	 */
+	inline void init(double priceTick) { _tick = priceTick; }
+
+	/*
+	 *	清空所有价位，断线期间撤掉的价位和上一个交易日的价位不会再有增量来清，只能整个丢掉
+	 *	下一笔行情按新的涨跌停价或者价格重新建阶梯
+	 */
+	void reset()
+	{
+		for (LadderSide* side : { &_bids, &_asks })
+		{
+			side->_qty.clear();
+			side->_bits.clear();
+			side->_best = -1;
+		}
+		_base = 0;
+		_size = 0;
+		_update_time = 0;
+	}
+
+	/*
+	 *	保证[lowPrice, highPrice]都在阶梯范围内，一般用涨跌停价
+	 */
+	void ensureRange(double lowPrice, double highPrice)
+	{
+		if (_tick <= 0 || lowPrice <= 0 || highPrice < lowPrice)
+			return;
+
+		if (!ready())
+		{
+			rebuild(lowPrice, (uint32_t)llround((highPrice - lowPrice) / _tick) + 1);
+			return;
+		}
+
+		int64_t lowIdx = toIndex(lowPrice);
+		int64_t highIdx = toIndex(highPrice);
+		if (lowIdx < 0 || highIdx >= (int64_t)_size)
+			extend(lowIdx, highIdx);
+	}
+
+	/*
+	 *	应用一条分价行情增量
+	 *	isBuy		是否买方向
+	 *	qty			该价位的最新总量，0表示价位撤空
+	 *	updateTime	HHMMSSmmm
+	 */
+	void apply(bool isBuy, double price, uint32_t qty, uint32_t updateTime)
+	{
+		if (_tick <= 0 || price <= 0)
+			return;
+
+		//没有涨跌停价的时候以第一笔价格为中心先建一段
+		if (!ready())
+			rebuild(price - DEFAULT_SPAN * _tick, DEFAULT_SPAN * 2 + 1);
+
+		int64_t idx = toIndex(price);
+		if (idx < 0 || idx >= (int64_t)_size)
+		{
+			extend(idx, idx);
+			idx = toIndex(price);
+			if (idx < 0 || idx >= (int64_t)_size)
+				return;
+		}
+
+		_update_time = updateTime;
+		int32_t i = (int32_t)idx;
+		if (isBuy)
+		{
+			LadderSide& side = _bids;
+			side.set(i, qty);
+			if (qty > 0 && i > side._best)
+				side._best = i;
+			else if (qty == 0 && i == side._best)
+				side._best = side.prev(i);
+		}
+		else
+		{
+			LadderSide& side = _asks;
+			side.set(i, qty);
+			if (qty > 0 && (side._best < 0 || i < side._best))
+				side._best = i;
+			else if (qty == 0 && i == side._best)
+				side._best = side.next(i);
+		}
+	}
+
+	/*
+	 *	从最优价开始填充depth档，返回实际填充的档数（两边取大）
+	 */
+	uint32_t fillTop(WTSTickStruct& quote, uint32_t depth) const
+	{
+		return fillSides(quote, 0, _bids._best, _asks._best, depth);
+	}
+
+	/*
+	 *	快照已经给了前fromLevel档，按第fromLevel档的价格向后续档，返回续上的档数
+	 */
+	uint32_t fillBeyond(WTSTickStruct& quote, uint32_t fromLevel, uint32_t depth) const
+	{
+		if (!ready() || fromLevel == 0 || fromLevel >= depth)
+			return 0;
+
+		int32_t bidStart = -1;
+		double lastBid = quote.bid_prices[fromLevel - 1];
+		if (lastBid > 0)
+		{
+			int64_t idx = toIndex(lastBid);
+			if (idx >= 0 && idx < (int64_t)_size)
+				bidStart = _bids.prev((int32_t)idx);
+		}
+
+		int32_t askStart = -1;
+		double lastAsk = quote.ask_prices[fromLevel - 1];
+		if (lastAsk > 0)
+		{
+			int64_t idx = toIndex(lastAsk);
+			if (idx >= 0 && idx < (int64_t)_size)
+				askStart = _asks.next((int32_t)idx);
+		}
+
+		return fillSides(quote, fromLevel, bidStart, askStart, depth);
+	}
+
+private:
+	static const uint32_t DEFAULT_SPAN = 512;
+
+	inline int64_t toIndex(double price) const
+	{
+		return llround((price - _base) / _tick);
+	}
+
+	inline double toPrice(int32_t idx) const
+	{
+		return _base + idx * _tick;
+	}
+
+	uint32_t fillSides(WTSTickStruct& quote, uint32_t fromLevel, int32_t bidIdx, int32_t askIdx, uint32_t depth) const
+	{
+		uint32_t bidCnt = 0, askCnt = 0;
+		for (uint32_t lv = fromLevel; lv < depth; lv++)
+		{
+			if (bidIdx >= 0)
+			{
+				quote.bid_prices[lv] = toPrice(bidIdx);
+				quote.bid_qty[lv] = _bids._qty[bidIdx];
+				bidIdx = _bids.prev(bidIdx);
+				bidCnt++;
+			}
+			else
+			{
+				quote.bid_prices[lv] = 0;
+				quote.bid_qty[lv] = 0;
+			}
+
+			if (askIdx >= 0)
+			{
+				quote.ask_prices[lv] = toPrice(askIdx);
+				quote.ask_qty[lv] = _asks._qty[askIdx];
+				askIdx = _asks.next(askIdx);
+				askCnt++;
+			}
+			else
+			{
+				quote.ask_prices[lv] = 0;
+				quote.ask_qty[lv] = 0;
+			}
+		}
+
+		return (bidCnt > askCnt) ? bidCnt : askCnt;
+	}
+
+	void rebuild(double basePrice, uint32_t size)
+	{
+		_base = basePrice;
+		_size = ((size + 63) >> 6) << 6;
+		for (LadderSide* side : { &_bids, &_asks })
+		{
+			side->_qty.assign(_size, 0);
+			side->_bits.assign(_size >> 6, 0);
+			side->_best = -1;
+		}
+	}
+
+	/*
+	 *	价格超出阶梯范围时扩展，已有的价位整体平移，很少发生
+	 */
+	void extend(int64_t lowIdx, int64_t highIdx)
+	{
+		int64_t newLow = (lowIdx < 0) ? lowIdx - DEFAULT_SPAN : 0;
+		int64_t newHigh = (highIdx >= (int64_t)_size) ? highIdx + DEFAULT_SPAN : (int64_t)_size - 1;
+		//基准价不能低于一个价位
+		while (newLow < 0 && _base + newLow * _tick < _tick)
+			newLow++;
+
+		uint32_t shift = (uint32_t)(-newLow);
+		uint32_t newSize = ((uint32_t)(newHigh - newLow + 1 + 63) >> 6) << 6;
+		for (LadderSide* side : { &_bids, &_asks })
+		{
+			std::vector<uint32_t> qty(newSize, 0);
+			for (uint32_t i = 0; i < _size; i++)
+				qty[i + shift] = side->_qty[i];
+
+			side->_qty.swap(qty);
+			side->_bits.assign(newSize >> 6, 0);
+			for (uint32_t i = 0; i < newSize; i++)
+			{
+				if (side->_qty[i] > 0)
+					side->_bits[i >> 6] |= (1ULL << (i & 63));
+			}
+
+			if (side->_best >= 0)
+				side->_best += shift;
+		}
+
+		_base += newLow * _tick;
+		_size = newSize;
+	}
+
+private:
+	double		_tick;
+	double		_base;
+	uint32_t	_size;
+	uint32_t	_update_time;
+
+	LadderSide	_bids;
+	LadderSide	_asks;
+};
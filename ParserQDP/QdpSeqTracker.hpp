@@ -0,0 +1,125 @@
+/*!
+ * \file QdpSeqTracker.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 行情包序号跟踪
+ *
+ * 按DataCenterID分通道跟踪PacketNo：
+ * 通道内序号跳号记为缺口，合约收到不大于上次序号的行情记为重复
+ * 单播和组播同时开启时同一笔行情会回调两次，靠这个去掉重复的那一笔
+ * 序号大幅回退视为通道重新编号（换日或者行情服务重启），此后的序号重新开始比较
+ * 缺口是按整个通道的序号算的，只订阅了部分合约的TCP会话本来就收不全通道的包，
+ * 这种线路只能用来去重，不能统计缺口
+ */
+#pragma once
+#include "../Share/TimeUtils.hpp"
+
+#include <vector>
+#include <stdint.h>
+
+class QdpSeqTracker
+{
+public:
+	typedef enum tagSeqCheck
+	{
+		SC_NEW = 0,		//新行情
+		SC_DUPLICATE,	//重复行情，应该丢弃
+		SC_GAP			//新行情，但是通道前面有缺口
+	} SeqCheck;
+
+	/*
+	 *	每个合约的序号状态，放在合约缓存里
+	 */
+	typedef struct _SeqState
+	{
+		int32_t		_channel;
+		uint32_t	_epoch;
+		int32_t		_packet;
+
+		_SeqState() :_channel(-1), _epoch(0), _packet(0) {}
+	} SeqState;
+
+	typedef struct _ChannelStat
+	{
+		int32_t		_max_packet;
+		uint32_t	_epoch;
+		uint64_t	_packets;
+		uint64_t	_duplicates;
+		uint64_t	_gaps;
+		uint64_t	_missing;
+		uint64_t	_resets;
+		int64_t		_last_gap_time;
+		int32_t		_last_gap_from;
+		int32_t		_last_gap_to;
+
+		_ChannelStat()
+			: _max_packet(0), _epoch(0), _packets(0), _duplicates(0), _gaps(0), _missing(0), _resets(0)
+			, _last_gap_time(0), _last_gap_from(0), _last_gap_to(0)
+		{
+		}
+	} ChannelStat;
+
+public:
+	/*
+	 *	检查一笔行情的序号
+	 *	state		合约的序号状态，新行情会被更新
+	 *	channel		DataCenterID
+	 *	packetNo	PacketNo
+	 *	gapCheck	是否统计缺口，收不全通道的线路和查询回来的快照传false
+	 */
+	SeqCheck check(SeqState& state, int32_t channel, int32_t packetNo, bool gapCheck = true)
+	{
+		if (channel < 0 || channel >= MAX_CHANNELS)
+			channel = 0;
+
+		if (channel >= (int32_t)_channels.size())
+			_channels.resize(channel + 1);
+
+		ChannelStat& ch = _channels[channel];
+		if (ch._max_packet > RESET_WINDOW && packetNo < ch._max_packet - RESET_WINDOW)
+		{
+			ch._epoch++;
+			ch._resets++;
+			ch._max_packet = 0;
+		}
+
+		if (state._channel == channel && state._epoch == ch._epoch && packetNo <= state._packet)
+		{
+			ch._duplicates++;
+			return SC_DUPLICATE;
+		}
+
+		SeqCheck ret = SC_NEW;
+		if (gapCheck && ch._max_packet > 0 && packetNo > ch._max_packet + 1)
+		{
+			ch._gaps++;
+			ch._missing += (uint32_t)(packetNo - ch._max_packet - 1);
+			ch._last_gap_time = TimeUtils::getLocalTimeNow();
+			ch._last_gap_from = ch._max_packet + 1;
+			ch._last_gap_to = packetNo - 1;
+			ret = SC_GAP;
+		}
+
+		if (packetNo > ch._max_packet)
+			ch._max_packet = packetNo;
+
+		ch._packets++;
+		state._channel = channel;
+		state._epoch = ch._epoch;
+		state._packet = packetNo;
+		return ret;
+	}
+
+	inline uint32_t channelCount() const { return (uint32_t)_channels.size(); }
+
+	inline const ChannelStat& channel(uint32_t idx) const { return _channels[idx]; }
+
+private:
+	static const int32_t MAX_CHANNELS = 1024;
+	static const int32_t RESET_WINDOW = 100000;
+
+	std::vector<ChannelStat>	_channels;
+};
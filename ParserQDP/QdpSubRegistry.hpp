@@ -0,0 +1,151 @@
+/*!
+ * \file QdpSubRegistry.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 行情订阅登记表
+ *
+ * 登记表保存全部已订阅的合约，订阅、退订只把增量放进待发送队列，
+ * 发送时按批次取出，每次重新登录以后把全部合约重新放进待订阅队列
+ * 合约代码统一去掉交易所前缀，和API的InstrumentID一致
+ */
+#pragma once
+#include "../Includes/FasterDefs.h"
+#include "../Share/StdUtils.hpp"
+
+#include <string>
+#include <vector>
+
+class QdpSubRegistry
+{
+public:
+	typedef wt_hashset<std::string> CodeSet;
+
+public:
+	/*
+	 *	返回新增的合约数，已经订阅过的不重复登记
+	 */
+	template<typename Codes>
+	uint32_t add(const Codes& codes)
+	{
+		StdUniqueLock lock(_mtx);
+		uint32_t cnt = 0;
+		for (const std::string& code : codes)
+		{
+			std::string stdCode = normalize(code);
+			if (!_codes.insert(stdCode).second)
+				continue;
+
+			_pending_unsub.erase(stdCode);
+			_pending_sub.insert(stdCode);
+			cnt++;
+		}
+		return cnt;
+	}
+
+	/*
+	 *	返回实际退订的合约数
+	 */
+	template<typename Codes>
+	uint32_t remove(const Codes& codes)
+	{
+		StdUniqueLock lock(_mtx);
+		uint32_t cnt = 0;
+		for (const std::string& code : codes)
+		{
+			std::string stdCode = normalize(code);
+			if (_codes.erase(stdCode) == 0)
+				continue;
+
+			//还没发出去的订阅直接撤掉就行
+			if (_pending_sub.erase(stdCode) == 0)
+				_pending_unsub.insert(stdCode);
+			cnt++;
+		}
+		return cnt;
+	}
+
+	/*
+	 *	重新登录以后，柜台那边的订阅已经没了，全部重新订阅
+	 */
+	void replay()
+	{
+		StdUniqueLock lock(_mtx);
+		_pending_unsub.clear();
+		_pending_sub = _codes;
+	}
+
+	/*
+	 *	取一批待发送的合约，先退订后订阅
+	 *	isSub		[out]这一批是订阅还是退订
+	 *	返回false表示没有待发送的
+	 */
+	bool nextBatch(std::vector<std::string>& batch, bool& isSub, uint32_t maxCnt)
+	{
+		StdUniqueLock lock(_mtx);
+		batch.clear();
+
+		CodeSet& pending = _pending_unsub.empty() ? _pending_sub : _pending_unsub;
+		isSub = (&pending == &_pending_sub);
+		auto it = pending.begin();
+		while (it != pending.end() && batch.size() < maxCnt)
+		{
+			batch.emplace_back(*it);
+			it = pending.erase(it);
+		}
+
+		return !batch.empty();
+	}
+
+	/*
+	 *	发送失败的一批放回去，下次再发
+	 */
+	void restore(const std::vector<std::string>& batch, bool isSub)
+	{
+		StdUniqueLock lock(_mtx);
+		for (const std::string& code : batch)
+		{
+			//放回去之前状态可能已经又变了
+			if (isSub && _codes.find(code) != _codes.end())
+				_pending_sub.insert(code);
+			else if (!isSub && _codes.find(code) == _codes.end())
+				_pending_unsub.insert(code);
+		}
+	}
+
+	inline bool hasPending()
+	{
+		StdUniqueLock lock(_mtx);
+		return !_pending_sub.empty() || !_pending_unsub.empty();
+	}
+
+	inline std::size_t size()
+	{
+		StdUniqueLock lock(_mtx);
+		return _codes.size();
+	}
+
+	/*
+	 *	拷贝一份全部已订阅的合约
+	 */
+	CodeSet snapshot()
+	{
+		StdUniqueLock lock(_mtx);
+		return _codes;
+	}
+
+private:
+	static inline std::string normalize(const std::string& code)
+	{
+		std::size_t pos = code.find('.');
+		return (pos != std::string::npos) ? code.substr(pos + 1) : code;
+	}
+
+private:
+	StdUniqueMutex	_mtx;
+	CodeSet			_codes;
+	CodeSet			_pending_sub;
+	CodeSet			_pending_unsub;
+};
@@ -0,0 +1,208 @@
+/*!
+ * \file QdpUniverse.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 订阅全市场时的合约发现
+ *
+ * 按"交易所.品种"的模式订阅，交易所部分必须是明确的代码，品种部分支持通配符，如SHFE.*,DCE.m*
+ * 登录后按交易所调用ReqQryInstrumentList列出全部合约，用基础数据过滤掉不认识的和品种不匹配的
+ * 查回来的原始列表按交易日缓存到文件，同一个交易日再次启动直接读缓存
+ */
+#pragma once
+#include "../Includes/IBaseDataMgr.h"
+#include "../Includes/WTSContractInfo.hpp"
+#include "../Includes/FasterDefs.h"
+#include "../Share/StrUtil.hpp"
+#include "../Share/StdUtils.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+USING_NS_WTP;
+
+class QdpUniverse
+{
+public:
+	typedef wt_hashset<std::string> CodeSet;
+
+public:
+	QdpUniverse() :_pending(0), _trading_date(0) {}
+
+	/*
+	 *	patterns	逗号分隔的模式列表
+	 *	返回false表示没有有效的模式
+	 */
+	bool init(const std::string& patterns)
+	{
+		_exchanges.clear();
+		_patterns.clear();
+		for (const std::string& item : StrUtil::split(patterns, ", "))
+		{
+			std::size_t pos = item.find('.');
+			std::string exchg = item.substr(0, pos);
+			if (exchg.empty() || exchg.find('*') != std::string::npos)
+				continue;
+
+			std::string product = (pos == std::string::npos) ? "*" : item.substr(pos + 1);
+			if (product.empty())
+				product = "*";
+
+			if (std::find(_exchanges.begin(), _exchanges.end(), exchg) == _exchanges.end())
+				_exchanges.emplace_back(exchg);
+			_patterns.emplace_back(exchg, product);
+		}
+
+		return !_patterns.empty();
+	}
+
+	inline const StringVector& exchanges() const { return _exchanges; }
+
+	inline bool querying() const { return _pending > 0; }
+
+public:
+	/*
+	 *	以下由API回调线程调用
+	 */
+	void beginQuery(uint32_t tradingDate)
+	{
+		_trading_date = tradingDate;
+		_requests.clear();
+		_codes.clear();
+		_pending = 0;
+	}
+
+	/*
+	 *	连接断开时调用，没回完的请求作废，重新登录后再查
+	 */
+	void cancelQuery()
+	{
+		_requests.clear();
+		_codes.clear();
+		_pending = 0;
+	}
+
+	inline void addRequest(int reqID, const std::string& exchg)
+	{
+		_requests[reqID] = exchg;
+		_pending++;
+	}
+
+	/*
+	 *	返回true表示全部交易所都查完了
+	 */
+	bool onInstrument(int reqID, const char* code, bool isLast)
+	{
+		auto it = _requests.find(reqID);
+		if (it == _requests.end())
+			return false;
+
+		if (code != NULL && code[0] != '\0')
+			_codes.emplace_back(it->second + "." + code);
+
+		if (!isLast)
+			return false;
+
+		_requests.erase(it);
+		_pending--;
+		return _pending == 0;
+	}
+
+	/*
+	 *	按基础数据和品种模式过滤，结果是EXCHG.CODE格式
+	 *	返回基础数据里不认识的合约数
+	 */
+	uint32_t filter(IBaseDataMgr* bdMgr, CodeSet& result) const
+	{
+		uint32_t unknown = 0;
+		for (const std::string& fullCode : _codes)
+		{
+			std::size_t pos = fullCode.find('.');
+			std::string exchg = fullCode.substr(0, pos);
+			std::string code = fullCode.substr(pos + 1);
+			WTSContractInfo* ct = bdMgr->getContract(code.c_str(), exchg.c_str());
+			if (ct == NULL)
+			{
+				unknown++;
+				continue;
+			}
+
+			if (accept(exchg, ct->getProduct()))
+				result.insert(fullCode);
+		}
+
+		return unknown;
+	}
+
+	inline std::size_t size() const { return _codes.size(); }
+
+public:
+	/*
+	 *	缓存文件第一行是交易日和交易所列表，后面每行一个EXCHG.CODE
+	 *	交易日或交易所列表对不上都视为没有缓存
+	 */
+	bool loadCache(const std::string& filename, uint32_t tradingDate)
+	{
+		if (!StdFile::exists(filename.c_str()))
+			return false;
+
+		std::string content;
+		StdFile::read_file_content(filename.c_str(), content);
+		StringVector lines = StrUtil::split(content, "\r\n");
+		if (lines.empty() || lines[0] != header(tradingDate))
+			return false;
+
+		_trading_date = tradingDate;
+		_codes.assign(lines.begin() + 1, lines.end());
+		return true;
+	}
+
+	void saveCache(const std::string& filename) const
+	{
+		std::string content = header(_trading_date);
+		content.reserve(content.size() + _codes.size() * 16);
+		for (const std::string& fullCode : _codes)
+		{
+			content += "\n";
+			content += fullCode;
+		}
+		content += "\n";
+		StdFile::write_file_content(filename.c_str(), content);
+	}
+
+private:
+	inline std::string header(uint32_t tradingDate) const
+	{
+		std::string ret = StrUtil::printf("%u|", tradingDate);
+		for (std::size_t i = 0; i < _exchanges.size(); i++)
+		{
+			if (i > 0)
+				ret += ",";
+			ret += _exchanges[i];
+		}
+		return ret;
+	}
+
+	inline bool accept(const std::string& exchg, const char* product) const
+	{
+		for (const auto& item : _patterns)
+		{
+			if (item.first == exchg && StrUtil::match(product, item.second))
+				return true;
+		}
+
+		return false;
+	}
+
+private:
+	StringVector	_exchanges;
+	std::vector<std::pair<std::string, std::string>>	_patterns;
+
+	wt_hashmap<int, std::string>	_requests;
+	uint32_t		_pending;
+	uint32_t		_trading_date;
+	StringVector	_codes;
+};
@@ -0,0 +1,325 @@
+﻿/*!
+ * \file ParserQDPReplay.cpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief QDP原始行情日志回放解析器实现
+ */
+#include "ParserQDPReplay.h"
+#include "../Share/StrUtil.hpp"
+#include "../Share/TimeUtils.hpp"
+
+#include "../Includes/WTSVariant.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <time.h>
+
+#include "../Share/fmtlib.h"
+
+template<typename... Args>
+inline void write_log(QdpAsyncLogger& logger, WTSLogLevel ll, const char* format, const Args&... args)
+{
+    logger.log(QLC_GENERAL, ll, format, args...);
+}
+
+static inline int64_t mono_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+extern "C"
+{
+    EXPORT_FLAG IParserApi* createParser()
+    {
+        ParserQDPReplay* parser = new ParserQDPReplay();
+        return parser;
+    }
+
+    EXPORT_FLAG void deleteParser(IParserApi* &parser)
+    {
+        if (NULL != parser)
+        {
+            delete parser;
+            parser = NULL;
+        }
+    }
+};
+
+ParserQDPReplay::ParserQDPReplay()
+    : m_dSpeed(0)
+    , m_uMaxGap(0)
+    , m_bReplaying(false)
+    , m_iBaseRecv(0)
+    , m_iBaseMono(0)
+    , m_iLastRecv(0)
+    , m_iLastClockSec(0)
+    , m_uRecords(0)
+    , m_uSkipped(0)
+{
+}
+
+ParserQDPReplay::~ParserQDPReplay()
+{
+    disconnect();
+}
+
+bool ParserQDPReplay::init(WTSVariant* config)
+{
+    if (!initOptions(config))
+        return false;
+
+    // 回放的时候不再录制
+    m_bJournal = false;
+
+    // "replay": {"files": ["..."], "folder": "./qdpjournal/", "begin": 20240110, "end": 20240115, "speed": 0, "maxgap": 0}
+    WTSVariant* cfgReplay = config->get("replay");
+    if (cfgReplay == NULL)
+    {
+        write_log(m_logger, LL_ERROR, "[ParserQDPReplay] Replay config missing");
+        return false;
+    }
+
+    m_dSpeed = std::max(cfgReplay->getDouble("speed"), 0.0);
+    m_uMaxGap = cfgReplay->getUInt32("maxgap");
+    collectFiles(cfgReplay);
+    if (m_ayFiles.empty())
+    {
+        write_log(m_logger, LL_ERROR, "[ParserQDPReplay] No journal file to replay");
+        return false;
+    }
+
+    // 日期推算的时钟跟着录制时间走，不看系统时间
+    m_dateResolver.setManual(true);
+    startWorkers();
+
+    if (m_dSpeed == 0)
+        write_log(m_logger, LL_INFO, "[ParserQDPReplay] {} journal files to replay as fast as possible", m_ayFiles.size());
+    else
+        write_log(m_logger, LL_INFO, "[ParserQDPReplay] {} journal files to replay at {}x speed", m_ayFiles.size(), m_dSpeed);
+
+    return true;
+}
+
+void ParserQDPReplay::collectFiles(WTSVariant* cfgReplay)
+{
+    m_ayFiles.clear();
+
+    WTSVariant* cfgFiles = cfgReplay->get("files");
+    if (cfgFiles != NULL && cfgFiles->isArray())
+    {
+        for (uint32_t i = 0; i < cfgFiles->size(); i++)
+            m_ayFiles.emplace_back(cfgFiles->get(i)->asCString());
+        return;
+    }
+
+    // 按交易日区间拼接目录下的日志，缺的交易日跳过
+    std::string folder = cfgReplay->getCString("folder");
+    if (folder.empty())
+        folder = "./qdpjournal/";
+    uint32_t uBegin = cfgReplay->getUInt32("begin");
+    uint32_t uEnd = cfgReplay->getUInt32("end");
+    if (uEnd == 0)
+        uEnd = uBegin;
+
+    for (uint32_t uDate = uBegin; uDate != 0 && uDate <= uEnd; uDate = TimeUtils::getNextDate(uDate))
+    {
+        std::string filename = QdpJournalWriter::journal_file(folder, uDate);
+        if (StdFile::exists(filename.c_str()))
+            m_ayFiles.emplace_back(filename);
+    }
+}
+
+void ParserQDPReplay::release()
+{
+    disconnect();
+    ParserQDP::release();
+}
+
+bool ParserQDPReplay::connect()
+{
+    if (m_thrdReplay != NULL)
+        return true;
+
+    m_bReplaying = true;
+    m_thrdReplay.reset(new StdThread([this]() {
+        doReplay();
+    }));
+    return true;
+}
+
+bool ParserQDPReplay::disconnect()
+{
+    m_bReplaying = false;
+    if (m_thrdReplay)
+    {
+        m_thrdReplay->join();
+        m_thrdReplay.reset();
+    }
+
+    m_loginState = LS_NOTLOGIN;
+    return true;
+}
+
+bool ParserQDPReplay::isConnected()
+{
+    return m_bReplaying && m_loginState == LS_LOGINED;
+}
+
+void ParserQDPReplay::doReplay()
+{
+    if (m_sink)
+        m_sink->handleEvent(WPE_Connect, 0);
+
+    int64_t tmStart = mono_ns();
+    for (const std::string& filename : m_ayFiles)
+    {
+        if (!replayFile(filename))
+            break;
+    }
+
+    double elapse = (mono_ns() - tmStart) / 1e9;
+    write_log(m_logger, LL_INFO, "[ParserQDPReplay] Replay finished, {} records in {:.3f}s, {:.0f} records/s, {} records skipped",
+        m_uRecords, elapse, (elapse > 0) ? m_uRecords / elapse : 0.0, m_uSkipped);
+
+    for (std::size_t i = 0; i < m_ayFeedStats.size(); i++)
+    {
+        const FeedStat& stat = m_ayFeedStats[i];
+        write_log(m_logger, LL_INFO, "[ParserQDPReplay] Source {}: won {} of {} updates, {} stale updates",
+            i, stat._wins, stat._wins + stat._losses, stat._stale);
+    }
+
+    m_loginState = LS_NOTLOGIN;
+    if (m_sink)
+        m_sink->handleEvent(WPE_Close, 0);
+}
+
+bool ParserQDPReplay::replayFile(const std::string& filename)
+{
+    QdpJournalReader reader;
+    if (!reader.open(filename))
+    {
+        write_log(m_logger, LL_ERROR, "[ParserQDPReplay] Journal {} invalid, skipped", filename);
+        return true;
+    }
+
+    // 每个交易日相当于一次重新登录
+    uint32_t tradingDay = reader.header()->_trading_date;
+    setTradingDate(tradingDay);
+    m_loginState = LS_LOGINED;
+    if (m_sink)
+        m_sink->handleEvent(WPE_Login, 0);
+    write_log(m_logger, LL_INFO, "[ParserQDPReplay] Replaying {} of trading day {}", filename, tradingDay);
+
+    //换日以后重新对齐节奏，两个文件之间不等待
+    m_iBaseRecv = 0;
+    uint64_t uRecords = m_uRecords;
+    bool bInMBL = false;
+    const QdpJournalRecord* rec = NULL;
+    while ((rec = reader.next()) != NULL)
+    {
+        if (!m_bReplaying)
+            return false;
+
+        //录制在仲裁之前，备用线路的行情也都在日志里，按原来的顺序全部送进去，
+        //用录制时同样的规则重新仲裁，只在备用线路上先到或者独有的行情才能复现
+        if (rec->_source >= m_ayFeedStats.size())
+            m_ayFeedStats.resize(rec->_source + 1);
+
+        advanceClock(rec->_recv_ns);
+        if (m_dSpeed > 0)
+            pace(rec->_recv_ns);
+
+        //录制时没有包结束的回调，分价行情一段连续的记录结束时补一次
+        if (bInMBL && rec->_type != JRT_MBL)
+        {
+            OnPackageEnd(0, 0);
+            bInMBL = false;
+        }
+
+        void* data = (void*)(rec + 1);
+        switch (rec->_type)
+        {
+        case JRT_DEPTH:
+            if (rec->_length != sizeof(CQdFtdcDepthMarketDataField))
+                break;
+            processDepthData((CQdFtdcDepthMarketDataField*)data, rec->_source, rec->_flags);
+            m_uRecords++;
+            continue;
+        case JRT_MBL:
+            if (rec->_length != sizeof(CQdFtdcMBLMarketDataField))
+                break;
+            OnRtnMBLMarketData((CQdFtdcMBLMarketDataField*)data);
+            bInMBL = true;
+            m_uRecords++;
+            continue;
+        case JRT_TEN_ENTRUST:
+            if (rec->_length != sizeof(CQdFtdcMDTenDepthMarketDataField))
+                break;
+            OnRtnTenEntrust((CQdFtdcMDTenDepthMarketDataField*)data);
+            m_uRecords++;
+            continue;
+        default:
+            break;
+        }
+
+        //长度对不上说明录制时的API版本不同
+        m_uSkipped++;
+    }
+
+    if (bInMBL)
+        OnPackageEnd(0, 0);
+
+    write_log(m_logger, LL_INFO, "[ParserQDPReplay] {} records of trading day {} replayed", m_uRecords - uRecords, tradingDay);
+    return true;
+}
+
+void ParserQDPReplay::pace(int64_t recvNs)
+{
+    int64_t now = mono_ns();
+    if (m_iBaseRecv == 0)
+    {
+        m_iBaseRecv = recvNs;
+        m_iBaseMono = now;
+        m_iLastRecv = recvNs;
+        return;
+    }
+
+    //休市之类的长空档整体前移，不傻等
+    if (m_uMaxGap > 0 && recvNs - m_iLastRecv > (int64_t)m_uMaxGap * 1000000)
+        m_iBaseRecv += recvNs - m_iLastRecv;
+    m_iLastRecv = recvNs;
+
+    int64_t target = m_iBaseMono + (int64_t)((recvNs - m_iBaseRecv) / m_dSpeed);
+    int64_t wait = target - now;
+    if (wait <= 0)
+        return;
+
+    //大段的等待交给系统休眠，最后一点忙等，保证微秒级的间隔
+    if (wait > 2000000)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(wait - 1000000));
+
+    while (mono_ns() < target && m_bReplaying)
+        std::this_thread::yield();
+}
+
+void ParserQDPReplay::advanceClock(int64_t recvNs)
+{
+    int64_t sec = recvNs / 1000000000;
+    if (sec == m_iLastClockSec)
+        return;
+    m_iLastClockSec = sec;
+
+    time_t t = (time_t)sec;
+    struct tm tmLocal;
+#ifdef _WIN32
+    localtime_s(&tmLocal, &t);
+#else
+    localtime_r(&t, &tmLocal);
+#endif
+    uint32_t curDate = (tmLocal.tm_year + 1900) * 10000 + (tmLocal.tm_mon + 1) * 100 + tmLocal.tm_mday;
+    uint32_t curTime = (tmLocal.tm_hour * 10000 + tmLocal.tm_min * 100 + tmLocal.tm_sec) * 1000;
+    m_dateResolver.refreshAt(curDate, curTime);
+}
@@ -0,0 +1,61 @@
+﻿/*!
+ * \file ParserQDPReplay.h
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief QDP原始行情日志回放解析器
+ *
+ * 读取ParserQDP录制的原始行情日志，按原来的回调顺序重新送进ParserQDP的处理流程，
+ * 行情转换、流水线、合并推送等和实盘是同一份代码
+ */
+#pragma once
+#include "../ParserQDP/ParserQDP.h"
+
+class ParserQDPReplay : public ParserQDP
+{
+public:
+    ParserQDPReplay();
+    virtual ~ParserQDPReplay();
+
+// IParserApi 接口
+public:
+    virtual bool init(WTSVariant* config) override;
+
+    virtual void release() override;
+
+    virtual bool connect() override;
+
+    virtual bool disconnect() override;
+
+    virtual bool isConnected() override;
+
+private:
+    /// 按配置整理要回放的日志文件，多个交易日按日期顺序拼接
+    void collectFiles(WTSVariant* cfgReplay);
+    /// 回放线程
+    void doReplay();
+    /// 回放一个文件，返回false表示中途被停止
+    bool replayFile(const std::string& filename);
+    /// 按录制时的收到时间控制回放速度
+    void pace(int64_t recvNs);
+    /// 用录制时的收到时间推进日期推算的时钟
+    void advanceClock(int64_t recvNs);
+
+private:
+    std::vector<std::string>    m_ayFiles;
+    double              m_dSpeed;           //0为不限速，1为按原速，N为N倍速
+    uint32_t            m_uMaxGap;          //超过这个间隔（毫秒）的空档直接跳过，0为不跳过
+
+    std::atomic<bool>   m_bReplaying;
+    StdThreadPtr        m_thrdReplay;
+
+    int64_t             m_iBaseRecv;        //节奏基准：录制时间和回放时的单调时钟
+    int64_t             m_iBaseMono;
+    int64_t             m_iLastRecv;
+    int64_t             m_iLastClockSec;
+
+    uint64_t            m_uRecords;
+    uint64_t            m_uSkipped;
+};
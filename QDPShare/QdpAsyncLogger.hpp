@@ -0,0 +1,513 @@
+/*!
+ * \file QdpAsyncLogger.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief QDP通道共用的异步日志管道
+ *
+ * 回调线程只把日志级别、格式串指针和原始参数拷进无锁环形队列，
+ * 格式化和向sink输出都放在后台线程里完成
+ * 格式串必须是字面量（生命周期覆盖整个进程），不带参数的日志会把文本本身拷进队列
+ * 字符串参数放不进定长槽位时（路径、统计明细等），在调用线程格式化好整条日志再入队，
+ * 超出输出缓冲的部分截掉并以TRUNCATED_MARK结尾
+ */
+#pragma once
+#include "../Includes/WTSTypes.h"
+#include "../Includes/WTSVariant.hpp"
+#include "../Share/StdUtils.hpp"
+#include "../Share/fmtlib.h"
+
+#include <atomic>
+#include <tuple>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+NS_WTP_BEGIN
+
+/*
+ *	日志分类，每个分类可以单独设置采样和限流
+ */
+typedef enum tagQdpLogCategory
+{
+	QLC_GENERAL = 0,	//一般日志，不采样不限流
+	QLC_TICK,			//逐笔行情日志
+	QLC_SUBSCRIBE,		//订阅相关日志
+	QLC_ORDER,			//订单回报日志
+	QLC_COUNT
+} QdpLogCategory;
+
+/*
+ *	定长字符串参数，字符串参数在入队时拷贝，避免后台线程访问已经失效的指针
+ *	放不下的字符串不走这里，见QdpLogArg::fits
+ */
+struct QdpLogStr
+{
+	char	_buf[64];
+};
+
+template<typename T>
+struct QdpLogArg
+{
+	static_assert(std::is_trivially_copyable<T>::value, "QdpAsyncLogger only accepts trivially copyable arguments");
+	typedef T stored;
+	static inline bool fits(const T& v) { return true; }
+	static inline stored wrap(const T& v) { return v; }
+};
+
+template<>
+struct QdpLogArg<const char*>
+{
+	typedef QdpLogStr stored;
+	static inline bool fits(const char* v) { return v == NULL || strnlen(v, sizeof(stored::_buf)) < sizeof(stored::_buf); }
+	static inline stored wrap(const char* v)
+	{
+		stored ret;
+		if (v == NULL)
+		{
+			ret._buf[0] = '\0';
+		}
+		else
+		{
+			std::size_t len = strnlen(v, sizeof(ret._buf) - 1);
+			memcpy(ret._buf, v, len);
+			ret._buf[len] = '\0';
+		}
+		return ret;
+	}
+};
+
+template<>
+struct QdpLogArg<char*> : public QdpLogArg<const char*> {};
+
+/*
+ *	定长字符数组，柜台结构体里的字段大多是这种，扫描长度不超过数组本身
+ */
+template<std::size_t N>
+struct QdpLogArg<char[N]>
+{
+	typedef QdpLogStr stored;
+	static const std::size_t BOUND = (N < sizeof(QdpLogStr::_buf)) ? N : sizeof(QdpLogStr::_buf);
+	static inline bool fits(const char(&v)[N]) { return strnlen(v, BOUND) < sizeof(stored::_buf); }
+	static inline stored wrap(const char(&v)[N])
+	{
+		stored ret;
+		std::size_t len = strnlen(v, std::min(BOUND, sizeof(ret._buf) - 1));
+		memcpy(ret._buf, v, len);
+		ret._buf[len] = '\0';
+		return ret;
+	}
+};
+
+/*
+ *	参数按值退化，字符数组保留长度，走上面的定长版本
+ */
+template<typename T>
+struct QdpLogType { typedef typename std::decay<T>::type type; };
+
+template<std::size_t N>
+struct QdpLogType<char[N]> { typedef char type[N]; };
+
+template<std::size_t N>
+struct QdpLogType<const char[N]> { typedef char type[N]; };
+
+template<>
+struct QdpLogArg<std::string>
+{
+	typedef QdpLogStr stored;
+	static inline bool fits(const std::string& v) { return v.size() < sizeof(stored::_buf); }
+	static inline stored wrap(const std::string& v) { return QdpLogArg<const char*>::wrap(v.c_str()); }
+};
+
+inline const char* qdp_log_unwrap(const QdpLogStr& v) { return v._buf; }
+
+template<typename T>
+inline const T& qdp_log_unwrap(const T& v) { return v; }
+
+class QdpAsyncLogger
+{
+public:
+	typedef std::function<void(WTSLogLevel, const char*)> LogOutputer;
+
+	static const uint32_t DEFAULT_QUEUE = 8192;
+	static constexpr const char* TRUNCATED_MARK = "...(truncated)";
+
+private:
+	static const std::size_t PAYLOAD_SIZE = 224;
+	static const std::size_t OUTPUT_SIZE = 2048;	//一条日志格式化以后的最大长度，含结尾的0
+	typedef void(*Formatter)(char* buffer, const char* format, const void* payload);
+
+	typedef struct _LogRecord
+	{
+		std::atomic<uint64_t>	_seq;
+		WTSLogLevel				_level;
+		Formatter				_formatter;
+		const char*				_format;
+		alignas(8) char			_payload[PAYLOAD_SIZE];
+	} LogRecord;
+
+	typedef struct _CategoryCtrl
+	{
+		uint32_t				_sample;	//每N条保留1条，0或1为不采样
+		uint32_t				_rate;		//每秒最多输出条数，0为不限流
+		std::atomic<uint64_t>	_counter;
+		std::atomic<int64_t>	_window;
+		std::atomic<uint32_t>	_in_window;
+		std::atomic<uint64_t>	_suppressed;
+
+		_CategoryCtrl() :_sample(0), _rate(0), _counter(0), _window(0), _in_window(0), _suppressed(0) {}
+	} CategoryCtrl;
+
+public:
+	QdpAsyncLogger()
+		: _buffer(NULL)
+		, _mask(0)
+		, _enqueue_pos(0)
+		, _dequeue_pos(0)
+		, _dropped(0)
+		, _running(false)
+	{
+		//逐笔行情默认每秒最多输出10条
+		_ctrls[QLC_TICK]._rate = 10;
+	}
+
+	~QdpAsyncLogger()
+	{
+		stop();
+		if (_buffer)
+			delete[] _buffer;
+	}
+
+public:
+	/*
+	 *	读取采样和限流配置
+	 *	"logctrl": {"tick": {"sample": 100, "rate": 20}, "subscribe": {"rate": 100}}
+	 */
+	void configure(WTSVariant* cfg)
+	{
+		if (cfg == NULL || !cfg->isObject())
+			return;
+
+		static const char* names[QLC_COUNT] = { "general", "tick", "subscribe", "order" };
+		for (uint32_t i = 0; i < QLC_COUNT; i++)
+		{
+			WTSVariant* cfgItem = cfg->get(names[i]);
+			if (cfgItem == NULL)
+				continue;
+
+			if (cfgItem->has("sample"))
+				_ctrls[i]._sample = cfgItem->getUInt32("sample");
+			if (cfgItem->has("rate"))
+				_ctrls[i]._rate = cfgItem->getUInt32("rate");
+		}
+	}
+
+	void start(LogOutputer outputer, uint32_t capacity = DEFAULT_QUEUE)
+	{
+		if (_running)
+			return;
+
+		_outputer = outputer;
+
+		std::size_t cap = 1024;
+		while (cap < capacity)
+			cap <<= 1;
+
+		if (_buffer == NULL)
+		{
+			_buffer = new LogRecord[cap];
+			_mask = cap - 1;
+			for (std::size_t i = 0; i < cap; i++)
+				_buffer[i]._seq.store(i, std::memory_order_relaxed);
+		}
+
+		_running = true;
+		_worker.reset(new StdThread([this]() {
+			while (_running)
+			{
+				if (drain() == 0)
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			drain();
+		}));
+	}
+
+	void stop()
+	{
+		if (!_running)
+			return;
+
+		_running = false;
+		if (_worker)
+		{
+			_worker->join();
+			_worker.reset();
+		}
+	}
+
+	template<typename... Args>
+	void log(QdpLogCategory cat, WTSLogLevel ll, const char* format, const Args&... args)
+	{
+		if (!admit(cat))
+			return;
+
+		//后台线程没起来之前（或者已经停止）直接同步输出
+		if (!_running)
+		{
+			if (!_outputer)
+				return;
+
+			if constexpr (sizeof...(Args) == 0)
+			{
+				_outputer(ll, format);
+			}
+			else
+			{
+				static thread_local char buffer[OUTPUT_SIZE] = { 0 };
+				format_bounded(buffer, format, args...);
+				_outputer(ll, buffer);
+			}
+			return;
+		}
+
+		//有放不进槽位的长字符串，在这里格式化好，队列里只放指针
+		char* spilled = NULL;
+		if constexpr (sizeof...(Args) == 0)
+		{
+			if (strnlen(format, PAYLOAD_SIZE) == PAYLOAD_SIZE)
+			{
+				spilled = new char[OUTPUT_SIZE];
+				copy_bounded(spilled, format);
+			}
+		}
+		else if (!(QdpLogArg<typename QdpLogType<Args>::type>::fits(args) && ...))
+		{
+			spilled = new char[OUTPUT_SIZE];
+			format_bounded(spilled, format, args...);
+		}
+
+		uint64_t pos = 0;
+		LogRecord* rec = reserve(pos);
+		if (rec == NULL)
+		{
+			delete[] spilled;
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		rec->_level = ll;
+		if (spilled != NULL)
+			fill_spilled(rec, spilled);
+		else
+			fill(rec, format, args...);
+		rec->_seq.store(pos + 1, std::memory_order_release);
+	}
+
+	inline uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+	inline uint64_t suppressed(QdpLogCategory cat) const { return _ctrls[cat]._suppressed.load(std::memory_order_relaxed); }
+
+private:
+	inline bool admit(QdpLogCategory cat)
+	{
+		CategoryCtrl& ctrl = _ctrls[cat];
+		if (ctrl._sample > 1)
+		{
+			uint64_t n = ctrl._counter.fetch_add(1, std::memory_order_relaxed);
+			if (n % ctrl._sample != 0)
+			{
+				ctrl._suppressed.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+		}
+
+		if (ctrl._rate > 0)
+		{
+			int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			int64_t window = ctrl._window.load(std::memory_order_relaxed);
+			if (now != window && ctrl._window.compare_exchange_strong(window, now, std::memory_order_relaxed))
+				ctrl._in_window.store(0, std::memory_order_relaxed);
+
+			if (ctrl._in_window.fetch_add(1, std::memory_order_relaxed) >= ctrl._rate)
+			{
+				ctrl._suppressed.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/*
+	 *	有界MPMC队列的入队占位，队列满时返回NULL
+	 */
+	inline LogRecord* reserve(uint64_t& pos)
+	{
+		pos = _enqueue_pos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			LogRecord* rec = &_buffer[pos & _mask];
+			uint64_t seq = rec->_seq.load(std::memory_order_acquire);
+			int64_t diff = (int64_t)seq - (int64_t)pos;
+			if (diff == 0)
+			{
+				if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					return rec;
+			}
+			else if (diff < 0)
+			{
+				return NULL;
+			}
+			else
+			{
+				pos = _enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/*
+	 *	格式化到OUTPUT_SIZE大小的缓冲区，超长时截断并加上标记
+	 */
+	template<typename... Args>
+	static void format_bounded(char* buffer, const char* format, const Args&... args)
+	{
+		const std::size_t limit = OUTPUT_SIZE - 1;
+		auto ret = fmt::format_to_n(buffer, limit, fmt::runtime(format), args...);
+		if (ret.size <= limit)
+		{
+			buffer[ret.size] = '\0';
+			return;
+		}
+
+		std::size_t markLen = strlen(TRUNCATED_MARK);
+		memcpy(buffer + limit - markLen, TRUNCATED_MARK, markLen + 1);
+	}
+
+	static void copy_bounded(char* buffer, const char* text)
+	{
+		const std::size_t limit = OUTPUT_SIZE - 1;
+		std::size_t len = strnlen(text, OUTPUT_SIZE);
+		if (len <= limit)
+		{
+			memcpy(buffer, text, len + 1);
+			return;
+		}
+
+		std::size_t markLen = strlen(TRUNCATED_MARK);
+		memcpy(buffer, text, limit - markLen);
+		memcpy(buffer + limit - markLen, TRUNCATED_MARK, markLen + 1);
+	}
+
+	template<typename Tuple, std::size_t... I>
+	static void format_tuple(char* buffer, const char* format, const Tuple& t, std::index_sequence<I...>)
+	{
+		format_bounded(buffer, format, qdp_log_unwrap(std::get<I>(t))...);
+	}
+
+	template<typename Tuple>
+	static void format_payload(char* buffer, const char* format, const void* payload)
+	{
+		const Tuple& t = *(const Tuple*)payload;
+		format_tuple(buffer, format, t, std::make_index_sequence<std::tuple_size<Tuple>::value>());
+	}
+
+	static void copy_text(char* buffer, const char* format, const void* payload)
+	{
+		strcpy(buffer, (const char*)payload);
+	}
+
+	//调用线程已经格式化好的长日志，拷出来以后释放
+	static void take_spilled(char* buffer, const char* format, const void* payload)
+	{
+		char* text = NULL;
+		memcpy(&text, payload, sizeof(text));
+		strcpy(buffer, text);
+		delete[] text;
+	}
+
+	inline void fill_spilled(LogRecord* rec, char* text)
+	{
+		memcpy(rec->_payload, &text, sizeof(text));
+		rec->_format = NULL;
+		rec->_formatter = &QdpAsyncLogger::take_spilled;
+	}
+
+	inline void fill(LogRecord* rec, const char* text)
+	{
+		std::size_t len = strnlen(text, PAYLOAD_SIZE - 1);
+		memcpy(rec->_payload, text, len);
+		rec->_payload[len] = '\0';
+		rec->_format = NULL;
+		rec->_formatter = &QdpAsyncLogger::copy_text;
+	}
+
+	template<typename First, typename... Args>
+	inline void fill(LogRecord* rec, const char* format, const First& first, const Args&... args)
+	{
+		typedef std::tuple<typename QdpLogArg<typename QdpLogType<First>::type>::stored,
+			typename QdpLogArg<typename QdpLogType<Args>::type>::stored...> Tuple;
+		static_assert(sizeof(Tuple) <= PAYLOAD_SIZE, "too many log arguments");
+
+		new (rec->_payload) Tuple(QdpLogArg<typename QdpLogType<First>::type>::wrap(first),
+			QdpLogArg<typename QdpLogType<Args>::type>::wrap(args)...);
+		rec->_format = format;
+		rec->_formatter = &QdpAsyncLogger::format_payload<Tuple>;
+	}
+
+	/*
+	 *	单消费者出队，返回本次处理的条数
+	 */
+	uint32_t drain()
+	{
+		char* buffer = _out_buf;
+		uint32_t cnt = 0;
+		for (;;)
+		{
+			LogRecord* rec = &_buffer[_dequeue_pos & _mask];
+			if (rec->_seq.load(std::memory_order_acquire) != _dequeue_pos + 1)
+				break;
+
+			rec->_formatter(buffer, rec->_format, rec->_payload);
+			WTSLogLevel ll = rec->_level;
+			rec->_seq.store(_dequeue_pos + _mask + 1, std::memory_order_release);
+			_dequeue_pos++;
+			cnt++;
+
+			if (_outputer)
+				_outputer(ll, buffer);
+		}
+
+		uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+		if (dropped != _last_dropped && _outputer)
+		{
+			fmtutil::format_to(buffer, "[QdpAsyncLogger] Log queue full, {} records dropped in total", dropped);
+			_outputer(LL_WARN, buffer);
+			_last_dropped = dropped;
+		}
+
+		return cnt;
+	}
+
+private:
+	LogRecord*				_buffer;
+	uint64_t				_mask;
+	std::atomic<uint64_t>	_enqueue_pos;
+	uint64_t				_dequeue_pos;
+	char					_out_buf[OUTPUT_SIZE];
+
+	std::atomic<uint64_t>	_dropped;
+	uint64_t				_last_dropped = 0;
+
+	CategoryCtrl			_ctrls[QLC_COUNT];
+
+	LogOutputer				_outputer;
+	std::atomic<bool>		_running;
+	StdThreadPtr			_worker;
+};
+
+NS_WTP_END
@@ -0,0 +1,136 @@
+/*!
+ * \file QdpConflator.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 按合约合并的最新值槽位
+ *
+ * 每个合约一个槽位，只保留最新的一笔，生产者写入以后在脏位图上置位，
+ * 消费者按自己的节奏扫描位图取走有更新的槽位，中间被覆盖的数据计入合并数
+ * 位图分两级，第二级每一位对应第一级的一个64位字，合约很多时空扫的开销也很小
+ */
+#pragma once
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+template<typename T>
+class QdpConflator
+{
+private:
+	static inline uint32_t lowest_bit(uint64_t v)
+	{
+#ifdef _MSC_VER
+		unsigned long idx;
+		_BitScanForward64(&idx, v);
+		return (uint32_t)idx;
+#else
+		return (uint32_t)__builtin_ctzll(v);
+#endif
+	}
+
+public:
+	QdpConflator(uint32_t capacity)
+		: _capacity(capacity)
+		, _words((capacity + 63) >> 6)
+		, _summaries((_words + 63) >> 6)
+		, _slots(new std::atomic<T*>[capacity])
+		, _coalesced(new std::atomic<uint64_t>[capacity])
+		, _dirty(new std::atomic<uint64_t>[_words])
+		, _summary(new std::atomic<uint64_t>[_summaries])
+	{
+		for (uint32_t i = 0; i < _capacity; i++)
+		{
+			_slots[i].store(NULL, std::memory_order_relaxed);
+			_coalesced[i].store(0, std::memory_order_relaxed);
+		}
+
+		for (uint32_t i = 0; i < _words; i++)
+			_dirty[i].store(0, std::memory_order_relaxed);
+
+		for (uint32_t i = 0; i < _summaries; i++)
+			_summary[i].store(0, std::memory_order_relaxed);
+	}
+
+public:
+	inline uint32_t capacity() const { return _capacity; }
+
+	/*
+	 *	生产者调用，返回被覆盖的旧数据，由调用方释放
+	 */
+	inline T* publish(uint32_t idx, T* item)
+	{
+		T* old = _slots[idx].exchange(item, std::memory_order_acq_rel);
+		if (old != NULL)
+		{
+			//消费者还没取走，说明已经置过位了
+			_coalesced[idx].store(_coalesced[idx].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return old;
+		}
+
+		uint32_t word = idx >> 6;
+		_dirty[word].fetch_or(1ULL << (idx & 63), std::memory_order_release);
+		_summary[word >> 6].fetch_or(1ULL << (word & 63), std::memory_order_release);
+		return NULL;
+	}
+
+	/*
+	 *	消费者调用，取走所有有更新的槽位，返回取走的个数
+	 */
+	template<typename Fn>
+	uint32_t drain(Fn fn)
+	{
+		uint32_t cnt = 0;
+		for (uint32_t s = 0; s < _summaries; s++)
+		{
+			if (_summary[s].load(std::memory_order_relaxed) == 0)
+				continue;
+
+			uint64_t words = _summary[s].exchange(0, std::memory_order_acquire);
+			while (words != 0)
+			{
+				uint32_t word = (s << 6) + lowest_bit(words);
+				words &= words - 1;
+
+				uint64_t bits = _dirty[word].exchange(0, std::memory_order_acquire);
+				while (bits != 0)
+				{
+					uint32_t idx = (word << 6) + lowest_bit(bits);
+					bits &= bits - 1;
+
+					//置位和写槽位之间被取走过的，这里会是空的
+					T* item = _slots[idx].exchange(NULL, std::memory_order_acq_rel);
+					if (item == NULL)
+						continue;
+
+					fn(idx, item);
+					cnt++;
+				}
+			}
+		}
+
+		return cnt;
+	}
+
+	/*
+	 *	槽位上被合并掉的数据笔数，任意线程可读
+	 */
+	inline uint64_t coalesced(uint32_t idx) const { return _coalesced[idx].load(std::memory_order_relaxed); }
+
+private:
+	uint32_t	_capacity;
+	uint32_t	_words;
+	uint32_t	_summaries;
+
+	std::unique_ptr<std::atomic<T*>[]>		_slots;
+	std::unique_ptr<std::atomic<uint64_t>[]>	_coalesced;
+	std::unique_ptr<std::atomic<uint64_t>[]>	_dirty;
+	std::unique_ptr<std::atomic<uint64_t>[]>	_summary;
+};
@@ -0,0 +1,157 @@
+/*!
+ * \file QdpFieldDecoder.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief QDP结构体中定长时间、日期字段的解析
+ *
+ * QDP的时间字段是char[9]的HH:MM:SS，日期字段是char[9]的YYYYMMDD，
+ * 都至少有8个字节可读，所以可以一次读入一个64位整数，按字节并行校验和换算
+ * 格式不符合时退回到逐字节解析，结果和原来的strtoul方式保持一致
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define QDP_DECODER_SCALAR_ONLY
+#endif
+
+class QdpFieldDecoder
+{
+private:
+	static inline uint64_t load8(const char* s)
+	{
+		uint64_t v;
+		memcpy(&v, s, 8);
+		return v;
+	}
+
+	/*
+	 *	8个字节是否都是'0'-'9'
+	 */
+	static inline bool is_eight_digits(uint64_t v)
+	{
+		return (((v & 0xF0F0F0F0F0F0F0F0ULL) | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+	}
+
+public:
+	/*
+	 *	解析HH:MM:SS，成功返回true，ret为HHMMSS
+	 *	s至少要有8个字节可读
+	 */
+	static inline bool parseTime(const char* s, uint32_t& ret)
+	{
+#ifndef QDP_DECODER_SCALAR_ONLY
+		const uint64_t COLON_MASK = 0x0000FF0000FF0000ULL;
+		const uint64_t COLONS = 0x00003A00003A0000ULL;
+
+		uint64_t v = load8(s);
+		if ((v & COLON_MASK) != COLONS)
+			return false;
+
+		//把两个冒号换成'0'，剩下的按8位数字统一校验
+		v = (v & ~COLON_MASK) | (0x3030303030303030ULL & COLON_MASK);
+		if (!is_eight_digits(v))
+			return false;
+
+		v -= 0x3030303030303030ULL;
+		//每个字节变成 d[i]*10 + d[i+1]，第0、3、6字节分别就是时、分、秒
+		v = v * 10 + (v >> 8);
+		uint32_t hh = (uint32_t)(v & 0xFF);
+		uint32_t mm = (uint32_t)((v >> 24) & 0xFF);
+		uint32_t ss = (uint32_t)((v >> 48) & 0xFF);
+#else
+		if (s[2] != ':' || s[5] != ':')
+			return false;
+
+		for (int i = 0; i < 8; i++)
+		{
+			if (i == 2 || i == 5)
+				continue;
+			if (s[i] < '0' || s[i] > '9')
+				return false;
+		}
+
+		uint32_t hh = (s[0] - '0') * 10 + (s[1] - '0');
+		uint32_t mm = (s[3] - '0') * 10 + (s[4] - '0');
+		uint32_t ss = (s[6] - '0') * 10 + (s[7] - '0');
+#endif
+		if (hh > 23 || mm > 59 || ss > 59)
+			return false;
+
+		ret = hh * 10000 + mm * 100 + ss;
+		return true;
+	}
+
+	/*
+	 *	解析YYYYMMDD，成功返回true
+	 *	s至少要有8个字节可读
+	 */
+	static inline bool parseDate(const char* s, uint32_t& ret)
+	{
+#ifndef QDP_DECODER_SCALAR_ONLY
+		uint64_t v = load8(s);
+		if (!is_eight_digits(v))
+			return false;
+
+		v -= 0x3030303030303030ULL;
+		v = v * 10 + (v >> 8);
+		v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+			(((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+		uint32_t date = (uint32_t)v;
+#else
+		uint32_t date = 0;
+		for (int i = 0; i < 8; i++)
+		{
+			if (s[i] < '0' || s[i] > '9')
+				return false;
+			date = date * 10 + (s[i] - '0');
+		}
+#endif
+		uint32_t month = date / 100 % 100;
+		uint32_t day = date % 100;
+		if (month == 0 || month > 12 || day == 0 || day > 31)
+			return false;
+
+		ret = date;
+		return true;
+	}
+
+	/*
+	 *	时间字段转成HHMMSS，不是标准格式时去掉冒号后按数字解析
+	 */
+	static inline uint32_t decodeTime(const char* s)
+	{
+		uint32_t ret = 0;
+		if (parseTime(s, ret))
+			return ret;
+
+		//兼容非标准格式，比如没有前导0的H:MM:SS，去掉冒号后和原来一样交给strtoul，
+		//前导空白、正负号的处理也保持一致
+		char buf[10];
+		int len = 0;
+		for (int i = 0; i < 9 && s[i] != '\0'; i++)
+		{
+			if (s[i] != ':')
+				buf[len++] = s[i];
+		}
+		buf[len] = '\0';
+		return (uint32_t)strtoul(buf, NULL, 10);
+	}
+
+	/*
+	 *	日期字段转成YYYYMMDD，空串或者格式不对返回0
+	 */
+	static inline uint32_t decodeDate(const char* s)
+	{
+		uint32_t ret = 0;
+		if (parseDate(s, ret))
+			return ret;
+
+		return strtoul(s, NULL, 10);
+	}
+};
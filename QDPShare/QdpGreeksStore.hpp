@@ -0,0 +1,235 @@
+/*!
+ * \file QdpGreeksStore.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 期权希腊值的列式存储
+ *
+ * 按标的和到期日把期权合约归成一条期权链，链内每个指标一列连续数组，
+ * 策略读取整条链的Delta、Vega等只需要顺序扫几段连续内存
+ * 每条链的列按固定容量一次分配好，写线程只在原位覆盖，读线程用序列锁拿一致的快照
+ * 存储是进程内所有解析器共用的，多个解析器可能同时写同一条链，建链和写链都要各自加锁
+ */
+#pragma once
+#include "../Includes/WTSTypes.h"
+#include "../Share/SpinMutex.hpp"
+
+#include <atomic>
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+NS_WTP_BEGIN
+
+/*
+ *	期权链的数值列
+ */
+typedef enum tagGreeksColumn
+{
+	GC_STRIKE = 0,			//行权价
+	GC_UNDERLYING_PRICE,	//标的最新价
+	GC_LAST_PRICE,			//期权最新价
+	GC_REMAIN_DAYS,			//剩余天数
+	GC_THEORY_VOL,			//理论波动率
+	GC_BID_VOL,				//买1价波动率
+	GC_ASK_VOL,				//卖1价波动率
+	GC_MID_VOL,				//中间价波动率
+	GC_LAST_VOL,			//最新价波动率
+	GC_DELTA,
+	GC_GAMMA,
+	GC_VEGA,
+	GC_THETA,
+	GC_RHO,
+	GC_COUNT
+} GreeksColumn;
+
+class QdpGreeksChain
+{
+public:
+	QdpGreeksChain(const char* underlying, uint32_t expiry, uint32_t capacity)
+		: _expiry(expiry)
+		, _capacity(capacity)
+		, _count(0)
+		, _seq(0)
+		, _codes(capacity * MAX_INSTRUMENT_LENGTH, 0)
+		, _is_call(capacity, 0)
+		, _update_time(capacity, 0)
+		, _data(capacity * GC_COUNT, 0)
+	{
+		strncpy(_underlying, underlying, MAX_INSTRUMENT_LENGTH - 1);
+		_underlying[MAX_INSTRUMENT_LENGTH - 1] = '\0';
+	}
+
+public:
+	inline const char* underlying() const { return _underlying; }
+	inline uint32_t expiry() const { return _expiry; }
+	inline uint32_t size() const { return _count.load(std::memory_order_acquire); }
+
+	inline const char* code(uint32_t row) const { return &_codes[row * MAX_INSTRUMENT_LENGTH]; }
+	inline bool isCall(uint32_t row) const { return _is_call[row] != 0; }
+	inline uint32_t updateTime(uint32_t row) const { return _update_time[row]; }
+
+	/*
+	 *	取一整列，长度为size()
+	 */
+	inline const double* column(GreeksColumn col) const { return &_data[col * _capacity]; }
+
+	/*
+	 *	序列锁读，fn里读到的整条链是同一时刻的
+	 *	返回false表示重试多次仍然和写线程冲突
+	 */
+	template<typename Fn>
+	bool read(Fn fn, uint32_t maxRetry = 64) const
+	{
+		for (uint32_t i = 0; i < maxRetry; i++)
+		{
+			uint32_t s1 = _seq.load(std::memory_order_acquire);
+			if (s1 & 1)
+				continue;
+
+			fn(*this);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (_seq.load(std::memory_order_relaxed) == s1)
+				return true;
+		}
+
+		return false;
+	}
+
+public:
+	/*
+	 *	以下由行情线程调用，可能来自多个解析器
+	 *	同一个期权已经有行了就直接返回那一行，多个解析器订阅同一个期权时共用
+	 */
+	int32_t addRow(const char* code, double strike, bool isCall)
+	{
+		SpinLock lock(_mtx);
+		uint32_t row = _count.load(std::memory_order_relaxed);
+		for (uint32_t i = 0; i < row; i++)
+		{
+			if (strcmp(this->code(i), code) == 0)
+				return (int32_t)i;
+		}
+
+		if (row >= _capacity)
+			return -1;
+
+		strncpy(&_codes[row * MAX_INSTRUMENT_LENGTH], code, MAX_INSTRUMENT_LENGTH - 1);
+		_is_call[row] = isCall ? 1 : 0;
+		_data[GC_STRIKE * _capacity + row] = strike;
+		_count.store(row + 1, std::memory_order_release);
+		return (int32_t)row;
+	}
+
+	/*
+	 *	序列锁只允许一个写者，beginWrite和endWrite之间持有写锁
+	 */
+	inline void beginWrite()
+	{
+		_mtx.lock();
+		_seq.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	inline void set(uint32_t row, GreeksColumn col, double val) { _data[col * _capacity + row] = val; }
+
+	inline void setUpdateTime(uint32_t row, uint32_t uTime) { _update_time[row] = uTime; }
+
+	inline void endWrite()
+	{
+		_seq.fetch_add(1, std::memory_order_release);
+		_mtx.unlock();
+	}
+
+private:
+	char					_underlying[MAX_INSTRUMENT_LENGTH];
+	uint32_t				_expiry;
+	uint32_t				_capacity;
+	std::atomic<uint32_t>	_count;
+	std::atomic<uint32_t>	_seq;
+	SpinMutex				_mtx;		//写者之间互斥
+
+	std::vector<char>		_codes;
+	std::vector<char>		_is_call;
+	std::vector<uint32_t>	_update_time;
+	std::vector<double>		_data;		//按列存放，第col列从col*_capacity开始
+};
+
+class QdpGreeksStore
+{
+public:
+	QdpGreeksStore()
+		: _chain_capacity(512)
+		, _chain_cnt(0)
+	{
+		memset(_chains, 0, sizeof(_chains));
+	}
+
+	~QdpGreeksStore()
+	{
+		uint32_t cnt = _chain_cnt.load(std::memory_order_relaxed);
+		for (uint32_t i = 0; i < cnt; i++)
+			delete _chains[i];
+	}
+
+public:
+	/*
+	 *	每条期权链的最大合约数，只对之后新建的链生效
+	 */
+	inline void setChainCapacity(uint32_t capacity) { _chain_capacity = capacity; }
+
+	inline uint32_t chainCount() const { return _chain_cnt.load(std::memory_order_acquire); }
+
+	inline const QdpGreeksChain* chainAt(uint32_t idx) const { return (idx < chainCount()) ? _chains[idx] : NULL; }
+
+	const QdpGreeksChain* findChain(const char* underlying, uint32_t expiry) const
+	{
+		uint32_t cnt = chainCount();
+		for (uint32_t i = 0; i < cnt; i++)
+		{
+			const QdpGreeksChain* chain = _chains[i];
+			if (chain->expiry() == expiry && strcmp(chain->underlying(), underlying) == 0)
+				return chain;
+		}
+
+		return NULL;
+	}
+
+	/*
+	 *	找不到就新建，由行情线程调用，多个解析器的行情线程可能同时建同一条链
+	 */
+	QdpGreeksChain* getChain(const char* underlying, uint32_t expiry)
+	{
+		QdpGreeksChain* chain = (QdpGreeksChain*)findChain(underlying, expiry);
+		if (chain != NULL)
+			return chain;
+
+		//加锁以后再找一遍，别的解析器可能刚建好
+		SpinLock lock(_mtx);
+		chain = (QdpGreeksChain*)findChain(underlying, expiry);
+		if (chain != NULL)
+			return chain;
+
+		uint32_t cnt = _chain_cnt.load(std::memory_order_relaxed);
+		if (cnt >= MAX_CHAINS)
+			return NULL;
+
+		chain = new QdpGreeksChain(underlying, expiry, _chain_capacity);
+		_chains[cnt] = chain;
+		_chain_cnt.store(cnt + 1, std::memory_order_release);
+		return chain;
+	}
+
+private:
+	static const uint32_t MAX_CHAINS = 4096;
+
+	uint32_t				_chain_capacity;
+	QdpGreeksChain*			_chains[MAX_CHAINS];
+	std::atomic<uint32_t>	_chain_cnt;
+	SpinMutex				_mtx;		//建链的解析器之间互斥
+};
+
+NS_WTP_END
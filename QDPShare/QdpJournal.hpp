@@ -0,0 +1,445 @@
+/*!
+ * \file QdpJournal.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 原始行情日志
+ *
+ * 按交易日一个文件，建文件时一次截断到固定大小再映射，写入只是原子地预留一段空间再拷贝，
+ * 记录头的类型最后写，读的时候遇到类型为0就认为到头了，进程中途退出也不会读到半截的记录
+ * 同一天重启接着写时，中途退出留下的空洞用填充记录盖掉，空洞后面已经写完的记录不会被覆盖
+ * 落盘由后台线程定时调用，换日以后旧文件过一段时间再解除映射，保证回调线程已经写完
+ */
+#pragma once
+#include "../Share/BoostFile.hpp"
+#include "../Share/BoostMappingFile.hpp"
+#include "../Share/StrUtil.hpp"
+#include "../Share/TimeUtils.hpp"
+#include "../Share/StdUtils.hpp"
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#define QDP_JOURNAL_MAGIC	"QDPJNL1"
+#define QDP_JOURNAL_VERSION	1
+
+/*
+ *	记录类型，负载是API原样的结构体
+ */
+typedef enum tagJournalRecordType
+{
+	JRT_NONE = 0,		//还没写完或者文件末尾
+	JRT_DEPTH,			//CQdFtdcDepthMarketDataField
+	JRT_MBL,			//CQdFtdcMBLMarketDataField
+	JRT_TEN_ENTRUST,	//CQdFtdcMDTenDepthMarketDataField
+	JRT_PAD				//填充，盖住进程退出时没写完的记录，读的时候跳过
+} JournalRecordType;
+
+#pragma pack(push, 8)
+typedef struct _QdpJournalHeader
+{
+	char		_magic[8];
+	uint32_t	_version;
+	uint32_t	_trading_date;
+	uint64_t	_capacity;		//文件大小，含文件头
+	uint64_t	_size;			//落盘时已写入的大小，含文件头
+	uint64_t	_dropped;		//文件写满以后丢掉的记录数
+} QdpJournalHeader;
+
+typedef struct _QdpJournalRecord
+{
+	uint16_t	_type;
+	uint16_t	_length;		//负载长度，不含记录头和对齐
+	uint16_t	_source;		//行情线路，0为主线路
+	uint16_t	_flags;			//解析器的处理标记
+	int64_t		_recv_ns;		//本地收到的时间，纳秒
+} QdpJournalRecord;
+#pragma pack(pop)
+
+class QdpJournalWriter
+{
+private:
+	typedef struct _Segment
+	{
+		BoostMappingFile	_file;
+		char*				_base;
+		QdpJournalHeader*	_header;
+		uint64_t			_capacity;
+		uint32_t			_date;
+		std::atomic<uint64_t>	_offset;
+		std::atomic<uint64_t>	_dropped;
+	} Segment;
+
+public:
+	QdpJournalWriter() :_capacity(UINT32_MAX), _cur(NULL), _appended(0) {}
+	~QdpJournalWriter() { close(); }
+
+	static inline int64_t now_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	static inline uint64_t record_size(uint32_t length)
+	{
+		return (sizeof(QdpJournalRecord) + length + 7) & ~(uint64_t)7;
+	}
+
+public:
+	/*
+	 *	folder		日志目录
+	 *	capacity	每个文件的大小，字节
+	 */
+	inline void init(const std::string& folder, uint64_t capacity)
+	{
+		_folder = StrUtil::standardisePath(folder);
+		//截断接口只接受32位的大小
+		_capacity = std::min(std::max(capacity, (uint64_t)(1 << 20)), (uint64_t)UINT32_MAX);
+	}
+
+	inline uint32_t tradingDate() const
+	{
+		Segment* seg = _cur.load(std::memory_order_acquire);
+		return (seg == NULL) ? 0 : seg->_date;
+	}
+
+	inline std::string filename(uint32_t tradingDate) const
+	{
+		return journal_file(_folder, tradingDate);
+	}
+
+	static inline std::string journal_file(const std::string& folder, uint32_t tradingDate)
+	{
+		return StrUtil::printf("%sqdp_%u.jnl", StrUtil::standardisePath(folder).c_str(), tradingDate);
+	}
+
+	/*
+	 *	切换到tradingDate的文件，同一天重启时接着已有的文件写
+	 */
+	bool rotate(uint32_t tradingDate)
+	{
+		StdUniqueLock lock(_mtx);
+		if (tradingDate == 0 || tradingDate == this->tradingDate())
+			return true;
+
+		Segment* seg = openSegment(tradingDate);
+		if (seg == NULL)
+			return false;
+
+		Segment* old = _cur.exchange(seg, std::memory_order_acq_rel);
+		if (old != NULL)
+			_retired.emplace_back(old, TimeUtils::getLocalTimeNow());
+		return true;
+	}
+
+	/*
+	 *	回调线程调用，可以多个线程同时写
+	 *	返回false表示还没有打开文件或者文件已满
+	 */
+	inline bool append(uint16_t type, uint16_t source, uint16_t flags, const void* data, uint32_t length)
+	{
+		int64_t recvNs = now_ns();
+		Segment* seg = _cur.load(std::memory_order_acquire);
+		if (seg == NULL)
+			return false;
+
+		uint64_t total = record_size(length);
+		uint64_t offset = seg->_offset.fetch_add(total, std::memory_order_relaxed);
+		if (offset + total > seg->_capacity)
+		{
+			seg->_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		QdpJournalRecord* rec = (QdpJournalRecord*)(seg->_base + offset);
+		rec->_length = (uint16_t)length;
+		rec->_source = source;
+		rec->_flags = flags;
+		rec->_recv_ns = recvNs;
+		memcpy(rec + 1, data, length);
+
+		//类型最后写，读到类型就说明整条记录已经写完
+		std::atomic_thread_fence(std::memory_order_release);
+		*(volatile uint16_t*)&rec->_type = type;
+		_appended.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	/*
+	 *	后台线程调用，更新文件头并落盘，顺便解除换下来的文件的映射
+	 */
+	void flush(int64_t graceMs = 1000)
+	{
+		StdUniqueLock lock(_mtx);
+		Segment* seg = _cur.load(std::memory_order_acquire);
+		if (seg != NULL)
+			syncSegment(seg);
+
+		int64_t now = TimeUtils::getLocalTimeNow();
+		for (auto it = _retired.begin(); it != _retired.end();)
+		{
+			if (now - it->second < graceMs)
+			{
+				it++;
+				continue;
+			}
+
+			syncSegment(it->first);
+			delete it->first;
+			it = _retired.erase(it);
+		}
+	}
+
+	void close()
+	{
+		{
+			StdUniqueLock lock(_mtx);
+			Segment* seg = _cur.exchange(NULL, std::memory_order_acq_rel);
+			if (seg != NULL)
+				_retired.emplace_back(seg, 0);
+		}
+
+		flush(0);
+	}
+
+	inline uint64_t appended() const { return _appended.load(std::memory_order_relaxed); }
+
+	inline uint64_t dropped() const
+	{
+		Segment* seg = _cur.load(std::memory_order_acquire);
+		return (seg == NULL) ? 0 : seg->_header->_dropped + seg->_dropped.load(std::memory_order_relaxed);
+	}
+
+	inline uint64_t used() const
+	{
+		Segment* seg = _cur.load(std::memory_order_acquire);
+		return (seg == NULL) ? 0 : std::min(seg->_offset.load(std::memory_order_relaxed), seg->_capacity);
+	}
+
+	inline uint64_t capacity() const { return _capacity; }
+
+private:
+	Segment* openSegment(uint32_t tradingDate)
+	{
+		std::string path = filename(tradingDate);
+		bool isNew = !BoostFile::exists(path.c_str());
+		if (isNew)
+		{
+			BoostFile::create_directories(_folder.c_str());
+			BoostFile bf;
+			if (!bf.create_new_file(path.c_str()))
+				return NULL;
+			bf.truncate_file((uint32_t)_capacity);
+			bf.close_file();
+		}
+
+		Segment* seg = new Segment;
+		if (!seg->_file.map(path.c_str()) || seg->_file.size() < sizeof(QdpJournalHeader))
+		{
+			delete seg;
+			return NULL;
+		}
+
+		seg->_base = (char*)seg->_file.addr();
+		seg->_header = (QdpJournalHeader*)seg->_base;
+		seg->_capacity = seg->_file.size();
+		seg->_date = tradingDate;
+		seg->_dropped.store(0, std::memory_order_relaxed);
+
+		QdpJournalHeader* header = seg->_header;
+		if (isNew || strcmp(header->_magic, QDP_JOURNAL_MAGIC) != 0)
+		{
+			memset(header, 0, sizeof(QdpJournalHeader));
+			strcpy(header->_magic, QDP_JOURNAL_MAGIC);
+			header->_version = QDP_JOURNAL_VERSION;
+			header->_trading_date = tradingDate;
+			header->_capacity = seg->_capacity;
+			header->_size = sizeof(QdpJournalHeader);
+		}
+
+		//多个线程同时写，进程退出时可能有预留了位置还没写完的记录，后面却有已经写完的，
+		//所以从头扫，遇到空洞就找后面最近的一条完整记录，找到了用填充记录盖住空洞接着扫
+		uint64_t offset = sizeof(QdpJournalHeader);
+		int64_t lastRecv = 0;
+		while (offset + sizeof(QdpJournalRecord) <= seg->_capacity)
+		{
+			const QdpJournalRecord* rec = (const QdpJournalRecord*)(seg->_base + offset);
+			if (rec->_type != JRT_NONE)
+			{
+				if (rec->_type != JRT_PAD)
+					lastRecv = rec->_recv_ns;
+				offset += record_size(rec->_length);
+				continue;
+			}
+
+			uint64_t next = findCommitted(seg, offset, lastRecv);
+			if (next == 0)
+				break;
+
+			fillHole(seg, offset, next);
+			offset = next;
+		}
+		seg->_offset.store(offset, std::memory_order_relaxed);
+		return seg;
+	}
+
+	/*
+	 *	在空洞后面找下一条写完的记录，返回0表示后面没有了
+	 *	空洞只可能是退出时还在写的那几条，不会太长；记录是8字节对齐的，按8字节往后试，
+	 *	类型合法、长度不越界、收到时间和空洞前最后一条相差不远才认为是记录头，避免把负载误认成记录头
+	 */
+	uint64_t findCommitted(Segment* seg, uint64_t hole, int64_t lastRecv) const
+	{
+		static const uint64_t MAX_HOLE = 1 << 20;
+		static const int64_t MAX_SKEW_NS = 60 * 1000000000LL;
+
+		uint64_t end = std::min(hole + MAX_HOLE, seg->_capacity);
+		for (uint64_t pos = hole + sizeof(QdpJournalRecord); pos + sizeof(QdpJournalRecord) <= end; pos += 8)
+		{
+			const QdpJournalRecord* rec = (const QdpJournalRecord*)(seg->_base + pos);
+			if (rec->_type < JRT_DEPTH || rec->_type >= JRT_PAD || rec->_recv_ns <= 0)
+				continue;
+
+			if (pos + record_size(rec->_length) > seg->_capacity)
+				continue;
+
+			if (lastRecv != 0 && (rec->_recv_ns < lastRecv - MAX_SKEW_NS || rec->_recv_ns > lastRecv + MAX_SKEW_NS))
+				continue;
+
+			return pos;
+		}
+
+		return 0;
+	}
+
+	/*
+	 *	用填充记录盖住[from, to)，一条填充记录放不下就拆成几条
+	 */
+	void fillHole(Segment* seg, uint64_t from, uint64_t to)
+	{
+		static const uint64_t MAX_PAD = record_size(UINT16_MAX) - 8;
+
+		while (from < to)
+		{
+			uint64_t total = std::min(to - from, MAX_PAD);
+			//剩下的不够一个记录头就少占一点留给下一条
+			if (to - from - total != 0 && to - from - total < sizeof(QdpJournalRecord))
+				total -= sizeof(QdpJournalRecord);
+
+			QdpJournalRecord* rec = (QdpJournalRecord*)(seg->_base + from);
+			rec->_length = (uint16_t)(total - sizeof(QdpJournalRecord));
+			rec->_source = 0;
+			rec->_flags = 0;
+			rec->_recv_ns = 0;
+			std::atomic_thread_fence(std::memory_order_release);
+			*(volatile uint16_t*)&rec->_type = JRT_PAD;
+			from += total;
+		}
+	}
+
+	void syncSegment(Segment* seg)
+	{
+		seg->_header->_size = std::min(seg->_offset.load(std::memory_order_relaxed), seg->_capacity);
+		seg->_header->_dropped += seg->_dropped.exchange(0, std::memory_order_relaxed);
+		seg->_file.flush();
+	}
+
+private:
+	std::string				_folder;
+	uint64_t				_capacity;
+	std::atomic<Segment*>	_cur;
+	std::vector<std::pair<Segment*, int64_t>>	_retired;
+	std::atomic<uint64_t>	_appended;
+	StdUniqueMutex			_mtx;		//换日和落盘可能在不同线程
+};
+
+/*
+ *	日志的顺序读取，只读映射，回放和离线分析用
+ */
+class QdpJournalReader
+{
+public:
+	QdpJournalReader() :_base(NULL), _size(0), _offset(0) {}
+
+	bool open(const std::string& filename)
+	{
+		close();
+		if (!BoostFile::exists(filename.c_str()))
+			return false;
+
+		_file.reset(new BoostMappingFile);
+		if (!_file->map(filename.c_str(), boost::interprocess::read_only, boost::interprocess::read_only)
+			|| _file->size() < sizeof(QdpJournalHeader))
+		{
+			_file.reset();
+			return false;
+		}
+
+		_base = (const char*)_file->addr();
+		_size = _file->size();
+		if (strcmp(header()->_magic, QDP_JOURNAL_MAGIC) != 0 || header()->_version != QDP_JOURNAL_VERSION)
+		{
+			close();
+			return false;
+		}
+
+#ifndef _WIN32
+		//只会从头读到尾，让内核多预读一些
+		madvise((void*)_base, _size, MADV_SEQUENTIAL);
+#endif
+		_offset = sizeof(QdpJournalHeader);
+		return true;
+	}
+
+	void close()
+	{
+		_file.reset();
+		_base = NULL;
+		_size = 0;
+		_offset = 0;
+	}
+
+	inline const QdpJournalHeader* header() const { return (const QdpJournalHeader*)_base; }
+
+	/*
+	 *	下一条记录，负载紧跟在记录头后面，读完了返回NULL
+	 */
+	inline const QdpJournalRecord* next()
+	{
+		while (_base != NULL && _offset + sizeof(QdpJournalRecord) <= _size)
+		{
+			const QdpJournalRecord* rec = (const QdpJournalRecord*)(_base + _offset);
+			if (rec->_type == JRT_NONE)
+				return NULL;
+
+			uint64_t total = QdpJournalWriter::record_size(rec->_length);
+			if (_offset + total > _size)
+				return NULL;
+
+			_offset += total;
+			if (rec->_type != JRT_PAD)
+				return rec;
+		}
+
+		return NULL;
+	}
+
+	inline uint64_t offset() const { return _offset; }
+
+private:
+	std::unique_ptr<BoostMappingFile>	_file;
+	const char*		_base;
+	uint64_t		_size;
+	uint64_t		_offset;
+};
@@ -0,0 +1,621 @@
+/*!
+ * \file QdpLatency.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 行情链路的延迟统计
+ *
+ * 每笔行情在回调入口用TSC打戳，分三段记录：交易所时间到收到、收到到交给下游、下游处理耗时
+ * 直方图是对数分桶（HDR风格），每个2的幂区间再均分8份，取桶中点时相对误差不超过6.25%，
+ * 记录只是几个原子加，不加锁；导出由后台线程按间隔做，输出的是两次导出之间的分位数
+ */
+#pragma once
+#include "../Share/BoostFile.hpp"
+#include "../Share/BoostMappingFile.hpp"
+#include "../Share/StrUtil.hpp"
+#include "../Share/StdUtils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define QDP_HAS_TSC
+#endif
+
+#define QDP_LATENCY_MAGIC	"QDPLAT1"
+#define QDP_LATENCY_VERSION	1
+
+/*
+ *	统计的阶段
+ */
+typedef enum tagLatencyStage
+{
+	LS_EXCH_RECV = 0,	//交易所时间到回调收到，交易所时间只到毫秒
+	LS_RECV_SINK,		//回调收到到交给IParserSpi，含转换、排队
+	LS_SINK,			//IParserSpi::handleQuote的耗时
+	LS_COUNT
+} LatencyStage;
+
+static const char* LATENCY_STAGE_NAMES[LS_COUNT] = { "exch2recv", "recv2sink", "sink" };
+
+#pragma pack(push, 8)
+/*
+ *	一个阶段的统计结果，单位纳秒
+ */
+typedef struct _QdpLatencySummary
+{
+	uint64_t	_count;
+	uint64_t	_sum;
+	uint64_t	_min;
+	uint64_t	_p50;
+	uint64_t	_p90;
+	uint64_t	_p99;
+	uint64_t	_p999;
+	uint64_t	_max;
+} QdpLatencySummary;
+
+/*
+ *	共享内存导出的文件头，_seq为奇数表示正在写，读的一方前后两次读到同一个偶数才算读完整
+ */
+typedef struct _QdpLatencyShmHeader
+{
+	char		_magic[8];
+	uint32_t	_version;
+	uint32_t	_stages;
+	uint32_t	_capacity;		//能放下的记录数
+	uint32_t	_count;			//本次导出的记录数，第一条是全局
+	uint64_t	_seq;
+	int64_t		_update_time;	//导出时间，毫秒
+	uint32_t	_interval;		//导出间隔，毫秒
+	uint32_t	_reserved;
+} QdpLatencyShmHeader;
+
+typedef struct _QdpLatencyShmRecord
+{
+	char				_name[32];	//全局为"*"，合约为交易所.代码
+	QdpLatencySummary	_stages[LS_COUNT];
+} QdpLatencyShmRecord;
+#pragma pack(pop)
+
+/*
+ *	TSC时钟，定时用系统时钟校准，不支持TSC的平台退化为steady_clock
+ *	校准结果放在两个槽位里轮换，读的一方不加锁
+ */
+class QdpTscClock
+{
+private:
+	typedef struct _Anchor
+	{
+		uint64_t	_tsc;
+		int64_t		_wall_ns;
+		int64_t		_tz_ns;		//本地时区相对UTC的偏移
+		uint64_t	_mult;		//每个tick的纳秒数，左移SHIFT位的定点数
+	} Anchor;
+
+	static const uint32_t SHIFT = 20;
+
+public:
+	QdpTscClock() :_base_tsc(0), _base_mono(0), _idx(0)
+	{
+		memset(_anchors, 0, sizeof(_anchors));
+		_anchors[0]._mult = 1ULL << SHIFT;
+	}
+
+	static inline uint64_t ticks()
+	{
+#ifdef QDP_HAS_TSC
+		return __rdtsc();
+#else
+		return (uint64_t)mono_ns();
+#endif
+	}
+
+	static inline int64_t mono_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static inline int64_t wall_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	/*
+	 *	第一次先忙等一小段估算频率，之后按第一次校准以来的整段时间算，越跑越准
+	 *	只能由一个线程调用
+	 */
+	void calibrate()
+	{
+		uint64_t tsc = ticks();
+		int64_t mono = mono_ns();
+		if (_base_tsc == 0)
+		{
+			_base_tsc = tsc;
+			_base_mono = mono;
+			while (mono_ns() - _base_mono < 10000000)
+				;
+			tsc = ticks();
+			mono = mono_ns();
+		}
+
+		Anchor& anchor = _anchors[1 - _idx.load(std::memory_order_relaxed)];
+		anchor._tsc = tsc;
+		anchor._wall_ns = wall_ns();
+		anchor._tz_ns = tz_offset(anchor._wall_ns);
+		if (tsc > _base_tsc)
+			anchor._mult = (uint64_t)((double)(mono - _base_mono) / (double)(tsc - _base_tsc) * (double)(1ULL << SHIFT));
+		_idx.store(1 - _idx.load(std::memory_order_relaxed), std::memory_order_release);
+	}
+
+	inline uint64_t toNs(uint64_t delta) const
+	{
+		return (delta * anchor()._mult) >> SHIFT;
+	}
+
+	/*
+	 *	打戳时刻在本地时间当天的纳秒数
+	 */
+	inline int64_t timeOfDay(uint64_t tsc) const
+	{
+		static const int64_t DAY_NS = 86400LL * 1000000000LL;
+		const Anchor& a = anchor();
+		int64_t wall = (tsc >= a._tsc) ? a._wall_ns + (int64_t)(((tsc - a._tsc) * a._mult) >> SHIFT)
+			: a._wall_ns - (int64_t)(((a._tsc - tsc) * a._mult) >> SHIFT);
+		return ((wall + a._tz_ns) % DAY_NS + DAY_NS) % DAY_NS;
+	}
+
+private:
+	inline const Anchor& anchor() const { return _anchors[_idx.load(std::memory_order_acquire)]; }
+
+	static int64_t tz_offset(int64_t wallNs)
+	{
+		time_t t = (time_t)(wallNs / 1000000000);
+		struct tm lt;
+#ifdef _WIN32
+		localtime_s(&lt, &t);
+#else
+		localtime_r(&t, &lt);
+#endif
+		int64_t localSec = lt.tm_hour * 3600 + lt.tm_min * 60 + lt.tm_sec;
+		int64_t utcSec = (int64_t)(t % 86400);
+		return (localSec - utcSec) * 1000000000LL;
+	}
+
+private:
+	uint64_t			_base_tsc;
+	int64_t				_base_mono;
+	Anchor				_anchors[2];
+	std::atomic<uint32_t>	_idx;
+};
+
+/*
+ *	对数分桶的直方图，可以多个线程同时记录
+ */
+class QdpLatencyHisto
+{
+public:
+	static const uint32_t SUB_BITS = 3;
+	static const uint32_t SUB_COUNT = 1 << SUB_BITS;
+	static const uint32_t MAX_BITS = 36;		//大约68秒，更大的都算在最后一个桶里
+	static const uint32_t BUCKETS = (MAX_BITS - SUB_BITS + 1) << SUB_BITS;
+
+	static inline uint32_t msb(uint64_t v)
+	{
+#ifdef _MSC_VER
+		unsigned long idx;
+		_BitScanReverse64(&idx, v);
+		return (uint32_t)idx;
+#else
+		return 63 - (uint32_t)__builtin_clzll(v);
+#endif
+	}
+
+	static inline uint32_t bucket(uint64_t v)
+	{
+		if (v < SUB_COUNT)
+			return (uint32_t)v;
+
+		uint32_t bits = msb(v);
+		if (bits >= MAX_BITS)
+			return BUCKETS - 1;
+
+		uint32_t shift = bits - SUB_BITS;
+		return ((shift + 1) << SUB_BITS) + (uint32_t)((v >> shift) & (SUB_COUNT - 1));
+	}
+
+	/*
+	 *	桶的代表值，取桶的中点
+	 */
+	static inline uint64_t value(uint32_t idx)
+	{
+		if (idx < SUB_COUNT)
+			return idx;
+
+		uint32_t shift = (idx >> SUB_BITS) - 1;
+		uint64_t lower = (uint64_t)((idx & (SUB_COUNT - 1)) | SUB_COUNT) << shift;
+		return lower + ((1ULL << shift) >> 1);
+	}
+
+public:
+	QdpLatencyHisto()
+		: _counts(new std::atomic<uint64_t>[BUCKETS])
+		, _prev(new uint64_t[BUCKETS])
+		, _sum(0)
+		, _prev_sum(0)
+		, _max(0)
+	{
+		for (uint32_t i = 0; i < BUCKETS; i++)
+		{
+			_counts[i].store(0, std::memory_order_relaxed);
+			_prev[i] = 0;
+		}
+	}
+
+	inline void record(uint64_t ns)
+	{
+		_counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+		_sum.fetch_add(ns, std::memory_order_relaxed);
+
+		uint64_t cur = _max.load(std::memory_order_relaxed);
+		while (ns > cur && !_max.compare_exchange_weak(cur, ns, std::memory_order_relaxed))
+			;
+	}
+
+	/*
+	 *	汇总，interval为true时只算上次汇总以来的部分，只能由导出线程调用
+	 *	区间汇总的最大值也取桶的代表值，累计汇总的最大值是精确的，分位数不超过最大值
+	 */
+	void summarize(QdpLatencySummary& out, bool interval)
+	{
+		uint64_t cur[BUCKETS];
+		uint64_t total = 0;
+		for (uint32_t i = 0; i < BUCKETS; i++)
+		{
+			uint64_t cnt = _counts[i].load(std::memory_order_relaxed);
+			cur[i] = interval ? cnt - _prev[i] : cnt;
+			total += cur[i];
+			if (interval)
+				_prev[i] = cnt;
+		}
+
+		uint64_t sum = _sum.load(std::memory_order_relaxed);
+		memset(&out, 0, sizeof(out));
+		out._count = total;
+		out._sum = interval ? sum - _prev_sum : sum;
+		if (interval)
+			_prev_sum = sum;
+		if (total == 0)
+			return;
+
+		out._max = _max.load(std::memory_order_relaxed);
+		if (interval)
+		{
+			for (uint32_t i = BUCKETS; i > 0; i--)
+			{
+				if (cur[i - 1] != 0)
+				{
+					out._max = std::min(value(i - 1), out._max);
+					break;
+				}
+			}
+		}
+
+		const double quantiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+		uint64_t* targets[4] = { &out._p50, &out._p90, &out._p99, &out._p999 };
+		uint32_t q = 0;
+		uint64_t acc = 0;
+		bool hasMin = false;
+		for (uint32_t i = 0; i < BUCKETS && q < 4; i++)
+		{
+			if (cur[i] == 0)
+				continue;
+
+			if (!hasMin)
+			{
+				out._min = value(i);
+				hasMin = true;
+			}
+
+			acc += cur[i];
+			while (q < 4 && acc >= (uint64_t)(quantiles[q] * total + 0.5))
+				*targets[q++] = std::min(value(i), out._max);
+		}
+	}
+
+private:
+	std::unique_ptr<std::atomic<uint64_t>[]>	_counts;
+	std::unique_ptr<uint64_t[]>	_prev;
+	std::atomic<uint64_t>	_sum;
+	uint64_t				_prev_sum;
+	std::atomic<uint64_t>	_max;
+};
+
+typedef struct _QdpLatencyScope
+{
+	std::string		_name;
+	QdpLatencyHisto	_histos[LS_COUNT];
+} QdpLatencyScope;
+
+/*
+ *	延迟统计，全局一份，按需给每个合约一份
+ */
+class QdpLatencyMonitor
+{
+public:
+	typedef enum tagExportMode
+	{
+		EM_NONE = 0,
+		EM_FILE,	//按行追加到文本文件
+		EM_SHM		//写到映射文件里，监控程序直接映射读取
+	} ExportMode;
+
+	QdpLatencyMonitor() :_mode(EM_NONE), _capacity(4096), _interval(10000), _shm_header(NULL), _skewed(0)
+	{
+		_global._name = "*";
+	}
+
+	~QdpLatencyMonitor()
+	{
+		for (QdpLatencyScope* scope : _scopes)
+			delete scope;
+		_scopes.clear();
+	}
+
+public:
+	/*
+	 *	mode		导出方式，file或者shm，其他不导出
+	 *	folder		导出目录
+	 *	capacity	共享内存里能放的记录数，含全局
+	 *	interval	导出间隔，毫秒
+	 */
+	bool init(const char* mode, const std::string& folder, uint32_t capacity, uint32_t interval)
+	{
+		_clock.calibrate();
+		_folder = StrUtil::standardisePath(folder);
+		_interval = interval;
+		if (capacity > 0)
+			_capacity = capacity;
+
+		if (strcmp(mode, "file") == 0)
+			_mode = EM_FILE;
+		else if (strcmp(mode, "shm") == 0)
+			_mode = EM_SHM;
+
+		if (_mode == EM_SHM)
+			return openShm();
+
+		return true;
+	}
+
+	inline ExportMode mode() const { return _mode; }
+	inline uint32_t interval() const { return _interval; }
+	inline uint64_t skewed() const { return _skewed.load(std::memory_order_relaxed); }
+	inline QdpLatencyScope& global() { return _global; }
+
+	inline uint64_t now() const { return QdpTscClock::ticks(); }
+
+	/*
+	 *	合约的统计，注册以后一直有效，由回调线程调用
+	 */
+	QdpLatencyScope* addScope(const std::string& name)
+	{
+		QdpLatencyScope* scope = new QdpLatencyScope;
+		scope->_name = name;
+
+		StdUniqueLock lock(_mtx);
+		_scopes.emplace_back(scope);
+		return scope;
+	}
+
+	/*
+	 *	actTime是交易所时间，格式HHMMSSmmm，本地时钟比交易所慢的不计，只计数
+	 */
+	inline void recordExchange(QdpLatencyScope* scope, uint64_t recvTsc, uint32_t actTime)
+	{
+		static const int64_t DAY_NS = 86400LL * 1000000000LL;
+		int64_t exchNs = ((int64_t)(actTime / 10000000) * 3600000 + (int64_t)(actTime / 100000 % 100) * 60000 + (int64_t)(actTime % 100000)) * 1000000;
+		int64_t lag = _clock.timeOfDay(recvTsc) - exchNs;
+		//跨午夜
+		if (lag < -DAY_NS / 2)
+			lag += DAY_NS;
+		else if (lag > DAY_NS / 2)
+			lag -= DAY_NS;
+
+		if (lag < 0)
+		{
+			_skewed.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		record(scope, LS_EXCH_RECV, (uint64_t)lag);
+	}
+
+	inline void recordSink(QdpLatencyScope* scope, uint64_t recvTsc, uint64_t sinkTsc, uint64_t doneTsc)
+	{
+		record(scope, LS_RECV_SINK, _clock.toNs(sinkTsc - recvTsc));
+		record(scope, LS_SINK, _clock.toNs(doneTsc - sinkTsc));
+	}
+
+	/*
+	 *	后台线程调用，校准时钟
+	 */
+	inline void calibrate() { _clock.calibrate(); }
+
+	/*
+	 *	后台线程调用，导出两次导出之间的统计
+	 */
+	void dump()
+	{
+		if (_mode == EM_FILE)
+			dumpFile();
+		else if (_mode == EM_SHM)
+			dumpShm();
+	}
+
+private:
+	inline void record(QdpLatencyScope* scope, LatencyStage stage, uint64_t ns)
+	{
+		_global._histos[stage].record(ns);
+		if (scope != NULL)
+			scope->_histos[stage].record(ns);
+	}
+
+	bool openShm()
+	{
+		std::string path = _folder + "qdp_latency.shm";
+		uint64_t size = sizeof(QdpLatencyShmHeader) + (uint64_t)_capacity * sizeof(QdpLatencyShmRecord);
+		BoostFile::create_directories(_folder.c_str());
+		if (!BoostFile::exists(path.c_str()))
+		{
+			BoostFile bf;
+			if (!bf.create_new_file(path.c_str()))
+				return false;
+			bf.close_file();
+		}
+
+		//监控程序可能还映射着旧文件，大小不对就重新截断
+		{
+			BoostFile bf;
+			if (!bf.open_existing_file(path.c_str(), false))
+				return false;
+			bf.truncate_file((uint32_t)size);
+			bf.close_file();
+		}
+
+		_shm.reset(new BoostMappingFile);
+		if (!_shm->map(path.c_str()) || _shm->size() < size)
+		{
+			_shm.reset();
+			return false;
+		}
+
+		_shm_header = (QdpLatencyShmHeader*)_shm->addr();
+		memset(_shm_header, 0, size);
+		strcpy(_shm_header->_magic, QDP_LATENCY_MAGIC);
+		_shm_header->_version = QDP_LATENCY_VERSION;
+		_shm_header->_stages = LS_COUNT;
+		_shm_header->_capacity = _capacity;
+		_shm_header->_interval = _interval;
+		return true;
+	}
+
+	void dumpShm()
+	{
+		if (_shm_header == NULL)
+			return;
+
+		//序号先变成奇数，写完再变成偶数
+		volatile uint64_t* seq = &_shm_header->_seq;
+		*seq = *seq + 1;
+		std::atomic_thread_fence(std::memory_order_release);
+
+		QdpLatencyShmRecord* records = (QdpLatencyShmRecord*)(_shm_header + 1);
+		uint32_t cnt = 0;
+		fillRecord(records[cnt++], _global);
+		{
+			StdUniqueLock lock(_mtx);
+			for (QdpLatencyScope* scope : _scopes)
+			{
+				if (cnt >= _capacity)
+					break;
+				fillRecord(records[cnt++], *scope);
+			}
+		}
+		_shm_header->_count = cnt;
+		_shm_header->_update_time = QdpTscClock::wall_ns() / 1000000;
+
+		std::atomic_thread_fence(std::memory_order_release);
+		*seq = *seq + 1;
+	}
+
+	void fillRecord(QdpLatencyShmRecord& rec, QdpLatencyScope& scope)
+	{
+		memset(rec._name, 0, sizeof(rec._name));
+		strncpy(rec._name, scope._name.c_str(), sizeof(rec._name) - 1);
+		for (uint32_t i = 0; i < LS_COUNT; i++)
+			scope._histos[i].summarize(rec._stages[i], true);
+	}
+
+	/*
+	 *	每天一个文件，一行一个阶段，没有数据的合约不输出
+	 */
+	void dumpFile()
+	{
+		int64_t now = QdpTscClock::wall_ns() / 1000000;
+		time_t t = (time_t)(now / 1000);
+		struct tm lt;
+#ifdef _WIN32
+		localtime_s(&lt, &t);
+#else
+		localtime_r(&t, &lt);
+#endif
+		std::string path = StrUtil::printf("%sqdp_latency_%04d%02d%02d.csv", _folder.c_str(), lt.tm_year + 1900, lt.tm_mon + 1, lt.tm_mday);
+		bool isNew = !BoostFile::exists(path.c_str());
+		if (isNew)
+			BoostFile::create_directories(_folder.c_str());
+
+		FILE* fp = fopen(path.c_str(), "a");
+		if (fp == NULL)
+			return;
+
+		if (isNew)
+			fputs("time,scope,stage,count,min,mean,p50,p90,p99,p999,max\n", fp);
+
+		char stamp[32];
+		snprintf(stamp, sizeof(stamp), "%02d:%02d:%02d.%03d", lt.tm_hour, lt.tm_min, lt.tm_sec, (int)(now % 1000));
+		writeScope(fp, stamp, _global);
+		{
+			StdUniqueLock lock(_mtx);
+			for (QdpLatencyScope* scope : _scopes)
+				writeScope(fp, stamp, *scope);
+		}
+		fclose(fp);
+	}
+
+	void writeScope(FILE* fp, const char* stamp, QdpLatencyScope& scope)
+	{
+		QdpLatencySummary summary;
+		for (uint32_t i = 0; i < LS_COUNT; i++)
+		{
+			scope._histos[i].summarize(summary, true);
+			if (summary._count == 0)
+				continue;
+
+			fprintf(fp, "%s,%s,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", stamp, scope._name.c_str(), LATENCY_STAGE_NAMES[i],
+				(unsigned long long)summary._count, (unsigned long long)summary._min, (unsigned long long)(summary._sum / summary._count),
+				(unsigned long long)summary._p50, (unsigned long long)summary._p90, (unsigned long long)summary._p99,
+				(unsigned long long)summary._p999, (unsigned long long)summary._max);
+		}
+	}
+
+private:
+	QdpTscClock			_clock;
+	ExportMode			_mode;
+	std::string			_folder;
+	uint32_t			_capacity;
+	uint32_t			_interval;
+
+	QdpLatencyScope		_global;
+	std::vector<QdpLatencyScope*>	_scopes;
+	StdUniqueMutex		_mtx;		//合约的统计在回调线程里注册，导出线程遍历
+
+	std::unique_ptr<BoostMappingFile>	_shm;
+	QdpLatencyShmHeader*	_shm_header;
+	std::atomic<uint64_t>	_skewed;	//本地时钟比交易所时间还早的笔数
+};
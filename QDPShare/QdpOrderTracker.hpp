@@ -0,0 +1,372 @@
+/*!
+ * \file QdpOrderTracker.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 报单生命周期的延迟跟踪
+ *
+ * 按UserOrderLocalID直接映射到固定容量的槽位，本地报单号是递增的，容量以内不会冲突，
+ * 发单线程和回调线程各自只做原子读写，不加锁；报单结束（全成、撤单、拒单）时把各段耗时
+ * 计入按合约和结果分组的直方图，会话结束时输出，还没结束的报单按未完成计
+ */
+#pragma once
+#include "QdpLatency.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ *	报单的结果
+ */
+typedef enum tagOrderOutcome
+{
+	OO_FILLED = 0,		//全部成交
+	OO_CANCELED,		//撤单，含FAK、FOK剩余部分被撤
+	OO_REJECTED,		//报单被拒
+	OO_OPEN,			//会话结束时还没有结束
+	OO_COUNT
+} OrderOutcome;
+
+static const char* ORDER_OUTCOME_NAMES[OO_COUNT] = { "filled", "canceled", "rejected", "open" };
+
+/*
+ *	统计的阶段，除了撤单都从发出报单算起
+ */
+typedef enum tagOrderStage
+{
+	OS_ACK = 0,			//报单应答
+	OS_REPORT,			//第一笔报单回报
+	OS_FILL,			//第一笔成交回报
+	OS_CANCEL,			//撤单请求到撤单回报
+	OS_DONE,			//报单结束
+	OS_COUNT
+} OrderStage;
+
+static const char* ORDER_STAGE_NAMES[OS_COUNT] = { "ack", "report", "fill", "cancel", "done" };
+
+class QdpOrderTracker
+{
+private:
+	typedef struct _OrderTrace
+	{
+		std::atomic<uint32_t>	_key;		//本地报单号+1，0为空槽位
+		std::atomic<uint32_t>	_done;
+		char					_code[32];
+		int						_volume;
+		std::atomic<int>		_traded;
+		std::atomic<uint64_t>	_send;
+		std::atomic<uint64_t>	_ack;
+		std::atomic<uint64_t>	_report;
+		std::atomic<uint64_t>	_fill;
+		std::atomic<uint64_t>	_cancel_req;
+		std::atomic<uint64_t>	_cancel_ack;
+	} OrderTrace;
+
+	typedef struct _OrderGroup
+	{
+		QdpLatencyHisto	_histos[OO_COUNT][OS_COUNT];
+	} OrderGroup;
+
+	static inline uint32_t make_key(int localID) { return (uint32_t)localID + 1; }
+
+	//只有第一次生效，返回这次是否写进去了
+	static inline bool stamp(std::atomic<uint64_t>& field, uint64_t tsc)
+	{
+		uint64_t expected = 0;
+		return field.compare_exchange_strong(expected, tsc, std::memory_order_relaxed);
+	}
+
+public:
+	QdpOrderTracker() :_mask(0), _evicted(0), _untracked(0), _cancel_rejects(0)
+	{
+		memset(_outcomes, 0, sizeof(_outcomes));
+	}
+
+	~QdpOrderTracker()
+	{
+		for (auto& item : _groups)
+			delete item.second;
+		_groups.clear();
+	}
+
+	/*
+	 *	capacity	槽位数，向上取到2的幂，在途加上近期结束的报单数不要超过它
+	 */
+	void init(uint32_t capacity)
+	{
+		uint32_t cap = 1024;
+		while (cap < capacity)
+			cap <<= 1;
+
+		_mask = cap - 1;
+		_traces.reset(new OrderTrace[cap]);
+		for (uint32_t i = 0; i < cap; i++)
+		{
+			_traces[i]._key.store(0, std::memory_order_relaxed);
+			_traces[i]._done.store(0, std::memory_order_relaxed);
+		}
+		_clock.calibrate();
+	}
+
+	inline bool active() const { return _traces != NULL; }
+	inline uint32_t capacity() const { return _mask + 1; }
+	inline uint64_t evicted() const { return _evicted.load(std::memory_order_relaxed); }
+	inline uint64_t untracked() const { return _untracked.load(std::memory_order_relaxed); }
+	inline uint64_t cancelRejects() const { return _cancel_rejects.load(std::memory_order_relaxed); }
+	inline uint64_t outcomes(OrderOutcome outcome) const { return _outcomes[outcome]; }
+
+	/*
+	 *	TSC和系统时钟重新对一次，由后台线程定时调用，和close不能同时调
+	 */
+	inline void calibrate() { _clock.calibrate(); }
+
+public:
+	/*
+	 *	发单线程调用，在调用ReqOrderInsert之前
+	 */
+	void onSend(int localID, const char* code, int volume)
+	{
+		OrderTrace& trace = _traces[(uint32_t)localID & _mask];
+		//槽位上还有没结束的报单，说明在途的报单比容量还多
+		uint32_t old = trace._key.exchange(0, std::memory_order_acq_rel);
+		if (old != 0 && trace._done.load(std::memory_order_relaxed) == 0)
+			_evicted.fetch_add(1, std::memory_order_relaxed);
+
+		strncpy(trace._code, code, sizeof(trace._code) - 1);
+		trace._code[sizeof(trace._code) - 1] = '\0';
+		trace._volume = volume;
+		trace._traded.store(0, std::memory_order_relaxed);
+		trace._ack.store(0, std::memory_order_relaxed);
+		trace._report.store(0, std::memory_order_relaxed);
+		trace._fill.store(0, std::memory_order_relaxed);
+		trace._cancel_req.store(0, std::memory_order_relaxed);
+		trace._cancel_ack.store(0, std::memory_order_relaxed);
+		trace._done.store(0, std::memory_order_relaxed);
+		trace._send.store(QdpTscClock::ticks(), std::memory_order_relaxed);
+		trace._key.store(make_key(localID), std::memory_order_release);
+	}
+
+	/*
+	 *	发单线程调用，ReqOrderInsert没发出去，报单不会有任何回报，槽位直接作废
+	 */
+	void onSendFailed(int localID)
+	{
+		OrderTrace* trace = find(localID);
+		if (trace != NULL)
+			trace->_key.store(0, std::memory_order_release);
+	}
+
+	/*
+	 *	发单线程调用，在调用ReqOrderAction之前
+	 *	返回写进去的撤单时间，没发出去时交给onCancelFailed撤掉
+	 */
+	uint64_t onCancel(int localID)
+	{
+		OrderTrace* trace = find(localID);
+		if (trace == NULL)
+			return 0;
+
+		uint64_t now = QdpTscClock::ticks();
+		return stamp(trace->_cancel_req, now) ? now : 0;
+	}
+
+	/*
+	 *	发单线程调用，ReqOrderAction没发出去，撤掉onCancel写的时间，下一次撤单重新计时
+	 */
+	void onCancelFailed(int localID, uint64_t cancelTsc)
+	{
+		if (cancelTsc == 0)
+			return;
+
+		OrderTrace* trace = find(localID);
+		if (trace != NULL)
+			trace->_cancel_req.compare_exchange_strong(cancelTsc, 0, std::memory_order_relaxed);
+	}
+
+	/*
+	 *	以下都由回调线程调用
+	 */
+	void onAck(int localID, bool rejected)
+	{
+		uint64_t now = QdpTscClock::ticks();
+		OrderTrace* trace = find(localID);
+		if (trace == NULL)
+			return;
+
+		stamp(trace->_ack, now);
+		if (rejected)
+			finish(*trace, OO_REJECTED, now);
+	}
+
+	/*
+	 *	canceled	报单已撤，含FAK、FOK剩余部分被撤
+	 *	allTraded	报单已全部成交
+	 */
+	void onReport(int localID, bool canceled, bool allTraded)
+	{
+		uint64_t now = QdpTscClock::ticks();
+		OrderTrace* trace = find(localID);
+		if (trace == NULL)
+			return;
+
+		stamp(trace->_report, now);
+		if (canceled)
+		{
+			stamp(trace->_cancel_ack, now);
+			finish(*trace, OO_CANCELED, now);
+		}
+		else if (allTraded && trace->_fill.load(std::memory_order_relaxed) != 0)
+		{
+			//成交回报先到了，全成以这笔回报为准
+			finish(*trace, OO_FILLED, now);
+		}
+	}
+
+	void onTrade(int localID, int volume)
+	{
+		uint64_t now = QdpTscClock::ticks();
+		OrderTrace* trace = find(localID);
+		if (trace == NULL)
+			return;
+
+		stamp(trace->_fill, now);
+		int traded = trace->_traded.fetch_add(volume, std::memory_order_relaxed) + volume;
+		if (traded >= trace->_volume)
+			finish(*trace, OO_FILLED, now);
+	}
+
+	void onCancelRejected(int localID)
+	{
+		_cancel_rejects.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/*
+	 *	会话结束时调用，回调线程已经停了，把还没结束的报单计入未完成
+	 */
+	void close()
+	{
+		if (_traces == NULL)
+			return;
+
+		//最后一批报单按最新的频率换算
+		_clock.calibrate();
+		uint64_t now = QdpTscClock::ticks();
+		for (uint32_t i = 0; i <= _mask; i++)
+		{
+			OrderTrace& trace = _traces[i];
+			if (trace._key.load(std::memory_order_acquire) != 0)
+				finish(trace, OO_OPEN, now);
+		}
+	}
+
+	inline void summarize(OrderOutcome outcome, OrderStage stage, QdpLatencySummary& out)
+	{
+		_global._histos[outcome][stage].summarize(out, false);
+	}
+
+	/*
+	 *	按合约和结果输出到文件，一行一个阶段，全部合约合计的合约名为"*"
+	 */
+	bool dump(const std::string& filename)
+	{
+		FILE* fp = fopen(filename.c_str(), "w");
+		if (fp == NULL)
+			return false;
+
+		fputs("code,outcome,stage,count,min,mean,p50,p90,p99,p999,max\n", fp);
+		writeGroup(fp, "*", _global);
+		for (auto& item : _groups)
+			writeGroup(fp, item.first.c_str(), *item.second);
+		fclose(fp);
+		return true;
+	}
+
+private:
+	inline OrderTrace* find(int localID)
+	{
+		if (_traces == NULL)
+			return NULL;
+
+		OrderTrace& trace = _traces[(uint32_t)localID & _mask];
+		if (trace._key.load(std::memory_order_acquire) != make_key(localID))
+		{
+			//别的会话或者重启前发出的报单
+			_untracked.fetch_add(1, std::memory_order_relaxed);
+			return NULL;
+		}
+
+		return &trace;
+	}
+
+	void finish(OrderTrace& trace, OrderOutcome outcome, uint64_t now)
+	{
+		uint32_t expected = 0;
+		if (!trace._done.compare_exchange_strong(expected, 1, std::memory_order_acq_rel))
+			return;
+
+		_outcomes[outcome]++;
+		OrderGroup*& group = _groups[trace._code];
+		if (group == NULL)
+			group = new OrderGroup;
+
+		uint64_t send = trace._send.load(std::memory_order_relaxed);
+		uint64_t stamps[OS_COUNT] = {
+			trace._ack.load(std::memory_order_relaxed),
+			trace._report.load(std::memory_order_relaxed),
+			trace._fill.load(std::memory_order_relaxed),
+			trace._cancel_ack.load(std::memory_order_relaxed),
+			(outcome == OO_OPEN) ? 0 : now
+		};
+
+		for (uint32_t stage = 0; stage < OS_COUNT; stage++)
+		{
+			uint64_t from = (stage == OS_CANCEL) ? trace._cancel_req.load(std::memory_order_relaxed) : send;
+			if (from == 0 || stamps[stage] == 0 || stamps[stage] < from)
+				continue;
+
+			uint64_t ns = _clock.toNs(stamps[stage] - from);
+			_global._histos[outcome][stage].record(ns);
+			group->_histos[outcome][stage].record(ns);
+		}
+	}
+
+	void writeGroup(FILE* fp, const char* code, OrderGroup& group)
+	{
+		QdpLatencySummary summary;
+		for (uint32_t outcome = 0; outcome < OO_COUNT; outcome++)
+		{
+			for (uint32_t stage = 0; stage < OS_COUNT; stage++)
+			{
+				group._histos[outcome][stage].summarize(summary, false);
+				if (summary._count == 0)
+					continue;
+
+				fprintf(fp, "%s,%s,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", code, ORDER_OUTCOME_NAMES[outcome], ORDER_STAGE_NAMES[stage],
+					(unsigned long long)summary._count, (unsigned long long)summary._min, (unsigned long long)(summary._sum / summary._count),
+					(unsigned long long)summary._p50, (unsigned long long)summary._p90, (unsigned long long)summary._p99,
+					(unsigned long long)summary._p999, (unsigned long long)summary._max);
+			}
+		}
+	}
+
+private:
+	QdpTscClock			_clock;
+	std::unique_ptr<OrderTrace[]>	_traces;
+	uint32_t			_mask;
+
+	//下面的只在回调线程里访问
+	OrderGroup			_global;
+	std::unordered_map<std::string, OrderGroup*>	_groups;
+	uint64_t			_outcomes[OO_COUNT];
+
+	std::atomic<uint64_t>	_evicted;
+	std::atomic<uint64_t>	_untracked;
+	std::atomic<uint64_t>	_cancel_rejects;
+};
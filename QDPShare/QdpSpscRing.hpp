@@ -0,0 +1,110 @@
+/*!
+ * \file QdpSpscRing.hpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 单生产者单消费者的无锁环形队列
+ *
+ * 容量在构造时一次分配，读写位置各占一条缓存行，
+ * 两边各缓存一份对方的位置，只有看起来满了（空了）才去读对方的原子变量
+ */
+#pragma once
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+template<typename T>
+class QdpSpscRing
+{
+public:
+	QdpSpscRing(uint32_t capacity)
+		: _head(0)
+		, _cached_tail(0)
+		, _high_water(0)
+		, _tail(0)
+		, _cached_head(0)
+	{
+		uint32_t cap = 16;
+		while (cap < capacity)
+			cap <<= 1;
+
+		_buffer.resize(cap);
+		_mask = cap - 1;
+	}
+
+public:
+	/*
+	 *	生产者调用，队列满了返回false
+	 */
+	inline bool push(const T& item)
+	{
+		uint64_t head = _head.load(std::memory_order_relaxed);
+		if (head - _cached_tail > _mask)
+		{
+			_cached_tail = _tail.load(std::memory_order_acquire);
+			if (head - _cached_tail > _mask)
+				return false;
+		}
+
+		_buffer[head & _mask] = item;
+		_head.store(head + 1, std::memory_order_release);
+
+		uint64_t depth = head + 1 - _cached_tail;
+		if (depth > _high_water.load(std::memory_order_relaxed))
+			_high_water.store(depth, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	/*
+	 *	消费者调用，队列空了返回false
+	 */
+	inline bool pop(T& item)
+	{
+		uint64_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail == _cached_head)
+		{
+			_cached_head = _head.load(std::memory_order_acquire);
+			if (tail == _cached_head)
+				return false;
+		}
+
+		item = _buffer[tail & _mask];
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/*
+	 *	当前深度，任意线程可读，是个近似值
+	 */
+	inline uint64_t size() const
+	{
+		uint64_t tail = _tail.load(std::memory_order_relaxed);
+		uint64_t head = _head.load(std::memory_order_relaxed);
+		return (head > tail) ? head - tail : 0;
+	}
+
+	inline uint64_t capacity() const { return _mask + 1; }
+
+	/*
+	 *	生产者看到的最大深度，生产者用的是缓存的读位置，所以会略微偏大
+	 */
+	inline uint64_t highWater() const { return _high_water.load(std::memory_order_relaxed); }
+
+	inline uint64_t pushed() const { return _head.load(std::memory_order_relaxed); }
+
+private:
+	std::vector<T>			_buffer;
+	uint64_t				_mask;
+
+	//生产者
+	alignas(64) std::atomic<uint64_t>	_head;
+	uint64_t				_cached_tail;
+	std::atomic<uint64_t>	_high_water;
+
+	//消费者
+	alignas(64) std::atomic<uint64_t>	_tail;
+	uint64_t				_cached_head;
+};
@@ -0,0 +1,850 @@
+﻿/*!
+ * \file QdpMdLoopback.cpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief QDP行情API的本地替身实现
+ */
+#include "QdpMdLoopback.h"
+#include "../Share/StrUtil.hpp"
+#include "../Share/TimeUtils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOOPBACK_VERSION "QdpMdLoopback 1.0"
+
+static inline int64_t mono_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline int64_t mono_ms()
+{
+    return mono_ns() / 1000000;
+}
+
+CQdFtdcMduserApi* CQdFtdcMduserApi::CreateFtdcMduserApi(const char *pszFlowPath /* = "" */)
+{
+    return new QdpMdLoopback(pszFlowPath);
+}
+
+const char* CQdFtdcMduserApi::GetVersion()
+{
+    return LOOPBACK_VERSION;
+}
+
+QdpMdLoopback::QdpMdLoopback(const char* flowPath)
+    : m_pSpi(NULL)
+    , m_strFlowPath(flowPath == NULL ? "" : flowPath)
+    , m_uRate(1000)
+    , m_uMBLLevels(0)
+    , m_uStatusCycle(0)
+    , m_uBurstRate(0)
+    , m_uBurstTime(0)
+    , m_uBurstPeriod(0)
+    , m_uReconnect(0)
+    , m_uReconnectDelay(3000)
+    , m_dTickSize(1.0)
+    , m_uCursor(0)
+    , m_bMultiCast(false)
+    , m_bConnected(false)
+    , m_bLogined(false)
+    , m_iReconnectAt(0)
+    , m_iNextReconnect(0)
+    , m_iNextStatus(0)
+    , m_cStatus(QD_FTDC_IS_Continous)
+    , m_iPacketNo(0)
+    , m_bStopped(false)
+    , m_uEmitted(0)
+    , m_uReconnects(0)
+{
+}
+
+QdpMdLoopback::~QdpMdLoopback()
+{
+    m_bStopped = true;
+    Join();
+
+    for (Contract* ct : m_ayContracts)
+        delete ct;
+    m_ayContracts.clear();
+    m_mapContracts.clear();
+}
+
+void QdpMdLoopback::parseOptions(const std::string& front)
+{
+    std::size_t pos = front.find('?');
+    if (pos == std::string::npos)
+        return;
+
+    double basePrice = 3000;
+    std::string instruments;
+    for (const std::string& item : StrUtil::split(front.substr(pos + 1), "&"))
+    {
+        std::size_t eq = item.find('=');
+        if (eq == std::string::npos)
+            continue;
+
+        std::string key = item.substr(0, eq);
+        std::string val = item.substr(eq + 1);
+        if (key == "instruments")
+            instruments = val;
+        else if (key == "tradingday")
+            m_strTradingDay = val;
+        else if (key == "rate")
+            m_uRate = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "mbl")
+            m_uMBLLevels = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "status")
+            m_uStatusCycle = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "reconnect")
+            m_uReconnect = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "reconnectdelay")
+            m_uReconnectDelay = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "ticksize")
+            m_dTickSize = std::max(atof(val.c_str()), 0.0001);
+        else if (key == "price")
+            basePrice = atof(val.c_str());
+        else if (key == "journal")
+            m_strJournal = val;
+        else if (key == "seed")
+            m_rng.seed((uint32_t)strtoul(val.c_str(), NULL, 10));
+        else if (key == "burst")
+        {
+            //突发速率:持续毫秒:周期毫秒
+            StringVector ay = StrUtil::split(val, ":");
+            if (ay.size() == 3)
+            {
+                m_uBurstRate = (uint32_t)strtoul(ay[0].c_str(), NULL, 10);
+                m_uBurstTime = (uint32_t)strtoul(ay[1].c_str(), NULL, 10);
+                m_uBurstPeriod = (uint32_t)strtoul(ay[2].c_str(), NULL, 10);
+            }
+        }
+    }
+
+    //预置的合约用来应答合约列表查询，也决定行情里的交易所代码，没预置的合约订阅时再建
+    for (const std::string& fullCode : StrUtil::split(instruments, ","))
+    {
+        Contract* ct = getContract(fullCode, true);
+        ct->_base_price = basePrice + (ct->_inst_no % 50) * 10 * m_dTickSize;
+        ct->_last_price = ct->_open = ct->_high = ct->_low = ct->_base_price;
+    }
+}
+
+QdpMdLoopback::Contract* QdpMdLoopback::getContract(const std::string& code, bool bCreate)
+{
+    std::size_t pos = code.find('.');
+    std::string exchg = (pos == std::string::npos) ? "" : code.substr(0, pos);
+    std::string instID = (pos == std::string::npos) ? code : code.substr(pos + 1);
+
+    auto it = m_mapContracts.find(instID);
+    if (it != m_mapContracts.end())
+        return it->second;
+
+    if (!bCreate)
+        return NULL;
+
+    Contract* ct = new Contract;
+    ct->_exchg = exchg;
+    ct->_code = instID;
+    ct->_inst_no = (int)m_ayContracts.size();
+    ct->_base_price = 3000 + (ct->_inst_no % 50) * 10 * m_dTickSize;
+    ct->_last_price = ct->_open = ct->_high = ct->_low = ct->_base_price;
+    ct->_volume = 0;
+    ct->_turnover = 0;
+    ct->_open_interest = 10000;
+    ct->_status = m_cStatus;
+    ct->_subscribed = false;
+
+    m_mapContracts[instID] = ct;
+    m_ayContracts.emplace_back(ct);
+    return ct;
+}
+
+void QdpMdLoopback::Release()
+{
+    m_bStopped = true;
+    Join();
+
+    printf("[QdpMdLoopback] %llu market data pushed, %u disconnections injected\r\n", (unsigned long long)m_uEmitted, m_uReconnects);
+    delete this;
+}
+
+void QdpMdLoopback::SetMultiCast(bool bMultiCast /* = false */)
+{
+    m_bMultiCast = bMultiCast;
+}
+
+void QdpMdLoopback::SetUserFreedom(bool userfree /* = false */)
+{
+}
+
+void QdpMdLoopback::SetMultiLevel(int level)
+{
+}
+
+void QdpMdLoopback::RegTopicMultiAddr(char *pMultiAddr)
+{
+}
+
+void QdpMdLoopback::Init()
+{
+    if (m_thrdWorker)
+        return;
+
+    parseOptions(m_strFront);
+    if (m_strTradingDay.empty())
+        m_strTradingDay = StrUtil::printf("%u", TimeUtils::getCurDate());
+
+    if (!m_strJournal.empty() && !m_journal.open(m_strJournal))
+    {
+        printf("[QdpMdLoopback] Journal %s invalid, generating random market data\r\n", m_strJournal.c_str());
+        m_strJournal.clear();
+    }
+
+    printf("[QdpMdLoopback] %u contracts preset, rate %u/s, mbl %u, burst %u/s %ums per %ums, reconnect every %ums, source %s\r\n",
+        (uint32_t)m_ayContracts.size(), m_uRate, m_uMBLLevels, m_uBurstRate, m_uBurstTime, m_uBurstPeriod, m_uReconnect,
+        m_strJournal.empty() ? "random" : m_strJournal.c_str());
+
+    //和真实API一样，Init之后异步连上前置
+    m_iReconnectAt = mono_ms() + 10;
+    m_bStopped = false;
+    m_thrdWorker.reset(new StdThread([this]() {
+        run();
+    }));
+}
+
+int QdpMdLoopback::Join()
+{
+    if (m_thrdWorker && m_thrdWorker->joinable() && m_thrdWorker->get_id() != std::this_thread::get_id())
+    {
+        m_thrdWorker->join();
+        m_thrdWorker.reset();
+    }
+    return 0;
+}
+
+const char* QdpMdLoopback::GetTradingDay()
+{
+    return m_strTradingDay.c_str();
+}
+
+void QdpMdLoopback::RegisterFront(char *pszFrontAddress)
+{
+    m_strFront = pszFrontAddress;
+}
+
+void QdpMdLoopback::RegisterNameServer(char *pszNsAddress)
+{
+    if (m_strFront.empty())
+        m_strFront = pszNsAddress;
+}
+
+void QdpMdLoopback::RegisterSpi(CQdFtdcMduserSpi *pSpi)
+{
+    //解析器摘回调之后马上就会释放自己，工作线程一批推送中途不会重新检查回调，
+    //所以摘回调之前先停掉工作线程，和真实API摘回调以后不再回调的行为一致
+    if (pSpi == NULL)
+    {
+        m_bStopped = true;
+        Join();
+    }
+
+    m_pSpi = pSpi;
+}
+
+void QdpMdLoopback::SubscribeMarketDataTopic(int nTopicID, QD_TE_RESUME_TYPE nResumeType)
+{
+}
+
+int QdpMdLoopback::SubMarketData(char *ppInstrumentID[], int nCount)
+{
+    if (!m_bConnected)
+        return -1;
+
+    std::vector<std::string> codes(ppInstrumentID, ppInstrumentID + nCount);
+    post([this, codes]() {
+        for (std::size_t i = 0; i < codes.size(); i++)
+        {
+            Contract* ct = getContract(codes[i], true);
+            if (!ct->_subscribed)
+            {
+                ct->_subscribed = true;
+                m_aySubscribed.emplace_back(ct);
+            }
+
+            if (m_pSpi)
+            {
+                CQdFtdcSpecificInstrumentField field;
+                memset(&field, 0, sizeof(field));
+                strncpy(field.InstrumentID, ct->_code.c_str(), sizeof(field.InstrumentID) - 1);
+                CQdFtdcRspInfoField info;
+                memset(&info, 0, sizeof(info));
+                m_pSpi->OnRspSubMarketData(&field, &info, 0, i + 1 == codes.size());
+            }
+        }
+    });
+    return 0;
+}
+
+int QdpMdLoopback::UnSubMarketData(char *ppInstrumentID[], int nCount)
+{
+    if (!m_bConnected)
+        return -1;
+
+    std::vector<std::string> codes(ppInstrumentID, ppInstrumentID + nCount);
+    post([this, codes]() {
+        for (std::size_t i = 0; i < codes.size(); i++)
+        {
+            Contract* ct = getContract(codes[i], false);
+            if (ct != NULL)
+                ct->_subscribed = false;
+
+            if (m_pSpi)
+            {
+                CQdFtdcSpecificInstrumentField field;
+                memset(&field, 0, sizeof(field));
+                strncpy(field.InstrumentID, codes[i].c_str(), sizeof(field.InstrumentID) - 1);
+                CQdFtdcRspInfoField info;
+                memset(&info, 0, sizeof(info));
+                m_pSpi->OnRspUnSubMarketData(&field, &info, 0, i + 1 == codes.size());
+            }
+        }
+
+        m_aySubscribed.erase(std::remove_if(m_aySubscribed.begin(), m_aySubscribed.end(), [](Contract* ct) {
+            return !ct->_subscribed;
+        }), m_aySubscribed.end());
+    });
+    return 0;
+}
+
+void QdpMdLoopback::SetHeartbeatTimeout(unsigned int timeout)
+{
+}
+
+void QdpMdLoopback::ShmMarketData(CQdFtdcShmDepthMarketDataField *reqfield, CQdFtdcDepthMarketDataField *defdata)
+{
+    //合约状态只在工作线程里改，这里没有共享内存可读，只回合约代码
+    memset(defdata, 0, sizeof(CQdFtdcDepthMarketDataField));
+    wt_strcpy(defdata->InstrumentID, reqfield->InstrumentID);
+}
+
+int QdpMdLoopback::ReqUserLogin(CQdFtdcReqUserLoginField *pReqUserLogin, int nRequestID)
+{
+    if (!m_bConnected)
+        return -1;
+
+    CQdFtdcReqUserLoginField req = *pReqUserLogin;
+    post([this, req, nRequestID]() {
+        m_bLogined = true;
+        if (m_pSpi == NULL)
+            return;
+
+        CQdFtdcRspUserLoginField rsp;
+        memset(&rsp, 0, sizeof(rsp));
+        strncpy(rsp.TradingDay, m_strTradingDay.c_str(), sizeof(rsp.TradingDay) - 1);
+        wt_strcpy(rsp.BrokerID, req.BrokerID);
+        wt_strcpy(rsp.UserID, req.UserID);
+        CQdFtdcRspInfoField info;
+        memset(&info, 0, sizeof(info));
+        m_pSpi->OnRspUserLogin(&rsp, &info, nRequestID, true);
+    });
+    return 0;
+}
+
+int QdpMdLoopback::ReqUserLogout(CQdFtdcReqUserLogoutField *pReqUserLogout, int nRequestID)
+{
+    if (!m_bConnected)
+        return -1;
+
+    CQdFtdcReqUserLogoutField req = *pReqUserLogout;
+    post([this, req, nRequestID]() {
+        m_bLogined = false;
+        if (m_pSpi == NULL)
+            return;
+
+        CQdFtdcRspUserLogoutField rsp;
+        memset(&rsp, 0, sizeof(rsp));
+        wt_strcpy(rsp.BrokerID, req.BrokerID);
+        wt_strcpy(rsp.UserID, req.UserID);
+        CQdFtdcRspInfoField info;
+        memset(&info, 0, sizeof(info));
+        m_pSpi->OnRspUserLogout(&rsp, &info, nRequestID, true);
+    });
+    return 0;
+}
+
+int QdpMdLoopback::ReqSubMarketData(CQdFtdcSpecificInstrumentField *pSpecificInstrument, int nRequestID)
+{
+    char* codes[1] = { pSpecificInstrument->InstrumentID };
+    return SubMarketData(codes, 1);
+}
+
+int QdpMdLoopback::ReqUnSubMarketData(CQdFtdcSpecificInstrumentField *pSpecificInstrument, int nRequestID)
+{
+    char* codes[1] = { pSpecificInstrument->InstrumentID };
+    return UnSubMarketData(codes, 1);
+}
+
+int QdpMdLoopback::ReqSubscribeTopic(CQdFtdcDisseminationField *pDissemination, int nRequestID)
+{
+    respondError(nRequestID, -1, "ReqSubscribeTopic not supported by loopback");
+    return 0;
+}
+
+int QdpMdLoopback::ReqQryTopic(CQdFtdcDisseminationField *pDissemination, int nRequestID)
+{
+    respondError(nRequestID, -1, "ReqQryTopic not supported by loopback");
+    return 0;
+}
+
+int QdpMdLoopback::ReqQryMarketData(CQdFtdcQryMarketDataField *pQryMarketData, int nRequestID)
+{
+    respondError(nRequestID, -1, "ReqQryMarketData not supported by loopback");
+    return 0;
+}
+
+int QdpMdLoopback::ReqQrySHFEMultiInfo(CQdFtdcQryShfeMultiInfoField *pQryShfeMultiInfo, int nRequestID)
+{
+    respondError(nRequestID, -1, "ReqQrySHFEMultiInfo not supported by loopback");
+    return 0;
+}
+
+int QdpMdLoopback::ReqQryInstrumentList(CQdFtdcMarketDataExchangeIDField *pMarketDataExchangeID, int nRequestID)
+{
+    if (!m_bConnected)
+        return -1;
+
+    std::string exchg = pMarketDataExchangeID->ExchangeID;
+    post([this, exchg, nRequestID]() {
+        if (m_pSpi == NULL)
+            return;
+
+        std::vector<Contract*> ayMatched;
+        for (Contract* ct : m_ayContracts)
+        {
+            if (ct->_exchg == exchg)
+                ayMatched.emplace_back(ct);
+        }
+
+        CQdFtdcSpecificInstrumentField field;
+        CQdFtdcRspInfoField info;
+        memset(&info, 0, sizeof(info));
+        if (ayMatched.empty())
+        {
+            memset(&field, 0, sizeof(field));
+            m_pSpi->OnRspQryInstrumentList(&field, &info, nRequestID, true);
+            return;
+        }
+
+        for (std::size_t i = 0; i < ayMatched.size(); i++)
+        {
+            memset(&field, 0, sizeof(field));
+            strncpy(field.InstrumentID, ayMatched[i]->_code.c_str(), sizeof(field.InstrumentID) - 1);
+            m_pSpi->OnRspQryInstrumentList(&field, &info, nRequestID, i + 1 == ayMatched.size());
+        }
+    });
+    return 0;
+}
+
+int QdpMdLoopback::ReqQryDepthMarketData(CQdFtdcQryMarketDataField *pQryMarketData, int nRequestID)
+{
+    if (!m_bConnected)
+        return -1;
+
+    std::string code = pQryMarketData->InstrumentID;
+    post([this, code, nRequestID]() {
+        if (m_pSpi == NULL)
+            return;
+
+        CQdFtdcDepthMarketDataField md;
+        fillDepth(getContract(code, true), md);
+        CQdFtdcRspInfoField info;
+        memset(&info, 0, sizeof(info));
+        m_pSpi->OnRspQryDepthMarketData(&md, &info, nRequestID, true);
+    });
+    return 0;
+}
+
+void QdpMdLoopback::ActiveMultiMarketData(char *TradingDay)
+{
+    if (TradingDay != NULL && TradingDay[0] != '\0')
+        m_strTradingDay = TradingDay;
+
+    //组播不需要登录也不需要订阅，预置的合约全部推送
+    post([this]() {
+        m_bLogined = true;
+        for (Contract* ct : m_ayContracts)
+        {
+            if (ct->_subscribed)
+                continue;
+            ct->_subscribed = true;
+            m_aySubscribed.emplace_back(ct);
+        }
+    });
+}
+
+void QdpMdLoopback::respondError(int nRequestID, int errorID, const char* message)
+{
+    std::string msg = message;
+    post([this, nRequestID, errorID, msg]() {
+        if (m_pSpi == NULL)
+            return;
+
+        CQdFtdcRspInfoField info;
+        memset(&info, 0, sizeof(info));
+        info.ErrorID = errorID;
+        strncpy(info.ErrorMsg, msg.c_str(), sizeof(info.ErrorMsg) - 1);
+        m_pSpi->OnRspError(&info, nRequestID, true);
+    });
+}
+
+void QdpMdLoopback::post(Task task)
+{
+    StdUniqueLock lock(m_mtxTasks);
+    m_queTasks.emplace_back(std::move(task));
+}
+
+void QdpMdLoopback::runTasks()
+{
+    std::deque<Task> tasks;
+    {
+        StdUniqueLock lock(m_mtxTasks);
+        tasks.swap(m_queTasks);
+    }
+
+    //回调里可能又发请求，新的请求留到下一轮
+    for (Task& task : tasks)
+        task();
+}
+
+uint32_t QdpMdLoopback::currentRate(int64_t now) const
+{
+    if (m_uBurstPeriod > 0 && m_uBurstTime > 0 && (uint64_t)now % m_uBurstPeriod < m_uBurstTime)
+        return m_uBurstRate;
+
+    return m_uRate;
+}
+
+void QdpMdLoopback::injectDisconnect(int64_t now)
+{
+    m_bConnected = false;
+    m_bLogined = false;
+    m_uReconnects++;
+
+    //前置那边的订阅和没处理的请求都随连接一起没了
+    for (Contract* ct : m_aySubscribed)
+        ct->_subscribed = false;
+    m_aySubscribed.clear();
+    {
+        StdUniqueLock lock(m_mtxTasks);
+        m_queTasks.clear();
+    }
+
+    if (m_pSpi)
+        m_pSpi->OnFrontDisconnected(0x2001);
+
+    m_iReconnectAt = now + m_uReconnectDelay;
+}
+
+void QdpMdLoopback::run()
+{
+    int64_t lastNs = mono_ns();
+    double credit = 0;
+    while (!m_bStopped)
+    {
+        int64_t now = mono_ms();
+        if (m_iReconnectAt > 0)
+        {
+            if (now < m_iReconnectAt)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+
+            m_iReconnectAt = 0;
+            m_bConnected = true;
+            if (m_uReconnect > 0)
+                m_iNextReconnect = now + m_uReconnect;
+            if (m_pSpi)
+                m_pSpi->OnFrontConnected();
+        }
+
+        runTasks();
+
+        if (m_uReconnect > 0 && now >= m_iNextReconnect)
+        {
+            injectDisconnect(now);
+            continue;
+        }
+
+        if (!m_bLogined || m_aySubscribed.empty())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            lastNs = mono_ns();
+            credit = 0;
+            continue;
+        }
+
+        if (m_uStatusCycle > 0 && now >= m_iNextStatus)
+        {
+            if (m_iNextStatus > 0)
+                emitStatus(m_cStatus == QD_FTDC_IS_Continous ? QD_FTDC_IS_BreakTime : QD_FTDC_IS_Continous);
+            m_iNextStatus = now + m_uStatusCycle;
+        }
+
+        //按速率积攒额度，额度最多攒100毫秒的量，避免卡顿之后一次推出去太多
+        uint32_t rate = currentRate(now);
+        if (rate == 0)
+        {
+            if (emit(256) == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        int64_t nowNs = mono_ns();
+        credit = std::min(credit + (nowNs - lastNs) * (double)rate / 1e9, std::max(rate / 10.0, 1.0));
+        lastNs = nowNs;
+
+        //日志里没有订阅的合约时也要扣掉额度，不然会一直空转
+        uint32_t count = (uint32_t)credit;
+        if (count > 0)
+            credit -= std::max(emit(count), (uint32_t)1);
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+uint32_t QdpMdLoopback::emit(uint32_t count)
+{
+    uint32_t emitted = m_strJournal.empty() ? emitSynthetic(count) : emitFromJournal(count);
+    m_uEmitted += emitted;
+    return emitted;
+}
+
+void QdpMdLoopback::fillDepth(Contract* ct, CQdFtdcDepthMarketDataField& md)
+{
+    memset(&md, 0, sizeof(md));
+
+    uint32_t curDate, curTime;
+    TimeUtils::getDateTime(curDate, curTime);
+    uint32_t hms = curTime / 1000;
+
+    strncpy(md.TradingDay, m_strTradingDay.c_str(), sizeof(md.TradingDay) - 1);
+    snprintf(md.CalendarDate, sizeof(md.CalendarDate), "%u", curDate);
+    snprintf(md.UpdateTime, sizeof(md.UpdateTime), "%02u:%02u:%02u", hms / 10000 % 100, hms / 100 % 100, hms % 100);
+    md.UpdateMillisec = curTime % 1000;
+    strncpy(md.InstrumentID, ct->_code.c_str(), sizeof(md.InstrumentID) - 1);
+    strncpy(md.ExchangeID, ct->_exchg.c_str(), sizeof(md.ExchangeID) - 1);
+    md.InstrumentNo = ct->_inst_no;
+    md.PacketNo = m_iPacketNo;
+    md.InstrumentStatus = ct->_status;
+
+    md.PreSettlementPrice = ct->_base_price;
+    md.PreClosePrice = ct->_base_price;
+    md.PreOpenInterest = 10000;
+    md.UpperLimitPrice = ct->_base_price * 1.1;
+    md.LowerLimitPrice = ct->_base_price * 0.9;
+    md.OpenPrice = ct->_open;
+    md.HighestPrice = ct->_high;
+    md.LowestPrice = ct->_low;
+    md.LastPrice = ct->_last_price;
+    md.Volume = ct->_volume;
+    md.Turnover = ct->_turnover;
+    md.OpenInterest = ct->_open_interest;
+
+    double* bidPx[5] = { &md.BidPrice1, &md.BidPrice2, &md.BidPrice3, &md.BidPrice4, &md.BidPrice5 };
+    int* bidQty[5] = { &md.BidVolume1, &md.BidVolume2, &md.BidVolume3, &md.BidVolume4, &md.BidVolume5 };
+    double* askPx[5] = { &md.AskPrice1, &md.AskPrice2, &md.AskPrice3, &md.AskPrice4, &md.AskPrice5 };
+    int* askQty[5] = { &md.AskVolume1, &md.AskVolume2, &md.AskVolume3, &md.AskVolume4, &md.AskVolume5 };
+    for (int i = 0; i < 5; i++)
+    {
+        *bidPx[i] = ct->_last_price - (i + 1) * m_dTickSize;
+        *bidQty[i] = 1 + m_rng() % 100;
+        *askPx[i] = ct->_last_price + (i + 1) * m_dTickSize;
+        *askQty[i] = 1 + m_rng() % 100;
+    }
+}
+
+uint32_t QdpMdLoopback::emitSynthetic(uint32_t count)
+{
+    if (m_pSpi == NULL)
+        return 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        //订阅的合约轮流推，价格随机游走
+        Contract* ct = m_aySubscribed[m_uCursor++ % m_aySubscribed.size()];
+        int step = (int)(m_rng() % 3) - 1;
+        ct->_last_price = std::min(std::max(ct->_last_price + step * m_dTickSize, ct->_base_price * 0.9), ct->_base_price * 1.1);
+        ct->_high = std::max(ct->_high, ct->_last_price);
+        ct->_low = std::min(ct->_low, ct->_last_price);
+        int qty = 1 + m_rng() % 10;
+        ct->_volume += qty;
+        ct->_turnover += qty * ct->_last_price;
+        ct->_open_interest += (int)(m_rng() % 5) - 2;
+
+        CQdFtdcDepthMarketDataField md;
+        m_iPacketNo++;
+        fillDepth(ct, md);
+
+        if (m_uMBLLevels == 0)
+        {
+            if (m_bMultiCast)
+                m_pSpi->OnRtnMultiDepthMarketData(&md);
+            else
+                m_pSpi->OnRtnDepthMarketData(&md);
+            continue;
+        }
+
+        //快照和分价放在同一个包里，包结束时分价簿才会推出去
+        m_pSpi->OnPackageStart(0, m_iPacketNo);
+        if (m_bMultiCast)
+            m_pSpi->OnRtnMultiDepthMarketData(&md);
+        else
+            m_pSpi->OnRtnDepthMarketData(&md);
+
+        CQdFtdcMBLMarketDataField mbl;
+        memset(&mbl, 0, sizeof(mbl));
+        wt_strcpy(mbl.InstrumentID, md.InstrumentID);
+        wt_strcpy(mbl.UpdateTime, md.UpdateTime);
+        mbl.UpdateMillisec = md.UpdateMillisec;
+        for (uint32_t lvl = 0; lvl < m_uMBLLevels; lvl++)
+        {
+            mbl.Direction = QD_FTDC_D_Buy;
+            mbl.Price = ct->_last_price - (lvl + 1) * m_dTickSize;
+            mbl.Volume = m_rng() % 100;
+            m_pSpi->OnRtnMBLMarketData(&mbl);
+
+            mbl.Direction = QD_FTDC_D_Sell;
+            mbl.Price = ct->_last_price + (lvl + 1) * m_dTickSize;
+            mbl.Volume = m_rng() % 100;
+            m_pSpi->OnRtnMBLMarketData(&mbl);
+        }
+        m_pSpi->OnPackageEnd(0, m_iPacketNo);
+    }
+
+    return count;
+}
+
+uint32_t QdpMdLoopback::emitFromJournal(uint32_t count)
+{
+    if (m_pSpi == NULL)
+        return 0;
+
+    uint32_t curDate, curTime;
+    TimeUtils::getDateTime(curDate, curTime);
+    uint32_t hms = curTime / 1000;
+    char updateTime[9];
+    snprintf(updateTime, sizeof(updateTime), "%02u:%02u:%02u", hms / 10000 % 100, hms / 100 % 100, hms % 100);
+
+    //日志循环使用，时间和交易日换成当前的，不然绕回开头以后会被当成乱序的行情丢掉
+    uint32_t emitted = 0;
+    bool bWrapped = false;
+    bool bInPackage = false;
+    while (emitted < count)
+    {
+        const QdpJournalRecord* rec = m_journal.next();
+        if (rec == NULL)
+        {
+            if (bWrapped || !m_journal.open(m_strJournal))
+                break;
+            bWrapped = true;
+            continue;
+        }
+
+        //备用线路的记录是重复的
+        if (rec->_source != 0)
+            continue;
+
+        if (rec->_type == JRT_DEPTH && rec->_length == sizeof(CQdFtdcDepthMarketDataField))
+        {
+            CQdFtdcDepthMarketDataField md;
+            memcpy(&md, rec + 1, sizeof(md));
+            Contract* ct = getContract(md.InstrumentID, false);
+            if (ct == NULL || !ct->_subscribed)
+                continue;
+
+            if (bInPackage)
+            {
+                m_pSpi->OnPackageEnd(0, m_iPacketNo);
+                bInPackage = false;
+            }
+
+            strncpy(md.TradingDay, m_strTradingDay.c_str(), sizeof(md.TradingDay) - 1);
+            snprintf(md.CalendarDate, sizeof(md.CalendarDate), "%u", curDate);
+            wt_strcpy(md.UpdateTime, updateTime);
+            md.UpdateMillisec = curTime % 1000;
+            md.PacketNo = ++m_iPacketNo;
+            if (m_uStatusCycle > 0)
+                md.InstrumentStatus = ct->_status;
+
+            if (m_bMultiCast)
+                m_pSpi->OnRtnMultiDepthMarketData(&md);
+            else
+                m_pSpi->OnRtnDepthMarketData(&md);
+            emitted++;
+        }
+        else if (rec->_type == JRT_MBL && rec->_length == sizeof(CQdFtdcMBLMarketDataField))
+        {
+            CQdFtdcMBLMarketDataField mbl;
+            memcpy(&mbl, rec + 1, sizeof(mbl));
+            Contract* ct = getContract(mbl.InstrumentID, false);
+            if (ct == NULL || !ct->_subscribed)
+                continue;
+
+            if (!bInPackage)
+            {
+                m_pSpi->OnPackageStart(0, ++m_iPacketNo);
+                bInPackage = true;
+            }
+
+            wt_strcpy(mbl.UpdateTime, updateTime);
+            mbl.UpdateMillisec = curTime % 1000;
+            m_pSpi->OnRtnMBLMarketData(&mbl);
+            emitted++;
+        }
+        else if (rec->_type == JRT_TEN_ENTRUST && rec->_length == sizeof(CQdFtdcMDTenDepthMarketDataField))
+        {
+            CQdFtdcMDTenDepthMarketDataField ten;
+            memcpy(&ten, rec + 1, sizeof(ten));
+            Contract* ct = getContract(ten.InstrumentID, false);
+            if (ct == NULL || !ct->_subscribed)
+                continue;
+
+            wt_strcpy(ten.UpdateTime, updateTime);
+            ten.UpdateMillisec = curTime % 1000;
+            m_pSpi->OnRtnTenEntrust(&ten);
+            emitted++;
+        }
+    }
+
+    if (bInPackage)
+        m_pSpi->OnPackageEnd(0, m_iPacketNo);
+
+    return emitted;
+}
+
+void QdpMdLoopback::emitStatus(char status)
+{
+    m_cStatus = status;
+    if (m_pSpi == NULL)
+        return;
+
+    CQdFtdcQmdInstrumentStateField field;
+    for (Contract* ct : m_aySubscribed)
+    {
+        ct->_status = status;
+        memset(&field, 0, sizeof(field));
+        strncpy(field.ExchangeID, ct->_exchg.c_str(), sizeof(field.ExchangeID) - 1);
+        strncpy(field.InstrumentID, ct->_code.c_str(), sizeof(field.InstrumentID) - 1);
+        field.InstrumentStatus = status;
+        m_pSpi->OnRtnQmdInstrumentStatu(&field);
+    }
+}
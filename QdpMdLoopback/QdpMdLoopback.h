@@ -0,0 +1,190 @@
+﻿/*!
+ * \file QdpMdLoopback.h
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief QDP行情API的本地替身
+ *
+ * 导出和libqdmdapi一样的CreateFtdcMduserApi，不连任何前置，在自己的线程里生成行情并回调CQdFtdcMduserSpi，
+ * 用来在没有QDP前置的机器上给ParserQDP做压力测试。参数全部写在前置地址里，如：
+ * loopback://local?instruments=SHFE.rb2405,DCE.m2405&rate=20000&mbl=5&burst=200000:500:10000&reconnect=60000
+ */
+#pragma once
+
+//Windows下导出API类，Linux下打开API类的可见性，创建函数的符号才能被ParserQDP找到
+#ifdef _WIN32
+#ifndef ISLIB
+#define ISLIB
+#endif
+#ifndef LIB_MDUSER_API_EXPORT
+#define LIB_MDUSER_API_EXPORT
+#endif
+#else
+#pragma GCC visibility push(default)
+#endif
+#include "../API/QDP7.0.0/QdFtdcMdApi.h"
+#ifndef _WIN32
+#pragma GCC visibility pop
+#endif
+
+#include "../Includes/FasterDefs.h"
+#include "../QDPShare/QdpJournal.hpp"
+#include "../Share/StdUtils.hpp"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+USING_NS_WTP;
+
+class QdpMdLoopback : public CQdFtdcMduserApi
+{
+public:
+    QdpMdLoopback(const char* flowPath);
+    virtual ~QdpMdLoopback();
+
+private:
+    typedef struct _Contract
+    {
+        std::string _exchg;
+        std::string _code;
+        int         _inst_no;
+
+        double      _base_price;
+        double      _last_price;
+        double      _open;
+        double      _high;
+        double      _low;
+        int         _volume;
+        double      _turnover;
+        double      _open_interest;
+        char        _status;
+        bool        _subscribed;
+    } Contract;
+
+    typedef std::function<void()> Task;
+
+// CQdFtdcMduserApi 接口
+public:
+    virtual void Release() override;
+
+    virtual void SetMultiCast(bool bMultiCast = false) override;
+
+    virtual void SetUserFreedom(bool userfree = false) override;
+
+    virtual void SetMultiLevel(int level) override;
+
+    virtual void RegTopicMultiAddr(char *pMultiAddr) override;
+
+    virtual void Init() override;
+
+    virtual int Join() override;
+
+    virtual const char *GetTradingDay() override;
+
+    virtual void RegisterFront(char *pszFrontAddress) override;
+
+    virtual void RegisterNameServer(char *pszNsAddress) override;
+
+    virtual void RegisterSpi(CQdFtdcMduserSpi *pSpi) override;
+
+    virtual void SubscribeMarketDataTopic(int nTopicID, QD_TE_RESUME_TYPE nResumeType) override;
+
+    virtual int SubMarketData(char *ppInstrumentID[], int nCount) override;
+
+    virtual int UnSubMarketData(char *ppInstrumentID[], int nCount) override;
+
+    virtual void SetHeartbeatTimeout(unsigned int timeout) override;
+
+    virtual void ShmMarketData(CQdFtdcShmDepthMarketDataField *reqfield, CQdFtdcDepthMarketDataField *defdata) override;
+
+    virtual int ReqUserLogin(CQdFtdcReqUserLoginField *pReqUserLogin, int nRequestID) override;
+
+    virtual int ReqUserLogout(CQdFtdcReqUserLogoutField *pReqUserLogout, int nRequestID) override;
+
+    virtual int ReqSubMarketData(CQdFtdcSpecificInstrumentField *pSpecificInstrument, int nRequestID) override;
+
+    virtual int ReqUnSubMarketData(CQdFtdcSpecificInstrumentField *pSpecificInstrument, int nRequestID) override;
+
+    virtual int ReqSubscribeTopic(CQdFtdcDisseminationField *pDissemination, int nRequestID) override;
+
+    virtual int ReqQryTopic(CQdFtdcDisseminationField *pDissemination, int nRequestID) override;
+
+    virtual int ReqQryMarketData(CQdFtdcQryMarketDataField *pQryMarketData, int nRequestID) override;
+
+    virtual int ReqQryInstrumentList(CQdFtdcMarketDataExchangeIDField *pMarketDataExchangeID, int nRequestID) override;
+
+    virtual int ReqQrySHFEMultiInfo(CQdFtdcQryShfeMultiInfoField *pQryShfeMultiInfo, int nRequestID) override;
+
+    virtual int ReqQryDepthMarketData(CQdFtdcQryMarketDataField *pQryMarketData, int nRequestID) override;
+
+    virtual void ActiveMultiMarketData(char *TradingDay) override;
+
+private:
+    /// 解析前置地址里的参数
+    void parseOptions(const std::string& front);
+    /// 工作线程，处理请求、按节奏推送行情、注入断线
+    void run();
+    /// 请求的应答和真实API一样在工作线程里回调
+    void post(Task task);
+    void runTasks();
+    /// 当前时刻的推送速率，突发期间用突发速率
+    uint32_t currentRate(int64_t now) const;
+    /// 推送count笔，返回实际推送的笔数
+    uint32_t emit(uint32_t count);
+    uint32_t emitSynthetic(uint32_t count);
+    uint32_t emitFromJournal(uint32_t count);
+    void emitStatus(char status);
+    void injectDisconnect(int64_t now);
+
+    Contract* getContract(const std::string& code, bool bCreate);
+    void fillDepth(Contract* ct, CQdFtdcDepthMarketDataField& md);
+    void respondError(int nRequestID, int errorID, const char* message);
+
+private:
+    CQdFtdcMduserSpi*   m_pSpi;
+    std::string         m_strFlowPath;
+    std::string         m_strFront;
+    std::string         m_strTradingDay;
+
+    //行情生成参数
+    uint32_t            m_uRate;            //每秒推送的快照笔数，0为不限速
+    uint32_t            m_uMBLLevels;       //每笔快照后跟的分价档数，0为不推分价
+    uint32_t            m_uStatusCycle;     //交易状态切换周期（毫秒），0为不切换
+    uint32_t            m_uBurstRate;       //突发：每m_uBurstPeriod毫秒里有m_uBurstTime毫秒按m_uBurstRate推送
+    uint32_t            m_uBurstTime;
+    uint32_t            m_uBurstPeriod;
+    uint32_t            m_uReconnect;       //断线注入周期（毫秒），0为不注入
+    uint32_t            m_uReconnectDelay;  //断线以后多久重新连上
+    double              m_dTickSize;
+    std::string         m_strJournal;       //从录制的日志取行情，为空则随机生成
+
+    wt_hashmap<std::string, Contract*>  m_mapContracts;
+    std::vector<Contract*>              m_ayContracts;
+    std::vector<Contract*>              m_aySubscribed;
+    std::size_t                         m_uCursor;
+    std::mt19937                        m_rng;
+
+    QdpJournalReader    m_journal;
+    bool                m_bMultiCast;
+    bool                m_bConnected;
+    bool                m_bLogined;
+    int64_t             m_iReconnectAt;     //大于0表示断线中，到时间重新连上
+    int64_t             m_iNextReconnect;
+    int64_t             m_iNextStatus;
+    char                m_cStatus;
+    int                 m_iPacketNo;
+
+    std::deque<Task>    m_queTasks;
+    StdUniqueMutex      m_mtxTasks;
+    StdThreadPtr        m_thrdWorker;
+    std::atomic<bool>   m_bStopped;
+
+    uint64_t            m_uEmitted;
+    uint32_t            m_uReconnects;
+};
@@ -0,0 +1,1072 @@
+﻿/*!
+ * \file QdpTdLoopback.cpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief QDP交易API的本地替身实现
+ */
+#include "QdpTdLoopback.h"
+#include "../Share/StrUtil.hpp"
+#include "../Share/TimeUtils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOOPBACK_VERSION "QdpTdLoopback 1.0"
+
+//error.xml里的错误码
+#define ERR_INSTRUMENT_NOT_FOUND    2
+#define ERR_BAD_ORDER_FIELD         6
+#define ERR_BAD_ORDER_ACTION_FIELD  8
+#define ERR_DUPLICATE_ORDER         12
+#define ERR_ORDER_NOT_FOUND         24
+#define ERR_ORDER_HAD_ALL_TRADED    28
+#define ERR_ORDER_HAD_CANCELED      29
+#define ERR_FLOWCONTROL_UNFINISHED  162     //FLOWCONTROL_TOOLARGE_UNFINISHED_ORDERS
+#define ERR_FLOWCONTROL_ORDERSPEED  163     //FLOWCONTROL_TOOQUICK_ORDERSPEED_FORORDER
+
+static inline int64_t mono_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//报单、报单回报和报单应答前面的字段是一样的
+template<typename T>
+static inline void copy_input(T& dst, const CQdpFtdcInputOrderField& src)
+{
+    dst.InvestorIDNum = src.InvestorIDNum;
+    dst.InstrumentIDNum = src.InstrumentIDNum;
+    dst.UserOrderLocalID = src.UserOrderLocalID;
+    dst.UserCustom = src.UserCustom;
+    dst.LimitPrice = src.LimitPrice;
+    dst.StopPrice = src.StopPrice;
+    dst.Volume = src.Volume;
+    dst.MinVolume = src.MinVolume;
+    dst.BranchID = src.BranchID;
+    dst.OrderPriceType = src.OrderPriceType;
+    dst.Direction = src.Direction;
+    dst.OffsetFlag = src.OffsetFlag;
+    dst.HedgeFlag = src.HedgeFlag;
+    dst.TimeCondition = src.TimeCondition;
+    dst.VolumeCondition = src.VolumeCondition;
+    dst.BusinessType = src.BusinessType;
+}
+
+CQdpFtdcTraderApi* CQdpFtdcTraderApi::CreateFtdcTraderApi(const char *pszFlowPath /* = "" */)
+{
+    return new QdpTdLoopback(pszFlowPath);
+}
+
+const char* CQdpFtdcTraderApi::GetVersion(int &nMajorVersion, int &nMinorVersion)
+{
+    nMajorVersion = 1;
+    nMinorVersion = 0;
+    return LOOPBACK_VERSION;
+}
+
+QdpTdLoopback::QdpTdLoopback(const char* flowPath)
+    : m_pSpi(NULL)
+    , m_strFlowPath(flowPath == NULL ? "" : flowPath)
+    , m_uAckLatency(0)
+    , m_uFillLatency(0)
+    , m_uLiquidity(10)
+    , m_uLevels(5)
+    , m_uWalk(0)
+    , m_uMaxInFlight(0)
+    , m_uMaxRate(0)
+    , m_dTickSize(1.0)
+    , m_iMultiplier(10)
+    , m_dBalance(10000000)
+    , m_iSessionID(0)
+    , m_iMaxLocalID(0)
+    , m_uOrderSysID(0)
+    , m_uTradeID(0)
+    , m_uEventSeq(0)
+    , m_uInFlight(0)
+    , m_iRateSec(0)
+    , m_uRateCount(0)
+    , m_bStopped(false)
+    , m_uInserted(0)
+    , m_uRejected(0)
+    , m_uThrottled(0)
+{
+}
+
+QdpTdLoopback::~QdpTdLoopback()
+{
+    m_bStopped = true;
+    Join();
+
+    for (Order* order : m_ayOrders)
+        delete order;
+    m_ayOrders.clear();
+
+    for (Instrument* inst : m_ayInstruments)
+        delete inst;
+    m_ayInstruments.clear();
+}
+
+void QdpTdLoopback::parseOptions(const std::string& front)
+{
+    std::size_t pos = front.find('?');
+    if (pos == std::string::npos)
+        return;
+
+    double basePrice = 3000;
+    std::string instruments;
+    for (const std::string& item : StrUtil::split(front.substr(pos + 1), "&"))
+    {
+        std::size_t eq = item.find('=');
+        if (eq == std::string::npos)
+            continue;
+
+        std::string key = item.substr(0, eq);
+        std::string val = item.substr(eq + 1);
+        if (key == "instruments")
+            instruments = val;
+        else if (key == "tradingday")
+            m_strTradingDay = val;
+        else if (key == "ack")
+            m_uAckLatency = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "fill")
+            m_uFillLatency = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "liquidity")
+            m_uLiquidity = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "levels")
+            m_uLevels = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "walk")
+            m_uWalk = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "maxinflight")
+            m_uMaxInFlight = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "maxrate")
+            m_uMaxRate = (uint32_t)strtoul(val.c_str(), NULL, 10);
+        else if (key == "ticksize")
+            m_dTickSize = std::max(atof(val.c_str()), 0.0001);
+        else if (key == "multiplier")
+            m_iMultiplier = std::max(atoi(val.c_str()), 1);
+        else if (key == "price")
+            basePrice = atof(val.c_str());
+        else if (key == "balance")
+            m_dBalance = atof(val.c_str());
+        else if (key == "seed")
+            m_rng.seed((uint32_t)strtoul(val.c_str(), NULL, 10));
+    }
+
+    //参考价的取法和行情替身一样，两边合约顺序一致时价格也对得上
+    for (const std::string& fullCode : StrUtil::split(instruments, ","))
+    {
+        std::size_t dot = fullCode.find('.');
+        if (dot == std::string::npos)
+            continue;
+
+        Instrument* inst = new Instrument;
+        inst->_exchg = fullCode.substr(0, dot);
+        inst->_code = fullCode.substr(dot + 1);
+        inst->_num = (int)m_ayInstruments.size() + 1;
+        inst->_base = basePrice + ((inst->_num - 1) % 50) * 10 * m_dTickSize;
+        inst->_mid = inst->_base;
+        inst->_long = 0;
+        inst->_short = 0;
+
+        m_ayInstruments.emplace_back(inst);
+        m_mapInstruments[inst->_num] = inst;
+    }
+}
+
+QdpTdLoopback::Instrument* QdpTdLoopback::findInstrument(int num)
+{
+    auto it = m_mapInstruments.find(num);
+    return (it == m_mapInstruments.end()) ? NULL : it->second;
+}
+
+void QdpTdLoopback::fillRspInfo(CQdpFtdcRspInfoField& info, int errorID, const char* message)
+{
+    memset(&info, 0, sizeof(info));
+    info.ErrorID = errorID;
+    if (message != NULL)
+        strncpy(info.ErrorMsg, message, sizeof(info.ErrorMsg) - 1);
+}
+
+void QdpTdLoopback::makeTime(char* buf, std::size_t len)
+{
+    uint32_t curDate, curTime;
+    TimeUtils::getDateTime(curDate, curTime);
+    uint32_t hms = curTime / 1000;
+    snprintf(buf, len, "%02u:%02u:%02u", hms / 10000 % 100, hms / 100 % 100, hms % 100);
+}
+
+void QdpTdLoopback::Release()
+{
+    m_bStopped = true;
+    Join();
+
+    printf("[QdpTdLoopback] %llu orders inserted, %llu rejected, %llu throttled, %u trades\r\n",
+        (unsigned long long)m_uInserted, (unsigned long long)m_uRejected, (unsigned long long)m_uThrottled, (uint32_t)m_ayTrades.size());
+    delete this;
+}
+
+void QdpTdLoopback::Init()
+{
+    if (m_thrdWorker)
+        return;
+
+    parseOptions(m_strFront);
+    if (m_strTradingDay.empty())
+        m_strTradingDay = StrUtil::printf("%u", TimeUtils::getCurDate());
+    m_iSessionID = (int)(TimeUtils::getLocalTimeNow() % 1000000);
+
+    printf("[QdpTdLoopback] %u instruments, ack %uus, fill %uus, liquidity %u x %u levels, max inflight %u, max rate %u/s\r\n",
+        (uint32_t)m_ayInstruments.size(), m_uAckLatency, m_uFillLatency, m_uLiquidity, m_uLevels, m_uMaxInFlight, m_uMaxRate);
+
+    //和真实API一样，Init之后异步连上前置
+    schedule(10000, [this]() {
+        if (m_pSpi)
+            m_pSpi->OnFrontConnected();
+    });
+
+    m_bStopped = false;
+    m_thrdWorker.reset(new StdThread([this]() {
+        run();
+    }));
+}
+
+int QdpTdLoopback::Join()
+{
+    if (m_thrdWorker && m_thrdWorker->joinable() && m_thrdWorker->get_id() != std::this_thread::get_id())
+    {
+        m_condEvents.notify_all();
+        m_thrdWorker->join();
+        m_thrdWorker.reset();
+    }
+    return 0;
+}
+
+const char* QdpTdLoopback::GetTradingDay()
+{
+    return m_strTradingDay.c_str();
+}
+
+void QdpTdLoopback::RegisterFront(char *pszFrontAddress)
+{
+    m_strFront = pszFrontAddress;
+}
+
+void QdpTdLoopback::RegisterNameServer(char *pszNsAddress)
+{
+    if (m_strFront.empty())
+        m_strFront = pszNsAddress;
+}
+
+void QdpTdLoopback::RegisterSpi(CQdpFtdcTraderSpi *pSpi)
+{
+    m_pSpi = pSpi;
+}
+
+void QdpTdLoopback::SubscribePrivateTopic(QDP_TE_RESUME_TYPE nResumeType)
+{
+}
+
+void QdpTdLoopback::SubscribePublicTopic(QDP_TE_RESUME_TYPE nResumeType)
+{
+}
+
+void QdpTdLoopback::SubscribeUserTopic(QDP_TE_RESUME_TYPE nResumeType)
+{
+}
+
+void QdpTdLoopback::SetHeartbeatTimeout(unsigned int timeout)
+{
+}
+
+int QdpTdLoopback::OpenRequestLog(const char *pszReqLogFileName)
+{
+    return 0;
+}
+
+int QdpTdLoopback::OpenResponseLog(const char *pszRspLogFileName)
+{
+    return 0;
+}
+
+void QdpTdLoopback::schedule(int64_t delayUs, Task task)
+{
+    StdUniqueLock lock(m_mtxEvents);
+    m_queEvents.push({ mono_ns() + delayUs * 1000, m_uEventSeq++, std::move(task) });
+    m_condEvents.notify_all();
+}
+
+void QdpTdLoopback::run()
+{
+    int64_t nextWalk = (m_uWalk > 0) ? mono_ns() + (int64_t)m_uWalk * 1000000 : 0;
+    while (!m_bStopped)
+    {
+        Task task;
+        {
+            StdUniqueLock lock(m_mtxEvents);
+            int64_t now = mono_ns();
+            if (!m_queEvents.empty() && m_queEvents.top()._due <= now)
+            {
+                task = std::move(const_cast<Event&>(m_queEvents.top())._task);
+                m_queEvents.pop();
+            }
+            else
+            {
+                //最多等1毫秒，参考价游走和退出都要检查
+                int64_t wait = 1000000;
+                if (!m_queEvents.empty())
+                    wait = std::min(wait, m_queEvents.top()._due - now);
+                m_condEvents.wait_for(lock, std::chrono::nanoseconds(wait));
+            }
+        }
+
+        if (task)
+            task();
+
+        if (nextWalk > 0 && mono_ns() >= nextWalk)
+        {
+            walkMarket();
+            nextWalk += (int64_t)m_uWalk * 1000000;
+        }
+    }
+}
+
+int QdpTdLoopback::unsupported(const char* reqName, int nRequestID)
+{
+    std::string msg = StrUtil::printf("%s not supported by loopback", reqName);
+    schedule(m_uAckLatency, [this, msg, nRequestID]() {
+        if (m_pSpi == NULL)
+            return;
+
+        CQdpFtdcRspInfoField info;
+        fillRspInfo(info, -1, msg.c_str());
+        m_pSpi->OnRspError(&info, nRequestID, true);
+    });
+    return 0;
+}
+
+int QdpTdLoopback::ReqAuthenticate(CQdpFtdcAuthenticateField *pAuthenticate, int nRequestID)
+{
+    CQdpFtdcAuthenticateField req = *pAuthenticate;
+    schedule(m_uAckLatency, [this, req, nRequestID]() {
+        if (m_pSpi == NULL)
+            return;
+
+        CQdpFtdcRtnAuthenticateField rsp;
+        memset(&rsp, 0, sizeof(rsp));
+        wt_strcpy(rsp.BrokerID, req.BrokerID);
+        wt_strcpy(rsp.UserID, req.UserID);
+        wt_strcpy(rsp.AppID, req.AppID);
+        CQdpFtdcRspInfoField info;
+        fillRspInfo(info, 0, NULL);
+        m_pSpi->OnRspAuthenticate(&rsp, &info, nRequestID, true);
+    });
+    return 0;
+}
+
+int QdpTdLoopback::ReqUserLogin(CQdpFtdcReqUserLoginField *pReqUserLogin, int nRequestID)
+{
+    CQdpFtdcReqUserLoginField req = *pReqUserLogin;
+    schedule(m_uAckLatency, [this, req, nRequestID]() {
+        if (m_pSpi == NULL)
+            return;
+
+        CQdpFtdcRspUserLoginField rsp;
+        memset(&rsp, 0, sizeof(rsp));
+        strncpy(rsp.TradingDay, m_strTradingDay.c_str(), sizeof(rsp.TradingDay) - 1);
+        wt_strcpy(rsp.BrokerID, req.BrokerID);
+        wt_strcpy(rsp.UserID, req.UserID);
+        makeTime(rsp.LoginTime, sizeof(rsp.LoginTime));
+        rsp.MaxOrderLocalID = m_iMaxLocalID;
+        rsp.SessionID = m_iSessionID;
+        rsp.FrontID = 1;
+        CQdpFtdcRspInfoField info;
+        fillRspInfo(info, 0, NULL);
+        m_pSpi->OnRspUserLogin(&rsp, &info, nRequestID, true);
+    });
+    return 0;
+}
+
+int QdpTdLoopback::ReqUserLogout(CQdpFtdcReqUserLogoutField *pReqUserLogout, int nRequestID)
+{
+    CQdpFtdcReqUserLogoutField req = *pReqUserLogout;
+    schedule(m_uAckLatency, [this, req, nRequestID]() {
+        if (m_pSpi == NULL)
+            return;
+
+        CQdpFtdcRspUserLogoutField rsp;
+        memset(&rsp, 0, sizeof(rsp));
+        wt_strcpy(rsp.BrokerID, req.BrokerID);
+        wt_strcpy(rsp.UserID, req.UserID);
+        CQdpFtdcRspInfoField info;
+        fillRspInfo(info, 0, NULL);
+        m_pSpi->OnRspUserLogout(&rsp, &info, nRequestID, true);
+    });
+    return 0;
+}
+
+int QdpTdLoopback::ReqUserPasswordUpdate(CQdpFtdcUserPasswordUpdateField *pUserPasswordUpdate, int nRequestID)
+{
+    return unsupported("ReqUserPasswordUpdate", nRequestID);
+}
+
+int QdpTdLoopback::ReqOrderInsert(CQdpFtdcInputOrderField *pInputOrder, int nRequestID)
+{
+    //交易所流控在请求时就判定，拒绝的报单不占在途名额
+    int errorID = 0;
+    {
+        StdUniqueLock lock(m_mtxEvents);
+        int64_t sec = mono_ns() / 1000000000;
+        if (sec != m_iRateSec)
+        {
+            m_iRateSec = sec;
+            m_uRateCount = 0;
+        }
+
+        if (m_uMaxRate > 0 && m_uRateCount >= m_uMaxRate)
+            errorID = ERR_FLOWCONTROL_ORDERSPEED;
+        else if (m_uMaxInFlight > 0 && m_uInFlight >= m_uMaxInFlight)
+            errorID = ERR_FLOWCONTROL_UNFINISHED;
+        else
+            m_uInFlight++;
+        m_uRateCount++;
+    }
+
+    CQdpFtdcInputOrderField input = *pInputOrder;
+    schedule(m_uAckLatency, [this, input, nRequestID, errorID]() {
+        onOrderInsert(input, nRequestID, errorID);
+    });
+    return 0;
+}
+
+void QdpTdLoopback::onOrderInsert(const CQdpFtdcInputOrderField& input, int nRequestID, int errorID)
+{
+    if (errorID != 0)
+    {
+        m_uThrottled++;
+    }
+    else
+    {
+        StdUniqueLock lock(m_mtxEvents);
+        m_uInFlight--;
+    }
+
+    Instrument* inst = findInstrument(input.InstrumentIDNum);
+    const char* message = NULL;
+    if (errorID != 0)
+        message = (errorID == ERR_FLOWCONTROL_ORDERSPEED) ? "FLOWCONTROL_TOOQUICK_ORDERSPEED_FORORDER" : "FLOWCONTROL_TOOLARGE_UNFINISHED_ORDERS";
+    else if (inst == NULL)
+        errorID = ERR_INSTRUMENT_NOT_FOUND, message = "INSTRUMENT_NOT_FOUND";
+    else if (m_mapLocalIDs.find(input.UserOrderLocalID) != m_mapLocalIDs.end())
+        errorID = ERR_DUPLICATE_ORDER, message = "DUPLICATE_ORDER";
+    else if (input.Volume <= 0 || (input.OrderPriceType == QDP_FTDC_OPT_LimitPrice && input.LimitPrice <= 0))
+        errorID = ERR_BAD_ORDER_FIELD, message = "BAD_ORDER_FIELD";
+
+    CQdpFtdcRspInputOrderField rsp;
+    memset(&rsp, 0, sizeof(rsp));
+    copy_input(rsp, input);
+    if (inst != NULL)
+    {
+        strncpy(rsp.InstrumentID, inst->_code.c_str(), sizeof(rsp.InstrumentID) - 1);
+        strncpy(rsp.ExchangeID, inst->_exchg.c_str(), sizeof(rsp.ExchangeID) - 1);
+    }
+
+    CQdpFtdcRspInfoField info;
+    fillRspInfo(info, errorID, message);
+    if (errorID != 0)
+    {
+        m_uRejected++;
+        if (m_pSpi)
+            m_pSpi->OnRspOrderInsert(&rsp, &info, nRequestID, true);
+        return;
+    }
+
+    m_uInserted++;
+    m_iMaxLocalID = std::max(m_iMaxLocalID, input.UserOrderLocalID);
+
+    Order* order = new Order;
+    memset(&order->_field, 0, sizeof(order->_field));
+    order->_inst = inst;
+    order->_matched = false;
+
+    CQdpFtdcOrderField& field = order->_field;
+    copy_input(field, input);
+    strncpy(field.InstrumentID, inst->_code.c_str(), sizeof(field.InstrumentID) - 1);
+    strncpy(field.ExchangeID, inst->_exchg.c_str(), sizeof(field.ExchangeID) - 1);
+    snprintf(field.OrderSysID, sizeof(field.OrderSysID), "%u", ++m_uOrderSysID);
+    makeTime(field.InsertTime, sizeof(field.InsertTime));
+    field.OrderStatus = QDP_FTDC_OS_NoTradeQueueing;
+    field.VolumeTraded = 0;
+    field.VolumeRemain = field.Volume;
+    field.SessionID = m_iSessionID;
+
+    m_ayOrders.emplace_back(order);
+    m_mapLocalIDs[field.UserOrderLocalID] = order;
+    m_mapSysIDs[field.OrderSysID] = order;
+
+    wt_strcpy(rsp.OrderSysID, field.OrderSysID);
+    if (m_pSpi)
+    {
+        m_pSpi->OnRspOrderInsert(&rsp, &info, nRequestID, true);
+        m_pSpi->OnRtnOrder(&field);
+    }
+
+    schedule(m_uFillLatency, [this, order]() {
+        matchOrder(order);
+    });
+}
+
+int QdpTdLoopback::fillable(Instrument* inst, bool isBuy, double limit) const
+{
+    int qty = 0;
+    if (isBuy)
+    {
+        for (auto& item : inst->_asks)
+        {
+            if (item.first > limit + 1e-8)
+                break;
+            for (Order* o : item.second)
+                qty += o->_field.VolumeRemain;
+        }
+    }
+    else
+    {
+        for (auto& item : inst->_bids)
+        {
+            if (item.first < limit - 1e-8)
+                break;
+            for (Order* o : item.second)
+                qty += o->_field.VolumeRemain;
+        }
+    }
+
+    for (uint32_t lvl = 1; lvl <= m_uLevels; lvl++)
+    {
+        double px = isBuy ? inst->_mid + lvl * m_dTickSize : inst->_mid - lvl * m_dTickSize;
+        if (isBuy ? (px > limit + 1e-8) : (px < limit - 1e-8))
+            break;
+        qty += m_uLiquidity;
+    }
+
+    return qty;
+}
+
+void QdpTdLoopback::fillOrder(Order* order, double price, int qty)
+{
+    CQdpFtdcOrderField& field = order->_field;
+    field.VolumeTraded += qty;
+    field.VolumeRemain -= qty;
+    field.OrderStatus = (field.VolumeRemain == 0) ? QDP_FTDC_OS_AllTraded : QDP_FTDC_OS_PartTradedQueueing;
+
+    Instrument* inst = order->_inst;
+    bool isBuy = (field.Direction == QDP_FTDC_D_Buy);
+    if (field.OffsetFlag == QDP_FTDC_OF_Open)
+        (isBuy ? inst->_long : inst->_short) += qty;
+    else if (isBuy)
+        inst->_short = std::max(inst->_short - qty, 0);
+    else
+        inst->_long = std::max(inst->_long - qty, 0);
+
+    CQdpFtdcTradeField trade;
+    memset(&trade, 0, sizeof(trade));
+    strncpy(trade.TradingDay, m_strTradingDay.c_str(), sizeof(trade.TradingDay) - 1);
+    wt_strcpy(trade.ExchangeID, field.ExchangeID);
+    wt_strcpy(trade.InvestorID, field.InvestorID);
+    snprintf(trade.TradeID, sizeof(trade.TradeID), "%u", ++m_uTradeID);
+    wt_strcpy(trade.OrderSysID, field.OrderSysID);
+    trade.UserOrderLocalID = field.UserOrderLocalID;
+    wt_strcpy(trade.InstrumentID, field.InstrumentID);
+    trade.Direction = field.Direction;
+    trade.OffsetFlag = field.OffsetFlag;
+    trade.HedgeFlag = field.HedgeFlag;
+    trade.TradePrice = price;
+    trade.TradeVolume = qty;
+    makeTime(trade.TradeTime, sizeof(trade.TradeTime));
+    m_ayTrades.emplace_back(trade);
+
+    //和柜台一样，先推报单状态再推成交
+    if (m_pSpi)
+    {
+        m_pSpi->OnRtnOrder(&field);
+        m_pSpi->OnRtnTrade(&trade);
+    }
+}
+
+void QdpTdLoopback::removeFromBook(Order* order)
+{
+    Instrument* inst = order->_inst;
+    double price = order->_field.LimitPrice;
+    auto remove = [order](OrderQueue& que) {
+        que.erase(std::remove(que.begin(), que.end(), order), que.end());
+        return que.empty();
+    };
+
+    if (order->_field.Direction == QDP_FTDC_D_Buy)
+    {
+        auto it = inst->_bids.find(price);
+        if (it != inst->_bids.end() && remove(it->second))
+            inst->_bids.erase(it);
+    }
+    else
+    {
+        auto it = inst->_asks.find(price);
+        if (it != inst->_asks.end() && remove(it->second))
+            inst->_asks.erase(it);
+    }
+}
+
+void QdpTdLoopback::matchOrder(Order* order)
+{
+    CQdpFtdcOrderField& field = order->_field;
+    //撮合之前已经撤掉了
+    if (field.OrderStatus == QDP_FTDC_OS_Canceled)
+        return;
+    order->_matched = true;
+
+    Instrument* inst = order->_inst;
+    bool isBuy = (field.Direction == QDP_FTDC_D_Buy);
+    bool isMarket = (field.OrderPriceType != QDP_FTDC_OPT_LimitPrice);
+    double limit = field.LimitPrice;
+    if (isMarket)
+        limit = isBuy ? std::numeric_limits<double>::max() : -std::numeric_limits<double>::max();
+
+    bool bCancelRest = isMarket || field.TimeCondition == QDP_FTDC_TC_IOC;
+    if (field.VolumeCondition == QDP_FTDC_VC_CV && fillable(inst, isBuy, limit) < field.VolumeRemain)
+    {
+        field.OrderStatus = QDP_FTDC_OS_Canceled;
+        makeTime(field.CancelTime, sizeof(field.CancelTime));
+        if (m_pSpi)
+            m_pSpi->OnRtnOrder(&field);
+        return;
+    }
+
+    //价格优先：对手挂单和虚拟对手盘谁的价格好先成交谁，同价时挂单先成交
+    uint32_t synLevel = 1;
+    uint32_t synLeft = m_uLiquidity;
+    while (field.VolumeRemain > 0)
+    {
+        Order* maker = NULL;
+        double makerPx = 0;
+        if (isBuy && !inst->_asks.empty())
+        {
+            makerPx = inst->_asks.begin()->first;
+            maker = inst->_asks.begin()->second.front();
+        }
+        else if (!isBuy && !inst->_bids.empty())
+        {
+            makerPx = inst->_bids.begin()->first;
+            maker = inst->_bids.begin()->second.front();
+        }
+
+        bool hasSyn = (synLevel <= m_uLevels && synLeft > 0);
+        double synPx = isBuy ? inst->_mid + synLevel * m_dTickSize : inst->_mid - synLevel * m_dTickSize;
+
+        bool useMaker = (maker != NULL) && (!hasSyn || (isBuy ? makerPx <= synPx : makerPx >= synPx));
+        double px = useMaker ? makerPx : synPx;
+        if (!useMaker && !hasSyn)
+            break;
+        if (isBuy ? (px > limit + 1e-8) : (px < limit - 1e-8))
+            break;
+
+        if (useMaker)
+        {
+            int qty = std::min(field.VolumeRemain, maker->_field.VolumeRemain);
+            fillOrder(maker, px, qty);
+            if (maker->_field.VolumeRemain == 0)
+                removeFromBook(maker);
+            fillOrder(order, px, qty);
+        }
+        else
+        {
+            int qty = std::min(field.VolumeRemain, (int)synLeft);
+            synLeft -= qty;
+            if (synLeft == 0)
+            {
+                synLevel++;
+                synLeft = m_uLiquidity;
+            }
+            fillOrder(order, px, qty);
+        }
+    }
+
+    if (field.VolumeRemain == 0)
+        return;
+
+    if (bCancelRest)
+    {
+        field.OrderStatus = QDP_FTDC_OS_Canceled;
+        makeTime(field.CancelTime, sizeof(field.CancelTime));
+        if (m_pSpi)
+            m_pSpi->OnRtnOrder(&field);
+        return;
+    }
+
+    if (isBuy)
+        inst->_bids[field.LimitPrice].emplace_back(order);
+    else
+        inst->_asks[field.LimitPrice].emplace_back(order);
+}
+
+void QdpTdLoopback::walkMarket()
+{
+    for (Instrument* inst : m_ayInstruments)
+    {
+        int step = (int)(m_rng() % 3) - 1;
+        inst->_mid = std::min(std::max(inst->_mid + step * m_dTickSize, inst->_base * 0.9), inst->_base * 1.1);
+
+        //买单价格够到虚拟卖一、卖单价格够到虚拟买一的，按挂单价全部成交
+        double bestAsk = inst->_mid + m_dTickSize;
+        while (!inst->_bids.empty() && inst->_bids.begin()->first >= bestAsk - 1e-8)
+        {
+            double px = inst->_bids.begin()->first;
+            OrderQueue que;
+            que.swap(inst->_bids.begin()->second);
+            inst->_bids.erase(inst->_bids.begin());
+            for (Order* order : que)
+                fillOrder(order, px, order->_field.VolumeRemain);
+        }
+
+        double bestBid = inst->_mid - m_dTickSize;
+        while (!inst->_asks.empty() && inst->_asks.begin()->first <= bestBid + 1e-8)
+        {
+            double px = inst->_asks.begin()->first;
+            OrderQueue que;
+            que.swap(inst->_asks.begin()->second);
+            inst->_asks.erase(inst->_asks.begin());
+            for (Order* order : que)
+                fillOrder(order, px, order->_field.VolumeRemain);
+        }
+    }
+}
+
+int QdpTdLoopback::ReqOrderAction(CQdpFtdcOrderActionField *pOrderAction, int nRequestID)
+{
+    CQdpFtdcOrderActionField action = *pOrderAction;
+    schedule(m_uAckLatency, [this, action, nRequestID]() {
+        onOrderAction(action, nRequestID);
+    });
+    return 0;
+}
+
+void QdpTdLoopback::onOrderAction(const CQdpFtdcOrderActionField& action, int nRequestID)
+{
+    Order* order = NULL;
+    std::string sysID = StrUtil::trim(action.OrderSysID);
+    if (!sysID.empty())
+    {
+        auto it = m_mapSysIDs.find(sysID);
+        if (it != m_mapSysIDs.end())
+            order = it->second;
+    }
+    else
+    {
+        auto it = m_mapLocalIDs.find(action.UserOrderLocalID);
+        if (it != m_mapLocalIDs.end())
+            order = it->second;
+    }
+
+    int errorID = 0;
+    const char* message = NULL;
+    if (action.ActionFlag != QDP_FTDC_AF_Delete)
+        errorID = ERR_BAD_ORDER_ACTION_FIELD, message = "BAD_ORDER_ACTION_FIELD";
+    else if (order == NULL)
+        errorID = ERR_ORDER_NOT_FOUND, message = "ORDER_NOT_FOUND";
+    else if (order->_field.OrderStatus == QDP_FTDC_OS_AllTraded)
+        errorID = ERR_ORDER_HAD_ALL_TRADED, message = "ORDER_HAD_ALL_TRADED";
+    else if (order->_field.OrderStatus == QDP_FTDC_OS_Canceled)
+        errorID = ERR_ORDER_HAD_CANCELED, message = "ORDER_HAD_CANCELED";
+
+    CQdpFtdcOrderActionField rsp = action;
+    CQdpFtdcRspInfoField info;
+    fillRspInfo(info, errorID, message);
+    if (errorID != 0)
+    {
+        if (m_pSpi)
+            m_pSpi->OnRspOrderAction(&rsp, &info, nRequestID, true);
+        return;
+    }
+
+    //还没撮合的报单只改状态，到撮合的时候会跳过
+    if (order->_matched)
+        removeFromBook(order);
+
+    CQdpFtdcOrderField& field = order->_field;
+    field.OrderStatus = QDP_FTDC_OS_Canceled;
+    makeTime(field.CancelTime, sizeof(field.CancelTime));
+    if (m_pSpi)
+    {
+        m_pSpi->OnRspOrderAction(&rsp, &info, nRequestID, true);
+        m_pSpi->OnRtnOrder(&field);
+    }
+}
+
+int QdpTdLoopback::ReqSetClientMaxSigVol(CQdpFtdcClientMaxSigVolField *pClientMaxSigVol, int nRequestID)
+{
+    return unsupported("ReqSetClientMaxSigVol", nRequestID);
+}
+
+int QdpTdLoopback::ReqSpOrderInsert(CQdpFtdcSpInputOrderField *pSpInputOrder, int nRequestID)
+{
+    return unsupported("ReqSpOrderInsert", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryOrder(CQdpFtdcQryOrderField *pQryOrder, int nRequestID)
+{
+    schedule(m_uAckLatency, [this, nRequestID]() {
+        if (m_pSpi == NULL)
+            return;
+
+        CQdpFtdcRspInfoField info;
+        fillRspInfo(info, 0, NULL);
+        if (m_ayOrders.empty())
+        {
+            m_pSpi->OnRspQryOrder(NULL, &info, nRequestID, true);
+            return;
+        }
+
+        for (std::size_t i = 0; i < m_ayOrders.size(); i++)
+            m_pSpi->OnRspQryOrder(&m_ayOrders[i]->_field, &info, nRequestID, i + 1 == m_ayOrders.size());
+    });
+    return 0;
+}
+
+int QdpTdLoopback::ReqQryTrade(CQdpFtdcQryTradeField *pQryTrade, int nRequestID)
+{
+    schedule(m_uAckLatency, [this, nRequestID]() {
+        if (m_pSpi == NULL)
+            return;
+
+        CQdpFtdcRspInfoField info;
+        fillRspInfo(info, 0, NULL);
+        if (m_ayTrades.empty())
+        {
+            m_pSpi->OnRspQryTrade(NULL, &info, nRequestID, true);
+            return;
+        }
+
+        for (std::size_t i = 0; i < m_ayTrades.size(); i++)
+            m_pSpi->OnRspQryTrade(&m_ayTrades[i], &info, nRequestID, i + 1 == m_ayTrades.size());
+    });
+    return 0;
+}
+
+int QdpTdLoopback::ReqQryUserInvestor(CQdpFtdcQryUserInvestorField *pQryUserInvestor, int nRequestID)
+{
+    return unsupported("ReqQryUserInvestor", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryInvestorAccount(CQdpFtdcQryInvestorAccountField *pQryInvestorAccount, int nRequestID)
+{
+    CQdpFtdcQryInvestorAccountField req = *pQryInvestorAccount;
+    schedule(m_uAckLatency, [this, req, nRequestID]() {
+        if (m_pSpi == NULL)
+            return;
+
+        //只做撮合，不算保证金和盈亏
+        CQdpFtdcRspInvestorAccountField rsp;
+        memset(&rsp, 0, sizeof(rsp));
+        wt_strcpy(rsp.BrokerID, req.BrokerID);
+        wt_strcpy(rsp.InvestorID, req.InvestorID);
+        //资金账号字段比投资者代码短，按资金账号的长度截断
+        wt_strcpy(rsp.AccountID, req.InvestorID, std::min(strlen(req.InvestorID), sizeof(rsp.AccountID) - 1));
+        rsp.PreBalance = m_dBalance;
+        rsp.PreAvailable = m_dBalance;
+        rsp.Available = m_dBalance;
+        rsp.Balance = m_dBalance;
+        rsp.DynamicRights = m_dBalance;
+        CQdpFtdcRspInfoField info;
+        fillRspInfo(info, 0, NULL);
+        m_pSpi->OnRspQryInvestorAccount(&rsp, &info, nRequestID, true);
+    });
+    return 0;
+}
+
+int QdpTdLoopback::ReqQryInstrument(CQdpFtdcQryInstrumentField *pQryInstrument, int nRequestID)
+{
+    schedule(m_uAckLatency, [this, nRequestID]() {
+        if (m_pSpi == NULL)
+            return;
+
+        CQdpFtdcRspInfoField info;
+        fillRspInfo(info, 0, NULL);
+        if (m_ayInstruments.empty())
+        {
+            fillRspInfo(info, ERR_INSTRUMENT_NOT_FOUND, "INSTRUMENT_NOT_FOUND");
+            m_pSpi->OnRspQryInstrument(NULL, &info, nRequestID, true);
+            return;
+        }
+
+        CQdpFtdcRspInstrumentField rsp;
+        for (std::size_t i = 0; i < m_ayInstruments.size(); i++)
+        {
+            Instrument* inst = m_ayInstruments[i];
+            memset(&rsp, 0, sizeof(rsp));
+            rsp.InstrumentIDNum = inst->_num;
+            strncpy(rsp.ExchangeID, inst->_exchg.c_str(), sizeof(rsp.ExchangeID) - 1);
+            strncpy(rsp.InstrumentID, inst->_code.c_str(), sizeof(rsp.InstrumentID) - 1);
+            strncpy(rsp.InstrumentName, inst->_code.c_str(), sizeof(rsp.InstrumentName) - 1);
+            rsp.MaxLimitOrderVolume = 1000;
+            rsp.MinLimitOrderVolume = 1;
+            rsp.MaxMarketOrderVolume = 1000;
+            rsp.MinMarketOrderVolume = 1;
+            rsp.VolumeMultiple = m_iMultiplier;
+            rsp.PriceTick = m_dTickSize;
+            rsp.UpperLimitPrice = inst->_base * 1.1;
+            rsp.LowerLimitPrice = inst->_base * 0.9;
+            rsp.PreSettlementPrice = inst->_base;
+            rsp.InstrumentStatus = QDP_FTDC_IS_Continous;
+            rsp.IsTrading = 1;
+            m_pSpi->OnRspQryInstrument(&rsp, &info, nRequestID, i + 1 == m_ayInstruments.size());
+        }
+    });
+    return 0;
+}
+
+int QdpTdLoopback::ReqQryExchange(CQdpFtdcQryExchangeField *pQryExchange, int nRequestID)
+{
+    return unsupported("ReqQryExchange", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryInvestorPosition(CQdpFtdcQryInvestorPositionField *pQryInvestorPosition, int nRequestID)
+{
+    CQdpFtdcQryInvestorPositionField req = *pQryInvestorPosition;
+    schedule(m_uAckLatency, [this, req, nRequestID]() {
+        if (m_pSpi == NULL)
+            return;
+
+        std::vector<CQdpFtdcRspInvestorPositionField> ayPos;
+        for (Instrument* inst : m_ayInstruments)
+        {
+            for (int side = 0; side < 2; side++)
+            {
+                int qty = (side == 0) ? inst->_long : inst->_short;
+                if (qty == 0)
+                    continue;
+
+                CQdpFtdcRspInvestorPositionField pos;
+                memset(&pos, 0, sizeof(pos));
+                wt_strcpy(pos.BrokerID, req.BrokerID);
+                wt_strcpy(pos.InvestorID, req.InvestorID);
+                strncpy(pos.ExchangeID, inst->_exchg.c_str(), sizeof(pos.ExchangeID) - 1);
+                strncpy(pos.InstrumentID, inst->_code.c_str(), sizeof(pos.InstrumentID) - 1);
+                pos.Direction = (side == 0) ? QDP_FTDC_D_Buy : QDP_FTDC_D_Sell;
+                pos.HedgeFlag = QDP_FTDC_CHF_Speculation;
+                pos.Position = qty;
+                pos.TodayPosition = qty;
+                ayPos.emplace_back(pos);
+            }
+        }
+
+        CQdpFtdcRspInfoField info;
+        fillRspInfo(info, 0, NULL);
+        if (ayPos.empty())
+        {
+            m_pSpi->OnRspQryInvestorPosition(NULL, &info, nRequestID, true);
+            return;
+        }
+
+        for (std::size_t i = 0; i < ayPos.size(); i++)
+            m_pSpi->OnRspQryInvestorPosition(&ayPos[i], &info, nRequestID, i + 1 == ayPos.size());
+    });
+    return 0;
+}
+
+int QdpTdLoopback::ReqSubscribeTopic(CQdpFtdcDisseminationField *pDissemination, int nRequestID)
+{
+    return unsupported("ReqSubscribeTopic", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryTopic(CQdpFtdcDisseminationField *pDissemination, int nRequestID)
+{
+    return unsupported("ReqQryTopic", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryInvestorFee(CQdpFtdcQryInvestorFeeField *pQryInvestorFee, int nRequestID)
+{
+    return unsupported("ReqQryInvestorFee", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryInvestorMargin(CQdpFtdcQryInvestorMarginField *pQryInvestorMargin, int nRequestID)
+{
+    return unsupported("ReqQryInvestorMargin", nRequestID);
+}
+
+int QdpTdLoopback::ReqQrySGEDeferRate(CQdpFtdcQrySGEDeferRateField *pQrySGEDeferRate, int nRequestID)
+{
+    return unsupported("ReqQrySGEDeferRate", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryInvestorOptionFee(CQdpFtdcQryInvestorOptionFeeField *pQryInvestorOptionFee, int nRequestID)
+{
+    return unsupported("ReqQryInvestorOptionFee", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryInvestorPositionLimit(CQdpFtdcQryInvestorPositionLimitField *pQryInvestorPositionLimit, int nRequestID)
+{
+    return unsupported("ReqQryInvestorPositionLimit", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryExchangeRate(CQdpFtdcQryExchangeRateField *pQryExchangeRate, int nRequestID)
+{
+    return unsupported("ReqQryExchangeRate", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryMarketData(CQdpFtdcQryMarketDataField *pQryMarketData, int nRequestID)
+{
+    return unsupported("ReqQryMarketData", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryFrontInfo(CQdpFtdcQryFrontInfoField *pQryFrontInfo, int nRequestID)
+{
+    return unsupported("ReqQryFrontInfo", nRequestID);
+}
+
+int QdpTdLoopback::ReqQryForQuote(CQdpFtdcQryForQuoteField *pQryForQuote, int nRequestID)
+{
+    return unsupported("ReqQryForQuote", nRequestID);
+}
+
+int QdpTdLoopback::ReqForQuoteInsert(CQdpFtdcInputForQuoteField *pInputForQuote, int nRequestID)
+{
+    return unsupported("ReqForQuoteInsert", nRequestID);
+}
+
+int QdpTdLoopback::ReqQuoteInsert(CQdpFtdcInputQuoteField *pInputQuote, int nRequestID)
+{
+    return unsupported("ReqQuoteInsert", nRequestID);
+}
+
+int QdpTdLoopback::ReqQuoteAction(CQdpFtdcQuoteActionField *pQuoteAction, int nRequestID)
+{
+    return unsupported("ReqQuoteAction", nRequestID);
+}
+
+int QdpTdLoopback::ReqSubmitUserSystemInfo(CQdpFtdcUserSystemInfoField *pUserSystemInfo, int nRequestID)
+{
+    return 0;
+}
+
+int QdpTdLoopback::ReqMarketData(CQdpFtdcClientDepthMarketDataField *pClientDepthMarketData, int nRequestID)
+{
+    return unsupported("ReqMarketData", nRequestID);
+}
+
+int QdpTdLoopback::ReqSubPrdTradeFlow(CQdpFtdcSpecificInstrumentField *pSpecificInstrument, int nRequestID)
+{
+    return unsupported("ReqSubPrdTradeFlow", nRequestID);
+}
+
+int QdpTdLoopback::ReqUnSubPrdTradeFlow(CQdpFtdcSpecificInstrumentField *pSpecificInstrument, int nRequestID)
+{
+    return unsupported("ReqUnSubPrdTradeFlow", nRequestID);
+}
+
+int QdpTdLoopback::ReqReady(CQdpFtdcFlowStatusField *pFlowStatus, int nRequestID)
+{
+    return 0;
+}
@@ -0,0 +1,262 @@
+﻿/*!
+ * \file QdpTdLoopback.h
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief QDP交易API的本地替身
+ *
+ * 导出和libqdptraderapi一样的CreateFtdcTraderApi，内置一个价格优先、时间优先的撮合引擎，
+ * 对手盘是围绕参考价的虚拟挂单，用来在没有柜台测试环境时测TraderQDP的报单吞吐和延迟。参数全部写在前置地址里，如：
+ * loopback://local?instruments=SHFE.rb2405,DCE.m2405&ack=50&fill=200&liquidity=10&maxinflight=200&maxrate=1000
+ */
+#pragma once
+
+//Windows下导出API类，Linux下打开API类的可见性，创建函数的符号才能被TraderQDP找到
+#ifdef _WIN32
+#ifndef ISLIB
+#define ISLIB
+#endif
+#ifndef LIB_TRADER_API_EXPORT
+#define LIB_TRADER_API_EXPORT
+#endif
+#else
+#pragma GCC visibility push(default)
+#endif
+#include "../API/QDP7.0.0/QdpFtdcTraderApi.h"
+#ifndef _WIN32
+#pragma GCC visibility pop
+#endif
+
+#include "../Includes/FasterDefs.h"
+#include "../Share/StdUtils.hpp"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+USING_NS_WTP;
+
+class QdpTdLoopback : public CQdpFtdcTraderApi
+{
+public:
+    QdpTdLoopback(const char* flowPath);
+    virtual ~QdpTdLoopback();
+
+private:
+    struct _Instrument;
+
+    typedef struct _Order
+    {
+        CQdpFtdcOrderField  _field;
+        struct _Instrument* _inst;
+        bool                _matched;       //已经过了首次撮合，之后的成交只会来自对手单和参考价移动
+    } Order;
+
+    typedef std::deque<Order*> OrderQueue;
+
+    typedef struct _Instrument
+    {
+        std::string _exchg;
+        std::string _code;
+        int         _num;
+        double      _mid;           //参考价，虚拟对手盘挂在参考价两侧
+        double      _base;
+        int         _long;          //按成交累计的持仓
+        int         _short;
+
+        std::map<double, OrderQueue, std::greater<double>>  _bids;
+        std::map<double, OrderQueue>                        _asks;
+    } Instrument;
+
+    typedef std::function<void()> Task;
+
+    typedef struct _Event
+    {
+        int64_t     _due;
+        uint64_t    _seq;
+        Task        _task;
+
+        //时间早的先出，同一时间按提交顺序
+        bool operator<(const struct _Event& rhs) const
+        {
+            return (_due != rhs._due) ? _due > rhs._due : _seq > rhs._seq;
+        }
+    } Event;
+
+// CQdpFtdcTraderApi 接口
+public:
+    virtual void Release() override;
+
+    virtual void Init() override;
+
+    virtual int Join() override;
+
+    virtual const char *GetTradingDay() override;
+
+    virtual void RegisterFront(char *pszFrontAddress) override;
+
+    virtual void RegisterNameServer(char *pszNsAddress) override;
+
+    virtual void RegisterSpi(CQdpFtdcTraderSpi *pSpi) override;
+
+    virtual void SubscribePrivateTopic(QDP_TE_RESUME_TYPE nResumeType) override;
+
+    virtual void SubscribePublicTopic(QDP_TE_RESUME_TYPE nResumeType) override;
+
+    virtual void SubscribeUserTopic(QDP_TE_RESUME_TYPE nResumeType) override;
+
+    virtual void SetHeartbeatTimeout(unsigned int timeout) override;
+
+    virtual int OpenRequestLog(const char *pszReqLogFileName) override;
+
+    virtual int OpenResponseLog(const char *pszRspLogFileName) override;
+
+    virtual int ReqUserLogin(CQdpFtdcReqUserLoginField *pReqUserLogin, int nRequestID) override;
+
+    virtual int ReqUserLogout(CQdpFtdcReqUserLogoutField *pReqUserLogout, int nRequestID) override;
+
+    virtual int ReqUserPasswordUpdate(CQdpFtdcUserPasswordUpdateField *pUserPasswordUpdate, int nRequestID) override;
+
+    virtual int ReqOrderInsert(CQdpFtdcInputOrderField *pInputOrder, int nRequestID) override;
+
+    virtual int ReqOrderAction(CQdpFtdcOrderActionField *pOrderAction, int nRequestID) override;
+
+    virtual int ReqSetClientMaxSigVol(CQdpFtdcClientMaxSigVolField *pClientMaxSigVol, int nRequestID) override;
+
+    virtual int ReqSpOrderInsert(CQdpFtdcSpInputOrderField *pSpInputOrder, int nRequestID) override;
+
+    virtual int ReqQryOrder(CQdpFtdcQryOrderField *pQryOrder, int nRequestID) override;
+
+    virtual int ReqQryTrade(CQdpFtdcQryTradeField *pQryTrade, int nRequestID) override;
+
+    virtual int ReqQryUserInvestor(CQdpFtdcQryUserInvestorField *pQryUserInvestor, int nRequestID) override;
+
+    virtual int ReqQryInvestorAccount(CQdpFtdcQryInvestorAccountField *pQryInvestorAccount, int nRequestID) override;
+
+    virtual int ReqQryInstrument(CQdpFtdcQryInstrumentField *pQryInstrument, int nRequestID) override;
+
+    virtual int ReqQryExchange(CQdpFtdcQryExchangeField *pQryExchange, int nRequestID) override;
+
+    virtual int ReqQryInvestorPosition(CQdpFtdcQryInvestorPositionField *pQryInvestorPosition, int nRequestID) override;
+
+    virtual int ReqSubscribeTopic(CQdpFtdcDisseminationField *pDissemination, int nRequestID) override;
+
+    virtual int ReqQryTopic(CQdpFtdcDisseminationField *pDissemination, int nRequestID) override;
+
+    virtual int ReqQryInvestorFee(CQdpFtdcQryInvestorFeeField *pQryInvestorFee, int nRequestID) override;
+
+    virtual int ReqQryInvestorMargin(CQdpFtdcQryInvestorMarginField *pQryInvestorMargin, int nRequestID) override;
+
+    virtual int ReqQrySGEDeferRate(CQdpFtdcQrySGEDeferRateField *pQrySGEDeferRate, int nRequestID) override;
+
+    virtual int ReqQryInvestorOptionFee(CQdpFtdcQryInvestorOptionFeeField *pQryInvestorOptionFee, int nRequestID) override;
+
+    virtual int ReqQryInvestorPositionLimit(CQdpFtdcQryInvestorPositionLimitField *pQryInvestorPositionLimit, int nRequestID) override;
+
+    virtual int ReqQryExchangeRate(CQdpFtdcQryExchangeRateField *pQryExchangeRate, int nRequestID) override;
+
+    virtual int ReqQryMarketData(CQdpFtdcQryMarketDataField *pQryMarketData, int nRequestID) override;
+
+    virtual int ReqQryFrontInfo(CQdpFtdcQryFrontInfoField *pQryFrontInfo, int nRequestID) override;
+
+    virtual int ReqQryForQuote(CQdpFtdcQryForQuoteField *pQryForQuote, int nRequestID) override;
+
+    virtual int ReqForQuoteInsert(CQdpFtdcInputForQuoteField *pInputForQuote, int nRequestID) override;
+
+    virtual int ReqQuoteInsert(CQdpFtdcInputQuoteField *pInputQuote, int nRequestID) override;
+
+    virtual int ReqQuoteAction(CQdpFtdcQuoteActionField *pQuoteAction, int nRequestID) override;
+
+    virtual int ReqAuthenticate(CQdpFtdcAuthenticateField *pAuthenticate, int nRequestID) override;
+
+    virtual int ReqSubmitUserSystemInfo(CQdpFtdcUserSystemInfoField *pUserSystemInfo, int nRequestID) override;
+
+    virtual int ReqMarketData(CQdpFtdcClientDepthMarketDataField *pClientDepthMarketData, int nRequestID) override;
+
+    virtual int ReqSubPrdTradeFlow(CQdpFtdcSpecificInstrumentField *pSpecificInstrument, int nRequestID) override;
+
+    virtual int ReqUnSubPrdTradeFlow(CQdpFtdcSpecificInstrumentField *pSpecificInstrument, int nRequestID) override;
+
+    virtual int ReqReady(CQdpFtdcFlowStatusField *pFlowStatus, int nRequestID) override;
+
+private:
+    /// 解析前置地址里的参数
+    void parseOptions(const std::string& front);
+    /// 工作线程，按到期时间处理事件，所有回调都在这个线程里
+    void run();
+    /// delayUs微秒以后在工作线程里执行
+    void schedule(int64_t delayUs, Task task);
+    int unsupported(const char* reqName, int nRequestID);
+
+    /// 报单应答，errorID非0表示请求时已经被流控拒绝
+    void onOrderInsert(const CQdpFtdcInputOrderField& input, int nRequestID, int errorID);
+    void onOrderAction(const CQdpFtdcOrderActionField& action, int nRequestID);
+    /// 首次撮合，剩余的挂进订单簿或者撤掉
+    void matchOrder(Order* order);
+    /// 参考价随机游走，穿过参考价的挂单按挂单价成交
+    void walkMarket();
+    /// 一笔成交，推送报单回报和成交回报
+    void fillOrder(Order* order, double price, int qty);
+    void removeFromBook(Order* order);
+    /// FOK报单能立刻成交的数量
+    int fillable(Instrument* inst, bool isBuy, double limit) const;
+
+    Instrument* findInstrument(int num);
+    void fillRspInfo(CQdpFtdcRspInfoField& info, int errorID, const char* message);
+    void makeTime(char* buf, std::size_t len);
+
+private:
+    CQdpFtdcTraderSpi*  m_pSpi;
+    std::string         m_strFlowPath;
+    std::string         m_strFront;
+    std::string         m_strTradingDay;
+
+    //撮合参数
+    uint32_t            m_uAckLatency;      //请求到应答的延迟，微秒
+    uint32_t            m_uFillLatency;     //应答到首次撮合的延迟，微秒
+    uint32_t            m_uLiquidity;       //虚拟对手盘每档的数量
+    uint32_t            m_uLevels;          //虚拟对手盘的档数
+    uint32_t            m_uWalk;            //参考价游走周期，毫秒，0为不动
+    uint32_t            m_uMaxInFlight;     //未应答报单上限，超过按交易所流控拒绝，0为不限
+    uint32_t            m_uMaxRate;         //每秒报单上限，超过按交易所流控拒绝，0为不限
+    double              m_dTickSize;
+    int                 m_iMultiplier;
+    double              m_dBalance;
+
+    std::vector<Instrument*>        m_ayInstruments;
+    wt_hashmap<int, Instrument*>    m_mapInstruments;
+
+    std::vector<Order*>                 m_ayOrders;
+    wt_hashmap<int, Order*>             m_mapLocalIDs;
+    wt_hashmap<std::string, Order*>     m_mapSysIDs;
+    std::vector<CQdpFtdcTradeField>     m_ayTrades;
+
+    int                 m_iSessionID;
+    int                 m_iMaxLocalID;
+    uint32_t            m_uOrderSysID;
+    uint32_t            m_uTradeID;
+    std::mt19937        m_rng;
+
+    //请求线程和工作线程共用
+    std::priority_queue<Event>  m_queEvents;
+    uint64_t            m_uEventSeq;
+    StdUniqueMutex      m_mtxEvents;
+    StdCondVariable     m_condEvents;
+    uint32_t            m_uInFlight;
+    int64_t             m_iRateSec;
+    uint32_t            m_uRateCount;
+
+    StdThreadPtr        m_thrdWorker;
+    std::atomic<bool>   m_bStopped;
+
+    uint64_t            m_uInserted;
+    uint64_t            m_uRejected;
+    uint64_t            m_uThrottled;
+};
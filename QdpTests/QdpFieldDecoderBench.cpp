@@ -0,0 +1,176 @@
+﻿/*!
+ * \file QdpFieldDecoderBench.cpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief QdpFieldDecoder和原来逐字节拼串再strtoul的解析方式对比
+ *
+ * 先逐个比对全部合法时间、一年的日期和各种非标准格式的结果，有不一致就返回非0，
+ * 再按行情里的字段分布各跑若干轮，输出每次解析的耗时
+ * 用法：QdpFieldDecoderBench [轮数]，轮数为0时只做结果比对
+ */
+#include "../QDPShare/QdpFieldDecoder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _Field
+{
+    char    _buf[9];
+} Field;
+
+// 原ParserQDP::strToTime
+static uint32_t legacyTime(const char* strTime)
+{
+    std::string str;
+    const char *pos = strTime;
+    while(strlen(pos) > 0)
+    {
+        if(pos[0] != ':')
+        {
+            str.append(pos, 1);
+        }
+        pos++;
+    }
+    return strtoul(str.c_str(), NULL, 10);
+}
+
+// 原TraderQDP里InsertTime、TradeTime的解析，StrUtil::replace去掉冒号
+static uint32_t legacyTradeTime(const char* strTime)
+{
+    std::string str = strTime;
+    str.erase(std::remove(str.begin(), str.end(), ':'), str.end());
+    return strtoul(str.c_str(), NULL, 10);
+}
+
+// 原来交易日、行情日期的解析
+static uint32_t legacyDate(const char* strDate)
+{
+    return strtoul(strDate, NULL, 10);
+}
+
+static Field makeField(const char* text)
+{
+    Field f;
+    memset(&f, 0, sizeof(f));
+    memcpy(f._buf, text, std::min(strlen(text), sizeof(f._buf) - 1));
+    return f;
+}
+
+static uint32_t g_failures = 0;
+
+static void expectTime(const Field& f)
+{
+    uint32_t expected = legacyTime(f._buf);
+    uint32_t actual = QdpFieldDecoder::decodeTime(f._buf);
+    if (expected != actual || legacyTradeTime(f._buf) != actual)
+    {
+        if (g_failures++ < 20)
+            printf("time mismatch: \"%s\" legacy %u decoder %u\n", f._buf, expected, actual);
+    }
+}
+
+static void expectDate(const Field& f)
+{
+    uint32_t expected = legacyDate(f._buf);
+    uint32_t actual = QdpFieldDecoder::decodeDate(f._buf);
+    if (expected != actual)
+    {
+        if (g_failures++ < 20)
+            printf("date mismatch: \"%s\" legacy %u decoder %u\n", f._buf, expected, actual);
+    }
+}
+
+static void checkResults(std::vector<Field>& times, std::vector<Field>& dates)
+{
+    char buf[16];
+    for (uint32_t hh = 0; hh < 24; hh++)
+    {
+        for (uint32_t mm = 0; mm < 60; mm++)
+        {
+            for (uint32_t ss = 0; ss < 60; ss++)
+            {
+                sprintf(buf, "%02u:%02u:%02u", hh, mm, ss);
+                times.push_back(makeField(buf));
+                expectTime(times.back());
+            }
+        }
+    }
+
+    for (uint32_t month = 1; month <= 12; month++)
+    {
+        for (uint32_t day = 1; day <= 31; day++)
+        {
+            sprintf(buf, "2024%02u%02u", month, day);
+            dates.push_back(makeField(buf));
+            expectDate(dates.back());
+        }
+    }
+
+    // 非标准格式走回退路径，结果也要和原来一致
+    const char* oddTimes[] = { "", "9:30:00", "24:00:00", "23:59:60", "12:3a:00", "123456", " 9:30:00", "+9:30:00",
+        "09:30", "09:30:00.5", "::", "99:99:99", "0:0:0", "-1:00:00", "09-30-00", "\t21:00:00" };
+    for (const char* text : oddTimes)
+        expectTime(makeField(text));
+
+    const char* oddDates[] = { "", "2024010", "20240100", "20241301", "20240132", "2024-01-", " 2024010", "+2024010",
+        "00000000", "99999999", "2024a101", "1", "\t2024010" };
+    for (const char* text : oddDates)
+        expectDate(makeField(text));
+}
+
+template<typename Func>
+static double measure(const std::vector<Field>& fields, uint32_t rounds, Func func, uint64_t& checksum)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        for (const Field& f : fields)
+            checksum += func(f._buf);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    return ns / ((double)fields.size() * rounds);
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t rounds = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : 50;
+
+    std::vector<Field> times, dates;
+    checkResults(times, dates);
+    if (g_failures > 0)
+    {
+        printf("%u mismatches against the legacy routines\n", g_failures);
+        return 1;
+    }
+    printf("decoder matches the legacy routines on %u times and %u dates\n", (uint32_t)times.size(), (uint32_t)dates.size());
+
+    if (rounds == 0)
+        return 0;
+
+    // 行情里同一个交易时段的时间集中出现，按顺序跑比随机打乱更接近实际
+    uint64_t checksum = 0;
+    double legacyTimeNs = measure(times, rounds, legacyTime, checksum);
+    double legacyTradeNs = measure(times, rounds, legacyTradeTime, checksum);
+    double decodeTimeNs = measure(times, rounds, QdpFieldDecoder::decodeTime, checksum);
+
+    uint32_t dateRounds = rounds * (uint32_t)(times.size() / dates.size());
+    double legacyDateNs = measure(dates, dateRounds, legacyDate, checksum);
+    double decodeDateNs = measure(dates, dateRounds, QdpFieldDecoder::decodeDate, checksum);
+
+    printf("time  legacy strToTime     %8.2f ns\n", legacyTimeNs);
+    printf("time  legacy replace+strtoul %6.2f ns\n", legacyTradeNs);
+    printf("time  decodeTime           %8.2f ns  (%.1fx)\n", decodeTimeNs, legacyTimeNs / decodeTimeNs);
+    printf("date  legacy strtoul       %8.2f ns\n", legacyDateNs);
+    printf("date  decodeDate           %8.2f ns  (%.1fx)\n", decodeDateNs, legacyDateNs / decodeDateNs);
+    printf("checksum %llu\n", (unsigned long long)checksum);
+    return 0;
+}
@@ -0,0 +1,488 @@
+﻿/*!
+ * \file QdpMultiDecoderTest.cpp
+ * \project	WonderTrader
+ *
+ * \author Wesley
+ * \date 2024/01/15
+ *
+ * \brief 组播原始报文解码器的编解码往返测试
+ *
+ * 没有柜台的抓包样本，这里按两种布局（小端、大端，字段类型各不相同）用encode生成报文，
+ * 再用decode解回来逐个字段比对；另外检查各种写错的布局会被拒绝，以及报文长度和布局对不上时的处理
+ * 比对通过后，再对比decode和OnRtnMultiDepthMarketData收到结构体后转换成tick的耗时
+ * 用法：QdpMultiDecoderTest [轮数]，轮数为0时只做结果比对
+ */
+#include "../ParserQDP/QdpMultiDecoder.hpp"
+
+#include <chrono>
+#include <float.h>
+#include <random>
+#include <stddef.h>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+USING_NS_WTP;
+
+typedef QdpMultiDecoder::FieldTarget FieldTarget;
+
+static uint32_t g_checks = 0;
+static uint32_t g_failures = 0;
+
+#define EXPECT(cond, ...) \
+    do { \
+        g_checks++; \
+        if (!(cond)) \
+        { \
+            if (g_failures++ < 20) \
+            { \
+                printf("%s:%d: ", __FILE__, __LINE__); \
+                printf(__VA_ARGS__); \
+                printf("\n"); \
+            } \
+        } \
+    } while (0)
+
+typedef struct _Decoded
+{
+    uint32_t        _inst_no;
+    uint32_t        _update_time;
+    uint32_t        _millisec;
+    WTSTickStruct   _quote;
+} Decoded;
+
+struct CollectHandler
+{
+    WTSTickStruct           _slot;
+    std::vector<Decoded>    _decoded;
+
+    WTSTickStruct* acquire(uint32_t instNo, const QdpMultiDecoder::MultiParams& params)
+    {
+        memset(&_slot, 0, sizeof(_slot));
+        return &_slot;
+    }
+
+    void commit(uint32_t instNo, WTSTickStruct& quote, uint32_t updateTime, uint32_t millisec)
+    {
+        Decoded item;
+        item._inst_no = instNo;
+        item._update_time = updateTime;
+        item._millisec = millisec;
+        item._quote = quote;
+        _decoded.emplace_back(item);
+    }
+};
+
+static void addParams(QdpMultiDecoder& decoder, const char* code, int instNo, double codecPrice, double priceTick)
+{
+    CQdFtdcShfeMultiParametersField field;
+    memset(&field, 0, sizeof(field));
+    strcpy(field.InstrumentID, code);
+    strcpy(field.TradingDay, "20240115");
+    field.InstrumentNo = instNo;
+    field.CodecPrice = codecPrice;
+    field.PriceTick = priceTick;
+    field.PreSettlementPrice = codecPrice;
+    field.PreClosePrice = codecPrice + priceTick;
+    field.PreOpenInterest = 100000;
+    field.UpperLimitPrice = codecPrice * 1.1;
+    field.LowerLimitPrice = codecPrice * 0.9;
+    decoder.addParameters(&field);
+}
+
+// 小端，时间是HH:MM:SS字符串，价格按价位编码，五档行情
+static bool layoutLittle(QdpMultiDecoder& decoder)
+{
+    if (!decoder.setLayout(16, 136, false))
+        return false;
+
+    bool ok = decoder.addField(QdpMultiDecoder::MFD_INSTRUMENT_NO, 0, "u32")
+        && decoder.addField(QdpMultiDecoder::MFD_UPDATE_TIME, 4, "timestr")
+        && decoder.addField(QdpMultiDecoder::MFD_UPDATE_MILLISEC, 12, "i32")
+        && decoder.addField(QdpMultiDecoder::MFD_LAST_PRICE, 16, "tick32")
+        && decoder.addField(QdpMultiDecoder::MFD_OPEN_PRICE, 20, "f64")
+        && decoder.addField(QdpMultiDecoder::MFD_HIGHEST_PRICE, 28, "tick32")
+        && decoder.addField(QdpMultiDecoder::MFD_LOWEST_PRICE, 32, "tick32")
+        && decoder.addField(QdpMultiDecoder::MFD_VOLUME, 36, "")
+        && decoder.addField(QdpMultiDecoder::MFD_TURNOVER, 40, "f64")
+        && decoder.addField(QdpMultiDecoder::MFD_OPEN_INTEREST, 48, "i64");
+    for (uint32_t i = 0; i < 5 && ok; i++)
+    {
+        ok = decoder.addField((FieldTarget)(QdpMultiDecoder::MFD_BID_PRICE1 + i), 56 + i * 4, "tick32")
+            && decoder.addField((FieldTarget)(QdpMultiDecoder::MFD_BID_VOLUME1 + i), 76 + i * 4, "i32")
+            && decoder.addField((FieldTarget)(QdpMultiDecoder::MFD_ASK_PRICE1 + i), 96 + i * 4, "tick32")
+            && decoder.addField((FieldTarget)(QdpMultiDecoder::MFD_ASK_VOLUME1 + i), 116 + i * 4, "u32");
+    }
+
+    return ok && decoder.finish();
+}
+
+// 大端，时间是整数HHMMSS，价格是浮点，只有一档，记录末尾有填充
+static bool layoutBig(QdpMultiDecoder& decoder)
+{
+    if (!decoder.setLayout(8, 64, true))
+        return false;
+
+    return decoder.addField(QdpMultiDecoder::MFD_INSTRUMENT_NO, 0, "i32")
+        && decoder.addField(QdpMultiDecoder::MFD_UPDATE_TIME, 4, "hhmmss")
+        && decoder.addField(QdpMultiDecoder::MFD_UPDATE_MILLISEC, 8, "u32")
+        && decoder.addField(QdpMultiDecoder::MFD_LAST_PRICE, 12, "f64")
+        && decoder.addField(QdpMultiDecoder::MFD_VOLUME, 20, "i64")
+        && decoder.addField(QdpMultiDecoder::MFD_TURNOVER, 28, "f64")
+        && decoder.addField(QdpMultiDecoder::MFD_OPEN_INTEREST, 36, "f64")
+        && decoder.addField(QdpMultiDecoder::MFD_BID_PRICE1, 44, "tick32")
+        && decoder.addField(QdpMultiDecoder::MFD_BID_VOLUME1, 48, "u32")
+        && decoder.addField(QdpMultiDecoder::MFD_ASK_PRICE1, 52, "tick32")
+        && decoder.addField(QdpMultiDecoder::MFD_ASK_VOLUME1, 56, "u32")
+        && decoder.finish();
+}
+
+typedef struct _Sample
+{
+    uint32_t        _inst_no;
+    uint32_t        _update_time;
+    uint32_t        _millisec;
+    WTSTickStruct   _quote;
+} Sample;
+
+static Sample makeSample(std::mt19937& rng, const QdpMultiDecoder& decoder, uint32_t instNo)
+{
+    const QdpMultiDecoder::MultiParams* params = decoder.getParams(instNo);
+    std::uniform_int_distribution<int> ticks(-2000, 2000);
+    std::uniform_int_distribution<int> qty(0, 5000);
+
+    Sample s;
+    memset(&s, 0, sizeof(s));
+    s._inst_no = instNo;
+    s._update_time = (9 + rng() % 6) * 10000 + (rng() % 60) * 100 + rng() % 60;
+    s._millisec = rng() % 1000;
+
+    // 价格都落在价位上，和真实行情一样
+    auto price = [&]() { return params->_codec_price + ticks(rng) * params->_price_tick; };
+    WTSTickStruct& q = s._quote;
+    q.price = price();
+    q.open = price();
+    q.high = price();
+    q.low = price();
+    q.total_volume = rng() % 1000000;
+    q.total_turnover = q.total_volume * params->_codec_price * 10;
+    q.open_interest = rng() % 500000;
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        q.bid_prices[i] = price();
+        q.ask_prices[i] = price();
+        q.bid_qty[i] = qty(rng);
+        q.ask_qty[i] = qty(rng);
+    }
+    return s;
+}
+
+static inline bool same(double a, double b)
+{
+    return fabs(a - b) < 1e-6;
+}
+
+static void compare(const Sample& s, const Decoded& d, const QdpMultiDecoder::MultiParams& params, bool full)
+{
+    const WTSTickStruct& e = s._quote;
+    const WTSTickStruct& a = d._quote;
+    EXPECT(d._inst_no == s._inst_no, "inst_no %u != %u", d._inst_no, s._inst_no);
+    EXPECT(d._update_time == s._update_time, "update_time %u != %u", d._update_time, s._update_time);
+    EXPECT(d._millisec == s._millisec, "millisec %u != %u", d._millisec, s._millisec);
+    EXPECT(same(a.price, e.price), "price %f != %f", a.price, e.price);
+    EXPECT(same(a.total_volume, e.total_volume), "volume %f != %f", a.total_volume, e.total_volume);
+    EXPECT(same(a.total_turnover, e.total_turnover), "turnover %f != %f", a.total_turnover, e.total_turnover);
+    EXPECT(same(a.open_interest, e.open_interest), "open_interest %f != %f", a.open_interest, e.open_interest);
+    EXPECT(same(a.pre_settle, params._pre_settle), "pre_settle %f != %f", a.pre_settle, params._pre_settle);
+    EXPECT(same(a.upper_limit, params._upper_limit), "upper_limit %f != %f", a.upper_limit, params._upper_limit);
+
+    uint32_t levels = full ? 5 : 1;
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        double bidPx = (i < levels) ? e.bid_prices[i] : 0;
+        double askPx = (i < levels) ? e.ask_prices[i] : 0;
+        double bidQty = (i < levels) ? e.bid_qty[i] : 0;
+        double askQty = (i < levels) ? e.ask_qty[i] : 0;
+        EXPECT(same(a.bid_prices[i], bidPx), "bid_price%u %f != %f", i + 1, a.bid_prices[i], bidPx);
+        EXPECT(same(a.ask_prices[i], askPx), "ask_price%u %f != %f", i + 1, a.ask_prices[i], askPx);
+        EXPECT(same(a.bid_qty[i], bidQty), "bid_volume%u %f != %f", i + 1, a.bid_qty[i], bidQty);
+        EXPECT(same(a.ask_qty[i], askQty), "ask_volume%u %f != %f", i + 1, a.ask_qty[i], askQty);
+    }
+
+    // 布局里没有的字段不能被写成别的值
+    EXPECT(same(a.open, full ? e.open : 0), "open %f", a.open);
+    EXPECT(same(a.high, full ? e.high : 0), "high %f", a.high);
+    EXPECT(same(a.low, full ? e.low : 0), "low %f", a.low);
+}
+
+static void roundTrip(const char* name, bool (*layout)(QdpMultiDecoder&), bool full)
+{
+    QdpMultiDecoder decoder;
+    EXPECT(layout(decoder), "%s layout rejected: %s", name, decoder.lastError().c_str());
+    addParams(decoder, "rb2405", 1, 3500, 1);
+    addParams(decoder, "au2406", 7, 480.5, 0.02);
+    addParams(decoder, "i2405", 42, 950, 0.5);
+
+    const uint32_t instNos[] = { 1, 7, 42 };
+    std::mt19937 rng(20240115);
+    std::vector<char> frame;
+    uint32_t total = 0;
+    for (uint32_t n = 0; n < 2000; n++)
+    {
+        uint32_t count = 1 + rng() % 8;
+        std::vector<Sample> samples;
+        frame.assign(decoder.headerSize() + count * decoder.recordSize(), (char)0xEE);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            samples.emplace_back(makeSample(rng, decoder, instNos[rng() % 3]));
+            const Sample& s = samples.back();
+            char* rec = frame.data() + decoder.headerSize() + i * decoder.recordSize();
+            decoder.encode(rec, s._inst_no, s._quote, s._update_time, s._millisec, *decoder.getParams(s._inst_no));
+        }
+
+        CollectHandler handler;
+        uint32_t decoded = decoder.decode(frame.data(), (int)frame.size(), handler);
+        EXPECT(decoded == count, "%s frame %u decoded %u of %u records", name, n, decoded, count);
+        for (uint32_t i = 0; i < count && i < handler._decoded.size(); i++)
+            compare(samples[i], handler._decoded[i], *decoder.getParams(samples[i]._inst_no), full);
+        total += count;
+    }
+    EXPECT(decoder.truncated() == 0, "%s truncated %llu", name, (unsigned long long)decoder.truncated());
+
+    // 末尾多出半条记录，前面完整的照常解出来，并且记一次长度不符
+    frame.assign(decoder.headerSize() + 2 * decoder.recordSize() + 10, 0);
+    Sample s = makeSample(rng, decoder, 7);
+    for (uint32_t i = 0; i < 2; i++)
+        decoder.encode(frame.data() + decoder.headerSize() + i * decoder.recordSize(), s._inst_no, s._quote, s._update_time, s._millisec, *decoder.getParams(7));
+    CollectHandler partial;
+    EXPECT(decoder.decode(frame.data(), (int)frame.size(), partial) == 2, "%s partial frame", name);
+    EXPECT(decoder.truncated() == 1, "%s truncated %llu after partial frame", name, (unsigned long long)decoder.truncated());
+
+    // 不认识的合约序号跳过并计数
+    decoder.encode(frame.data() + decoder.headerSize(), 99, s._quote, s._update_time, s._millisec, *decoder.getParams(7));
+    CollectHandler unknown;
+    EXPECT(decoder.decode(frame.data(), (int)frame.size(), unknown) == 1, "%s unknown instrument not skipped", name);
+    EXPECT(decoder.unknown() == 1, "%s unknown %llu", name, (unsigned long long)decoder.unknown());
+
+    // 只有包头或者更短的报文不解
+    CollectHandler empty;
+    EXPECT(decoder.decode(frame.data(), (int)decoder.headerSize(), empty) == 0, "%s header-only frame", name);
+
+    printf("%s: %u records round-tripped\n", name, total);
+}
+
+static void rejectLayouts()
+{
+    QdpMultiDecoder decoder;
+    EXPECT(!decoder.setLayout(16, 0, false), "record size 0 accepted");
+
+    decoder.setLayout(16, 64, false);
+    EXPECT(!decoder.addField(QdpMultiDecoder::MFD_VOLUME, 62, "i32"), "field past the record accepted");
+    EXPECT(!decoder.addField(QdpMultiDecoder::MFD_TURNOVER, 60, "f64"), "8-byte field past the record accepted");
+    EXPECT(!decoder.addField(QdpMultiDecoder::MFD_VOLUME, 0xFFFFFFFE, "i32"), "wrapping offset accepted");
+    EXPECT(!decoder.addField(QdpMultiDecoder::MFD_VOLUME, 0, "float"), "unknown type accepted");
+
+    EXPECT(decoder.addField(QdpMultiDecoder::MFD_INSTRUMENT_NO, 0, "u32"), "instrument_no rejected: %s", decoder.lastError().c_str());
+    EXPECT(!decoder.addField(QdpMultiDecoder::MFD_VOLUME, 2, "i32"), "overlapping field accepted");
+    EXPECT(!decoder.addField(QdpMultiDecoder::MFD_INSTRUMENT_NO, 8, "u32"), "duplicated field accepted");
+    EXPECT(decoder.addField(QdpMultiDecoder::MFD_UPDATE_TIME, 4, "timestr"), "update_time rejected: %s", decoder.lastError().c_str());
+    EXPECT(!decoder.addField(QdpMultiDecoder::MFD_LAST_PRICE, 8, "tick32"), "field inside timestr accepted");
+    EXPECT(decoder.finish(), "valid layout rejected: %s", decoder.lastError().c_str());
+
+    decoder.setLayout(16, 64, false);
+    decoder.addField(QdpMultiDecoder::MFD_VOLUME, 0, "i32");
+    EXPECT(!decoder.finish(), "layout without instrument_no accepted");
+
+    decoder.setLayout(16, 64, false);
+    decoder.addField(QdpMultiDecoder::MFD_INSTRUMENT_NO, 0, "f64");
+    EXPECT(!decoder.finish(), "floating instrument_no accepted");
+}
+
+// 和ParserQDP::RawTickHandler一样复用一个tick，只清掉行情部分
+struct BenchHandler
+{
+    WTSTickStruct   _slot;
+    uint64_t        _checksum;
+
+    WTSTickStruct* acquire(uint32_t instNo, const QdpMultiDecoder::MultiParams& params)
+    {
+        memset(&_slot.price, 0, sizeof(WTSTickStruct) - offsetof(WTSTickStruct, price));
+        return &_slot;
+    }
+
+    void commit(uint32_t instNo, WTSTickStruct& quote, uint32_t updateTime, uint32_t millisec)
+    {
+        quote.action_time = updateTime * 1000 + millisec;
+        _checksum += quote.action_time + (uint64_t)quote.total_volume + (uint64_t)quote.bid_qty[0];
+    }
+};
+
+static inline double checkValid(double val)
+{
+    if (val == DBL_MAX || val == FLT_MAX)
+        return 0;
+    return val;
+}
+
+// API解好的结构体，和组播报文里是同一笔行情
+static void makeDepth(const Sample& s, const QdpMultiDecoder::MultiParams& params, CQdFtdcDepthMarketDataField& f)
+{
+    const WTSTickStruct& q = s._quote;
+    char buf[16];
+    memset(&f, 0, sizeof(f));
+    memcpy(f.InstrumentID, params._code, strlen(params._code) + 1);
+    memcpy(f.ExchangeID, "SHFE", 5);
+    memcpy(f.TradingDay, "20240115", 9);
+    sprintf(buf, "%02u:%02u:%02u", s._update_time / 10000 % 100, s._update_time / 100 % 100, s._update_time % 100);
+    memcpy(f.UpdateTime, buf, sizeof(f.UpdateTime));
+    f.UpdateMillisec = s._millisec;
+    f.LastPrice = q.price;
+    f.OpenPrice = q.open;
+    f.HighestPrice = q.high;
+    f.LowestPrice = q.low;
+    f.Volume = (int)q.total_volume;
+    f.Turnover = q.total_turnover;
+    f.OpenInterest = q.open_interest;
+    f.SettlementPrice = DBL_MAX;
+    f.UpperLimitPrice = params._upper_limit;
+    f.LowerLimitPrice = params._lower_limit;
+    f.PreClosePrice = params._pre_close;
+    f.PreSettlementPrice = params._pre_settle;
+    f.PreOpenInterest = params._pre_interest;
+    f.BidPrice1 = q.bid_prices[0]; f.BidVolume1 = (int)q.bid_qty[0];
+    f.BidPrice2 = q.bid_prices[1]; f.BidVolume2 = (int)q.bid_qty[1];
+    f.BidPrice3 = q.bid_prices[2]; f.BidVolume3 = (int)q.bid_qty[2];
+    f.BidPrice4 = q.bid_prices[3]; f.BidVolume4 = (int)q.bid_qty[3];
+    f.BidPrice5 = q.bid_prices[4]; f.BidVolume5 = (int)q.bid_qty[4];
+    f.AskPrice1 = q.ask_prices[0]; f.AskVolume1 = (int)q.ask_qty[0];
+    f.AskPrice2 = q.ask_prices[1]; f.AskVolume2 = (int)q.ask_qty[1];
+    f.AskPrice3 = q.ask_prices[2]; f.AskVolume3 = (int)q.ask_qty[2];
+    f.AskPrice4 = q.ask_prices[3]; f.AskVolume4 = (int)q.ask_qty[3];
+    f.AskPrice5 = q.ask_prices[4]; f.AskVolume5 = (int)q.ask_qty[4];
+}
+
+// ParserQDP::processDepthData里从结构体到tick的转换，不含合约查找、日期解析和分发
+static void convertDepth(const CQdFtdcDepthMarketDataField* p, WTSTickStruct& quote)
+{
+    quote.action_time = QdpFieldDecoder::decodeTime(p->UpdateTime) * 1000 + p->UpdateMillisec;
+    quote.trading_date = QdpFieldDecoder::decodeDate(p->TradingDay);
+    quote.price = checkValid(p->LastPrice);
+    quote.open = checkValid(p->OpenPrice);
+    quote.high = checkValid(p->HighestPrice);
+    quote.low = checkValid(p->LowestPrice);
+    quote.total_volume = p->Volume;
+    quote.settle_price = checkValid(p->SettlementPrice);
+    quote.total_turnover = checkValid(p->Turnover);
+    quote.open_interest = (uint32_t)p->OpenInterest;
+    quote.upper_limit = checkValid(p->UpperLimitPrice);
+    quote.lower_limit = checkValid(p->LowerLimitPrice);
+    quote.pre_close = checkValid(p->PreClosePrice);
+    quote.pre_settle = checkValid(p->PreSettlementPrice);
+    quote.pre_interest = (uint32_t)p->PreOpenInterest;
+
+    quote.ask_prices[0] = checkValid(p->AskPrice1);
+    quote.ask_prices[1] = checkValid(p->AskPrice2);
+    quote.ask_prices[2] = checkValid(p->AskPrice3);
+    quote.ask_prices[3] = checkValid(p->AskPrice4);
+    quote.ask_prices[4] = checkValid(p->AskPrice5);
+    quote.bid_prices[0] = checkValid(p->BidPrice1);
+    quote.bid_prices[1] = checkValid(p->BidPrice2);
+    quote.bid_prices[2] = checkValid(p->BidPrice3);
+    quote.bid_prices[3] = checkValid(p->BidPrice4);
+    quote.bid_prices[4] = checkValid(p->BidPrice5);
+    quote.ask_qty[0] = p->AskVolume1;
+    quote.ask_qty[1] = p->AskVolume2;
+    quote.ask_qty[2] = p->AskVolume3;
+    quote.ask_qty[3] = p->AskVolume4;
+    quote.ask_qty[4] = p->AskVolume5;
+    quote.bid_qty[0] = p->BidVolume1;
+    quote.bid_qty[1] = p->BidVolume2;
+    quote.bid_qty[2] = p->BidVolume3;
+    quote.bid_qty[3] = p->BidVolume4;
+    quote.bid_qty[4] = p->BidVolume5;
+}
+
+// 结构体路径只计了ParserQDP里的转换，API把报文解成结构体的耗时量不到，实际差距只会更大
+static void bench(uint32_t rounds)
+{
+    QdpMultiDecoder decoder;
+    layoutLittle(decoder);
+    addParams(decoder, "rb2405", 1, 3500, 1);
+    addParams(decoder, "au2406", 7, 480.5, 0.02);
+    addParams(decoder, "i2405", 42, 950, 0.5);
+
+    const uint32_t instNos[] = { 1, 7, 42 };
+    const uint32_t frameCount = 1000;
+    const uint32_t perFrame = 8;
+    std::mt19937 rng(20240116);
+    std::vector<std::vector<char>> frames(frameCount);
+    std::vector<CQdFtdcDepthMarketDataField> depths(frameCount * perFrame);
+    for (uint32_t n = 0; n < frameCount; n++)
+    {
+        frames[n].assign(decoder.headerSize() + perFrame * decoder.recordSize(), 0);
+        for (uint32_t i = 0; i < perFrame; i++)
+        {
+            Sample s = makeSample(rng, decoder, instNos[rng() % 3]);
+            const QdpMultiDecoder::MultiParams& params = *decoder.getParams(s._inst_no);
+            decoder.encode(frames[n].data() + decoder.headerSize() + i * decoder.recordSize(), s._inst_no, s._quote, s._update_time, s._millisec, params);
+            makeDepth(s, params, depths[n * perFrame + i]);
+        }
+    }
+
+    double records = (double)depths.size() * rounds;
+    BenchHandler handler;
+    memset(&handler, 0, sizeof(handler));
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        for (const std::vector<char>& frame : frames)
+            decoder.decode(frame.data(), (int)frame.size(), handler);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double decodeNs = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / records;
+
+    WTSTickStruct quote;
+    memset(&quote, 0, sizeof(quote));
+    uint64_t checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        for (const CQdFtdcDepthMarketDataField& depth : depths)
+        {
+            memset(&quote.price, 0, sizeof(WTSTickStruct) - offsetof(WTSTickStruct, price));
+            convertDepth(&depth, quote);
+            checksum += quote.action_time + (uint64_t)quote.total_volume + (uint64_t)quote.bid_qty[0];
+        }
+    }
+    end = std::chrono::steady_clock::now();
+    double convertNs = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / records;
+
+    printf("raw   QdpMultiDecoder::decode  %8.2f ns/record\n", decodeNs);
+    printf("field depth struct -> tick     %8.2f ns/record  (%.1fx)\n", convertNs, convertNs / decodeNs);
+    printf("checksum %llu %llu\n", (unsigned long long)handler._checksum, (unsigned long long)checksum);
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t rounds = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : 200;
+
+    rejectLayouts();
+    roundTrip("little-endian", layoutLittle, true);
+    roundTrip("big-endian", layoutBig, false);
+
+    if (g_failures > 0)
+    {
+        printf("%u of %u checks failed\n", g_failures, g_checks);
+        return 1;
+    }
+
+    printf("all %u checks passed\n", g_checks);
+
+    if (rounds == 0)
+        return 0;
+
+    bench(rounds);
+    return 0;
+}
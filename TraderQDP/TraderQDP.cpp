@@ -27,14 +27,17 @@ const char* ORDER_SECTION = "orders";
 
 // By Wesley @ 2022.01.05
 #include "../Share/fmtlib.h"
+// ־ͳһ첽ܵʽں̨߳
 template<typename... Args>
-inline void write_log(ITraderSpi* sink, WTSLogLevel ll, const char* format, const Args&... args)
+inline void write_log(QdpAsyncLogger& logger, WTSLogLevel ll, const char* format, const Args&... args)
 {
-    if (sink == NULL)
-        return;
+    logger.log(QLC_GENERAL, ll, format, args...);
+}
 
-    const char* buffer = fmtutil::format(format, args...);
-    sink->handleTraderLog(ll, buffer);
+template<typename... Args>
+inline void write_log(QdpAsyncLogger& logger, QdpLogCategory cat, WTSLogLevel ll, const char* format, const Args&... args)
+{
+    logger.log(cat, ll, format, args...);
 }
 
 // InvestorIDInvestorIDNumתϵ
@@ -113,15 +116,23 @@ TraderQDP::TraderQDP()
     , m_bStopped(false)
     , m_lastQryTime(0)
     , m_sessionID(0)
+    , m_bOrderTrack(false)
 {
 }
 
 TraderQDP::~TraderQDP()
 {
+    m_logger.stop();
 }
 
 bool TraderQDP::init(WTSVariant* params)
 {
+    m_logger.configure(params->get("logctrl"));
+    m_logger.start([this](WTSLogLevel ll, const char* message) {
+        if (m_sink)
+            m_sink->handleTraderLog(ll, message);
+    }, params->has("logqueue") ? params->getUInt32("logqueue") : QdpAsyncLogger::DEFAULT_QUEUE);
+
     m_strFront = params->getCString("front");
     m_strBroker = params->getCString("broker");
     m_strUser = params->getCString("user");
@@ -136,6 +147,19 @@ bool TraderQDP::init(WTSVariant* params)
 
     m_strFlowDir = StrUtil::standardisePath(m_strFlowDir);
 
+    WTSVariant* cfgTrack = params->get("ordertrack");
+    if (cfgTrack && cfgTrack->getBoolean("active"))
+    {
+        m_bOrderTrack = true;
+        m_strTrackDir = cfgTrack->getCString("path");
+        if (m_strTrackDir.empty())
+            m_strTrackDir = m_strFlowDir + "latency/";
+        m_strTrackDir = StrUtil::standardisePath(m_strTrackDir);
+
+        uint32_t capacity = cfgTrack->getUInt32("capacity");
+        m_orderTracker.init(capacity == 0 ? 65536 : capacity);
+    }
+
     std::string module = params->getCString("qdpmodule");
     if (module.empty())
         module = "qdptraderapi";
@@ -168,6 +192,13 @@ void TraderQDP::release()
         m_pUserAPI = NULL;
     }
 
+    // APIͷԺ󲻻лصûıһͳ
+    if (m_bOrderTrack)
+    {
+        reportOrderLatency();
+        m_bOrderTrack = false;
+    }
+
     if (m_ayOrders)
         m_ayOrders->clear();
 
@@ -216,8 +247,16 @@ void TraderQDP::connect()
     if (m_thrdWorker == NULL)
     {
         m_thrdWorker.reset(new StdThread([this]() {
+            int64_t lastCalibrate = TimeUtils::getLocalTimeNow();
             while (!m_bStopped)
             {
+                //ӳͳƵTSCϵͳʱÿһ
+                if (m_bOrderTrack && TimeUtils::getLocalTimeNow() - lastCalibrate >= 1000)
+                {
+                    m_orderTracker.calibrate();
+                    lastCalibrate = TimeUtils::getLocalTimeNow();
+                }
+
                 if (m_queQuery.empty() || m_bInQuery)
                 {
                     std::this_thread::sleep_for(std::chrono::milliseconds(1));
@@ -316,7 +355,7 @@ int TraderQDP::authenticate()
     int iResult = m_pUserAPI->ReqAuthenticate(&req, genRequestID());
     if (iResult != 0)
     {
-        write_log(m_sink, LL_ERROR, "[TraderQDP] Sending authenticate request failed: {}", iResult);
+        write_log(m_logger, LL_ERROR, "[TraderQDP] Sending authenticate request failed: {}", iResult);
     }
 
     return iResult;
@@ -334,7 +373,7 @@ int TraderQDP::doLogin()
     int iResult = m_pUserAPI->ReqUserLogin(&req, genRequestID());
     if (iResult != 0)
     {
-        write_log(m_sink, LL_ERROR, "[TraderQDP] Sending login request failed: {}", iResult);
+        write_log(m_logger, LL_ERROR, "[TraderQDP] Sending login request failed: {}", iResult);
     }
 
     return iResult;
@@ -353,7 +392,7 @@ int TraderQDP::logout()
     int iResult = m_pUserAPI->ReqUserLogout(&req, genRequestID());
     if (iResult != 0)
     {
-        write_log(m_sink, LL_ERROR, "[TraderQDP] Sending logout request failed: {}", iResult);
+        write_log(m_logger, LL_ERROR, "[TraderQDP] Sending logout request failed: {}", iResult);
     }
 
     return iResult;
@@ -382,7 +421,7 @@ int TraderQDP::orderInsert(WTSEntrust* entrust)
 	}
 	else
 	{
-		write_log(m_sink, LL_ERROR, "[TraderQDP] Order inserting failed: {}", "cant find InstrumentIDNum");
+		write_log(m_logger, LL_ERROR, "[TraderQDP] Order inserting failed: {}", "cant find InstrumentIDNum");
 	}
     
     uint32_t orderref = m_orderRef.fetch_add(1);
@@ -400,7 +439,7 @@ int TraderQDP::orderInsert(WTSEntrust* entrust)
     if (strlen(entrust->getUserTag()) > 0)
     {
         m_eidCache.put(entrust->getEntrustID(), entrust->getUserTag(), 0, [this](const char* message) {
-            write_log(m_sink, LL_WARN, message);
+            write_log(m_logger, LL_WARN, message);
         });
     }
 
@@ -434,10 +473,15 @@ int TraderQDP::orderInsert(WTSEntrust* entrust)
         req.VolumeCondition = QDP_FTDC_VC_CV;
     }
 
+    if (m_bOrderTrack)
+        m_orderTracker.onSend(req.UserOrderLocalID, entrust->getCode(), req.Volume);
+
     int iResult = m_pUserAPI->ReqOrderInsert(&req, genRequestID());
     if (iResult != 0)
     {
-        write_log(m_sink, LL_ERROR, "[TraderQDP] Order inserting failed: {}", iResult);
+        write_log(m_logger, LL_ERROR, "[TraderQDP] Order inserting failed: {}", iResult);
+        if (m_bOrderTrack)
+            m_orderTracker.onSendFailed(req.UserOrderLocalID);
     }
 
     return iResult;
@@ -461,10 +505,16 @@ int TraderQDP::orderAction(WTSEntrustAction* action)
     
     strcpy(req.ExchangeID, action->getExchg());
 
+    uint64_t cancelTsc = 0;
+    if (m_bOrderTrack)
+        cancelTsc = m_orderTracker.onCancel(orderref);
+
     int iResult = m_pUserAPI->ReqOrderAction(&req, genRequestID());
     if (iResult != 0)
     {
-        write_log(m_sink, LL_ERROR, "[TraderQDP] Sending cancel request failed: {}", iResult);
+        write_log(m_logger, LL_ERROR, "[TraderQDP] Sending cancel request failed: {}", iResult);
+        if (m_bOrderTrack)
+            m_orderTracker.onCancelFailed(orderref, cancelTsc);
     }
 
     return iResult;
@@ -553,14 +603,14 @@ int TraderQDP::queryTrades()
 // QDPصʵ
 void TraderQDP::OnFrontConnected()
 {
-    write_log(m_sink, LL_INFO, "[TraderQDP] Front connected");
+    write_log(m_logger, LL_INFO, "[TraderQDP] Front connected");
     if (m_sink)
         m_sink->handleEvent(WTE_Connect, 0);
 }
 
 void TraderQDP::OnFrontDisconnected(int nReason)
 {
-    write_log(m_sink, LL_ERROR, "[TraderQDP] Front disconnected, reason: {}", nReason);
+    write_log(m_logger, LL_ERROR, "[TraderQDP] Front disconnected, reason: {}", nReason);
     m_wrapperState = WS_NOTLOGIN;
     if (m_sink)
         m_sink->handleEvent(WTE_Close, nReason);
@@ -568,19 +618,19 @@ void TraderQDP::OnFrontDisconnected(int nReason)
 
 void TraderQDP::OnHeartBeatWarning(int nTimeLapse)
 {
-	write_log(m_sink, LL_DEBUG, "[TraderQDP][{}-{}] Heartbeating...", m_strBroker.c_str(), m_strUser.c_str());
+	write_log(m_logger, LL_DEBUG, "[TraderQDP][{}-{}] Heartbeating...", m_strBroker.c_str(), m_strUser.c_str());
 }
 
 void TraderQDP::OnRspAuthenticate(CQdpFtdcRtnAuthenticateField *pRtnAuthenticate, CQdpFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
 {
     if (!IsErrorRspInfo(pRspInfo))
     {
-        write_log(m_sink, LL_INFO, "[TraderQDP] Authentication succeed");
+        write_log(m_logger, LL_INFO, "[TraderQDP] Authentication succeed");
         doLogin();
     }
     else
     {
-        write_log(m_sink, LL_ERROR, "[TraderQDP] Authentication failed: {}", pRspInfo->ErrorMsg);
+        write_log(m_logger, LL_ERROR, "[TraderQDP] Authentication failed: {}", pRspInfo->ErrorMsg);
         m_wrapperState = WS_LOGINFAILED;
         if (m_sink)
             m_sink->onLoginResult(false, pRspInfo->ErrorMsg, 0);
@@ -598,7 +648,7 @@ void TraderQDP::OnRspUserLogin(CQdpFtdcRspUserLoginField *pRspUserLogin, CQdpFtd
         // ȡǰ
         m_lDate = atoi(m_pUserAPI->GetTradingDay());
 
-        write_log(m_sink, LL_INFO, "[TraderQDP][{}-{}] Login succeed, SessionID: {}", 
+        write_log(m_logger, LL_INFO, "[TraderQDP][{}-{}] Login succeed, SessionID: {}", 
             m_strBroker.c_str(), m_strUser.c_str(), m_sessionID);
 
         // ʼ
@@ -611,17 +661,17 @@ void TraderQDP::OnRspUserLogin(CQdpFtdcRspUserLoginField *pRspUserLogin, CQdpFtd
         // ʼίе
         ss << m_strUser << "_eid.sc";
         m_eidCache.init(ss.str().c_str(), m_lDate, [this](const char* message) {
-            write_log(m_sink, LL_WARN, message);
+            write_log(m_logger, LL_WARN, message);
         });
 
         // ʼǻ
         ss.str("");
         ss << m_strFlowDir << "local/" << m_strBroker << "/" << m_strUser << "_oid.sc";
         m_oidCache.init(ss.str().c_str(), m_lDate, [this](const char* message) {
-            write_log(m_sink, LL_WARN, message);
+            write_log(m_logger, LL_WARN, message);
         });
 
-        write_log(m_sink, LL_INFO, "[TraderQDP][{}-{}] Login succeed, trading date: {}", 
+        write_log(m_logger, LL_INFO, "[TraderQDP][{}-{}] Login succeed, trading date: {}", 
             m_strBroker.c_str(), m_strUser.c_str(), m_lDate);
         
         m_wrapperState = WS_ALLREADY;
@@ -645,7 +695,7 @@ void TraderQDP::OnRspUserLogin(CQdpFtdcRspUserLoginField *pRspUserLogin, CQdpFtd
     }
     else
     {
-        write_log(m_sink, LL_ERROR, "[TraderQDP][{}-{}] Login failed: {}", 
+        write_log(m_logger, LL_ERROR, "[TraderQDP][{}-{}] Login failed: {}", 
             m_strBroker.c_str(), m_strUser.c_str(), pRspInfo->ErrorMsg);
         m_wrapperState = WS_LOGINFAILED;
         if (m_sink)
@@ -662,6 +712,9 @@ void TraderQDP::OnRspUserLogout(CQdpFtdcRspUserLogoutField *pRspUserLogout, CQdp
 
 void TraderQDP::OnRspOrderInsert(CQdpFtdcRspInputOrderField *pRspInputOrder, CQdpFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
 {
+    if (m_bOrderTrack && pRspInputOrder)
+        m_orderTracker.onAck(pRspInputOrder->UserOrderLocalID, IsErrorRspInfo(pRspInfo));
+
     if (pRspInputOrder)
     {
         WTSEntrust* entrust = makeEntrust(pRspInputOrder);
@@ -680,6 +733,9 @@ void TraderQDP::OnRspOrderAction(CQdpFtdcOrderActionField *pOrderAction, CQdpFtd
 {
     if (IsErrorRspInfo(pRspInfo))
     {
+        if (m_bOrderTrack && pOrderAction)
+            m_orderTracker.onCancelRejected(pOrderAction->UserOrderLocalID);
+
         WTSError* error = WTSError::create(WEC_ORDERCANCEL, pRspInfo->ErrorMsg);
         if (m_sink)
             m_sink->onTraderError(error);
@@ -821,6 +877,17 @@ void TraderQDP::OnRspQryOrder(CQdpFtdcOrderField *pOrder, CQdpFtdcRspInfoField *
 
 void TraderQDP::OnRtnOrder(CQdpFtdcOrderField *pOrder)
 {
+    if (m_bOrderTrack && pOrder)
+    {
+        char status = pOrder->OrderStatus;
+        bool canceled = (status == QDP_FTDC_OS_Canceled || status == QDP_FTDC_OS_PartTradedNotQueueing || status == QDP_FTDC_OS_NoTradeNotQueueing);
+        m_orderTracker.onReport(pOrder->UserOrderLocalID, canceled, status == QDP_FTDC_OS_AllTraded);
+    }
+
+    if (pOrder)
+        write_log(m_logger, QLC_ORDER, LL_DEBUG, "[TraderQDP] Order pushed, localid: {}, code: {}, sysid: {}, status: {}, traded: {}/{}",
+            pOrder->UserOrderLocalID, pOrder->InstrumentID, pOrder->OrderSysID, pOrder->OrderStatus, pOrder->VolumeTraded, pOrder->Volume);
+
     WTSOrderInfo *orderInfo = makeOrderInfo(pOrder);
     if (orderInfo)
     {
@@ -833,6 +900,13 @@ void TraderQDP::OnRtnOrder(CQdpFtdcOrderField *pOrder)
 
 void TraderQDP::OnRtnTrade(CQdpFtdcTradeField *pTrade)
 {
+    if (m_bOrderTrack && pTrade)
+        m_orderTracker.onTrade(pTrade->UserOrderLocalID, pTrade->TradeVolume);
+
+    if (pTrade)
+        write_log(m_logger, QLC_ORDER, LL_DEBUG, "[TraderQDP] Trade pushed, localid: {}, code: {}, tradeid: {}, price: {}, volume: {}",
+            pTrade->UserOrderLocalID, pTrade->InstrumentID, pTrade->TradeID, pTrade->TradePrice, pTrade->TradeVolume);
+
     WTSTradeInfo *tRecord = makeTradeRecord(pTrade);
     if (tRecord)
     {
@@ -845,6 +919,9 @@ void TraderQDP::OnRtnTrade(CQdpFtdcTradeField *pTrade)
 
 void TraderQDP::OnErrRtnOrderInsert(CQdpFtdcRspInputOrderField *pRspInputOrder, CQdpFtdcRspInfoField *pRspInfo)
 {
+    if (m_bOrderTrack && pRspInputOrder)
+        m_orderTracker.onAck(pRspInputOrder->UserOrderLocalID, true);
+
     if (pRspInputOrder)
     {
         WTSEntrust* entrust = makeEntrust(pRspInputOrder);
@@ -864,6 +941,9 @@ void TraderQDP::OnErrRtnOrderAction(CQdpFtdcOrderActionField *pOrderAction, CQdp
     // 
     if (IsErrorRspInfo(pRspInfo))
     {
+        if (m_bOrderTrack && pOrderAction)
+            m_orderTracker.onCancelRejected(pOrderAction->UserOrderLocalID);
+
         WTSError* error = WTSError::create(WEC_ORDERCANCEL, pRspInfo->ErrorMsg);
         if (m_sink)
             m_sink->onTraderError(error);
@@ -892,6 +972,40 @@ bool TraderQDP::IsErrorRspInfo(CQdpFtdcRspInfoField *pRspInfo)
     return false;
 }
 
+void TraderQDP::reportOrderLatency()
+{
+    m_orderTracker.close();
+
+    for (uint32_t i = 0; i < OO_COUNT; i++)
+    {
+        OrderOutcome outcome = (OrderOutcome)i;
+        uint64_t count = m_orderTracker.outcomes(outcome);
+        if (count == 0)
+            continue;
+
+        QdpLatencySummary ack, done;
+        m_orderTracker.summarize(outcome, OS_ACK, ack);
+        m_orderTracker.summarize(outcome, OS_DONE, done);
+        write_log(m_logger, LL_INFO, "[TraderQDP] {} {} orders, ack p50/p99: {}/{} ns, done p50/p99: {}/{} ns",
+            count, ORDER_OUTCOME_NAMES[i], ack._p50, ack._p99, done._p50, done._p99);
+    }
+
+    if (m_orderTracker.evicted() > 0)
+        write_log(m_logger, LL_WARN, "[TraderQDP] {} orders overwritten before finishing, capacity {} is too small",
+            m_orderTracker.evicted(), m_orderTracker.capacity());
+
+    if (m_orderTracker.untracked() > 0 || m_orderTracker.cancelRejects() > 0)
+        write_log(m_logger, LL_INFO, "[TraderQDP] {} callbacks of untracked orders, {} cancels rejected",
+            m_orderTracker.untracked(), m_orderTracker.cancelRejects());
+
+    boost::filesystem::create_directories(m_strTrackDir.c_str());
+    std::string filename = fmt::format("{}orders_{}_{}_{}.csv", m_strTrackDir, m_strUser, m_lDate, TimeUtils::getLocalTimeNow());
+    if (m_orderTracker.dump(filename))
+        write_log(m_logger, LL_INFO, "[TraderQDP] Order latency dumped to {}", filename);
+    else
+        write_log(m_logger, LL_ERROR, "[TraderQDP] Dumping order latency to {} failed", filename);
+}
+
 // ת
 char TraderQDP::wrapPriceType(WTSPriceType priceType)
 {
@@ -1054,9 +1168,7 @@ WTSOrderInfo* TraderQDP::makeOrderInfo(CQdpFtdcOrderField* orderField)
     pRet->setExchange(orderField->ExchangeID);
 
     // öʱ
-    std::string strTime = orderField->InsertTime;
-    StrUtil::replace(strTime, ":", "");
-    uint32_t uTime = strtoul(strTime.c_str(), NULL, 10);
+    uint32_t uTime = QdpFieldDecoder::decodeTime(orderField->InsertTime);
     
     pRet->setOrderDate(m_lDate);
     pRet->setOrderTime(TimeUtils::makeTime(pRet->getOrderDate(), uTime * 1000));
@@ -1079,7 +1191,7 @@ WTSOrderInfo* TraderQDP::makeOrderInfo(CQdpFtdcOrderField* orderField)
         if (strlen(pRet->getOrderID()) > 0)
         {
             m_oidCache.put(StrUtil::trim(pRet->getOrderID()).c_str(), usertag, 0, [this](const char* message) {
-                write_log(m_sink, LL_ERROR, message);
+                write_log(m_logger, LL_ERROR, message);
             });
         }
     }
@@ -1146,9 +1258,7 @@ WTSTradeInfo* TraderQDP::makeTradeRecord(CQdpFtdcTradeField *tradeField)
     pRet->setTradeID(tradeField->TradeID);
 
     // ýʱ
-    std::string strTime = tradeField->TradeTime;
-    StrUtil::replace(strTime, ":", "");
-    uint32_t uTime = strtoul(strTime.c_str(), NULL, 10);
+    uint32_t uTime = QdpFieldDecoder::decodeTime(tradeField->TradeTime);
     
     pRet->setTradeDate(m_lDate);
     pRet->setTradeTime(TimeUtils::makeTime(m_lDate, uTime * 1000));
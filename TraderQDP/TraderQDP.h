@@ -23,6 +23,10 @@
 #include "../Share/DLLHelper.hpp"
 #include "../Share/WtKVCache.hpp"
 
+#include "../QDPShare/QdpAsyncLogger.hpp"
+#include "../QDPShare/QdpFieldDecoder.hpp"
+#include "../QDPShare/QdpOrderTracker.hpp"
+
 USING_NS_WTP;
 
 class TraderQDP : public ITraderApi, public CQdpFtdcTraderSpi
@@ -123,6 +127,9 @@ protected:
     
     uint32_t genRequestID();
 
+    // ڵӳͳ
+    void reportOrderLatency();
+
 protected:
     std::string     m_strBroker;
     std::string     m_strFront;
@@ -173,4 +180,11 @@ protected:
     WtKVCache       m_eidCache;
     // ǻ  
     WtKVCache       m_oidCache;
+
+    // ڵӳͳƣỰʱ
+    bool            m_bOrderTrack;
+    std::string     m_strTrackDir;
+    QdpOrderTracker m_orderTracker;
+
+    QdpAsyncLogger  m_logger;
 };
\ No newline at end of file